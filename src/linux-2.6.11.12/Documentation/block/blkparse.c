@@ -0,0 +1,482 @@
+/*
+ * blkparse.c: trace block devices and break down where their io spent
+ * its time.
+ *
+ *	blkparse [-b kbytes] [-n bufs] [-w seconds] device...
+ *
+ *	Sets up tracing on each device (see Documentation/block/blktrace.txt),
+ *	reads every cpu's ring until interrupted or for the given time, then
+ *	matches up the events for each request by sector and prints, per
+ *	device, how long on average requests took from being queued to being
+ *	allocated a request or merged (Q2G), to being inserted into the io
+ *	scheduler (G2I), to being issued to the driver (I2D) and to being
+ *	completed (D2C).
+ *
+ *	Needs debugfs mounted on /sys/kernel/debug.
+ *
+ *		This program is free software; you can redistribute it
+ *		and/or modify it under the terms of the GNU General Public
+ *		License as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+/* From <linux/blktrace.h>, which C libraries do not ship yet. */
+#define BLK_TC_SHIFT		16
+#define BLK_TC_ACT(act)		((act) << BLK_TC_SHIFT)
+#define BLK_TC_ACT_MASK		((1 << BLK_TC_SHIFT) - 1)
+
+enum {
+	__BLK_TA_QUEUE = 1,
+	__BLK_TA_BACKMERGE,
+	__BLK_TA_FRONTMERGE,
+	__BLK_TA_GETRQ,
+	__BLK_TA_SLEEPRQ,
+	__BLK_TA_REQUEUE,
+	__BLK_TA_ISSUE,
+	__BLK_TA_COMPLETE,
+	__BLK_TA_PLUG,
+	__BLK_TA_UNPLUG_IO,
+	__BLK_TA_UNPLUG_TIMER,
+	__BLK_TA_INSERT,
+};
+
+#define BLK_IO_TRACE_MAGIC	0x65617400
+#define BLK_IO_TRACE_VERSION	0x07
+
+struct blk_io_trace {
+	uint32_t magic;
+	uint32_t sequence;
+	uint64_t time;
+	uint64_t sector;
+	uint32_t bytes;
+	uint32_t action;
+	uint32_t pid;
+	uint32_t device;
+	uint32_t cpu;
+	uint16_t error;
+	uint16_t pdu_len;
+};
+
+struct blk_user_trace_setup {
+	char name[32];
+	uint16_t act_mask;
+	uint32_t buf_size;
+	uint32_t buf_nr;
+	uint64_t start_lba;
+	uint64_t end_lba;
+	uint32_t pid;
+};
+
+#define BLKTRACESETUP		_IOWR(0x12, 115, struct blk_user_trace_setup)
+#define BLKTRACESTART		_IO(0x12, 116)
+#define BLKTRACESTOP		_IO(0x12, 117)
+#define BLKTRACETEARDOWN	_IO(0x12, 118)
+
+#define DEBUGFS		"/sys/kernel/debug/block"
+#define MAX_DEVS	16
+#define MAX_CPUS	256
+#define HASH_SIZE	4096
+
+enum { Q2G, G2I, I2D, D2C, Q2C, NR_STAGES };
+static const char *stage_name[NR_STAGES] = {
+	"Q2G", "G2I", "I2D", "D2C", "Q2C"
+};
+
+struct stat_ent {
+	unsigned long	n;
+	uint64_t	total;
+	uint64_t	max;
+};
+
+struct dev_trace {
+	char			*path;
+	int			fd;
+	struct blk_user_trace_setup buts;
+	int			cpu_fd[MAX_CPUS];
+	uint32_t		device;
+	unsigned long		dropped;
+	unsigned long		merges;
+	unsigned long		requeues;
+	struct stat_ent		stat[NR_STAGES];
+};
+
+/* one request being followed through the queue, by its first sector */
+struct io {
+	struct io	*next;
+	uint32_t	device;
+	uint64_t	sector;
+	uint64_t	q, g, i, d;
+};
+
+static struct dev_trace devs[MAX_DEVS];
+static int ndevs;
+
+static struct blk_io_trace *recs;
+static size_t nr_recs, max_recs;
+
+static struct io *hash[HASH_SIZE];
+
+static volatile sig_atomic_t done;
+
+static void handle_sigint(int sig)
+{
+	done = 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: blkparse [-b kbytes] [-n bufs] [-w seconds] device...\n");
+	exit(2);
+}
+
+static int setup_dev(struct dev_trace *dt, unsigned int buf_size,
+		     unsigned int buf_nr)
+{
+	char path[256];
+	struct stat st;
+	int cpu;
+
+	dt->fd = open(dt->path, O_RDONLY | O_NONBLOCK);
+	if (dt->fd < 0 || fstat(dt->fd, &st) < 0) {
+		perror(dt->path);
+		return -1;
+	}
+	dt->device = (major(st.st_rdev) << 20) | minor(st.st_rdev);
+
+	memset(&dt->buts, 0, sizeof(dt->buts));
+	dt->buts.buf_size = buf_size;
+	dt->buts.buf_nr = buf_nr;
+	if (ioctl(dt->fd, BLKTRACESETUP, &dt->buts) < 0) {
+		perror("BLKTRACESETUP");
+		return -1;
+	}
+
+	/* possible cpus need not be numbered contiguously */
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		snprintf(path, sizeof(path), DEBUGFS "/%s/trace%d",
+			 dt->buts.name, cpu);
+		dt->cpu_fd[cpu] = open(path, O_RDONLY | O_NONBLOCK);
+		if (dt->cpu_fd[cpu] < 0 && errno != ENOENT) {
+			perror(path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read whatever is in the rings.  Returns the number of rings that
+ * are not yet finished.
+ */
+static int read_rings(struct dev_trace *dt)
+{
+	int cpu, live = 0;
+	ssize_t ret;
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if (dt->cpu_fd[cpu] < 0)
+			continue;
+		for (;;) {
+			if (max_recs - nr_recs < 64) {
+				max_recs = max_recs ? max_recs * 2 : 65536;
+				recs = realloc(recs, max_recs * sizeof(*recs));
+				if (!recs) {
+					perror("realloc");
+					exit(1);
+				}
+			}
+			ret = read(dt->cpu_fd[cpu], recs + nr_recs,
+				   (max_recs - nr_recs) * sizeof(*recs));
+			if (ret > 0) {
+				nr_recs += ret / sizeof(*recs);
+				continue;
+			}
+			if (ret == 0) {
+				/* stopped and drained */
+				close(dt->cpu_fd[cpu]);
+				dt->cpu_fd[cpu] = -1;
+			} else if (errno == EAGAIN || errno == EINTR) {
+				live++;
+			} else {
+				perror("read");
+				exit(1);
+			}
+			break;
+		}
+	}
+	return live;
+}
+
+static void read_dropped(struct dev_trace *dt)
+{
+	char path[256], buf[32];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), DEBUGFS "/%s/dropped", dt->buts.name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	n = read(fd, buf, sizeof(buf) - 1);
+	if (n > 0) {
+		buf[n] = '\0';
+		dt->dropped = strtoul(buf, NULL, 10);
+	}
+	close(fd);
+}
+
+static int cmp_time(const void *a, const void *b)
+{
+	const struct blk_io_trace *ta = a, *tb = b;
+
+	if (ta->time < tb->time)
+		return -1;
+	return ta->time > tb->time;
+}
+
+static struct io **io_slot(uint32_t device, uint64_t sector)
+{
+	struct io **p = &hash[(sector ^ device) & (HASH_SIZE - 1)];
+
+	while (*p && ((*p)->device != device || (*p)->sector != sector))
+		p = &(*p)->next;
+	return p;
+}
+
+static struct io *io_find(uint32_t device, uint64_t sector)
+{
+	return *io_slot(device, sector);
+}
+
+static struct io *io_unlink(uint32_t device, uint64_t sector)
+{
+	struct io **p = io_slot(device, sector), *io = *p;
+
+	if (io)
+		*p = io->next;
+	return io;
+}
+
+static void io_insert(struct io *io)
+{
+	struct io **p = &hash[(io->sector ^ io->device) & (HASH_SIZE - 1)];
+
+	io->next = *p;
+	*p = io;
+}
+
+static struct dev_trace *find_dev(uint32_t device)
+{
+	int i;
+
+	for (i = 0; i < ndevs; i++)
+		if (devs[i].device == device)
+			return &devs[i];
+	return NULL;
+}
+
+static void account(struct dev_trace *dt, int stage, uint64_t from,
+		    uint64_t to)
+{
+	struct stat_ent *s = &dt->stat[stage];
+	uint64_t delta;
+
+	if (!from || !to || to < from)
+		return;
+	delta = to - from;
+	s->n++;
+	s->total += delta;
+	if (delta > s->max)
+		s->max = delta;
+}
+
+static void handle(struct blk_io_trace *t)
+{
+	struct dev_trace *dt = find_dev(t->device);
+	uint64_t end = t->sector + (t->bytes >> 9);
+	struct io *io;
+
+	if (!dt)
+		return;
+
+	switch (t->action & BLK_TC_ACT_MASK) {
+	case __BLK_TA_QUEUE:
+		io = calloc(1, sizeof(*io));
+		if (!io)
+			return;
+		io->device = t->device;
+		io->sector = t->sector;
+		io->q = t->time;
+		io_insert(io);
+		break;
+	case __BLK_TA_BACKMERGE:
+	case __BLK_TA_FRONTMERGE:
+		/* the bio's io ends here; what is left is the request's */
+		dt->merges++;
+		io = io_unlink(t->device, t->sector);
+		if (io) {
+			account(dt, Q2G, io->q, t->time);
+			free(io);
+		}
+		if ((t->action & BLK_TC_ACT_MASK) == __BLK_TA_FRONTMERGE) {
+			/* the request now starts at the bio's sector */
+			io = io_unlink(t->device, end);
+			if (io) {
+				io->sector = t->sector;
+				io_insert(io);
+			}
+		}
+		break;
+	case __BLK_TA_GETRQ:
+		io = io_find(t->device, t->sector);
+		if (io && !io->g)
+			io->g = t->time;
+		break;
+	case __BLK_TA_INSERT:
+		io = io_find(t->device, t->sector);
+		if (io && !io->i)
+			io->i = t->time;
+		break;
+	case __BLK_TA_ISSUE:
+		io = io_find(t->device, t->sector);
+		if (io && !io->d)
+			io->d = t->time;
+		break;
+	case __BLK_TA_REQUEUE:
+		/* it will be issued again; count from the last issue */
+		dt->requeues++;
+		io = io_find(t->device, t->sector);
+		if (io)
+			io->d = 0;
+		break;
+	case __BLK_TA_COMPLETE:
+		io = io_unlink(t->device, t->sector);
+		if (!io)
+			break;
+		account(dt, Q2G, io->q, io->g);
+		account(dt, G2I, io->g, io->i);
+		account(dt, I2D, io->i, io->d);
+		account(dt, D2C, io->d, t->time);
+		account(dt, Q2C, io->q, t->time);
+		/* partly completed: the rest carries on from here */
+		if (end > t->sector) {
+			io->sector = end;
+			io_insert(io);
+		} else
+			free(io);
+		break;
+	}
+}
+
+static void report(struct dev_trace *dt)
+{
+	int i;
+
+	printf("%s (%u,%u):", dt->path, dt->device >> 20,
+	       dt->device & ((1 << 20) - 1));
+	printf(" %lu merges, %lu requeues", dt->merges, dt->requeues);
+	if (dt->dropped)
+		printf(", %lu events DROPPED", dt->dropped);
+	printf("\n");
+
+	printf("  stage        count      avg usec      max usec\n");
+	for (i = 0; i < NR_STAGES; i++) {
+		struct stat_ent *s = &dt->stat[i];
+
+		printf("  %-6s %12lu %13.1f %13.1f\n", stage_name[i], s->n,
+		       s->n ? (double) s->total / s->n / 1000 : 0.0,
+		       (double) s->max / 1000);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int buf_size = 512 * 1024, buf_nr = 4, wait = 0;
+	time_t stop_at = 0;
+	size_t i;
+	int c, live, ret = 1;
+
+	while ((c = getopt(argc, argv, "b:n:w:")) != -1) {
+		switch (c) {
+		case 'b':
+			buf_size = strtoul(optarg, NULL, 10) * 1024;
+			break;
+		case 'n':
+			buf_nr = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			wait = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind == argc || argc - optind > MAX_DEVS)
+		usage();
+
+	for (; optind < argc; optind++) {
+		devs[ndevs].path = argv[optind];
+		if (setup_dev(&devs[ndevs++], buf_size, buf_nr) < 0)
+			goto teardown;
+	}
+
+	signal(SIGINT, handle_sigint);
+	signal(SIGTERM, handle_sigint);
+	if (wait)
+		stop_at = time(NULL) + wait;
+
+	for (c = 0; c < ndevs; c++)
+		if (ioctl(devs[c].fd, BLKTRACESTART) < 0) {
+			perror("BLKTRACESTART");
+			goto teardown;
+		}
+
+	while (!done && (!stop_at || time(NULL) < stop_at)) {
+		for (c = 0; c < ndevs; c++)
+			read_rings(&devs[c]);
+		usleep(100000);
+	}
+
+	/* stop, then read until every ring reports end of file */
+	for (c = 0; c < ndevs; c++)
+		ioctl(devs[c].fd, BLKTRACESTOP);
+	do {
+		live = 0;
+		for (c = 0; c < ndevs; c++)
+			live += read_rings(&devs[c]);
+	} while (live);
+	for (c = 0; c < ndevs; c++)
+		read_dropped(&devs[c]);
+
+	/* rings are per cpu, so put the events back in order first */
+	qsort(recs, nr_recs, sizeof(*recs), cmp_time);
+	for (i = 0; i < nr_recs; i++) {
+		if ((recs[i].magic & 0xffffff00) != BLK_IO_TRACE_MAGIC ||
+		    (recs[i].magic & 0xff) != BLK_IO_TRACE_VERSION) {
+			fprintf(stderr, "bad trace magic %x\n", recs[i].magic);
+			continue;
+		}
+		handle(&recs[i]);
+	}
+	for (c = 0; c < ndevs; c++)
+		report(&devs[c]);
+	ret = 0;
+
+teardown:
+	for (c = 0; c < ndevs; c++)
+		ioctl(devs[c].fd, BLKTRACETEARDOWN);
+	return ret;
+}
@@ -306,6 +306,18 @@ fastcall void do_page_fault(struct pt_regs *regs, unsigned long error_code)
 	if (in_atomic() || !mm)
 		goto bad_area_nosemaphore;
 
+	/*
+	 * First-touch faults on anonymous memory are by far the most common
+	 * kind in threaded programs.  Try them without mmap_sem so that they
+	 * do not queue behind mmap/munmap/brk in other threads; anything the
+	 * speculative path cannot handle falls through to the code below.
+	 */
+	if (!(error_code & 1) && !(regs->eflags & VM_MASK) &&
+	    handle_speculative_fault(mm, address, error_code & 2)) {
+		tsk->min_flt++;
+		return;
+	}
+
 	/* When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in the
 	 * kernel and should generate an OOPS.  Unfortunatly, in the case of an
@@ -95,6 +95,90 @@ static int crypt(struct crypto_tfm *tfm,
 	}
 }
 
+/*
+ * As crypt(), but restarting the chain from a new IV every 'unit' bytes,
+ * and working through each page mapped once rather than once per block:
+ * the run of whole blocks that both the source and the destination page
+ * have left is processed right in the mapped pages, and only blocks that
+ * straddle a page boundary go through the temporary blocks.  ivfn is
+ * called with nothing mapped, so it may use the crypto API itself.
+ */
+static int crypt_units(struct crypto_tfm *tfm,
+		       struct scatterlist *dst,
+		       struct scatterlist *src,
+		       unsigned int nbytes, unsigned int unit,
+		       cryptfn_t crfn, procfn_t prfn, int enc,
+		       u8 *iv, crypto_ivfn_t *ivfn, void *data)
+{
+	struct scatter_walk walk_in, walk_out;
+	const unsigned int bsize = crypto_tfm_alg_blocksize(tfm);
+	u8 tmp_src[bsize];
+	u8 tmp_dst[bsize];
+	unsigned int n = 0, left = 0;
+	int r;
+
+	if (!nbytes)
+		return 0;
+
+	if (!unit || unit % bsize || nbytes % unit) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_BLOCK_LEN;
+		return -EINVAL;
+	}
+
+	scatterwalk_start(&walk_in, src);
+	scatterwalk_start(&walk_out, dst);
+
+	for(;;) {
+		u8 *src_p, *dst_p;
+		unsigned int todo, done;
+		int in_place;
+
+		if (!left) {
+			r = ivfn(data, iv, n++);
+			if (r < 0)
+				return r;
+			left = unit;
+		}
+
+		scatterwalk_map(&walk_in, 0);
+		scatterwalk_map(&walk_out, 1);
+
+		todo = min(walk_in.len_this_page, walk_out.len_this_page);
+		todo = min(todo, left) & ~(bsize - 1);
+		if (todo) {
+			src_p = walk_in.data;
+			dst_p = walk_out.data;
+			in_place = walk_in.page == walk_out.page &&
+				   walk_in.offset == walk_out.offset;
+		} else {
+			todo = bsize;
+			src_p = scatterwalk_whichbuf(&walk_in, bsize, tmp_src);
+			dst_p = scatterwalk_whichbuf(&walk_out, bsize, tmp_dst);
+			in_place = scatterwalk_samebuf(&walk_in, &walk_out,
+						       src_p, dst_p);
+		}
+
+		nbytes -= todo;
+		left -= todo;
+
+		scatterwalk_copychunks(src_p, &walk_in, todo, 0);
+
+		for (done = 0; done < todo; done += bsize)
+			prfn(tfm, dst_p + done, src_p + done, crfn, enc, iv,
+			     in_place);
+
+		scatterwalk_done(&walk_in, 0, nbytes);
+
+		scatterwalk_copychunks(dst_p, &walk_out, todo, 1);
+		scatterwalk_done(&walk_out, 1, nbytes);
+
+		if (!nbytes)
+			return 0;
+
+		crypto_yield(tfm);
+	}
+}
+
 static void cbc_process(struct crypto_tfm *tfm, u8 *dst, u8 *src,
 			cryptfn_t fn, int enc, void *info, int in_place)
 {
@@ -197,6 +281,28 @@ static int cbc_decrypt_iv(struct crypto_tfm *tfm,
 	             cbc_process, 0, iv);
 }
 
+static int cbc_encrypt_units(struct crypto_tfm *tfm,
+                             struct scatterlist *dst,
+                             struct scatterlist *src,
+                             unsigned int nbytes, unsigned int unit,
+                             u8 *iv, crypto_ivfn_t *ivfn, void *data)
+{
+	return crypt_units(tfm, dst, src, nbytes, unit,
+	                   tfm->__crt_alg->cra_cipher.cia_encrypt,
+	                   cbc_process, 1, iv, ivfn, data);
+}
+
+static int cbc_decrypt_units(struct crypto_tfm *tfm,
+                             struct scatterlist *dst,
+                             struct scatterlist *src,
+                             unsigned int nbytes, unsigned int unit,
+                             u8 *iv, crypto_ivfn_t *ivfn, void *data)
+{
+	return crypt_units(tfm, dst, src, nbytes, unit,
+	                   tfm->__crt_alg->cra_cipher.cia_decrypt,
+	                   cbc_process, 0, iv, ivfn, data);
+}
+
 static int nocrypt(struct crypto_tfm *tfm,
                    struct scatterlist *dst,
                    struct scatterlist *src,
@@ -213,6 +319,15 @@ static int nocrypt_iv(struct crypto_tfm *tfm,
 	return -ENOSYS;
 }
 
+static int nocrypt_units(struct crypto_tfm *tfm,
+                         struct scatterlist *dst,
+                         struct scatterlist *src,
+                         unsigned int nbytes, unsigned int unit,
+                         u8 *iv, crypto_ivfn_t *ivfn, void *data)
+{
+	return -ENOSYS;
+}
+
 int crypto_init_cipher_flags(struct crypto_tfm *tfm, u32 flags)
 {
 	u32 mode = flags & CRYPTO_TFM_MODE_MASK;
@@ -242,6 +357,8 @@ int crypto_init_cipher_ops(struct crypto_tfm *tfm)
 		ops->cit_decrypt = cbc_decrypt;
 		ops->cit_encrypt_iv = cbc_encrypt_iv;
 		ops->cit_decrypt_iv = cbc_decrypt_iv;
+		ops->cit_encrypt_units = cbc_encrypt_units;
+		ops->cit_decrypt_units = cbc_decrypt_units;
 		break;
 		
 	case CRYPTO_TFM_MODE_CFB:
@@ -249,6 +366,8 @@ int crypto_init_cipher_ops(struct crypto_tfm *tfm)
 		ops->cit_decrypt = nocrypt;
 		ops->cit_encrypt_iv = nocrypt_iv;
 		ops->cit_decrypt_iv = nocrypt_iv;
+		ops->cit_encrypt_units = nocrypt_units;
+		ops->cit_decrypt_units = nocrypt_units;
 		break;
 	
 	case CRYPTO_TFM_MODE_CTR:
@@ -256,6 +375,8 @@ int crypto_init_cipher_ops(struct crypto_tfm *tfm)
 		ops->cit_decrypt = nocrypt;
 		ops->cit_encrypt_iv = nocrypt_iv;
 		ops->cit_decrypt_iv = nocrypt_iv;
+		ops->cit_encrypt_units = nocrypt_units;
+		ops->cit_decrypt_units = nocrypt_units;
 		break;
 
 	default:
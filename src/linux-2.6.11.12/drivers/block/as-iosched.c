@@ -17,7 +17,6 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/compiler.h>
-#include <linux/hash.h>
 #include <linux/rbtree.h>
 #include <linux/interrupt.h>
 
@@ -83,6 +82,21 @@ enum anticipation_status {
 				 * or timed out */
 };
 
+/*
+ * counters shown in the "stats" attribute
+ */
+struct as_stats {
+	unsigned long batches;		/* new batches started */
+	unsigned long dispatched;	/* requests moved to the dispatch queue */
+	unsigned long expired[2];	/* requests taken off an expired fifo */
+	unsigned long starved[2];	/* batches of the other direction started
+					   while these were waiting */
+	unsigned long antic_hits;	/* a new request ended anticipation */
+	unsigned long antic_misses;	/* anticipation timed out */
+	unsigned long back_merges;
+	unsigned long front_merges;
+};
+
 struct as_data {
 	/*
 	 * run time data
@@ -99,7 +113,6 @@ struct as_data {
 	struct as_rq *next_arq[2];	/* next in sort order */
 	sector_t last_sector[2];	/* last REQ_SYNC & REQ_ASYNC sectors */
 	struct list_head *dispatch;	/* driver dispatch queue */
-	struct list_head *hash;		/* request hash */
 
 	unsigned long exit_prob;	/* probability a task will exit while
 					   being waited on */
@@ -132,6 +145,8 @@ struct as_data {
 	unsigned long fifo_expire[2];
 	unsigned long batch_expire[2];
 	unsigned long antic_expire;
+
+	struct as_stats stats;
 };
 
 #define list_entry_fifo(ptr)	list_entry((ptr), struct as_rq, fifo)
@@ -162,12 +177,6 @@ struct as_rq {
 
 	struct io_context *io_context;	/* The submitting task */
 
-	/*
-	 * request hash, key is the ending offset (for back merge lookup)
-	 */
-	struct list_head hash;
-	unsigned int on_hash;
-
 	/*
 	 * expire fifo
 	 */
@@ -239,90 +248,12 @@ static struct io_context *as_get_io_context(void)
 	return ioc;
 }
 
-/*
- * the back merge hash support functions
- */
-static const int as_hash_shift = 6;
-#define AS_HASH_BLOCK(sec)	((sec) >> 3)
-#define AS_HASH_FN(sec)		(hash_long(AS_HASH_BLOCK((sec)), as_hash_shift))
-#define AS_HASH_ENTRIES		(1 << as_hash_shift)
-#define rq_hash_key(rq)		((rq)->sector + (rq)->nr_sectors)
-#define list_entry_hash(ptr)	list_entry((ptr), struct as_rq, hash)
-
-static inline void __as_del_arq_hash(struct as_rq *arq)
-{
-	arq->on_hash = 0;
-	list_del_init(&arq->hash);
-}
-
-static inline void as_del_arq_hash(struct as_rq *arq)
-{
-	if (arq->on_hash)
-		__as_del_arq_hash(arq);
-}
-
 static void as_remove_merge_hints(request_queue_t *q, struct as_rq *arq)
 {
-	as_del_arq_hash(arq);
-
 	if (q->last_merge == arq->request)
 		q->last_merge = NULL;
 }
 
-static void as_add_arq_hash(struct as_data *ad, struct as_rq *arq)
-{
-	struct request *rq = arq->request;
-
-	BUG_ON(arq->on_hash);
-
-	arq->on_hash = 1;
-	list_add(&arq->hash, &ad->hash[AS_HASH_FN(rq_hash_key(rq))]);
-}
-
-/*
- * move hot entry to front of chain
- */
-static inline void as_hot_arq_hash(struct as_data *ad, struct as_rq *arq)
-{
-	struct request *rq = arq->request;
-	struct list_head *head = &ad->hash[AS_HASH_FN(rq_hash_key(rq))];
-
-	if (!arq->on_hash) {
-		WARN_ON(1);
-		return;
-	}
-
-	if (arq->hash.prev != head) {
-		list_del(&arq->hash);
-		list_add(&arq->hash, head);
-	}
-}
-
-static struct request *as_find_arq_hash(struct as_data *ad, sector_t offset)
-{
-	struct list_head *hash_list = &ad->hash[AS_HASH_FN(offset)];
-	struct list_head *entry, *next = hash_list->next;
-
-	while ((entry = next) != hash_list) {
-		struct as_rq *arq = list_entry_hash(entry);
-		struct request *__rq = arq->request;
-
-		next = entry->next;
-
-		BUG_ON(!arq->on_hash);
-
-		if (!rq_mergeable(__rq)) {
-			as_remove_merge_hints(ad->q, arq);
-			continue;
-		}
-
-		if (rq_hash_key(__rq) == offset)
-			return __rq;
-	}
-
-	return NULL;
-}
-
 /*
  * rb tree support functions
  */
@@ -417,6 +348,34 @@ as_find_arq_rb(struct as_data *ad, sector_t sector, int data_dir)
 	return NULL;
 }
 
+/*
+ * find the request ending at offset, for a back merge. Only the request
+ * starting closest below offset is looked at: a longer one overlapping it
+ * that happens to end at offset too is missed, which costs a merge but is
+ * never wrong.
+ */
+static struct request *
+as_find_arq_end(struct as_data *ad, sector_t offset, int data_dir)
+{
+	struct rb_node *n = ad->sort_list[data_dir].rb_node;
+	struct as_rq *arq, *prev = NULL;
+
+	while (n) {
+		arq = rb_entry_arq(n);
+
+		if (arq->rb_key < offset) {
+			prev = arq;
+			n = n->rb_right;
+		} else
+			n = n->rb_left;
+	}
+
+	if (prev && prev->rb_key + prev->request->nr_sectors == offset)
+		return prev->request;
+
+	return NULL;
+}
+
 /*
  * IO Scheduler proper
  */
@@ -624,6 +583,7 @@ static void as_antic_timeout(unsigned long data)
 
 		ad->antic_status = ANTIC_FINISHED;
 		kblockd_schedule_work(&ad->antic_work);
+		ad->stats.antic_misses++;
 
 		if (aic->ttime_samples == 0) {
 			/* process anticipated on has exitted or timed out*/
@@ -906,8 +866,10 @@ static void as_update_arq(struct as_data *ad, struct as_rq *arq)
 	 */
 	if (ad->antic_status == ANTIC_WAIT_REQ
 			|| ad->antic_status == ANTIC_WAIT_NEXT) {
-		if (as_can_break_anticipation(ad, arq))
+		if (as_can_break_anticipation(ad, arq)) {
+			ad->stats.antic_hits++;
 			as_antic_stop(ad);
+		}
 	}
 }
 
@@ -1213,6 +1175,7 @@ static void as_move_to_dispatch(struct as_data *ad, struct as_rq *arq)
 		__arq->state = AS_RQ_DISPATCHED;
 
 		ad->nr_dispatched++;
+		ad->stats.dispatched++;
 	}
 
 	as_remove_queued_request(ad->q, rq);
@@ -1223,6 +1186,7 @@ static void as_move_to_dispatch(struct as_data *ad, struct as_rq *arq)
 	if (arq->io_context && arq->io_context->aic)
 		atomic_inc(&arq->io_context->aic->nr_dispatched);
 	ad->nr_dispatched++;
+	ad->stats.dispatched++;
 }
 
 /*
@@ -1292,6 +1256,9 @@ static int as_dispatch_request(struct as_data *ad)
 			ad->changed_batch = 1;
 		}
 		ad->batch_data_dir = REQ_SYNC;
+		ad->stats.batches++;
+		if (writes)
+			ad->stats.starved[REQ_ASYNC]++;
 		arq = list_entry_fifo(ad->fifo_list[ad->batch_data_dir].next);
 		ad->last_check_fifo[ad->batch_data_dir] = jiffies;
 		goto dispatch_request;
@@ -1316,6 +1283,9 @@ dispatch_writes:
 			ad->new_batch = 0;
 		}
 		ad->batch_data_dir = REQ_ASYNC;
+		ad->stats.batches++;
+		if (reads)
+			ad->stats.starved[REQ_SYNC]++;
 		ad->current_write_count = ad->write_batch_count;
 		ad->write_batch_idled = 0;
 		arq = ad->next_arq[ad->batch_data_dir];
@@ -1334,6 +1304,7 @@ dispatch_request:
 fifo_expired:
 		arq = list_entry_fifo(ad->fifo_list[ad->batch_data_dir].next);
 		BUG_ON(arq == NULL);
+		ad->stats.expired[ad->batch_data_dir]++;
 	}
 
 	if (ad->changed_batch) {
@@ -1437,12 +1408,8 @@ static void as_add_request(struct as_data *ad, struct as_rq *arq)
 		arq->expires = jiffies + ad->fifo_expire[data_dir];
 		list_add_tail(&arq->fifo, &ad->fifo_list[data_dir]);
 
-		if (rq_mergeable(arq->request)) {
-			as_add_arq_hash(ad, arq);
-
-			if (!ad->q->last_merge)
-				ad->q->last_merge = arq->request;
-		}
+		if (rq_mergeable(arq->request) && !ad->q->last_merge)
+			ad->q->last_merge = arq->request;
 		as_update_arq(ad, arq); /* keep state machine up to date */
 
 	} else {
@@ -1455,8 +1422,10 @@ static void as_add_request(struct as_data *ad, struct as_rq *arq)
 		 */
 		if (ad->antic_status == ANTIC_WAIT_REQ
 				|| ad->antic_status == ANTIC_WAIT_NEXT) {
-			if (as_can_break_anticipation(ad, arq))
+			if (as_can_break_anticipation(ad, arq)) {
+				ad->stats.antic_hits++;
 				as_antic_stop(ad);
+			}
 		}
 	}
 
@@ -1604,10 +1573,10 @@ as_merge(request_queue_t *q, struct request **req, struct bio *bio)
 	struct as_data *ad = q->elevator->elevator_data;
 	sector_t rb_key = bio->bi_sector + bio_sectors(bio);
 	struct request *__rq;
-	int ret;
+	int ret, i;
 
 	/*
-	 * try last_merge to avoid going to hash
+	 * try last_merge to avoid the rbtree lookups
 	 */
 	ret = elv_try_last_merge(q, bio);
 	if (ret != ELEVATOR_NO_MERGE) {
@@ -1616,13 +1585,13 @@ as_merge(request_queue_t *q, struct request **req, struct bio *bio)
 	}
 
 	/*
-	 * see if the merge hash can satisfy a back merge
+	 * the sort lists are split sync/async rather than read/write, and
+	 * a write may sit in either, so look in both. elv_rq_merge_ok
+	 * checks the direction. First see if one can satisfy a back merge
 	 */
-	__rq = as_find_arq_hash(ad, bio->bi_sector);
-	if (__rq) {
-		BUG_ON(__rq->sector + __rq->nr_sectors != bio->bi_sector);
-
-		if (elv_rq_merge_ok(__rq, bio)) {
+	for (i = 0; i < 2; i++) {
+		__rq = as_find_arq_end(ad, bio->bi_sector, i);
+		if (__rq && elv_rq_merge_ok(__rq, bio)) {
 			ret = ELEVATOR_BACK_MERGE;
 			goto out;
 		}
@@ -1631,11 +1600,10 @@ as_merge(request_queue_t *q, struct request **req, struct bio *bio)
 	/*
 	 * check for front merge
 	 */
-	__rq = as_find_arq_rb(ad, rb_key, bio_data_dir(bio));
-	if (__rq) {
-		BUG_ON(rb_key != rq_rb_key(__rq));
-
-		if (elv_rq_merge_ok(__rq, bio)) {
+	for (i = 0; i < 2; i++) {
+		__rq = as_find_arq_rb(ad, rb_key, i);
+		if (__rq && elv_rq_merge_ok(__rq, bio)) {
+			BUG_ON(rb_key != rq_rb_key(__rq));
 			ret = ELEVATOR_FRONT_MERGE;
 			goto out;
 		}
@@ -1643,13 +1611,8 @@ as_merge(request_queue_t *q, struct request **req, struct bio *bio)
 
 	return ELEVATOR_NO_MERGE;
 out:
-	if (rq_mergeable(__rq))
-		q->last_merge = __rq;
+	q->last_merge = __rq;
 out_insert:
-	if (ret) {
-		if (rq_mergeable(__rq))
-			as_hot_arq_hash(ad, RQ_DATA(__rq));
-	}
 	*req = __rq;
 	return ret;
 }
@@ -1659,18 +1622,14 @@ static void as_merged_request(request_queue_t *q, struct request *req)
 	struct as_data *ad = q->elevator->elevator_data;
 	struct as_rq *arq = RQ_DATA(req);
 
-	/*
-	 * hash always needs to be repositioned, key is end sector
-	 */
-	as_del_arq_hash(arq);
-	as_add_arq_hash(ad, arq);
-
 	/*
 	 * if the merge was a front merge, we need to reposition request
 	 */
 	if (rq_rb_key(req) != arq->rb_key) {
 		struct as_rq *alias, *next_arq = NULL;
 
+		ad->stats.front_merges++;
+
 		if (ad->next_arq[arq->is_sync] == arq)
 			next_arq = as_find_next_arq(ad, arq);
 
@@ -1691,9 +1650,13 @@ static void as_merged_request(request_queue_t *q, struct request *req)
 		 * request may not be optimal - eg the request may have "grown"
 		 * behind the disk head. We currently don't bother adjusting.
 		 */
-	}
+	} else
+		ad->stats.back_merges++;
 
-	if (arq->on_hash)
+	/*
+	 * an aliased request is off the rbtree and we don't merge onto it
+	 */
+	if (ON_RB(&arq->rb_node))
 		q->last_merge = req;
 }
 
@@ -1709,12 +1672,9 @@ as_merged_requests(request_queue_t *q, struct request *req,
 	BUG_ON(!anext);
 
 	/*
-	 * reposition arq (this is the merged request) in hash, and in rbtree
-	 * in case of a front merge
+	 * reposition arq (this is the merged request) in rbtree in case of
+	 * a front merge
 	 */
-	as_del_arq_hash(arq);
-	as_add_arq_hash(ad, arq);
-
 	if (rq_rb_key(req) != arq->rb_key) {
 		struct as_rq *alias, *next_arq = NULL;
 
@@ -1816,8 +1776,6 @@ static int as_set_request(request_queue_t *q, struct request *rq, int gfp_mask)
 		arq->request = rq;
 		arq->state = AS_RQ_PRESCHED;
 		arq->io_context = NULL;
-		INIT_LIST_HEAD(&arq->hash);
-		arq->on_hash = 0;
 		INIT_LIST_HEAD(&arq->fifo);
 		rq->elevator_private = arq;
 		return 0;
@@ -1854,7 +1812,6 @@ static void as_exit_queue(elevator_t *e)
 
 	mempool_destroy(ad->arq_pool);
 	put_io_context(ad->io_context);
-	kfree(ad->hash);
 	kfree(ad);
 }
 
@@ -1865,7 +1822,6 @@ static void as_exit_queue(elevator_t *e)
 static int as_init_queue(request_queue_t *q, elevator_t *e)
 {
 	struct as_data *ad;
-	int i;
 
 	if (!arq_pool)
 		return -ENOMEM;
@@ -1877,15 +1833,8 @@ static int as_init_queue(request_queue_t *q, elevator_t *e)
 
 	ad->q = q; /* Identify what queue the data belongs to */
 
-	ad->hash = kmalloc(sizeof(struct list_head)*AS_HASH_ENTRIES,GFP_KERNEL);
-	if (!ad->hash) {
-		kfree(ad);
-		return -ENOMEM;
-	}
-
 	ad->arq_pool = mempool_create(BLKDEV_MIN_RQ, mempool_alloc_slab, mempool_free_slab, arq_pool);
 	if (!ad->arq_pool) {
-		kfree(ad->hash);
 		kfree(ad);
 		return -ENOMEM;
 	}
@@ -1896,9 +1845,6 @@ static int as_init_queue(request_queue_t *q, elevator_t *e)
 	init_timer(&ad->antic_timer);
 	INIT_WORK(&ad->antic_work, as_work_handler, q);
 
-	for (i = 0; i < AS_HASH_ENTRIES; i++)
-		INIT_LIST_HEAD(&ad->hash[i]);
-
 	INIT_LIST_HEAD(&ad->fifo_list[REQ_SYNC]);
 	INIT_LIST_HEAD(&ad->fifo_list[REQ_ASYNC]);
 	ad->sort_list[REQ_SYNC] = RB_ROOT;
@@ -1962,6 +1908,32 @@ static ssize_t as_est_show(struct as_data *ad, char *page)
 	return pos;
 }
 
+static ssize_t as_stats_show(struct as_data *ad, char *page)
+{
+	struct as_stats *st = &ad->stats;
+	unsigned long avg = 0, frac = 0;
+	int pos = 0;
+
+	if (st->batches) {
+		avg = st->dispatched / st->batches;
+		frac = (st->dispatched % st->batches) * 100 / st->batches;
+	}
+
+	pos += sprintf(page+pos, "batches %lu\n", st->batches);
+	pos += sprintf(page+pos, "dispatched %lu\n", st->dispatched);
+	pos += sprintf(page+pos, "avg_batch %lu.%02lu\n", avg, frac);
+	pos += sprintf(page+pos, "read_expired %lu\n", st->expired[REQ_SYNC]);
+	pos += sprintf(page+pos, "write_expired %lu\n", st->expired[REQ_ASYNC]);
+	pos += sprintf(page+pos, "read_starved %lu\n", st->starved[REQ_SYNC]);
+	pos += sprintf(page+pos, "write_starved %lu\n", st->starved[REQ_ASYNC]);
+	pos += sprintf(page+pos, "antic_hits %lu\n", st->antic_hits);
+	pos += sprintf(page+pos, "antic_misses %lu\n", st->antic_misses);
+	pos += sprintf(page+pos, "back_merges %lu\n", st->back_merges);
+	pos += sprintf(page+pos, "front_merges %lu\n", st->front_merges);
+
+	return pos;
+}
+
 #define SHOW_FUNCTION(__FUNC, __VAR)				\
 static ssize_t __FUNC(struct as_data *ad, char *page)		\
 {								\
@@ -1998,6 +1970,10 @@ static struct as_fs_entry as_est_entry = {
 	.attr = {.name = "est_time", .mode = S_IRUGO },
 	.show = as_est_show,
 };
+static struct as_fs_entry as_stats_entry = {
+	.attr = {.name = "stats", .mode = S_IRUGO },
+	.show = as_stats_show,
+};
 static struct as_fs_entry as_readexpire_entry = {
 	.attr = {.name = "read_expire", .mode = S_IRUGO | S_IWUSR },
 	.show = as_readexpire_show,
@@ -2026,6 +2002,7 @@ static struct as_fs_entry as_write_batchexpire_entry = {
 
 static struct attribute *default_attrs[] = {
 	&as_est_entry.attr,
+	&as_stats_entry.attr,
 	&as_readexpire_entry.attr,
 	&as_writeexpire_entry.attr,
 	&as_anticexpire_entry.attr,
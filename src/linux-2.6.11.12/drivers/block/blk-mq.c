@@ -0,0 +1,616 @@
+/*
+ *  linux/drivers/block/blk-mq.c
+ *
+ * Multi-queue request submission: per-cpu software queues feeding the
+ * hardware dispatch queues of a driver, with tag-indexed preallocated
+ * requests.  See include/linux/blk-mq.h.
+ */
+
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/blktrace.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/smp.h>
+#include <linux/interrupt.h>
+
+/*
+ * Tag allocation.  Each cpu starts looking where it last succeeded, so
+ * that cpus sharing a hardware queue mostly stay off each other's words
+ * of the bitmap.
+ */
+static struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+					    unsigned int cmd_size)
+{
+	struct blk_mq_tags *tags;
+	unsigned int i;
+
+	tags = kmalloc(sizeof(*tags), GFP_KERNEL);
+	if (!tags)
+		return NULL;
+	memset(tags, 0, sizeof(*tags));
+	tags->nr_tags = nr_tags;
+	init_waitqueue_head(&tags->wait);
+
+	tags->bitmap = kmalloc(BITS_TO_LONGS(nr_tags) * sizeof(long),
+			       GFP_KERNEL);
+	tags->hint = alloc_percpu(unsigned int);
+	tags->rqs = kmalloc(nr_tags * sizeof(struct request *), GFP_KERNEL);
+	if (!tags->bitmap || !tags->hint || !tags->rqs)
+		goto fail;
+	memset(tags->bitmap, 0, BITS_TO_LONGS(nr_tags) * sizeof(long));
+	memset(tags->rqs, 0, nr_tags * sizeof(struct request *));
+
+	for (i = 0; i < nr_tags; i++) {
+		tags->rqs[i] = kmalloc(sizeof(struct request) + cmd_size,
+				       GFP_KERNEL);
+		if (!tags->rqs[i])
+			goto fail;
+	}
+	return tags;
+
+fail:
+	if (tags->rqs)
+		for (i = 0; i < nr_tags; i++)
+			kfree(tags->rqs[i]);
+	kfree(tags->rqs);
+	if (tags->hint)
+		free_percpu(tags->hint);
+	kfree(tags->bitmap);
+	kfree(tags);
+	return NULL;
+}
+
+static void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	unsigned int i;
+
+	for (i = 0; i < tags->nr_tags; i++)
+		kfree(tags->rqs[i]);
+	kfree(tags->rqs);
+	free_percpu(tags->hint);
+	kfree(tags->bitmap);
+	kfree(tags);
+}
+
+static int blk_mq_get_tag(struct blk_mq_tags *tags)
+{
+	unsigned int *hint = per_cpu_ptr(tags->hint, get_cpu());
+	unsigned int tag = *hint;
+
+	if (tag >= tags->nr_tags)
+		tag = 0;
+	do {
+		tag = find_next_zero_bit(tags->bitmap, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags) {
+			tag = find_first_zero_bit(tags->bitmap, tags->nr_tags);
+			if (tag >= tags->nr_tags) {
+				put_cpu();
+				return -1;
+			}
+		}
+	} while (test_and_set_bit(tag, tags->bitmap));
+
+	*hint = tag + 1;
+	put_cpu();
+	return tag;
+}
+
+static void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	smp_mb__before_clear_bit();
+	clear_bit(tag, tags->bitmap);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+/*
+ * Get a request from the hardware queue serving this cpu, sleeping for
+ * a free tag unless this is readahead.
+ */
+static struct request *blk_mq_get_request(request_queue_t *q,
+					  struct bio *bio)
+{
+	struct blk_mq_ctx *ctx;
+	struct blk_mq_hw_ctx *hctx;
+	struct request *rq;
+	DEFINE_WAIT(wait);
+	int tag;
+
+	for (;;) {
+		ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+		put_cpu();
+		hctx = ctx->hctx;
+
+		tag = blk_mq_get_tag(hctx->tags);
+		if (tag >= 0)
+			break;
+		if (bio_rw_ahead(bio))
+			return NULL;
+
+		prepare_to_wait_exclusive(&hctx->tags->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		tag = blk_mq_get_tag(hctx->tags);
+		if (tag < 0)
+			io_schedule();
+		finish_wait(&hctx->tags->wait, &wait);
+		if (tag >= 0)
+			break;
+	}
+
+	rq = hctx->tags->rqs[tag];
+	memset(rq, 0, sizeof(*rq));
+	INIT_LIST_HEAD(&rq->queuelist);
+	rq->q = q;
+	rq->mq_ctx = ctx;
+	rq->tag = tag;
+	rq->ref_count = 1;
+	rq->rq_status = RQ_ACTIVE;
+	return rq;
+}
+
+static void blk_mq_bio_to_request(struct request *rq, struct bio *bio)
+{
+	rq->flags |= REQ_CMD;
+	if (bio_data_dir(bio) == WRITE)
+		rq->flags |= REQ_RW;
+	if (bio_rw_ahead(bio) || bio_failfast(bio))
+		rq->flags |= REQ_FAILFAST;
+
+	rq->hard_sector = rq->sector = bio->bi_sector;
+	rq->hard_nr_sectors = rq->nr_sectors = bio_sectors(bio);
+	rq->current_nr_sectors = rq->hard_cur_sectors = bio_cur_sectors(bio);
+	rq->nr_phys_segments = bio_phys_segments(rq->q, bio);
+	rq->nr_hw_segments = bio_hw_segments(rq->q, bio);
+	rq->buffer = bio_data(bio);
+	rq->bio = rq->biotail = bio;
+	rq->rq_disk = bio->bi_bdev->bd_disk;
+	rq->start_time = jiffies;
+}
+
+/*
+ * Disk statistics are per-cpu counters, safe against ourselves once
+ * interrupts are off.  in_flight and the time-weighted counters need a
+ * lock shared by all cpus, which is what this path does without: they
+ * are not maintained for multi-queue devices.
+ */
+static void blk_mq_account_done(struct request *rq, unsigned int nr_sectors)
+{
+	struct gendisk *disk = rq->rq_disk;
+	unsigned long duration = jiffies - rq->start_time;
+	unsigned long flags;
+
+	if (!disk)
+		return;
+
+	local_irq_save(flags);
+	if (rq_data_dir(rq) == WRITE) {
+		__disk_stat_inc(disk, writes);
+		__disk_stat_add(disk, write_sectors, nr_sectors);
+		__disk_stat_add(disk, write_ticks, duration);
+	} else {
+		__disk_stat_inc(disk, reads);
+		__disk_stat_add(disk, read_sectors, nr_sectors);
+		__disk_stat_add(disk, read_ticks, duration);
+	}
+	local_irq_restore(flags);
+}
+
+/**
+ * blk_mq_end_io - complete a request started by ->queue_rq
+ * @rq:		the request
+ * @error:	0, or the negative error to fail all of its bios with
+ *
+ * May be called from interrupt context.
+ **/
+void blk_mq_end_io(struct request *rq, int error)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_ctx->hctx;
+	struct completion *waiting = rq->waiting;
+	unsigned int nr_sectors = rq->hard_nr_sectors;
+
+	if (end_that_request_first(rq, error ? error : 1, nr_sectors))
+		BUG();
+	blk_mq_account_done(rq, nr_sectors);
+
+	rq->rq_status = RQ_INACTIVE;
+	blk_mq_put_tag(hctx->tags, rq->tag);
+	if (waiting)
+		complete(waiting);
+}
+
+EXPORT_SYMBOL(blk_mq_end_io);
+
+/*
+ * Hand a batch of requests to the driver: whatever a busy driver gave
+ * back last time first, then everything the mapped cpus have queued.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	request_queue_t *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!list_empty(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	/*
+	 * A submitter sets its bit after queueing, under ctx->lock, so a
+	 * request added after we cleared the bit is either taken here or
+	 * leaves the bit set for the run its submitter starts.
+	 */
+	for (bit = find_first_bit(hctx->ctx_map, hctx->nr_ctx);
+	     bit < hctx->nr_ctx;
+	     bit = find_next_bit(hctx->ctx_map, hctx->nr_ctx, bit + 1)) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+
+		spin_lock(&ctx->lock);
+		list_splice_init(&ctx->rq_list, rq_list.prev);
+		spin_unlock(&ctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_entry_rq(rq_list.next);
+		list_del_init(&rq->queuelist);
+
+		blk_add_trace_rq(q, rq, BLK_TA_ISSUE);
+		switch (q->mq_ops->queue_rq(hctx, rq)) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			/*
+			 * The driver is out of resources and has stopped
+			 * the queue: keep the rest, in order, for when it
+			 * restarts it.  A completion may have restarted it
+			 * already, and that run found ->dispatch empty, so
+			 * look again once the requests are back on it.
+			 */
+			list_add(&rq->queuelist, &rq_list);
+			spin_lock(&hctx->lock);
+			list_splice_init(&rq_list, &hctx->dispatch);
+			spin_unlock(&hctx->lock);
+			smp_mb();
+			if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+				blk_mq_run_hw_queue(hctx, 1);
+			return;
+		default:
+			printk(KERN_ERR "blk-mq: bad return from queue_rq\n");
+			/* fall through */
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			blk_mq_end_io(rq, -EIO);
+			break;
+		}
+	}
+}
+
+static void blk_mq_run_work_fn(void *data)
+{
+	__blk_mq_run_hw_queue(data);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the requests queued on a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	leave it to kblockd
+ *
+ * Description:
+ *   From interrupt context @async must be set.  A queue whose ->queue_rq
+ *   may sleep is also run from kblockd when the caller is not in a state
+ *   to sleep, e.g. flushing its plug on the way into schedule().
+ **/
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, int async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async && (hctx->flags & BLK_MQ_F_SHOULD_SLEEP) &&
+	    (current->state != TASK_RUNNING || in_atomic()))
+		async = 1;
+
+	if (async)
+		kblockd_schedule_work(&hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(request_queue_t *q, int async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_run_hw_queue(hctx, async);
+}
+
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/*
+ * A driver that returned BLK_MQ_RQ_QUEUE_BUSY stops the queue, and
+ * starts it again once it has room: the requests handed back are then
+ * dispatched from kblockd.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	if (test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		blk_mq_run_hw_queue(hctx, 1);
+}
+
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(request_queue_t *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_start_hw_queue(hctx);
+}
+
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_queue_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	blk_add_trace_rq(rq->q, rq, BLK_TA_INSERT);
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	set_bit(ctx->index_hw, ctx->hctx->ctx_map);
+	spin_unlock(&ctx->lock);
+}
+
+/*
+ * Queue the requests of a flushed plug, all for @q, running a hardware
+ * queue whenever the batch moves on from it.  A plug is normally filled
+ * from one cpu, so that is once.
+ */
+void blk_mq_insert_requests(request_queue_t *q, struct list_head *list)
+{
+	struct blk_mq_hw_ctx *hctx, *last = NULL;
+	struct request *rq;
+
+	while (!list_empty(list)) {
+		rq = list_entry_rq(list->next);
+		list_del_init(&rq->queuelist);
+		blk_mq_queue_request(rq);
+
+		hctx = rq->mq_ctx->hctx;
+		if (last && hctx != last)
+			blk_mq_run_hw_queue(last, 0);
+		last = hctx;
+	}
+	if (last)
+		blk_mq_run_hw_queue(last, 0);
+}
+
+static int blk_mq_make_request(request_queue_t *q, struct bio *bio)
+{
+	struct blk_plug *plug = current->plug;
+	struct request *rq;
+
+	blk_queue_bounce(q, &bio);
+
+	if (bio_barrier(bio)) {
+		bio_endio(bio, bio->bi_size, -EOPNOTSUPP);
+		return 0;
+	}
+
+	if (plug && blk_attempt_plug_merge(plug, q, bio))
+		return 0;
+
+	rq = blk_mq_get_request(q, bio);
+	if (!rq) {
+		bio_endio(bio, bio->bi_size, -EWOULDBLOCK);
+		return 0;
+	}
+	blk_mq_bio_to_request(rq, bio);
+	blk_add_trace_bio(q, bio, BLK_TA_GETRQ);
+
+	if (plug) {
+		if (list_empty(&plug->list))
+			blk_add_trace_generic(q, BLK_TA_PLUG);
+		list_add_tail(&rq->queuelist, &plug->list);
+		if (++plug->count >= BLK_MAX_PLUG_COUNT)
+			blk_flush_plug_list(plug);
+		return 0;
+	}
+
+	blk_mq_queue_request(rq);
+	blk_mq_run_hw_queue(rq->mq_ctx->hctx, 0);
+	return 0;
+}
+
+/**
+ * blk_mq_map_queue - default cpu to hardware queue mapping
+ * @q:		the queue
+ * @cpu:	the cpu
+ **/
+struct blk_mq_hw_ctx *blk_mq_map_queue(request_queue_t *q, int cpu)
+{
+	return q->queue_hw_ctx[cpu % q->nr_hw_queues];
+}
+
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static void blk_mq_free_hw_queues(request_queue_t *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		hctx = q->queue_hw_ctx[i];
+		if (!hctx)
+			continue;
+		if (hctx->tags)
+			blk_mq_free_tags(hctx->tags);
+		kfree(hctx->ctxs);
+		kfree(hctx->ctx_map);
+		kfree(hctx);
+	}
+	kfree(q->queue_hw_ctx);
+	q->queue_hw_ctx = NULL;
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+	q->queue_ctx = NULL;
+}
+
+/*
+ * Map every possible cpu's software queue onto a hardware queue, then
+ * size each hardware queue's table of software queues to match.
+ */
+static int blk_mq_map_swqueues(request_queue_t *q)
+{
+	map_queue_fn *map_queue = q->mq_ops->map_queue;
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	unsigned int i;
+	int cpu;
+
+	if (!map_queue)
+		map_queue = blk_mq_map_queue;
+
+	for_each_cpu(cpu) {
+		ctx = per_cpu_ptr(q->queue_ctx, cpu);
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+
+		hctx = map_queue(q, cpu);
+		ctx->hctx = hctx;
+		ctx->index_hw = hctx->nr_ctx++;
+		cpu_set(cpu, hctx->cpumask);
+	}
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!hctx->nr_ctx)
+			continue;
+		hctx->ctxs = kmalloc(hctx->nr_ctx * sizeof(void *), GFP_KERNEL);
+		hctx->ctx_map = kmalloc(BITS_TO_LONGS(hctx->nr_ctx) *
+					sizeof(long), GFP_KERNEL);
+		if (!hctx->ctxs || !hctx->ctx_map)
+			return -ENOMEM;
+		memset(hctx->ctx_map, 0,
+		       BITS_TO_LONGS(hctx->nr_ctx) * sizeof(long));
+	}
+
+	for_each_cpu(cpu) {
+		ctx = per_cpu_ptr(q->queue_ctx, cpu);
+		ctx->hctx->ctxs[ctx->index_hw] = ctx;
+	}
+	return 0;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	hardware queues, their depth and the driver's methods
+ * @driver_data: passed to ->init_hctx
+ *
+ * Description:
+ *   The queue is released with blk_cleanup_queue() like any other.
+ **/
+request_queue_t *blk_mq_init_queue(struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	request_queue_t *q;
+	unsigned int i;
+
+	if (!reg->nr_hw_queues || !reg->queue_depth || !reg->ops->queue_rq)
+		return NULL;
+
+	q = blk_alloc_queue(GFP_KERNEL);
+	if (!q)
+		return NULL;
+	blk_queue_make_request(q, blk_mq_make_request);
+	blk_queue_merge_defaults(q);
+
+	q->mq_ops = reg->ops;
+	q->nr_hw_queues = reg->nr_hw_queues;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kmalloc(reg->nr_hw_queues * sizeof(void *),
+				  GFP_KERNEL);
+	if (!q->queue_ctx || !q->queue_hw_ctx)
+		goto fail;
+	memset(q->queue_hw_ctx, 0, reg->nr_hw_queues * sizeof(void *));
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = kmalloc(sizeof(*hctx), GFP_KERNEL);
+		if (!hctx)
+			goto fail;
+		memset(hctx, 0, sizeof(*hctx));
+		q->queue_hw_ctx[i] = hctx;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_WORK(&hctx->run_work, blk_mq_run_work_fn, hctx);
+		cpus_clear(hctx->cpumask);
+		hctx->queue_num = i;
+		hctx->flags = reg->flags;
+		hctx->queue = q;
+		hctx->tags = blk_mq_init_tags(reg->queue_depth, reg->cmd_size);
+		if (!hctx->tags)
+			goto fail;
+	}
+
+	if (blk_mq_map_swqueues(q))
+		goto fail;
+
+	if (reg->ops->init_hctx) {
+		queue_for_each_hw_ctx(q, hctx, i)
+			if (reg->ops->init_hctx(hctx, driver_data, i)) {
+				while (i--)
+					if (reg->ops->exit_hctx)
+						reg->ops->exit_hctx(
+							q->queue_hw_ctx[i], i);
+				goto fail;
+			}
+	}
+	return q;
+
+fail:
+	blk_mq_free_hw_queues(q);
+	q->mq_ops = NULL;
+	blk_cleanup_queue(q);
+	return NULL;
+}
+
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_cleanup_queue() once the last reference is gone.
+ */
+void blk_mq_free_queue(request_queue_t *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	kblockd_flush();
+	if (q->mq_ops->exit_hctx)
+		queue_for_each_hw_ctx(q, hctx, i)
+			q->mq_ops->exit_hctx(hctx, i);
+	blk_mq_free_hw_queues(q);
+}
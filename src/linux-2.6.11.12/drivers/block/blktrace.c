@@ -0,0 +1,454 @@
+/*
+ * blktrace.c - per-cpu logging of block layer events.
+ *
+ * The hooks in ll_rw_blk.c, elevator.c and blk-mq.c call in here only
+ * while a queue has a struct blk_trace; records go into a ring on the
+ * logging cpu, taken under a lock no other cpu contends for except a
+ * reader of that ring.  See include/linux/blktrace.h for the interface
+ * and Documentation/block/blktrace.txt for a parser.
+ */
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/blktrace.h>
+#include <linux/bio.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/rcupdate.h>
+#include <asm/uaccess.h>
+#include <asm/semaphore.h>
+
+/* largest ring a cpu may have, in bytes */
+#define BLK_TRACE_MAX_BUF	(16 << 20)
+
+/* serializes setup and teardown, and creating blk_tree_root */
+static DECLARE_MUTEX(blk_trace_sem);
+static struct dentry *blk_tree_root;
+
+void __blk_add_trace(request_queue_t *q, sector_t sector, int bytes,
+		     u32 what, int error)
+{
+	struct blk_trace_buf *buf;
+	struct blk_io_trace *t;
+	struct blk_trace *bt;
+	pid_t pid = current->pid;
+	unsigned long flags;
+	int cpu;
+
+	/*
+	 * With interrupts off we hold up the synchronize_kernel() in
+	 * blk_trace_remove() for as long as we use bt.
+	 */
+	local_irq_save(flags);
+	bt = q->blk_trace;
+	smp_read_barrier_depends();
+	if (!bt || bt->trace_state != Blktrace_running)
+		goto out;
+	if (!((bt->act_mask << BLK_TC_SHIFT) & what))
+		goto out;
+	if (sector < bt->start_lba || sector > bt->end_lba)
+		goto out;
+	if (bt->pid && pid != bt->pid)
+		goto out;
+
+	cpu = smp_processor_id();
+	buf = per_cpu_ptr(bt->bufs, cpu);
+	spin_lock(&buf->lock);
+	if (buf->head - buf->tail > buf->mask) {
+		buf->dropped++;
+		spin_unlock(&buf->lock);
+		goto out;
+	}
+	t = &buf->recs[buf->head++ & buf->mask];
+	t->magic = BLK_IO_TRACE_MAGIC | BLK_IO_TRACE_VERSION;
+	t->sequence = ++buf->sequence;
+	t->time = sched_clock();
+	t->sector = sector;
+	t->bytes = bytes;
+	t->action = what;
+	t->pid = pid;
+	t->device = bt->dev;
+	t->cpu = cpu;
+	t->error = error;
+	t->pdu_len = 0;
+	spin_unlock(&buf->lock);
+
+	if (waitqueue_active(&buf->wait))
+		wake_up(&buf->wait);
+out:
+	local_irq_restore(flags);
+}
+
+EXPORT_SYMBOL_GPL(__blk_add_trace);
+
+void __blk_add_trace_rq(request_queue_t *q, struct request *rq, int bytes,
+			u32 what, int error)
+{
+	if (rq->flags & REQ_RW)
+		what |= BLK_TC_ACT(BLK_TC_WRITE);
+	else
+		what |= BLK_TC_ACT(BLK_TC_READ);
+	if (rq->flags & REQ_HARDBARRIER)
+		what |= BLK_TC_ACT(BLK_TC_BARRIER);
+	if (blk_pc_request(rq))
+		what |= BLK_TC_ACT(BLK_TC_PC);
+	else
+		what |= BLK_TC_ACT(BLK_TC_FS);
+
+	__blk_add_trace(q, rq->hard_sector, bytes, what, error);
+}
+
+EXPORT_SYMBOL_GPL(__blk_add_trace_rq);
+
+void __blk_add_trace_bio(request_queue_t *q, struct bio *bio, u32 what)
+{
+	if (bio_data_dir(bio) == WRITE)
+		what |= BLK_TC_ACT(BLK_TC_WRITE);
+	else
+		what |= BLK_TC_ACT(BLK_TC_READ);
+	if (bio_barrier(bio))
+		what |= BLK_TC_ACT(BLK_TC_BARRIER);
+	if (bio_sync(bio))
+		what |= BLK_TC_ACT(BLK_TC_SYNC);
+	what |= BLK_TC_ACT(BLK_TC_FS);
+
+	__blk_add_trace(q, bio->bi_sector, bio->bi_size, what, 0);
+}
+
+EXPORT_SYMBOL_GPL(__blk_add_trace_bio);
+
+static void blk_trace_put(struct blk_trace *bt)
+{
+	int i;
+
+	if (!atomic_dec_and_test(&bt->refcnt))
+		return;
+
+	if (bt->bufs) {
+		for_each_cpu(i)
+			vfree(per_cpu_ptr(bt->bufs, i)->recs);
+		free_percpu(bt->bufs);
+	}
+	kfree(bt);
+}
+
+static int blk_trace_open(struct inode *inode, struct file *file)
+{
+	struct blk_trace_buf *buf = inode->u.generic_ip;
+
+	atomic_inc(&buf->bt->refcnt);
+	file->private_data = buf;
+	return 0;
+}
+
+static int blk_trace_release(struct inode *inode, struct file *file)
+{
+	struct blk_trace_buf *buf = file->private_data;
+
+	blk_trace_put(buf->bt);
+	return 0;
+}
+
+/*
+ * Hand out whole records, waiting for some unless tracing has stopped,
+ * when an empty ring reads as end of file.
+ */
+static ssize_t blk_trace_read(struct file *file, char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct blk_trace_buf *buf = file->private_data;
+	struct blk_trace *bt = buf->bt;
+	struct blk_io_trace *page;
+	unsigned int i, n;
+	ssize_t ret;
+
+	n = count / sizeof(struct blk_io_trace);
+	if (!n)
+		return -EINVAL;
+	if (n > PAGE_SIZE / sizeof(struct blk_io_trace))
+		n = PAGE_SIZE / sizeof(struct blk_io_trace);
+
+	page = (struct blk_io_trace *) __get_free_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (;;) {
+		spin_lock_irq(&buf->lock);
+		if (buf->head != buf->tail)
+			break;
+		spin_unlock_irq(&buf->lock);
+
+		ret = 0;
+		if (bt->trace_state == Blktrace_stopped)
+			goto out;
+		ret = -EAGAIN;
+		if (file->f_flags & O_NONBLOCK)
+			goto out;
+		ret = wait_event_interruptible(buf->wait,
+				buf->head != buf->tail ||
+				bt->trace_state == Blktrace_stopped);
+		if (ret)
+			goto out;
+	}
+
+	if (n > buf->head - buf->tail)
+		n = buf->head - buf->tail;
+	for (i = 0; i < n; i++)
+		page[i] = buf->recs[buf->tail++ & buf->mask];
+	spin_unlock_irq(&buf->lock);
+
+	ret = n * sizeof(struct blk_io_trace);
+	if (copy_to_user(ubuf, page, ret))
+		ret = -EFAULT;
+out:
+	free_page((unsigned long) page);
+	return ret;
+}
+
+static struct file_operations blk_trace_fops = {
+	.owner =	THIS_MODULE,
+	.open =		blk_trace_open,
+	.read =		blk_trace_read,
+	.release =	blk_trace_release,
+};
+
+static int blk_dropped_open(struct inode *inode, struct file *file)
+{
+	struct blk_trace *bt = inode->u.generic_ip;
+
+	atomic_inc(&bt->refcnt);
+	file->private_data = bt;
+	return 0;
+}
+
+static int blk_dropped_release(struct inode *inode, struct file *file)
+{
+	blk_trace_put(file->private_data);
+	return 0;
+}
+
+static ssize_t blk_dropped_read(struct file *file, char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct blk_trace *bt = file->private_data;
+	unsigned long dropped = 0;
+	char tmp[24];
+	int i;
+
+	for_each_cpu(i)
+		dropped += per_cpu_ptr(bt->bufs, i)->dropped;
+	i = snprintf(tmp, sizeof(tmp), "%lu\n", dropped);
+	return simple_read_from_buffer(ubuf, count, ppos, tmp, i);
+}
+
+static struct file_operations blk_dropped_fops = {
+	.owner =	THIS_MODULE,
+	.open =		blk_dropped_open,
+	.read =		blk_dropped_read,
+	.release =	blk_dropped_release,
+};
+
+static void blk_trace_cleanup(struct blk_trace *bt)
+{
+	int i;
+
+	if (bt->bufs)
+		for_each_cpu(i)
+			debugfs_remove(per_cpu_ptr(bt->bufs, i)->dentry);
+	debugfs_remove(bt->dropped_file);
+	debugfs_remove(bt->dir);
+	blk_trace_put(bt);
+}
+
+static void blk_trace_wake_readers(struct blk_trace *bt)
+{
+	int i;
+
+	for_each_cpu(i)
+		wake_up(&per_cpu_ptr(bt->bufs, i)->wait);
+}
+
+static int blk_trace_remove(request_queue_t *q)
+{
+	struct blk_trace *bt = q->blk_trace;
+
+	if (!bt)
+		return -EINVAL;
+
+	q->blk_trace = NULL;
+	/* wait out __blk_add_trace() callers that saw it */
+	synchronize_kernel();
+
+	bt->trace_state = Blktrace_stopped;
+	blk_trace_wake_readers(bt);
+	blk_trace_cleanup(bt);
+	return 0;
+}
+
+static int blk_trace_setup(request_queue_t *q, struct block_device *bdev,
+			   char __user *arg)
+{
+	struct blk_user_trace_setup buts;
+	struct blk_trace_buf *buf;
+	struct blk_trace *bt;
+	char b[BDEVNAME_SIZE];
+	unsigned int nr;
+	int i, ret;
+
+	if (copy_from_user(&buts, arg, sizeof(buts)))
+		return -EFAULT;
+	if (q->blk_trace)
+		return -EBUSY;
+	if (!buts.buf_size || !buts.buf_nr ||
+	    buts.buf_size > BLK_TRACE_MAX_BUF / buts.buf_nr)
+		return -EINVAL;
+
+	/* whole records, a power of two of them */
+	nr = buts.buf_size * buts.buf_nr / sizeof(struct blk_io_trace);
+	if (!nr)
+		return -EINVAL;
+	nr = 1U << (fls(nr) - 1);
+
+	strcpy(buts.name, bdevname(bdev, b));
+	/* a debugfs name, so no '/' as in cciss/c0d0 */
+	for (i = 0; i < strlen(buts.name); i++)
+		if (buts.name[i] == '/')
+			buts.name[i] = '!';
+	if (copy_to_user(arg, &buts, sizeof(buts)))
+		return -EFAULT;
+
+	bt = kmalloc(sizeof(*bt), GFP_KERNEL);
+	if (!bt)
+		return -ENOMEM;
+	memset(bt, 0, sizeof(*bt));
+	atomic_set(&bt->refcnt, 1);
+	bt->act_mask = buts.act_mask ? buts.act_mask : (u16) -1;
+	bt->start_lba = buts.start_lba;
+	bt->end_lba = buts.end_lba ? buts.end_lba : (u64) -1;
+	bt->pid = buts.pid;
+	bt->dev = bdev->bd_dev;
+	bt->trace_state = Blktrace_setup;
+
+	ret = -ENOMEM;
+	bt->bufs = alloc_percpu(struct blk_trace_buf);
+	if (!bt->bufs)
+		goto err;
+	for_each_cpu(i) {
+		buf = per_cpu_ptr(bt->bufs, i);
+		spin_lock_init(&buf->lock);
+		init_waitqueue_head(&buf->wait);
+		buf->bt = bt;
+		buf->mask = nr - 1;
+		buf->recs = vmalloc(nr * sizeof(struct blk_io_trace));
+		if (!buf->recs)
+			goto err;
+	}
+
+	if (!blk_tree_root) {
+		blk_tree_root = debugfs_create_dir("block", NULL);
+		if (!blk_tree_root)
+			goto err;
+	}
+	bt->dir = debugfs_create_dir(buts.name, blk_tree_root);
+	if (!bt->dir)
+		goto err;
+	bt->dropped_file = debugfs_create_file("dropped", 0444, bt->dir, bt,
+					       &blk_dropped_fops);
+	if (!bt->dropped_file)
+		goto err;
+	for_each_cpu(i) {
+		buf = per_cpu_ptr(bt->bufs, i);
+		sprintf(b, "trace%d", i);
+		buf->dentry = debugfs_create_file(b, 0444, bt->dir, buf,
+						  &blk_trace_fops);
+		if (!buf->dentry)
+			goto err;
+	}
+
+	smp_wmb();
+	q->blk_trace = bt;
+	return 0;
+
+err:
+	blk_trace_cleanup(bt);
+	return ret;
+}
+
+static int blk_trace_startstop(request_queue_t *q, int start)
+{
+	struct blk_trace *bt = q->blk_trace;
+
+	if (!bt)
+		return -EINVAL;
+
+	if (start) {
+		if (bt->trace_state == Blktrace_running)
+			return -EINVAL;
+		bt->trace_state = Blktrace_running;
+	} else {
+		if (bt->trace_state != Blktrace_running)
+			return -EINVAL;
+		bt->trace_state = Blktrace_stopped;
+		blk_trace_wake_readers(bt);
+	}
+	return 0;
+}
+
+/**
+ * blk_trace_ioctl - handle the BLKTRACE* ioctls
+ * @bdev:	the block device
+ * @cmd:	the ioctl cmd
+ * @arg:	the argument data, if any
+ *
+ * Description:
+ *   The trace belongs to the queue, so it covers every partition of
+ *   the disk whichever of them it was set up through.
+ **/
+int blk_trace_ioctl(struct block_device *bdev, unsigned cmd, char __user *arg)
+{
+	request_queue_t *q = bdev_get_queue(bdev);
+	int ret;
+
+	if (!q)
+		return -ENXIO;
+	if (!capable(CAP_SYS_ADMIN))
+		return -EACCES;
+
+	down(&blk_trace_sem);
+	switch (cmd) {
+	case BLKTRACESETUP:
+		ret = blk_trace_setup(q, bdev, arg);
+		break;
+	case BLKTRACESTART:
+		ret = blk_trace_startstop(q, 1);
+		break;
+	case BLKTRACESTOP:
+		ret = blk_trace_startstop(q, 0);
+		break;
+	case BLKTRACETEARDOWN:
+		ret = blk_trace_remove(q);
+		break;
+	default:
+		ret = -ENOTTY;
+		break;
+	}
+	up(&blk_trace_sem);
+	return ret;
+}
+
+/*
+ * Called from blk_cleanup_queue() when the queue goes away.
+ */
+void blk_trace_shutdown(request_queue_t *q)
+{
+	down(&blk_trace_sem);
+	if (q->blk_trace)
+		blk_trace_remove(q);
+	up(&blk_trace_sem);
+}
@@ -7,6 +7,15 @@
  *  scheduler (round robin per-process disk scheduling) and Andrea Arcangeli.
  *
  *  Copyright (C) 2003 Jens Axboe <axboe@suse.de>
+ *
+ *  Queues are served one at a time, each for a time slice.  The slice
+ *  length and the order of service follow the io priority of the queue
+ *  (see include/linux/ioprio.h): busy realtime queues always go first,
+ *  in order of level; best-effort queues take turns, a slice scaled by
+ *  their level each; idle class queues only get the disk once nobody
+ *  else has used it for a while.  A sync queue that runs dry before its
+ *  slice ends keeps the disk idle for a short while in case the process
+ *  issues another request close by, unless its think time says it won't.
  */
 #include <linux/kernel.h>
 #include <linux/fs.h>
@@ -21,6 +30,7 @@
 #include <linux/hash.h>
 #include <linux/rbtree.h>
 #include <linux/mempool.h>
+#include <linux/ioprio.h>
 
 static unsigned long max_elapsed_crq;
 static unsigned long max_elapsed_dispatch;
@@ -30,13 +40,29 @@ static unsigned long max_elapsed_dispatch;
  */
 static int cfq_quantum = 4;		/* max queue in one round of service */
 static int cfq_queued = 8;		/* minimum rq allocate limit per-queue*/
-static int cfq_service = HZ;		/* period over which service is avg */
 static int cfq_fifo_expire_r = HZ / 2;	/* fifo timeout for sync requests */
 static int cfq_fifo_expire_w = 5 * HZ;	/* fifo timeout for async requests */
 static int cfq_fifo_rate = HZ / 8;	/* fifo expiry rate */
 static int cfq_back_max = 16 * 1024;	/* maximum backwards seek, in KiB */
 static int cfq_back_penalty = 2;	/* penalty of a backwards seek */
 
+static int cfq_slice_sync = HZ / 10;	/* base time slice of a sync queue */
+static int cfq_slice_async = HZ / 25;	/* base time slice of an async queue */
+static int cfq_slice_async_rq = 2;	/* base requests per async slice */
+static int cfq_slice_idle = HZ / 100;	/* wait for a sync queue's next rq */
+
+/*
+ * the slice of level 4 is the base slice, each level up or down adds or
+ * takes 1/CFQ_SLICE_SCALE of it
+ */
+#define CFQ_SLICE_SCALE		(5)
+
+/*
+ * how long the disk must have been left alone by everyone else before
+ * the idle class is served
+ */
+#define CFQ_IDLE_GRACE		(HZ / 10)
+
 /*
  * for the hash of cfqq inside the cfqd
  */
@@ -76,9 +102,11 @@ static int cfq_back_penalty = 2;	/* penalty of a backwards seek */
 #define rq_rb_key(rq)		(rq)->sector
 
 /*
- * threshold for switching off non-tag accounting
+ * busy queues of each class, rr_list[ioprio_class - 1]
  */
-#define CFQ_MAX_TAG		(4)
+#define CFQ_NR_CLASSES		(3)
+#define cfq_class_rt(cfqq)	((cfqq)->ioprio_class == IOPRIO_CLASS_RT)
+#define cfq_class_idle(cfqq)	((cfqq)->ioprio_class == IOPRIO_CLASS_IDLE)
 
 /*
  * sort key types and names
@@ -98,9 +126,22 @@ static kmem_cache_t *cfq_pool;
 static kmem_cache_t *cfq_ioc_pool;
 
 struct cfq_data {
-	struct list_head rr_list;
+	/*
+	 * busy queues waiting for a slice, per class.  the realtime list is
+	 * sorted by level, the others are plain round robin
+	 */
+	struct list_head rr_list[CFQ_NR_CLASSES];
 	struct list_head empty_list;
 
+	/* queue being served, and the timers that move service along */
+	struct cfq_queue *active_queue;
+	struct timer_list idle_slice_timer;
+	struct timer_list idle_class_timer;
+	struct work_struct unplug_work;
+
+	/* last completion of a request not of the idle class */
+	unsigned long last_end_request;
+
 	struct hlist_head *cfq_hash;
 	struct hlist_head *crq_hash;
 
@@ -132,8 +173,9 @@ struct cfq_data {
 	unsigned int cfq_back_penalty;
 	unsigned int cfq_back_max;
 	unsigned int find_best_crq;
-
-	unsigned int cfq_tagged;
+	unsigned int cfq_slice[2];	/* async, sync */
+	unsigned int cfq_slice_async_rq;
+	unsigned int cfq_slice_idle;
 };
 
 struct cfq_queue {
@@ -164,10 +206,24 @@ struct cfq_queue {
 
 	int key_type;
 
-	unsigned long service_start;
-	unsigned long service_used;
-
-	unsigned int max_rate;
+	/* io priority, from the task that allocated the last request */
+	unsigned short ioprio_class;
+	unsigned short ioprio;
+
+	/* jiffies at which the slice ends, 0 until its first dispatch */
+	unsigned long slice_end;
+	/* requests dispatched in this slice */
+	int slice_dispatch;
+	/* slice was started with sync requests queued */
+	unsigned int slice_sync : 1;
+	/* worth idling for the next request when we run dry */
+	unsigned int idle_window : 1;
+
+	/* think time: from completion of one sync request to the next */
+	unsigned long last_end_request;
+	unsigned long ttime_total;
+	unsigned long ttime_samples;
+	unsigned long ttime_mean;
 
 	/* number of requests that have been handed to the driver */
 	int in_flight;
@@ -401,75 +457,38 @@ static void cfq_update_next_crq(struct cfq_rq *crq)
 		cfqq->next_crq = cfq_find_next_crq(cfqq->cfqd, cfqq, crq);
 }
 
-static int cfq_check_sort_rr_list(struct cfq_queue *cfqq)
-{
-	struct list_head *head = &cfqq->cfqd->rr_list;
-	struct list_head *next, *prev;
-
-	/*
-	 * list might still be ordered
-	 */
-	next = cfqq->cfq_list.next;
-	if (next != head) {
-		struct cfq_queue *cnext = list_entry_cfqq(next);
-
-		if (cfqq->service_used > cnext->service_used)
-			return 1;
-	}
-
-	prev = cfqq->cfq_list.prev;
-	if (prev != head) {
-		struct cfq_queue *cprev = list_entry_cfqq(prev);
-
-		if (cfqq->service_used < cprev->service_used)
-			return 1;
-	}
-
-	return 0;
-}
-
-static void cfq_sort_rr_list(struct cfq_queue *cfqq, int new_queue)
+/*
+ * put a busy queue where it waits for its next slice: at the back of its
+ * class, behind the queues of its level and above for realtime, or at
+ * the front if it was preempted so that it gets the disk back first
+ */
+static void cfq_resort_rr_list(struct cfq_queue *cfqq, int preempted)
 {
-	struct list_head *entry = &cfqq->cfqd->rr_list;
-
-	if (!cfqq->on_rr)
-		return;
-	if (!new_queue && !cfq_check_sort_rr_list(cfqq))
-		return;
+	struct cfq_data *cfqd = cfqq->cfqd;
+	struct list_head *list = &cfqd->rr_list[cfqq->ioprio_class - 1];
+	struct list_head *entry = list;
 
 	list_del(&cfqq->cfq_list);
 
-	/*
-	 * sort by our mean service_used, sub-sort by in-flight requests
-	 */
-	while ((entry = entry->prev) != &cfqq->cfqd->rr_list) {
-		struct cfq_queue *__cfqq = list_entry_cfqq(entry);
-
-		if (cfqq->service_used > __cfqq->service_used)
-			break;
-		else if (cfqq->service_used == __cfqq->service_used) {
-			struct list_head *prv;
-
-			while ((prv = entry->prev) != &cfqq->cfqd->rr_list) {
-				__cfqq = list_entry_cfqq(prv);
+	if (preempted) {
+		list_add(&cfqq->cfq_list, list);
+		return;
+	}
 
-				WARN_ON(__cfqq->service_used > cfqq->service_used);
-				if (cfqq->service_used != __cfqq->service_used)
-					break;
-				if (cfqq->in_flight > __cfqq->in_flight)
-					break;
+	if (cfq_class_rt(cfqq)) {
+		while ((entry = entry->prev) != list) {
+			struct cfq_queue *__cfqq = list_entry_cfqq(entry);
 
-				entry = prv;
-			}
+			if (__cfqq->ioprio <= cfqq->ioprio)
+				break;
 		}
-	}
-
-	list_add(&cfqq->cfq_list, entry);
+		list_add(&cfqq->cfq_list, entry);
+	} else
+		list_add_tail(&cfqq->cfq_list, list);
 }
 
 /*
- * add to busy list of queues for service, trying to be fair in ordering
- * the pending list according to requests serviced
+ * add to busy list of queues for service
  */
 static inline void
 cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
@@ -480,10 +499,7 @@ cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	cfqq->on_rr = 1;
 	cfqd->busy_queues++;
 
-	if (time_after(jiffies, cfqq->service_start + cfq_service))
-		cfqq->service_used >>= 3;
-
-	cfq_sort_rr_list(cfqq, 1);
+	cfq_resort_rr_list(cfqq, 0);
 }
 
 static inline void
@@ -608,7 +624,7 @@ out:
 }
 
 /*
- * make sure the service time gets corrected on reissue of this request
+ * make sure the driver accounting gets corrected on reissue of this request
  */
 static void cfq_requeue_request(request_queue_t *q, struct request *rq)
 {
@@ -617,11 +633,6 @@ static void cfq_requeue_request(request_queue_t *q, struct request *rq)
 	if (crq) {
 		struct cfq_queue *cfqq = crq->cfq_queue;
 
-		if (cfqq->cfqd->cfq_tagged) {
-			cfqq->service_used--;
-			cfq_sort_rr_list(cfqq, 0);
-		}
-
 		if (crq->accounted) {
 			crq->accounted = 0;
 			cfqq->cfqd->rq_in_driver--;
@@ -816,46 +827,235 @@ cfq_dispatch_request(request_queue_t *q, struct cfq_data *cfqd,
 	cfq_dispatch_sort(q, crq);
 }
 
+static void cfq_schedule_dispatch(struct cfq_data *cfqd)
+{
+	if (cfqd->busy_queues)
+		kblockd_schedule_work(&cfqd->unplug_work);
+}
+
+/*
+ * kick off dispatch from inside the elevator, queue lock held
+ */
+static inline void cfq_start_queueing(struct cfq_data *cfqd)
+{
+	request_queue_t *q = cfqd->queue;
+
+	blk_remove_plug(q);
+	q->request_fn(q);
+}
+
+static void cfq_kick_queue(void *data)
+{
+	blk_run_queue((request_queue_t *) data);
+}
+
+/*
+ * the slice length of a queue of this level: a sync slice for a queue that
+ * started it with sync requests queued, async otherwise
+ */
+static inline int
+cfq_prio_to_slice(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	const int base_slice = cfqd->cfq_slice[cfqq->slice_sync];
+	/* at HZ=100 the async base slice is only a few jiffies */
+	const int step = max(base_slice / CFQ_SLICE_SCALE, 1);
+
+	return max(base_slice + step * (4 - cfqq->ioprio), 1);
+}
+
+/*
+ * async requests cost the submitter nothing to wait for, so an async slice
+ * is also cut off after this many, fewer at lower priority
+ */
+static inline int
+cfq_prio_to_maxrq(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	const int base_rq = cfqd->cfq_slice_async_rq;
+
+	return 2 * (base_rq + base_rq * (IOPRIO_BE_NR - 1 - cfqq->ioprio));
+}
+
+/*
+ * end the slice of the active queue, which goes back on its rr list if it
+ * still has requests
+ */
+static void cfq_slice_expired(struct cfq_data *cfqd, int preempted)
+{
+	struct cfq_queue *cfqq = cfqd->active_queue;
+
+	if (!cfqq)
+		return;
+
+	del_timer(&cfqd->idle_slice_timer);
+
+	if (cfqq->on_rr)
+		cfq_resort_rr_list(cfqq, preempted);
+
+	cfqd->active_queue = NULL;
+}
+
+/*
+ * pick the queue to serve next: the first realtime queue, else the next
+ * best-effort one, else an idle class one if the disk has been left alone
+ * for long enough
+ */
+static struct cfq_queue *cfq_set_active_queue(struct cfq_data *cfqd)
+{
+	struct cfq_queue *cfqq = NULL;
+	int i;
+
+	for (i = 0; i < CFQ_NR_CLASSES; i++) {
+		if (!list_empty(&cfqd->rr_list[i])) {
+			cfqq = list_entry_cfqq(cfqd->rr_list[i].next);
+			break;
+		}
+	}
+
+	if (cfqq && cfq_class_idle(cfqq)) {
+		unsigned long end = cfqd->last_end_request + CFQ_IDLE_GRACE;
+
+		if (time_before(jiffies, end)) {
+			mod_timer(&cfqd->idle_class_timer, end);
+			cfqq = NULL;
+		}
+	}
+
+	if (cfqq) {
+		cfqq->slice_end = 0;
+		cfqq->slice_dispatch = 0;
+	}
+
+	cfqd->active_queue = cfqq;
+	return cfqq;
+}
+
+/*
+ * the active queue ran dry with its last request completed: wait a little
+ * for the next one rather than seek away to another queue.  returns 1 if
+ * we are waiting
+ */
+static int cfq_arm_slice_timer(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned long end;
+
+	if (!cfqd->cfq_slice_idle || !cfqq->idle_window || !cfqq->slice_sync)
+		return 0;
+
+	end = jiffies + cfqd->cfq_slice_idle;
+	if (cfqq->slice_end && time_after(end, cfqq->slice_end))
+		return 0;
+
+	mod_timer(&cfqd->idle_slice_timer, end);
+	return 1;
+}
+
+/*
+ * the active queue, unless its slice is over; NULL if we are idling
+ */
+static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd)
+{
+	struct cfq_queue *cfqq = cfqd->active_queue;
+
+	if (!cfqq)
+		goto new_queue;
+
+	if (cfqq->slice_end && time_after(jiffies, cfqq->slice_end))
+		goto expire;
+
+	if (!cfqq->slice_sync &&
+	    cfqq->slice_dispatch >= cfq_prio_to_maxrq(cfqd, cfqq))
+		goto expire;
+
+	if (!RB_EMPTY(&cfqq->sort_list))
+		goto keep_queue;
+
+	/*
+	 * out of requests. if we are idling for the next one, or will once
+	 * those in flight complete, don't serve anyone else meanwhile
+	 */
+	if (timer_pending(&cfqd->idle_slice_timer) ||
+	    (cfqq->in_flight && cfqq->idle_window && cfqq->slice_sync &&
+	     cfqd->cfq_slice_idle)) {
+		cfqq = NULL;
+		goto keep_queue;
+	}
+
+expire:
+	cfq_slice_expired(cfqd, 0);
+new_queue:
+	cfqq = cfq_set_active_queue(cfqd);
+keep_queue:
+	return cfqq;
+}
+
+/*
+ * empty every queue onto the dispatch list, slices and idling or not.
+ * for barriers and such, which must see everything before them out.
+ */
+static int cfq_forced_dispatch(struct cfq_data *cfqd)
+{
+	struct cfq_queue *cfqq;
+	int i, dispatched = 0;
+
+	for (i = 0; i < CFQ_NR_CLASSES; i++) {
+		while (!list_empty(&cfqd->rr_list[i])) {
+			cfqq = list_entry_cfqq(cfqd->rr_list[i].next);
+
+			while (!RB_EMPTY(&cfqq->sort_list)) {
+				cfq_dispatch_request(cfqd->queue, cfqd, cfqq);
+				dispatched++;
+			}
+		}
+	}
+
+	cfq_slice_expired(cfqd, 0);
+	del_timer(&cfqd->idle_class_timer);
+
+	return dispatched;
+}
+
 static int cfq_dispatch_requests(request_queue_t *q, int max_dispatch)
 {
 	struct cfq_data *cfqd = q->elevator->elevator_data;
 	struct cfq_queue *cfqq;
-	struct list_head *entry, *tmp;
-	int queued, busy_queues, first_round;
+	int dispatched = 0;
 
-	if (list_empty(&cfqd->rr_list))
+	if (!cfqd->busy_queues)
 		return 0;
 
-	queued = 0;
-	first_round = 1;
-restart:
-	busy_queues = 0;
-	list_for_each_safe(entry, tmp, &cfqd->rr_list) {
-		cfqq = list_entry_cfqq(entry);
-
-		BUG_ON(RB_EMPTY(&cfqq->sort_list));
-
-		/*
-		 * first round of queueing, only select from queues that
-		 * don't already have io in-flight
-		 */
-		if (first_round && cfqq->in_flight)
-			continue;
+	cfqq = cfq_select_queue(cfqd);
+	if (!cfqq)
+		return 0;
 
-		cfq_dispatch_request(q, cfqd, cfqq);
+	/*
+	 * the slice starts with its first request
+	 */
+	if (!cfqq->slice_end) {
+		cfqq->slice_sync = cfqq->queued[1] != 0;
+		cfqq->slice_end = jiffies + cfq_prio_to_slice(cfqd, cfqq);
+	}
 
-		if (!RB_EMPTY(&cfqq->sort_list))
-			busy_queues++;
+	if (!cfqq->slice_sync) {
+		int left = cfq_prio_to_maxrq(cfqd, cfqq) - cfqq->slice_dispatch;
 
-		queued++;
+		if (max_dispatch > left)
+			max_dispatch = left;
 	}
 
-	if ((queued < max_dispatch) && (busy_queues || first_round)) {
-		first_round = 0;
-		goto restart;
+	while (dispatched < max_dispatch && !RB_EMPTY(&cfqq->sort_list)) {
+		cfq_dispatch_request(q, cfqd, cfqq);
+		dispatched++;
 	}
+	cfqq->slice_dispatch += dispatched;
+
+	/*
+	 * the idle class gives the disk back after every batch, so that
+	 * anyone else turning up gets it straight away
+	 */
+	if (cfq_class_idle(cfqq))
+		cfq_slice_expired(cfqd, 0);
 
-	return queued;
+	return dispatched;
 }
 
 static inline void cfq_account_dispatch(struct cfq_rq *crq)
@@ -875,42 +1075,20 @@ static inline void cfq_account_dispatch(struct cfq_rq *crq)
 		return;
 
 	now = jiffies;
-	if (cfqq->service_start == ~0UL)
-		cfqq->service_start = now;
-
-	/*
-	 * on drives with tagged command queueing, command turn-around time
-	 * doesn't necessarily reflect the time spent processing this very
-	 * command inside the drive. so do the accounting differently there,
-	 * by just sorting on the number of requests
-	 */
-	if (cfqd->cfq_tagged) {
-		if (time_after(now, cfqq->service_start + cfq_service)) {
-			cfqq->service_start = now;
-			cfqq->service_used /= 10;
-		}
-
-		cfqq->service_used++;
-		cfq_sort_rr_list(cfqq, 0);
-	}
-
 	elapsed = now - crq->queue_start;
 	if (elapsed > max_elapsed_dispatch)
 		max_elapsed_dispatch = elapsed;
 
 	crq->accounted = 1;
 	crq->service_start = now;
-
-	if (++cfqd->rq_in_driver >= CFQ_MAX_TAG && !cfqd->cfq_tagged) {
-		cfqq->cfqd->cfq_tagged = 1;
-		printk("cfq: depth %d reached, tagging now on\n", CFQ_MAX_TAG);
-	}
+	cfqd->rq_in_driver++;
 }
 
 static inline void
 cfq_account_completion(struct cfq_queue *cfqq, struct cfq_rq *crq)
 {
 	struct cfq_data *cfqd = cfqq->cfqd;
+	unsigned long duration;
 
 	if (!crq->accounted)
 		return;
@@ -918,21 +1096,9 @@ cfq_account_completion(struct cfq_queue *cfqq, struct cfq_rq *crq)
 	WARN_ON(!cfqd->rq_in_driver);
 	cfqd->rq_in_driver--;
 
-	if (!cfqd->cfq_tagged) {
-		unsigned long now = jiffies;
-		unsigned long duration = now - crq->service_start;
-
-		if (time_after(now, cfqq->service_start + cfq_service)) {
-			cfqq->service_start = now;
-			cfqq->service_used >>= 3;
-		}
-
-		cfqq->service_used += duration;
-		cfq_sort_rr_list(cfqq, 0);
-
-		if (duration > max_elapsed_crq)
-			max_elapsed_crq = duration;
-	}
+	duration = jiffies - crq->service_start;
+	if (duration > max_elapsed_crq)
+		max_elapsed_crq = duration;
 }
 
 static struct request *cfq_next_request(request_queue_t *q)
@@ -967,6 +1133,8 @@ dispatch:
  */
 static void cfq_put_queue(struct cfq_queue *cfqq)
 {
+	struct cfq_data *cfqd = cfqq->cfqd;
+
 	BUG_ON(!atomic_read(&cfqq->ref));
 
 	if (!atomic_dec_and_test(&cfqq->ref))
@@ -975,7 +1143,16 @@ static void cfq_put_queue(struct cfq_queue *cfqq)
 	BUG_ON(rb_first(&cfqq->sort_list));
 	BUG_ON(cfqq->on_rr);
 
-	cfq_put_cfqd(cfqq->cfqd);
+	/*
+	 * an empty queue may still own the slice, idling for a request
+	 * that will now never come
+	 */
+	if (unlikely(cfqd->active_queue == cfqq)) {
+		cfq_slice_expired(cfqd, 0);
+		cfq_schedule_dispatch(cfqd);
+	}
+
+	cfq_put_cfqd(cfqd);
 
 	/*
 	 * it's on the empty list and still hashed
@@ -1219,7 +1396,10 @@ retry:
 		cfqq->cfqd = cfqd;
 		atomic_inc(&cfqd->ref);
 		cfqq->key_type = cfqd->key_type;
-		cfqq->service_start = ~0UL;
+		cfqq->ioprio_class = IOPRIO_CLASS_BE;
+		cfqq->ioprio = 4;
+		cfqq->idle_window = 1;
+		cfqq->last_end_request = jiffies;
 	}
 
 	if (new_cfqq)
@@ -1231,6 +1411,98 @@ out:
 	return cfqq;
 }
 
+/*
+ * set the io priority of a queue to that of the task allocating a
+ * request for it, moving it to the right rr list if that changed
+ */
+static void
+cfq_update_prio(struct cfq_data *cfqd, struct cfq_queue *cfqq, int ioprio)
+{
+	unsigned short ioprio_class = IOPRIO_PRIO_CLASS(ioprio);
+	unsigned short data = IOPRIO_PRIO_DATA(ioprio);
+
+	/*
+	 * the idle class has no levels, it is served below everyone
+	 */
+	if (ioprio_class == IOPRIO_CLASS_IDLE)
+		data = IOPRIO_BE_NR - 1;
+
+	if (cfqq->ioprio_class == ioprio_class && cfqq->ioprio == data)
+		return;
+
+	cfqq->ioprio_class = ioprio_class;
+	cfqq->ioprio = data;
+
+	if (cfqq->on_rr && cfqq != cfqd->active_queue)
+		cfq_resort_rr_list(cfqq, 0);
+}
+
+/*
+ * keep a decaying average of the time from the completion of one sync
+ * request of the queue to the arrival of the next one
+ */
+static void
+cfq_update_io_thinktime(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned long ttime = jiffies - cfqq->last_end_request;
+
+	ttime = min(ttime, 2UL * cfqd->cfq_slice_idle);
+
+	cfqq->ttime_samples = (7 * cfqq->ttime_samples + 256) / 8;
+	cfqq->ttime_total = (7 * cfqq->ttime_total + 256 * ttime) / 8;
+	cfqq->ttime_mean = (cfqq->ttime_total + 128) / cfqq->ttime_samples;
+}
+
+/*
+ * idling is only worth it if the next request usually arrives within
+ * the idle time, and never for the idle class
+ */
+static void
+cfq_update_idle_window(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	int enable_idle = 1;
+
+	if (cfq_class_idle(cfqq) || !cfqd->cfq_slice_idle)
+		enable_idle = 0;
+	else if (cfqq->ttime_mean > cfqd->cfq_slice_idle)
+		enable_idle = 0;
+
+	cfqq->idle_window = enable_idle;
+}
+
+/*
+ * should the new request of cfqq take the disk from the active queue?
+ * a higher class always does, a sync request of the same class does
+ * from an async slice
+ */
+static int
+cfq_should_preempt(struct cfq_data *cfqd, struct cfq_queue *new_cfqq,
+		   struct cfq_rq *crq)
+{
+	struct cfq_queue *cfqq = cfqd->active_queue;
+
+	if (!cfqq)
+		return 0;
+	if (new_cfqq->ioprio_class < cfqq->ioprio_class)
+		return 1;
+	if (new_cfqq->ioprio_class > cfqq->ioprio_class)
+		return 0;
+	if (crq->is_sync && cfqq->slice_end && !cfqq->slice_sync)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * the active queue goes back to the front of its list, new_cfqq in
+ * front of it to be picked next
+ */
+static void cfq_preempt_queue(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	cfq_slice_expired(cfqd, 1);
+	cfq_resort_rr_list(cfqq, 1);
+}
+
 static void cfq_enqueue(struct cfq_data *cfqd, struct cfq_rq *crq)
 {
 	crq->is_sync = 0;
@@ -1243,6 +1515,34 @@ static void cfq_enqueue(struct cfq_data *cfqd, struct cfq_rq *crq)
 	list_add_tail(&crq->request->queuelist, &crq->cfq_queue->fifo[crq->is_sync]);
 }
 
+/*
+ * a new request was sorted in and hashed: start dispatch at once if it
+ * is the one we were idling for, or if it takes the disk from the active
+ * queue
+ */
+static void cfq_crq_enqueued(struct cfq_data *cfqd, struct cfq_rq *crq)
+{
+	struct cfq_queue *cfqq = crq->cfq_queue;
+
+	if (crq->is_sync) {
+		cfq_update_io_thinktime(cfqd, cfqq);
+		cfq_update_idle_window(cfqd, cfqq);
+	}
+
+	if (cfqq == cfqd->active_queue) {
+		/*
+		 * the request we were idling for, start it now
+		 */
+		if (timer_pending(&cfqd->idle_slice_timer)) {
+			del_timer(&cfqd->idle_slice_timer);
+			cfq_start_queueing(cfqd);
+		}
+	} else if (cfq_should_preempt(cfqd, cfqq, crq)) {
+		cfq_preempt_queue(cfqd, cfqq);
+		cfq_start_queueing(cfqd);
+	}
+}
+
 static void
 cfq_insert_request(request_queue_t *q, struct request *rq, int where)
 {
@@ -1251,8 +1551,7 @@ cfq_insert_request(request_queue_t *q, struct request *rq, int where)
 
 	switch (where) {
 		case ELEVATOR_INSERT_BACK:
-			while (cfq_dispatch_requests(q, cfqd->cfq_quantum))
-				;
+			cfq_forced_dispatch(cfqd);
 			list_add_tail(&rq->queuelist, &q->queue_head);
 			break;
 		case ELEVATOR_INSERT_FRONT:
@@ -1273,24 +1572,31 @@ cfq_insert_request(request_queue_t *q, struct request *rq, int where)
 		if (!q->last_merge)
 			q->last_merge = rq;
 	}
+
+	if (where == ELEVATOR_INSERT_SORT)
+		cfq_crq_enqueued(cfqd, crq);
 }
 
 static int cfq_queue_empty(request_queue_t *q)
 {
 	struct cfq_data *cfqd = q->elevator->elevator_data;
 
-	return list_empty(&q->queue_head) && list_empty(&cfqd->rr_list);
+	return list_empty(&q->queue_head) && !cfqd->busy_queues;
 }
 
 static void cfq_completed_request(request_queue_t *q, struct request *rq)
 {
 	struct cfq_rq *crq = RQ_DATA(rq);
+	struct cfq_data *cfqd;
 	struct cfq_queue *cfqq;
+	unsigned long now;
 
 	if (unlikely(!blk_fs_request(rq)))
 		return;
 
 	cfqq = crq->cfq_queue;
+	cfqd = cfqq->cfqd;
+	now = jiffies;
 
 	if (crq->in_flight) {
 		WARN_ON(!cfqq->in_flight);
@@ -1298,6 +1604,22 @@ static void cfq_completed_request(request_queue_t *q, struct request *rq)
 	}
 
 	cfq_account_completion(cfqq, crq);
+
+	if (!cfq_class_idle(cfqq))
+		cfqd->last_end_request = now;
+	if (crq->is_sync)
+		cfqq->last_end_request = now;
+
+	/*
+	 * the active queue has nothing left queued or in flight: wait for
+	 * its next request, or move on to the next queue
+	 */
+	if (cfqd->active_queue == cfqq && RB_EMPTY(&cfqq->sort_list) &&
+	    !cfqq->in_flight && cfq_arm_slice_timer(cfqd, cfqq))
+		return;
+
+	if (!cfqd->rq_in_driver)
+		cfq_schedule_dispatch(cfqd);
 }
 
 static struct request *
@@ -1420,6 +1742,8 @@ static int cfq_set_request(request_queue_t *q, struct request *rq, int gfp_mask)
 	if (!cfqq)
 		goto out_lock;
 
+	cfq_update_prio(cfqd, cfqq, task_ioprio(current));
+
 repeat:
 	if (cfqq->allocated[rw] >= cfqd->max_queued)
 		goto out_lock;
@@ -1485,9 +1809,51 @@ static void cfq_put_cfqd(struct cfq_data *cfqd)
 	kfree(cfqd);
 }
 
+static void cfq_shutdown_timer_wq(struct cfq_data *cfqd)
+{
+	del_timer_sync(&cfqd->idle_slice_timer);
+	del_timer_sync(&cfqd->idle_class_timer);
+	kblockd_flush();
+}
+
 static void cfq_exit_queue(elevator_t *e)
 {
-	cfq_put_cfqd(e->elevator_data);
+	struct cfq_data *cfqd = e->elevator_data;
+
+	cfq_shutdown_timer_wq(cfqd);
+	cfq_put_cfqd(cfqd);
+}
+
+/*
+ * the active queue idled for its next request in vain, move on
+ */
+static void cfq_idle_slice_timer(unsigned long data)
+{
+	struct cfq_data *cfqd = (struct cfq_data *) data;
+	struct cfq_queue *cfqq;
+	unsigned long flags;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+
+	cfqq = cfqd->active_queue;
+	if (cfqq && RB_EMPTY(&cfqq->sort_list))
+		cfq_slice_expired(cfqd, 0);
+
+	cfq_schedule_dispatch(cfqd);
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
+}
+
+/*
+ * the disk has been left alone for long enough, let the idle class in
+ */
+static void cfq_idle_class_timer(unsigned long data)
+{
+	struct cfq_data *cfqd = (struct cfq_data *) data;
+	unsigned long flags;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+	cfq_schedule_dispatch(cfqd);
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
 }
 
 static int cfq_init_queue(request_queue_t *q, elevator_t *e)
@@ -1500,7 +1866,8 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 		return -ENOMEM;
 
 	memset(cfqd, 0, sizeof(*cfqd));
-	INIT_LIST_HEAD(&cfqd->rr_list);
+	for (i = 0; i < CFQ_NR_CLASSES; i++)
+		INIT_LIST_HEAD(&cfqd->rr_list[i]);
 	INIT_LIST_HEAD(&cfqd->empty_list);
 
 	cfqd->crq_hash = kmalloc(sizeof(struct hlist_head) * CFQ_MHASH_ENTRIES, GFP_KERNEL);
@@ -1525,6 +1892,16 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->queue = q;
 	atomic_inc(&q->refcnt);
 
+	init_timer(&cfqd->idle_slice_timer);
+	cfqd->idle_slice_timer.function = cfq_idle_slice_timer;
+	cfqd->idle_slice_timer.data = (unsigned long) cfqd;
+
+	init_timer(&cfqd->idle_class_timer);
+	cfqd->idle_class_timer.function = cfq_idle_class_timer;
+	cfqd->idle_class_timer.data = (unsigned long) cfqd;
+
+	INIT_WORK(&cfqd->unplug_work, cfq_kick_queue, q);
+
 	/*
 	 * just set it to some high value, we want anyone to be able to queue
 	 * some requests. fairness is handled differently
@@ -1535,6 +1912,11 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->key_type = CFQ_KEY_TGID;
 	cfqd->find_best_crq = 1;
 	atomic_set(&cfqd->ref, 1);
+	/*
+	 * jiffies starts out just short of wrapping: left at 0 this would
+	 * look like a recent completion and hold idle-class I/O back
+	 */
+	cfqd->last_end_request = jiffies;
 
 	cfqd->cfq_queued = cfq_queued;
 	cfqd->cfq_quantum = cfq_quantum;
@@ -1543,6 +1925,10 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->cfq_fifo_batch_expire = cfq_fifo_rate;
 	cfqd->cfq_back_max = cfq_back_max;
 	cfqd->cfq_back_penalty = cfq_back_penalty;
+	cfqd->cfq_slice[0] = cfq_slice_async;
+	cfqd->cfq_slice[1] = cfq_slice_sync;
+	cfqd->cfq_slice_async_rq = cfq_slice_async_rq;
+	cfqd->cfq_slice_idle = cfq_slice_idle;
 
 	return 0;
 out_crqpool:
@@ -1667,6 +2053,10 @@ SHOW_FUNCTION(cfq_fifo_batch_expire_show, cfqd->cfq_fifo_batch_expire, 1);
 SHOW_FUNCTION(cfq_find_best_show, cfqd->find_best_crq, 0);
 SHOW_FUNCTION(cfq_back_max_show, cfqd->cfq_back_max, 0);
 SHOW_FUNCTION(cfq_back_penalty_show, cfqd->cfq_back_penalty, 0);
+SHOW_FUNCTION(cfq_slice_sync_show, cfqd->cfq_slice[1], 1);
+SHOW_FUNCTION(cfq_slice_async_show, cfqd->cfq_slice[0], 1);
+SHOW_FUNCTION(cfq_slice_async_rq_show, cfqd->cfq_slice_async_rq, 0);
+SHOW_FUNCTION(cfq_slice_idle_show, cfqd->cfq_slice_idle, 1);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -1692,6 +2082,10 @@ STORE_FUNCTION(cfq_fifo_batch_expire_store, &cfqd->cfq_fifo_batch_expire, 0, UIN
 STORE_FUNCTION(cfq_find_best_store, &cfqd->find_best_crq, 0, 1, 0);
 STORE_FUNCTION(cfq_back_max_store, &cfqd->cfq_back_max, 0, UINT_MAX, 0);
 STORE_FUNCTION(cfq_back_penalty_store, &cfqd->cfq_back_penalty, 1, UINT_MAX, 0);
+STORE_FUNCTION(cfq_slice_sync_store, &cfqd->cfq_slice[1], 1, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_async_store, &cfqd->cfq_slice[0], 1, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_async_rq_store, &cfqd->cfq_slice_async_rq, 1, UINT_MAX, 0);
+STORE_FUNCTION(cfq_slice_idle_store, &cfqd->cfq_slice_idle, 0, UINT_MAX, 1);
 #undef STORE_FUNCTION
 
 static struct cfq_fs_entry cfq_quantum_entry = {
@@ -1734,6 +2128,26 @@ static struct cfq_fs_entry cfq_back_penalty_entry = {
 	.show = cfq_back_penalty_show,
 	.store = cfq_back_penalty_store,
 };
+static struct cfq_fs_entry cfq_slice_sync_entry = {
+	.attr = {.name = "slice_sync", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_sync_show,
+	.store = cfq_slice_sync_store,
+};
+static struct cfq_fs_entry cfq_slice_async_entry = {
+	.attr = {.name = "slice_async", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_async_show,
+	.store = cfq_slice_async_store,
+};
+static struct cfq_fs_entry cfq_slice_async_rq_entry = {
+	.attr = {.name = "slice_async_rq", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_async_rq_show,
+	.store = cfq_slice_async_rq_store,
+};
+static struct cfq_fs_entry cfq_slice_idle_entry = {
+	.attr = {.name = "slice_idle", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_idle_show,
+	.store = cfq_slice_idle_store,
+};
 static struct cfq_fs_entry cfq_clear_elapsed_entry = {
 	.attr = {.name = "clear_elapsed", .mode = S_IWUSR },
 	.store = cfq_clear_elapsed,
@@ -1754,6 +2168,10 @@ static struct attribute *default_attrs[] = {
 	&cfq_find_best_entry.attr,
 	&cfq_back_max_entry.attr,
 	&cfq_back_penalty_entry.attr,
+	&cfq_slice_sync_entry.attr,
+	&cfq_slice_async_entry.attr,
+	&cfq_slice_async_rq_entry.attr,
+	&cfq_slice_idle_entry.attr,
 	&cfq_clear_elapsed_entry.attr,
 	NULL,
 };
@@ -15,7 +15,6 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/compiler.h>
-#include <linux/hash.h>
 #include <linux/rbtree.h>
 
 /*
@@ -27,13 +26,18 @@ static int writes_starved = 2;    /* max times reads can starve a write */
 static int fifo_batch = 16;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
 
-static const int deadline_hash_shift = 5;
-#define DL_HASH_BLOCK(sec)	((sec) >> 3)
-#define DL_HASH_FN(sec)		(hash_long(DL_HASH_BLOCK((sec)), deadline_hash_shift))
-#define DL_HASH_ENTRIES		(1 << deadline_hash_shift)
-#define rq_hash_key(rq)		((rq)->sector + (rq)->nr_sectors)
-#define list_entry_hash(ptr)	list_entry((ptr), struct deadline_rq, hash)
-#define ON_HASH(drq)		(drq)->on_hash
+/*
+ * counters shown in the "stats" attribute
+ */
+struct deadline_stats {
+	unsigned long batches;		/* new batches started */
+	unsigned long dispatched;	/* requests moved to the dispatch queue */
+	unsigned long expired[2];	/* batches started on an expired request */
+	unsigned long starved[2];	/* batches of the other direction started
+					   while these were waiting */
+	unsigned long back_merges;
+	unsigned long front_merges;
+};
 
 /* ޵㷨˽ */
 struct deadline_data {
@@ -54,7 +58,6 @@ struct deadline_data {
 	 */
 	struct deadline_rq *next_drq[2];
 	struct list_head *dispatch;	/* driver dispatch queue */
-	struct list_head *hash;		/* request hash */
 	/* ǰύĿֻҪСfifo_batchͿԽύ */
 	unsigned int batching;		/* number of sequential requests made */
 	/* ʵδãҪַĽ */
@@ -74,6 +77,8 @@ struct deadline_data {
 	int front_merges;
 
 	mempool_t *drq_pool;
+
+	struct deadline_stats stats;
 };
 
 /*
@@ -88,12 +93,6 @@ struct deadline_rq {
 
 	struct request *request;
 
-	/*
-	 * request hash, key is the ending offset (for back merge lookup)
-	 */
-	struct list_head hash;
-	char on_hash;
-
 	/*
 	 * expire fifo
 	 */
@@ -107,82 +106,13 @@ static kmem_cache_t *drq_pool;
 
 #define RQ_DATA(rq)	((struct deadline_rq *) (rq)->elevator_private)
 
-/*
- * the back merge hash support functions
- */
-static inline void __deadline_del_drq_hash(struct deadline_rq *drq)
-{
-	drq->on_hash = 0;
-	list_del_init(&drq->hash);
-}
-
-static inline void deadline_del_drq_hash(struct deadline_rq *drq)
-{
-	if (ON_HASH(drq))
-		__deadline_del_drq_hash(drq);
-}
-
-static void
+static inline void
 deadline_remove_merge_hints(request_queue_t *q, struct deadline_rq *drq)
 {
-	deadline_del_drq_hash(drq);
-
 	if (q->last_merge == drq->request)
 		q->last_merge = NULL;
 }
 
-static inline void
-deadline_add_drq_hash(struct deadline_data *dd, struct deadline_rq *drq)
-{
-	struct request *rq = drq->request;
-
-	BUG_ON(ON_HASH(drq));
-
-	drq->on_hash = 1;
-	list_add(&drq->hash, &dd->hash[DL_HASH_FN(rq_hash_key(rq))]);
-}
-
-/*
- * move hot entry to front of chain
- */
-static inline void
-deadline_hot_drq_hash(struct deadline_data *dd, struct deadline_rq *drq)
-{
-	struct request *rq = drq->request;
-	struct list_head *head = &dd->hash[DL_HASH_FN(rq_hash_key(rq))];
-
-	if (ON_HASH(drq) && drq->hash.prev != head) {
-		list_del(&drq->hash);
-		list_add(&drq->hash, head);
-	}
-}
-
-static struct request *
-deadline_find_drq_hash(struct deadline_data *dd, sector_t offset)
-{
-	struct list_head *hash_list = &dd->hash[DL_HASH_FN(offset)];
-	struct list_head *entry, *next = hash_list->next;
-
-	while ((entry = next) != hash_list) {
-		struct deadline_rq *drq = list_entry_hash(entry);
-		struct request *__rq = drq->request;
-
-		next = entry->next;
-		
-		BUG_ON(!ON_HASH(drq));
-
-		if (!rq_mergeable(__rq)) {
-			__deadline_del_drq_hash(drq);
-			continue;
-		}
-
-		if (rq_hash_key(__rq) == offset)
-			return __rq;
-	}
-
-	return NULL;
-}
-
 /*
  * rb tree support functions
  */
@@ -274,6 +204,34 @@ deadline_find_drq_rb(struct deadline_data *dd, sector_t sector, int data_dir)
 	return NULL;
 }
 
+/*
+ * find the request ending at offset, for a back merge. Only the request
+ * starting closest below offset is looked at: a longer one overlapping it
+ * that happens to end at offset too is missed, which costs a merge but is
+ * never wrong.
+ */
+static struct request *
+deadline_find_drq_end(struct deadline_data *dd, sector_t offset, int data_dir)
+{
+	struct rb_node *n = dd->sort_list[data_dir].rb_node;
+	struct deadline_rq *drq, *prev = NULL;
+
+	while (n) {
+		drq = rb_entry_drq(n);
+
+		if (drq->rb_key < offset) {
+			prev = drq;
+			n = n->rb_right;
+		} else
+			n = n->rb_left;
+	}
+
+	if (prev && prev->rb_key + prev->request->nr_sectors == offset)
+		return prev->request;
+
+	return NULL;
+}
+
 /*
  * deadline_find_first_drq finds the first (lowest sector numbered) request
  * for the specified data_dir. Used to sweep back to the start of the disk
@@ -312,16 +270,12 @@ deadline_add_request(struct request_queue *q, struct request *rq)
 	drq->expires = jiffies + dd->fifo_expire[data_dir];/* ʱʱ-deadline */
 	list_add_tail(&drq->fifo, &dd->fifo_list[data_dir]);/* ӵFIFO */
 
-	if (rq_mergeable(rq)) {
-		deadline_add_drq_hash(dd, drq);
-
-		if (!q->last_merge)
-			q->last_merge = rq;
-	}
+	if (rq_mergeable(rq) && !q->last_merge)
+		q->last_merge = rq;
 }
 
 /*
- * remove rq from rbtree, fifo, and hash
+ * remove rq from rbtree and fifo
  */
 static void deadline_remove_request(request_queue_t *q, struct request *rq)
 {
@@ -345,18 +299,18 @@ deadline_merge(request_queue_t *q, struct request **req, struct bio *bio)
 	int ret;
 
 	/*
-	 * try last_merge to avoid going to hash
+	 * try last_merge to avoid the rbtree lookups
 	 */
-	ret = elv_try_last_merge(q, bio);/* ȳϴκϲĿкϲhash */
+	ret = elv_try_last_merge(q, bio);/* ȳϴκϲĿкϲҺ */
 	if (ret != ELEVATOR_NO_MERGE) {/* ϴεĿ˺ϲ */
 		__rq = q->last_merge;
 		goto out_insert;
 	}
 
 	/*
-	 * see if the merge hash can satisfy a back merge
+	 * see if the sort list can satisfy a back merge
 	 */
-	__rq = deadline_find_drq_hash(dd, bio->bi_sector);/* ϲǰϲĳĺ */
+	__rq = deadline_find_drq_end(dd, bio->bi_sector, bio_data_dir(bio));/* ϲǰϲĳĺ */
 	if (__rq) {/* ǰĳĺ */
 		BUG_ON(__rq->sector + __rq->nr_sectors != bio->bi_sector);
 
@@ -389,8 +343,6 @@ deadline_merge(request_queue_t *q, struct request **req, struct bio *bio)
 out:
 	q->last_merge = __rq;/* ¼һκϲһεҲϲ */
 out_insert:
-	if (ret)
-		deadline_hot_drq_hash(dd, RQ_DATA(__rq));
 	*req = __rq;
 	return ret;
 }
@@ -400,19 +352,15 @@ static void deadline_merged_request(request_queue_t *q, struct request *req)
 	struct deadline_data *dd = q->elevator->elevator_data;
 	struct deadline_rq *drq = RQ_DATA(req);
 
-	/*
-	 * hash always needs to be repositioned, key is end sector
-	 */
-	deadline_del_drq_hash(drq);
-	deadline_add_drq_hash(dd, drq);
-
 	/*
 	 * if the merge was a front merge, we need to reposition request
 	 */
 	if (rq_rb_key(req) != drq->rb_key) {
 		deadline_del_drq_rb(dd, drq);
 		deadline_add_drq_rb(dd, drq);
-	}
+		dd->stats.front_merges++;
+	} else
+		dd->stats.back_merges++;
 
 	q->last_merge = req;
 }
@@ -429,12 +377,9 @@ deadline_merged_requests(request_queue_t *q, struct request *req,
 	BUG_ON(!dnext);
 
 	/*
-	 * reposition drq (this is the merged request) in hash, and in rbtree
-	 * in case of a front merge
+	 * reposition drq (this is the merged request) in rbtree in case of
+	 * a front merge
 	 */
-	deadline_del_drq_hash(drq);
-	deadline_add_drq_hash(dd, drq);
-
 	if (rq_rb_key(req) != drq->rb_key) {
 		deadline_del_drq_rb(dd, drq);
 		deadline_add_drq_rb(dd, drq);
@@ -491,6 +436,7 @@ deadline_move_request(struct deadline_data *dd, struct deadline_rq *drq)
 	 * to dispatch queue
 	 */
 	deadline_move_to_dispatch(dd, drq);
+	dd->stats.dispatched++;
 }
 
 #define list_entry_fifo(ptr)	list_entry((ptr), struct deadline_rq, fifo)
@@ -587,9 +533,14 @@ dispatch_find_request:
 	/*
 	 * we are not running a batch, find best request for selected data_dir
 	 */
+	dd->stats.batches++;
+	if (!list_empty(&dd->fifo_list[other_dir]))
+		dd->stats.starved[other_dir]++;
+
 	if (deadline_check_fifo(dd, data_dir)) {/* FIFOǷй󣬻ߵѾͷҲFIFOȡһ */
 		/* An expired request exists - satisfy it */
 		dd->batching = 0;
+		dd->stats.expired[data_dir]++;
 		drq = list_entry_fifo(dd->fifo_list[data_dir].next);/* ȡFIFOеһ */
 		
 	} else if (dd->next_drq[data_dir]) {
@@ -711,7 +662,6 @@ static void deadline_exit_queue(elevator_t *e)
 	BUG_ON(!list_empty(&dd->fifo_list[WRITE]));
 
 	mempool_destroy(dd->drq_pool);
-	kfree(dd->hash);
 	kfree(dd);
 }
 
@@ -722,7 +672,6 @@ static void deadline_exit_queue(elevator_t *e)
 static int deadline_init_queue(request_queue_t *q, elevator_t *e)
 {
 	struct deadline_data *dd;
-	int i;
 
 	if (!drq_pool)
 		return -ENOMEM;
@@ -732,22 +681,12 @@ static int deadline_init_queue(request_queue_t *q, elevator_t *e)
 		return -ENOMEM;
 	memset(dd, 0, sizeof(*dd));
 
-	dd->hash = kmalloc(sizeof(struct list_head)*DL_HASH_ENTRIES,GFP_KERNEL);
-	if (!dd->hash) {
-		kfree(dd);
-		return -ENOMEM;
-	}
-
 	dd->drq_pool = mempool_create(BLKDEV_MIN_RQ, mempool_alloc_slab, mempool_free_slab, drq_pool);
 	if (!dd->drq_pool) {
-		kfree(dd->hash);
 		kfree(dd);
 		return -ENOMEM;
 	}
 
-	for (i = 0; i < DL_HASH_ENTRIES; i++)
-		INIT_LIST_HEAD(&dd->hash[i]);
-
 	INIT_LIST_HEAD(&dd->fifo_list[READ]);
 	INIT_LIST_HEAD(&dd->fifo_list[WRITE]);
 	dd->sort_list[READ] = RB_ROOT;
@@ -785,9 +724,6 @@ deadline_set_request(request_queue_t *q, struct request *rq, int gfp_mask)
 		RB_CLEAR(&drq->rb_node);
 		drq->request = rq;
 
-		INIT_LIST_HEAD(&drq->hash);
-		drq->on_hash = 0;
-
 		INIT_LIST_HEAD(&drq->fifo);
 
 		rq->elevator_private = drq;
@@ -858,6 +794,30 @@ STORE_FUNCTION(deadline_frontmerges_store, &dd->front_merges, 0, 1, 0);
 STORE_FUNCTION(deadline_fifobatch_store, &dd->fifo_batch, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+static ssize_t deadline_stats_show(struct deadline_data *dd, char *page)
+{
+	struct deadline_stats *st = &dd->stats;
+	unsigned long avg = 0, frac = 0;
+	int pos = 0;
+
+	if (st->batches) {
+		avg = st->dispatched / st->batches;
+		frac = (st->dispatched % st->batches) * 100 / st->batches;
+	}
+
+	pos += sprintf(page+pos, "batches %lu\n", st->batches);
+	pos += sprintf(page+pos, "dispatched %lu\n", st->dispatched);
+	pos += sprintf(page+pos, "avg_batch %lu.%02lu\n", avg, frac);
+	pos += sprintf(page+pos, "read_expired %lu\n", st->expired[READ]);
+	pos += sprintf(page+pos, "write_expired %lu\n", st->expired[WRITE]);
+	pos += sprintf(page+pos, "read_starved %lu\n", st->starved[READ]);
+	pos += sprintf(page+pos, "write_starved %lu\n", st->starved[WRITE]);
+	pos += sprintf(page+pos, "back_merges %lu\n", st->back_merges);
+	pos += sprintf(page+pos, "front_merges %lu\n", st->front_merges);
+
+	return pos;
+}
+
 static struct deadline_fs_entry deadline_readexpire_entry = {
 	.attr = {.name = "read_expire", .mode = S_IRUGO | S_IWUSR },
 	.show = deadline_readexpire_show,
@@ -883,6 +843,10 @@ static struct deadline_fs_entry deadline_fifobatch_entry = {
 	.show = deadline_fifobatch_show,
 	.store = deadline_fifobatch_store,
 };
+static struct deadline_fs_entry deadline_stats_entry = {
+	.attr = {.name = "stats", .mode = S_IRUGO },
+	.show = deadline_stats_show,
+};
 
 static struct attribute *default_attrs[] = {
 	&deadline_readexpire_entry.attr,
@@ -890,6 +854,7 @@ static struct attribute *default_attrs[] = {
 	&deadline_writesstarved_entry.attr,
 	&deadline_frontmerges_entry.attr,
 	&deadline_fifobatch_entry.attr,
+	&deadline_stats_entry.attr,
 	NULL,
 };
 
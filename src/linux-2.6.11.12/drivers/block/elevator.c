@@ -34,6 +34,7 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/compiler.h>
+#include <linux/blktrace.h>
 
 #include <asm/uaccess.h>
 
@@ -349,6 +350,8 @@ struct request *elv_next_request(request_queue_t *q)
 		 * that has been delayed should not be passed by new incoming
 		 * requests
 		 */
+		if (!(rq->flags & REQ_STARTED))
+			blk_add_trace_rq(q, rq, BLK_TA_ISSUE);
 		rq->flags |= REQ_STARTED;/* Ӷȡٿ󣬱ӵ */
 
 		if (rq == q->last_merge)/* ǰǶе߽(IO) */
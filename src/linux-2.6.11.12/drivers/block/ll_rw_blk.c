@@ -18,6 +18,8 @@
 #include <linux/backing-dev.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/blktrace.h>
 #include <linux/highmem.h>
 #include <linux/mm.h>
 #include <linux/kernel_stat.h>
@@ -1287,8 +1289,10 @@ void blk_plug_device(request_queue_t *q)
 	 * queue_flagsֶеQUEUE_FLAG_PLUGGED.
 	 * Ȼunplug_timerֶеǶ̬ʱ
 	 */
-	if (!test_and_set_bit(QUEUE_FLAG_PLUGGED, &q->queue_flags))
+	if (!test_and_set_bit(QUEUE_FLAG_PLUGGED, &q->queue_flags)) {
 		mod_timer(&q->unplug_timer, jiffies + q->unplug_delay);
+		blk_add_trace_generic(q, BLK_TA_PLUG);
+	}
 }
 
 EXPORT_SYMBOL(blk_plug_device);
@@ -1381,8 +1385,10 @@ static void blk_backing_dev_unplug(struct backing_dev_info *bdi,
 	/*
 	 * devices don't necessarily have an ->unplug_fn defined
 	 */
-	if (q->unplug_fn)
+	if (q->unplug_fn) {
+		blk_add_trace_generic(q, BLK_TA_UNPLUG_IO);
 		q->unplug_fn(q);
+	}
 }
 
 /**
@@ -1406,6 +1412,8 @@ static void blk_unplug_timeout(unsigned long data)
 {
 	request_queue_t *q = (request_queue_t *)data;
 
+	blk_add_trace_generic(q, BLK_TA_UNPLUG_TIMER);
+
 	/**
 	 * ں߳kblockdĹkblockd_workqueue
 	 * kblockdִblk_unplug_workq->unplug_workС
@@ -1507,6 +1515,18 @@ void blk_run_queue(struct request_queue *q)
 }
 EXPORT_SYMBOL(blk_run_queue);
 
+/*
+ * Start a queue that has just been given requests, plugged or not.
+ * Queue lock must be held.
+ */
+static void __blk_run_queue(request_queue_t *q)
+{
+	blk_remove_plug(q);
+	if (!test_bit(QUEUE_FLAG_STOPPED, &q->queue_flags) &&
+	    elv_next_request(q))
+		q->request_fn(q);
+}
+
 /**
  * blk_cleanup_queue: - release a &request_queue_t when it is no longer needed
  * @q:    the request queue to be released
@@ -1532,6 +1552,11 @@ void blk_cleanup_queue(request_queue_t * q)
 	if (!atomic_dec_and_test(&q->refcnt))
 		return;
 
+	blk_trace_shutdown(q);
+
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
 	if (q->elevator)
 		elevator_exit(q->elevator);
 
@@ -1587,6 +1612,21 @@ request_queue_t *blk_alloc_queue(int gfp_mask)
 
 EXPORT_SYMBOL(blk_alloc_queue);
 
+/*
+ * The merge methods and segment limits blk_init_queue() gives a queue.
+ * Merging a bio into a request on a plug goes through them, so queues
+ * that take plugged requests without blk_init_queue() need them too.
+ */
+void blk_queue_merge_defaults(request_queue_t *q)
+{
+	q->back_merge_fn	= ll_back_merge_fn;
+	q->front_merge_fn	= ll_front_merge_fn;
+	q->merge_requests_fn	= ll_merge_requests_fn;
+
+	blk_queue_segment_boundary(q, 0xffffffff);
+	blk_queue_max_segment_size(q, MAX_SEGMENT_SIZE);
+}
+
 /**
  * blk_init_queue  - prepare a request queue for use with a block device
  * @rfn:  The function to be called to process requests that have been
@@ -1636,18 +1676,14 @@ request_queue_t *blk_init_queue(request_fn_proc *rfn, spinlock_t *lock)
 		goto out_init;
 
 	q->request_fn		= rfn;
-	q->back_merge_fn       	= ll_back_merge_fn;
-	q->front_merge_fn      	= ll_front_merge_fn;
-	q->merge_requests_fn	= ll_merge_requests_fn;
 	q->prep_rq_fn		= NULL;
 	q->unplug_fn		= generic_unplug_device;
 	q->queue_flags		= (1 << QUEUE_FLAG_CLUSTER);
 	q->queue_lock		= lock;
 
-	blk_queue_segment_boundary(q, 0xffffffff);
+	blk_queue_merge_defaults(q);
 
 	blk_queue_make_request(q, __make_request);
-	blk_queue_max_segment_size(q, MAX_SEGMENT_SIZE);
 
 	blk_queue_max_hw_segments(q, MAX_HW_SEGMENTS);
 	blk_queue_max_phys_segments(q, MAX_PHYS_SEGMENTS);
@@ -1902,6 +1938,7 @@ static struct request *get_request_wait(request_queue_t *q, int rw)
 		if (!rq) {
 			struct io_context *ioc;
 
+			blk_add_trace_generic(q, BLK_TA_SLEEPRQ);
 			io_schedule();
 
 			/*
@@ -1952,6 +1989,8 @@ EXPORT_SYMBOL(blk_get_request);
  */
 void blk_requeue_request(request_queue_t *q, struct request *rq)
 {
+	blk_add_trace_rq(q, rq, BLK_TA_REQUEUE);
+
 	if (blk_rq_tagged(rq))
 		blk_queue_end_tag(q, rq);
 
@@ -2256,6 +2295,7 @@ void drive_stat_acct(struct request *rq, int nr_sectors, int new_io)
 static inline void add_request(request_queue_t * q, struct request * req)
 {
 	drive_stat_acct(req, req->nr_sectors, 1);
+	blk_add_trace_rq(q, req, BLK_TA_INSERT);
 
 	if (q->activity_fn)/* еĻصʾһ룬һδ */
 		q->activity_fn(q->activity_data, rq_data_dir(req));
@@ -2482,12 +2522,133 @@ void __blk_attempt_remerge(request_queue_t *q, struct request *rq)
 
 EXPORT_SYMBOL(__blk_attempt_remerge);
 
+/**
+ * blk_start_plug - hold back the requests of a batch of I/O
+ * @plug:	The &struct blk_plug, on the caller's stack
+ *
+ * Description:
+ *   Until the matching blk_finish_plug(), requests built by the current
+ *   task collect on @plug rather than being started one by one.  An inner
+ *   blk_start_plug() while a plug is already in place is a no-op: the
+ *   outermost plug keeps them all.
+ **/
+void blk_start_plug(struct blk_plug *plug)
+{
+	INIT_LIST_HEAD(&plug->list);
+	plug->count = 0;
+
+	if (!current->plug)
+		current->plug = plug;
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/*
+ * Give the plugged requests to their queues, each queue taking all of
+ * its requests under a single hold of its lock before being started.
+ */
+void blk_flush_plug_list(struct blk_plug *plug)
+{
+	request_queue_t *q;
+	struct request *rq, *tmp;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	list_splice_init(&plug->list, &list);
+	plug->count = 0;
+
+	while (!list_empty(&list)) {
+		q = list_entry_rq(list.next)->q;
+
+		if (q->mq_ops) {
+			LIST_HEAD(mq_list);
+
+			list_for_each_entry_safe(rq, tmp, &list, queuelist)
+				if (rq->q == q)
+					list_move_tail(&rq->queuelist, &mq_list);
+			blk_add_trace_generic(q, BLK_TA_UNPLUG_IO);
+			blk_mq_insert_requests(q, &mq_list);
+			continue;
+		}
+
+		spin_lock_irqsave(q->queue_lock, flags);
+		blk_add_trace_generic(q, BLK_TA_UNPLUG_IO);
+		list_for_each_entry_safe(rq, tmp, &list, queuelist) {
+			if (rq->q != q)
+				continue;
+			list_del_init(&rq->queuelist);
+			add_request(q, rq);
+		}
+		__blk_run_queue(q);
+		spin_unlock_irqrestore(q->queue_lock, flags);
+	}
+}
+EXPORT_SYMBOL(blk_flush_plug_list);
+
+/**
+ * blk_finish_plug - submit the requests held on a plug
+ * @plug:	The &struct blk_plug passed to blk_start_plug()
+ **/
+void blk_finish_plug(struct blk_plug *plug)
+{
+	if (!list_empty(&plug->list))
+		blk_flush_plug_list(plug);
+
+	if (current->plug == plug)
+		current->plug = NULL;
+}
+EXPORT_SYMBOL(blk_finish_plug);
+
+/*
+ * Try to merge @bio into one of the requests on the current task's plug.
+ * Those requests are private to the task, so no queue lock is needed to
+ * grow them; their sectors get accounted once they reach the queue.
+ */
+int blk_attempt_plug_merge(struct blk_plug *plug, request_queue_t *q,
+			   struct bio *bio)
+{
+	struct request *rq;
+	sector_t sector = bio->bi_sector;
+	int nr_sectors = bio_sectors(bio);
+
+	list_for_each_entry_reverse(rq, &plug->list, queuelist) {
+		if (rq->q != q || !elv_rq_merge_ok(rq, bio))
+			continue;
+
+		if (rq->sector + rq->nr_sectors == sector) {
+			if (!q->back_merge_fn(q, rq, bio))
+				continue;
+			rq->biotail->bi_next = bio;
+			rq->biotail = bio;
+			blk_add_trace_bio(q, bio, BLK_TA_BACKMERGE);
+		} else if (rq->sector - nr_sectors == sector) {
+			if (!q->front_merge_fn(q, rq, bio))
+				continue;
+			bio->bi_next = rq->bio;
+			rq->bio = bio;
+			rq->buffer = bio_data(bio);
+			rq->current_nr_sectors = bio_cur_sectors(bio);
+			rq->hard_cur_sectors = rq->current_nr_sectors;
+			rq->sector = rq->hard_sector = sector;
+			blk_add_trace_bio(q, bio, BLK_TA_FRONTMERGE);
+		} else
+			continue;
+
+		rq->nr_sectors = rq->hard_nr_sectors += nr_sectors;
+		preempt_disable();
+		drive_stat_acct(rq, 0, 0);
+		preempt_enable();
+		return 1;
+	}
+	return 0;
+}
+
 /**
  * ͨÿô˺IOȲķ
  */
 static int __make_request(request_queue_t *q, struct bio *bio)
 {
 	struct request *req, *freereq = NULL;
+	struct blk_plug *plug;
 	int el_ret, rw, nr_sectors, cur_nr_sectors, barrier, err;
 	sector_t sector;
 
@@ -2516,20 +2677,28 @@ static int __make_request(request_queue_t *q, struct bio *bio)
 		goto end_io;
 	}
 
+	/*
+	 * Requests on our own plug are not in the elevator yet, so
+	 * elv_merge() cannot see them.
+	 */
+	if (!barrier && current->plug &&
+	    blk_attempt_plug_merge(current->plug, q, bio))
+		return 0;
+
+	/*
+	 * A barrier must reach the queue behind everything this task
+	 * submitted before it, including what is still on its plug.
+	 */
+	if (barrier && current->plug)
+		blk_flush_plug_list(current->plug);
+
 again:
 	spin_lock_irq(q->queue_lock);
 
 	/**
 	 * Ƿڴ
 	 */
-	if (elv_queue_empty(q)) {
-		/**
-		 * ûдblk_plug_deviceС
-		 */
-		blk_plug_device(q);
-		goto get_rq;
-	}
-	if (barrier)
+	if (elv_queue_empty(q) || barrier)
 		goto get_rq;
 
 	/**
@@ -2553,6 +2722,7 @@ again:
 			req->biotail = bio;
 			req->nr_sectors = req->hard_nr_sectors += nr_sectors;
 			drive_stat_acct(req, nr_sectors, 0);
+			blk_add_trace_bio(q, bio, BLK_TA_BACKMERGE);
 			/**
 			 * Ƿϲ
 			 */
@@ -2586,6 +2756,7 @@ again:
 			req->sector = req->hard_sector = sector;
 			req->nr_sectors = req->hard_nr_sectors += nr_sectors;
 			drive_stat_acct(req, nr_sectors, 0);
+			blk_add_trace_bio(q, bio, BLK_TA_FRONTMERGE);
 			/**
 			 * Ƿbioнһĺϲ
 			 */
@@ -2672,17 +2843,31 @@ get_rq:
 	req->bio = req->biotail = bio;
 	req->rq_disk = bio->bi_bdev->bd_disk;
 	req->start_time = jiffies;
+	blk_add_trace_bio(q, bio, BLK_TA_GETRQ);
+
+	plug = current->plug;
+	if (plug && !barrier) {
+		if (list_empty(&plug->list))
+			blk_add_trace_generic(q, BLK_TA_PLUG);
+		list_add_tail(&req->queuelist, &plug->list);
+		spin_unlock_irq(q->queue_lock);
+		if (++plug->count >= BLK_MAX_PLUG_COUNT)
+			blk_flush_plug_list(plug);
+		return 0;
+	}
 
 	/**
 	 * bio
 	 */
 	add_request(q, req);
+	__blk_run_queue(q);
+	goto unlock;
 out:
 	if (freereq)/* ʱڵǰ󱻺ϲҪͷ */
 		__blk_put_request(q, freereq);
 	if (bio_sync(bio))/* BIO_RW_SYNC__generic_unplug_deviceժ豸 */
 		__generic_unplug_device(q);
-
+unlock:
 	spin_unlock_irq(q->queue_lock);
 	return 0;
 
@@ -2945,6 +3130,8 @@ end_io:
 		 * 豸Ļص__make_request
 		 * make_request_fnBIOq
 		 */
+		blk_add_trace_bio(q, bio, BLK_TA_QUEUE);
+
 		ret = q->make_request_fn(q, bio); /**/
 	} while (ret);/* ret0ʾbioѾ޸ģҪύ豸Ҫջʽ豸 */
 }
@@ -3073,6 +3260,9 @@ static int __end_that_request_first(struct request *req, int uptodate,
 	if (end_io_error(uptodate))
 		error = !uptodate ? -EIO : uptodate;
 
+	if (req->q)
+		blk_add_trace_complete(req->q, req, nr_bytes, error);
+
 	/*
 	 * for a REQ_BLOCK_PC request, we want to carry any eventual
 	 * sense key with us all the way through
@@ -3591,6 +3781,21 @@ static ssize_t queue_max_hw_sectors_show(struct request_queue *q, char *page)
 	return queue_var_show(max_hw_sectors_kb, (page));
 }
 
+static ssize_t queue_ra_stats_show(struct request_queue *q, char *page)
+{
+	unsigned long *stat = q->backing_dev_info.ra_stat;
+
+	return sprintf(page,
+		       "sync     %lu\n"
+		       "async    %lu\n"
+		       "context  %lu\n"
+		       "random   %lu\n"
+		       "thrash   %lu\n"
+		       "pages    %lu\n",
+		       stat[RA_STAT_SYNC], stat[RA_STAT_ASYNC],
+		       stat[RA_STAT_CONTEXT], stat[RA_STAT_RANDOM],
+		       stat[RA_STAT_THRASH], stat[RA_STAT_PAGES]);
+}
 
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
@@ -3615,6 +3820,11 @@ static struct queue_sysfs_entry queue_max_hw_sectors_entry = {
 	.show = queue_max_hw_sectors_show,
 };
 
+static struct queue_sysfs_entry queue_ra_stats_entry = {
+	.attr = {.name = "ra_stats", .mode = S_IRUGO },
+	.show = queue_ra_stats_show,
+};
+
 static struct queue_sysfs_entry queue_iosched_entry = {
 	.attr = {.name = "scheduler", .mode = S_IRUGO | S_IWUSR },
 	.show = elv_iosched_show,
@@ -3624,6 +3834,7 @@ static struct queue_sysfs_entry queue_iosched_entry = {
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
+	&queue_ra_stats_entry.attr,
 	&queue_max_hw_sectors_entry.attr,
 	&queue_max_sectors_entry.attr,
 	&queue_iosched_entry.attr,
@@ -39,6 +39,10 @@
  * Support up to 256 loop devices
  * Heinz Mauelshagen <mge@sistina.com>, Feb 2002
  *
+ * A pool of worker threads per device, and LOOP_SET_DIRECT_IO to remap
+ * bios straight onto the blocks of a fully allocated backing file,
+ * asynchronously and bypassing its page cache.
+ *
  * Still To Fix:
  * - Advisory locking is ignored here.
  * - Should use an own CAP_* category instead of CAP_SYS_ADMIN
@@ -67,13 +71,32 @@
 #include <linux/writeback.h>
 #include <linux/buffer_head.h>		/* for invalidate_bdev() */
 #include <linux/completion.h>
+#include <linux/mempool.h>
+#include <linux/vmalloc.h>
 
 #include <asm/uaccess.h>
 
 static int max_loop = 8;
+static int workers = 4;
 static struct loop_device *loop_dev;
 static struct gendisk **disks;
 
+/*
+ * One per bio handled with LO_FLAGS_DIRECT_IO, until all the bios it was
+ * split into against lo_target have completed.
+ */
+struct loop_dio {
+	struct loop_device	*lo;
+	struct bio		*bio;
+	atomic_t		remaining;
+	int			error;
+};
+
+#define LOOP_DIO_POOL_SIZE	16
+
+static kmem_cache_t *loop_dio_cachep;
+static mempool_t *loop_dio_pool;
+
 /*
  * Transfer functions
  */
@@ -363,6 +386,287 @@ static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 	return ret;
 }
 
+/*
+ * Drop a reference on lo_pending; once it is gone in rundown there is no
+ * more work, and every worker is woken to see that.
+ */
+static void loop_put_pending(struct loop_device *lo)
+{
+	int i;
+
+	if (atomic_dec_and_test(&lo->lo_pending))
+		for (i = 0; i < lo->lo_nr_workers; i++)
+			up(&lo->lo_bh_mutex);
+}
+
+/*
+ * Map the whole device onto lo_target.  Like a swapfile, the backing
+ * file must have no holes, since nothing can allocate blocks for it
+ * behind the filesystem's back, and is marked S_SWAPFILE to keep it from
+ * being truncated while we hold its block numbers.
+ */
+static int loop_map_extents(struct loop_device *lo)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+	struct inode *inode = mapping->host;
+	sector_t nr_sects = get_capacity(disks[lo->lo_number]);
+	struct loop_extent *map, *ext = NULL;
+	int nr = 0, max = 16;
+	int error;
+
+	if (S_ISBLK(inode->i_mode))
+		lo->lo_target = I_BDEV(inode);
+	else
+		lo->lo_target = inode->i_sb->s_bdev;
+	if (!lo->lo_target || bdev_hardsect_size(lo->lo_target) > 512)
+		return -EINVAL;
+
+	map = vmalloc(max * sizeof(*map));
+	if (!map)
+		return -ENOMEM;
+
+	filemap_write_and_wait(mapping);
+
+	if (S_ISBLK(inode->i_mode)) {
+		error = -EINVAL;
+		if (lo->lo_offset & 511)
+			goto out_free;
+		map[0].start = 0;
+		map[0].nr_sects = nr_sects;
+		map[0].disk_sector = lo->lo_offset >> 9;
+		nr = 1;
+	} else {
+		unsigned int shift = inode->i_blkbits - 9;
+		sector_t block, first, last, phys;
+
+		error = -EINVAL;
+		if (!mapping->a_ops->bmap ||
+		    (lo->lo_offset & ((1 << inode->i_blkbits) - 1)))
+			goto out_free;
+
+		down(&inode->i_sem);
+		error = -EBUSY;
+		if (IS_SWAPFILE(inode)) {
+			up(&inode->i_sem);
+			goto out_free;
+		}
+		inode->i_flags |= S_SWAPFILE;
+		up(&inode->i_sem);
+
+		first = lo->lo_offset >> inode->i_blkbits;
+		last = (lo->lo_offset + ((loff_t) nr_sects << 9) +
+			(1 << inode->i_blkbits) - 1) >> inode->i_blkbits;
+		for (block = first; block < last; block++) {
+			phys = bmap(inode, block);
+			if (!phys) {
+				error = -EINVAL;
+				goto out_swapfile;
+			}
+			phys <<= shift;
+			if (ext && ext->disk_sector + ext->nr_sects == phys) {
+				ext->nr_sects += 1 << shift;
+				continue;
+			}
+			if (nr == max) {
+				struct loop_extent *new;
+
+				new = vmalloc(2 * max * sizeof(*map));
+				if (!new) {
+					error = -ENOMEM;
+					goto out_swapfile;
+				}
+				memcpy(new, map, max * sizeof(*map));
+				vfree(map);
+				map = new;
+				max *= 2;
+			}
+			ext = &map[nr++];
+			ext->start = (block - first) << shift;
+			ext->nr_sects = 1 << shift;
+			ext->disk_sector = phys;
+			cond_resched();
+		}
+		error = -EINVAL;
+		if (!nr)
+			goto out_swapfile;
+	}
+
+	/* anything cached from before would go stale under us */
+	invalidate_inode_pages2(mapping);
+
+	lo->lo_extents = map;
+	lo->lo_nr_extents = nr;
+	return 0;
+
+out_swapfile:
+	down(&inode->i_sem);
+	inode->i_flags &= ~S_SWAPFILE;
+	up(&inode->i_sem);
+out_free:
+	vfree(map);
+	lo->lo_target = NULL;
+	return error;
+}
+
+static void loop_unmap_extents(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+
+	if (!S_ISBLK(inode->i_mode)) {
+		down(&inode->i_sem);
+		inode->i_flags &= ~S_SWAPFILE;
+		up(&inode->i_sem);
+	}
+	vfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	lo->lo_target = NULL;
+}
+
+static struct loop_extent *
+loop_find_extent(struct loop_device *lo, sector_t sector)
+{
+	struct loop_extent *map = lo->lo_extents;
+	int l = 0, h = lo->lo_nr_extents - 1, m;
+
+	while (l < h) {
+		m = (l + h + 1) / 2;
+		if (map[m].start <= sector)
+			l = m;
+		else
+			h = m - 1;
+	}
+	return &map[l];
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+	struct bio *bio = dio->bio;
+	int error;
+
+	if (!atomic_dec_and_test(&dio->remaining))
+		return;
+
+	/* only now have all the children stored their errors */
+	error = dio->error;
+	mempool_free(dio, loop_dio_pool);
+	bio_endio(bio, bio->bi_size, error);
+	if (atomic_dec_and_test(&lo->lo_dio_inflight))
+		wake_up(&lo->lo_dio_wait);
+	loop_put_pending(lo);
+}
+
+static int loop_dio_end_io(struct bio *bio, unsigned int bytes_done, int error)
+{
+	struct loop_dio *dio = bio->bi_private;
+
+	if (bio->bi_size)
+		return 1;
+
+	if (!error && !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		error = -EIO;
+	if (error)
+		dio->error = error;
+	bio_put(bio);
+	loop_dio_put(dio);
+	return 0;
+}
+
+/*
+ * Remap @bio onto lo_target, split at extent boundaries, and return
+ * without waiting: the last piece to complete ends @bio.
+ */
+static void loop_dio_submit(struct loop_device *lo, struct bio *bio)
+{
+	sector_t sector = bio->bi_sector;
+	struct bio *child = NULL;
+	struct loop_extent *ext;
+	struct loop_dio *dio;
+	struct bio_vec *bvec;
+	sector_t disk, next = 0;
+	unsigned int off, len, n;
+	int i;
+
+	dio = mempool_alloc(loop_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	atomic_set(&dio->remaining, 1);
+	atomic_inc(&lo->lo_dio_inflight);
+
+	bio_for_each_segment(bvec, bio, i) {
+		off = bvec->bv_offset;
+		len = bvec->bv_len;
+		while (len) {
+			ext = loop_find_extent(lo, sector);
+			disk = ext->disk_sector + (sector - ext->start);
+			n = len;
+			if ((n >> 9) > ext->start + ext->nr_sects - sector)
+				n = (ext->start + ext->nr_sects - sector) << 9;
+
+			if (child && (disk != next ||
+			    bio_add_page(child, bvec->bv_page, n, off) < n)) {
+				generic_make_request(child);
+				child = NULL;
+			}
+			if (!child) {
+				child = bio_alloc(GFP_NOIO, bio->bi_vcnt - i);
+				child->bi_sector = disk;
+				child->bi_bdev = lo->lo_target;
+				child->bi_rw = bio->bi_rw;
+				child->bi_end_io = loop_dio_end_io;
+				child->bi_private = dio;
+				if (bio_add_page(child, bvec->bv_page, n, off) < n) {
+					bio_put(child);
+					child = NULL;
+					dio->error = -EIO;
+					goto out;
+				}
+				atomic_inc(&dio->remaining);
+			}
+
+			next = disk + (n >> 9);
+			sector += n >> 9;
+			off += n;
+			len -= n;
+		}
+	}
+out:
+	if (child)
+		generic_make_request(child);
+	loop_dio_put(dio);
+}
+
+/*
+ * Switch LO_FLAGS_DIRECT_IO on or off, once nothing is in flight.
+ */
+static int loop_set_direct_io(struct loop_device *lo, unsigned long arg)
+{
+	int error = 0;
+
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (!arg == !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+	/* the data is never copied, so there is nowhere to transform it */
+	if (arg && lo->lo_encryption)
+		return -EINVAL;
+
+	down_write(&lo->lo_io_sem);
+	wait_event(lo->lo_dio_wait, !atomic_read(&lo->lo_dio_inflight));
+	if (arg) {
+		error = loop_map_extents(lo);
+		if (!error)
+			lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	} else {
+		loop_unmap_extents(lo);
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	}
+	up_write(&lo->lo_io_sem);
+	return error;
+}
+
 /*
  * Add bio to back of pending list
  */
@@ -426,8 +730,7 @@ static int loop_make_request(request_queue_t *q, struct bio *old_bio)
 	loop_add_bio(lo, old_bio);
 	return 0;
 err:
-	if (atomic_dec_and_test(&lo->lo_pending))
-		up(&lo->lo_bh_mutex);
+	loop_put_pending(lo);
 out:
 	bio_io_error(old_bio, old_bio->bi_size);
 	return 0;
@@ -454,24 +757,42 @@ struct switch_request {
 
 static void do_loop_switch(struct loop_device *, struct switch_request *);
 
-static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
+static void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 {
+	int excl = !bio->bi_bdev || lo->lo_encryption;
 	int ret;
 
+	if (excl)
+		down_write(&lo->lo_io_sem);
+	else
+		down_read(&lo->lo_io_sem);
+
 	if (unlikely(!bio->bi_bdev)) {
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
+	} else if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		/* lo_pending is dropped when it completes */
+		loop_dio_submit(lo, bio);
+		up_read(&lo->lo_io_sem);
+		return;
 	} else {
 		ret = do_bio_filebacked(lo, bio);
 		bio_endio(bio, bio->bi_size, ret);
 	}
+
+	if (excl)
+		up_write(&lo->lo_io_sem);
+	else
+		up_read(&lo->lo_io_sem);
+	loop_put_pending(lo);
 }
 
 /*
  * worker thread that handles reads/writes to file backed loop devices,
  * to avoid blocking in our make_request_fn. it also does loop decrypting
  * on reads for block backed loop, as that is too heavy to do from
- * b_end_io context where irqs may be disabled.
+ * b_end_io context where irqs may be disabled.  each device has a pool
+ * of lo_nr_workers of these, all taking bios off the same list.
  */
 static int loop_thread(void *data)
 {
@@ -489,9 +810,6 @@ static int loop_thread(void *data)
 
 	set_user_nice(current, -20);
 
-	lo->lo_state = Lo_bound;
-	atomic_inc(&lo->lo_pending);
-
 	/*
 	 * up sem, we are running
 	 */
@@ -501,7 +819,8 @@ static int loop_thread(void *data)
 		down_interruptible(&lo->lo_bh_mutex);
 		/*
 		 * could be upped because of tear-down, not because of
-		 * pending work
+		 * pending work: lo_pending hit zero and every worker
+		 * got an up
 		 */
 		if (!atomic_read(&lo->lo_pending))
 			break;
@@ -512,13 +831,6 @@ static int loop_thread(void *data)
 			continue;
 		}
 		loop_handle_bio(lo, bio);
-
-		/*
-		 * upped both for pending work and tear-down, lo_pending
-		 * will hit zero then
-		 */
-		if (atomic_dec_and_test(&lo->lo_pending))
-			break;
 	}
 
 	up(&lo->lo_sem);
@@ -730,8 +1042,26 @@ static int loop_set_fd(struct loop_device *lo, struct file *lo_file,
 
 	set_blocksize(bdev, lo_blocksize);
 
-	kernel_thread(loop_thread, lo, CLONE_KERNEL);
-	down(&lo->lo_sem);
+	lo->lo_nr_workers = 0;
+	while (lo->lo_nr_workers < workers) {
+		error = kernel_thread(loop_thread, lo, CLONE_KERNEL);
+		if (error < 0)
+			break;
+		down(&lo->lo_sem);
+		lo->lo_nr_workers++;
+	}
+	if (!lo->lo_nr_workers) {
+		set_capacity(disks[lo->lo_number], 0);
+		bd_set_size(bdev, 0);
+		mapping_set_gfp_mask(mapping, lo->old_gfp_mask);
+		lo->lo_backing_file = NULL;
+		goto out_putf;
+	}
+
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_state = Lo_bound;
+	atomic_set(&lo->lo_pending, 1);
+	spin_unlock_irq(&lo->lo_lock);
 	return 0;
 
  out_putf:
@@ -783,6 +1113,7 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 {
 	struct file *filp = lo->lo_backing_file;
 	int gfp = lo->old_gfp_mask;
+	int i;
 
 	if (lo->lo_state != Lo_bound)
 		return -ENXIO;
@@ -795,12 +1126,15 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	spin_lock_irq(&lo->lo_lock);
 	lo->lo_state = Lo_rundown;
-	if (atomic_dec_and_test(&lo->lo_pending))
-		up(&lo->lo_bh_mutex);
+	loop_put_pending(lo);
 	spin_unlock_irq(&lo->lo_lock);
 
-	down(&lo->lo_sem);
+	for (i = 0; i < lo->lo_nr_workers; i++)
+		down(&lo->lo_sem);
+	lo->lo_nr_workers = 0;
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		loop_unmap_extents(lo);
 	lo->lo_backing_file = NULL;
 
 	loop_release_xfer(lo);
@@ -839,6 +1173,11 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* the extent map is for this offset and size, and no transfer */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (info->lo_encrypt_type || lo->lo_offset != info->lo_offset ||
+	     lo->lo_sizelimit != info->lo_sizelimit))
+		return -EBUSY;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1057,6 +1396,9 @@ static int lo_ioctl(struct inode * inode, struct file * file,
 	case LOOP_GET_STATUS64:
 		err = loop_get_status64(lo, (struct loop_info64 __user *) arg);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		err = loop_set_direct_io(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1098,6 +1440,8 @@ static struct block_device_operations lo_fops = {
  */
 module_param(max_loop, int, 0);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices (1-256)");
+module_param(workers, int, 0);
+MODULE_PARM_DESC(workers, "Worker threads per bound loop device (1-16)");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1146,9 +1490,28 @@ int __init loop_init(void)
 				    " 1 and 256), using default (8)\n");
 		max_loop = 8;
 	}
+	if (workers < 1 || workers > 16) {
+		printk(KERN_WARNING "loop: invalid workers (must be between"
+				    " 1 and 16), using default (4)\n");
+		workers = 4;
+	}
 
-	if (register_blkdev(LOOP_MAJOR, "loop"))
+	loop_dio_cachep = kmem_cache_create("loop_dio",
+			sizeof(struct loop_dio), 0, 0, NULL, NULL);
+	if (!loop_dio_cachep)
+		return -ENOMEM;
+	loop_dio_pool = mempool_create(LOOP_DIO_POOL_SIZE, mempool_alloc_slab,
+				       mempool_free_slab, loop_dio_cachep);
+	if (!loop_dio_pool) {
+		kmem_cache_destroy(loop_dio_cachep);
+		return -ENOMEM;
+	}
+
+	if (register_blkdev(LOOP_MAJOR, "loop")) {
+		mempool_destroy(loop_dio_pool);
+		kmem_cache_destroy(loop_dio_cachep);
 		return -EIO;
+	}
 
 	loop_dev = kmalloc(max_loop * sizeof(struct loop_device), GFP_KERNEL);
 	if (!loop_dev)
@@ -1178,6 +1541,8 @@ int __init loop_init(void)
 		init_MUTEX(&lo->lo_ctl_mutex);
 		init_MUTEX_LOCKED(&lo->lo_sem);
 		init_MUTEX_LOCKED(&lo->lo_bh_mutex);
+		init_rwsem(&lo->lo_io_sem);
+		init_waitqueue_head(&lo->lo_dio_wait);
 		lo->lo_number = i;
 		spin_lock_init(&lo->lo_lock);
 		disk->major = LOOP_MAJOR;
@@ -1208,6 +1573,8 @@ out_mem2:
 	kfree(loop_dev);
 out_mem1:
 	unregister_blkdev(LOOP_MAJOR, "loop");
+	mempool_destroy(loop_dio_pool);
+	kmem_cache_destroy(loop_dio_cachep);
 	printk(KERN_ERR "loop: ran out of memory\n");
 	return -ENOMEM;
 }
@@ -1227,6 +1594,8 @@ void loop_exit(void)
 
 	kfree(disks);
 	kfree(loop_dev);
+	mempool_destroy(loop_dio_pool);
+	kmem_cache_destroy(loop_dio_cachep);
 }
 
 module_init(loop_init);
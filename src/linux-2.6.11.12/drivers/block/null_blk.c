@@ -0,0 +1,468 @@
+/*
+ * null_blk.c - a block device that does no I/O.
+ *
+ * Every request is completed successfully without its data being touched,
+ * so that what is measured against these devices is the block layer
+ * itself: __make_request(), the elevator, plugging and blk-mq, with no
+ * page cache (as for rd) or backing file (as for loop) in the way.
+ *
+ * Module parameters select how requests reach the driver:
+ *
+ *	queue_mode=0	bios, through our own make_request_fn
+ *	queue_mode=1	a request_fn queue, with the elevator and queue_lock
+ *	queue_mode=2	blk-mq, submit_queues hardware queues
+ *
+ * and how they are completed:
+ *
+ *	irqmode=0	at once, in the submitting context
+ *	irqmode=1	from a per-cpu tasklet, as a driver completing from
+ *			its interrupt handler would
+ *	irqmode=2	from a per-cpu timer, completion_nsec after
+ *			submission (rounded up to whole jiffies)
+ *
+ * hw_queue_depth bounds the commands in flight per device (per hardware
+ * queue for blk-mq); bs sets the logical block size.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/genhd.h>
+#include <linux/devfs_fs_kernel.h>
+#include <linux/interrupt.h>
+#include <linux/timer.h>
+#include <linux/percpu.h>
+#include <linux/jiffies.h>
+
+enum {
+	NULL_Q_BIO		= 0,
+	NULL_Q_RQ		= 1,
+	NULL_Q_MQ		= 2,
+};
+
+enum {
+	NULL_IRQ_NONE		= 0,
+	NULL_IRQ_SOFTIRQ	= 1,
+	NULL_IRQ_TIMER		= 2,
+};
+
+struct nullb {
+	struct list_head	list;
+	unsigned int		index;
+	request_queue_t		*q;
+	struct gendisk		*disk;
+	spinlock_t		lock;		/* queue_lock for NULL_Q_RQ */
+	unsigned int		nr_inflight;	/* NULL_Q_RQ, under lock */
+	mempool_t		*cmd_pool;	/* not for NULL_Q_MQ */
+};
+
+/*
+ * One per request or bio in flight.  For blk-mq it lives in the request's
+ * pdu; otherwise it comes from the device's cmd_pool.
+ */
+struct nullb_cmd {
+	struct list_head	list;
+	unsigned long		deadline;	/* NULL_IRQ_TIMER */
+	struct nullb		*nullb;
+	struct request		*rq;
+	struct bio		*bio;
+};
+
+/*
+ * Commands waiting for their simulated interrupt, queued on the cpu that
+ * submitted them.  The lock is only contended when a cpu goes away and
+ * its tasklet or timer is run elsewhere.
+ */
+struct nullb_cpu {
+	spinlock_t		lock;
+	struct list_head	list;
+	struct tasklet_struct	tasklet;
+	struct timer_list	timer;
+};
+
+static DEFINE_PER_CPU(struct nullb_cpu, nullb_cpus);
+
+static LIST_HEAD(nullb_list);
+static kmem_cache_t *nullb_cmd_cachep;
+static int null_major;
+static unsigned long completion_jiffies;
+
+static int queue_mode = NULL_Q_MQ;
+static int irqmode = NULL_IRQ_SOFTIRQ;
+static unsigned long completion_nsec = 10000;
+static int hw_queue_depth = 64;
+static int submit_queues;
+static int nr_devices = 2;
+static int gb = 250;
+static int bs = 512;
+
+static void null_end_request(struct request *rq)
+{
+	if (end_that_request_first(rq, 1, rq->hard_nr_sectors))
+		BUG();
+	end_that_request_last(rq);
+}
+
+static void null_end_cmd(struct nullb_cmd *cmd)
+{
+	struct nullb *nullb = cmd->nullb;
+	struct request *rq = cmd->rq;
+	unsigned long flags;
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		blk_mq_end_io(rq, 0);
+		return;
+	case NULL_Q_RQ:
+		mempool_free(cmd, nullb->cmd_pool);
+		spin_lock_irqsave(&nullb->lock, flags);
+		null_end_request(rq);
+		nullb->nr_inflight--;
+		if (blk_queue_stopped(nullb->q))
+			blk_start_queue(nullb->q);
+		spin_unlock_irqrestore(&nullb->lock, flags);
+		return;
+	case NULL_Q_BIO:
+		bio_endio(cmd->bio, cmd->bio->bi_size, 0);
+		mempool_free(cmd, nullb->cmd_pool);
+		return;
+	}
+}
+
+/*
+ * Take the commands off a cpu's list, only those whose deadline has passed
+ * if @due, and complete them with the list unlocked.
+ */
+static void null_complete_list(struct nullb_cpu *nc, int due)
+{
+	struct nullb_cmd *cmd, *tmp;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	spin_lock_irqsave(&nc->lock, flags);
+	list_for_each_entry_safe(cmd, tmp, &nc->list, list) {
+		/* queued in submission order with equal delays */
+		if (due && time_before(jiffies, cmd->deadline))
+			break;
+		list_move_tail(&cmd->list, &done);
+	}
+	if (due && !list_empty(&nc->list)) {
+		cmd = list_entry(nc->list.next, struct nullb_cmd, list);
+		mod_timer(&nc->timer, cmd->deadline);
+	}
+	spin_unlock_irqrestore(&nc->lock, flags);
+
+	while (!list_empty(&done)) {
+		cmd = list_entry(done.next, struct nullb_cmd, list);
+		list_del(&cmd->list);
+		null_end_cmd(cmd);
+	}
+}
+
+static void null_tasklet_fn(unsigned long data)
+{
+	null_complete_list((struct nullb_cpu *) data, 0);
+}
+
+static void null_timer_fn(unsigned long data)
+{
+	null_complete_list((struct nullb_cpu *) data, 1);
+}
+
+static void null_handle_cmd(struct nullb_cmd *cmd)
+{
+	struct nullb_cpu *nc;
+	unsigned long flags;
+
+	if (irqmode == NULL_IRQ_NONE) {
+		null_end_cmd(cmd);
+		return;
+	}
+
+	local_irq_save(flags);
+	nc = &__get_cpu_var(nullb_cpus);
+	spin_lock(&nc->lock);
+	list_add_tail(&cmd->list, &nc->list);
+	if (irqmode == NULL_IRQ_SOFTIRQ)
+		tasklet_schedule(&nc->tasklet);
+	else {
+		cmd->deadline = jiffies + completion_jiffies;
+		if (!timer_pending(&nc->timer))
+			mod_timer(&nc->timer, cmd->deadline);
+	}
+	spin_unlock(&nc->lock);
+	local_irq_restore(flags);
+}
+
+static int null_queue_bio(request_queue_t *q, struct bio *bio)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_cmd *cmd;
+
+	/* sleeps while hw_queue_depth bios are in flight */
+	cmd = mempool_alloc(nullb->cmd_pool, GFP_NOIO);
+	cmd->nullb = nullb;
+	cmd->rq = NULL;
+	cmd->bio = bio;
+	null_handle_cmd(cmd);
+	return 0;
+}
+
+static void null_request_fn(request_queue_t *q)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_cmd *cmd;
+	struct request *rq;
+
+	while ((rq = elv_next_request(q)) != NULL) {
+		blkdev_dequeue_request(rq);
+
+		if (irqmode == NULL_IRQ_NONE) {
+			null_end_request(rq);
+			continue;
+		}
+
+		/*
+		 * The pool holds hw_queue_depth commands in reserve and we
+		 * never have more in flight, so GFP_ATOMIC cannot fail.
+		 */
+		cmd = mempool_alloc(nullb->cmd_pool, GFP_ATOMIC);
+		cmd->nullb = nullb;
+		cmd->rq = rq;
+		cmd->bio = NULL;
+		if (++nullb->nr_inflight >= hw_queue_depth)
+			blk_stop_queue(q);
+
+		spin_unlock_irq(q->queue_lock);
+		null_handle_cmd(cmd);
+		spin_lock_irq(q->queue_lock);
+
+		if (blk_queue_stopped(q))
+			break;
+	}
+}
+
+static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct nullb_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+	cmd->nullb = hctx->queue->queuedata;
+	cmd->rq = rq;
+	cmd->bio = NULL;
+	null_handle_cmd(cmd);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_rq	= null_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+static struct blk_mq_reg null_mq_reg = {
+	.ops		= &null_mq_ops,
+	.cmd_size	= sizeof(struct nullb_cmd),
+};
+
+static struct block_device_operations null_fops = {
+	.owner =	THIS_MODULE,
+};
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del(&nullb->list);
+	del_gendisk(nullb->disk);
+	put_disk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+	if (nullb->cmd_pool)
+		mempool_destroy(nullb->cmd_pool);
+	kfree(nullb);
+}
+
+static int null_add_dev(unsigned int index)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+
+	nullb = kmalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		return -ENOMEM;
+	memset(nullb, 0, sizeof(*nullb));
+	nullb->index = index;
+	spin_lock_init(&nullb->lock);
+
+	if (queue_mode != NULL_Q_MQ) {
+		nullb->cmd_pool = mempool_create(hw_queue_depth,
+				mempool_alloc_slab, mempool_free_slab,
+				nullb_cmd_cachep);
+		if (!nullb->cmd_pool)
+			goto out_free;
+	}
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		null_mq_reg.nr_hw_queues = submit_queues;
+		null_mq_reg.queue_depth = hw_queue_depth;
+		nullb->q = blk_mq_init_queue(&null_mq_reg, nullb);
+		break;
+	case NULL_Q_RQ:
+		nullb->q = blk_init_queue(null_request_fn, &nullb->lock);
+		break;
+	case NULL_Q_BIO:
+		nullb->q = blk_alloc_queue(GFP_KERNEL);
+		if (nullb->q)
+			blk_queue_make_request(nullb->q, null_queue_bio);
+		break;
+	}
+	if (!nullb->q)
+		goto out_pool;
+	nullb->q->queuedata = nullb;
+	blk_queue_hardsect_size(nullb->q, bs);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk)
+		goto out_queue;
+	disk->major = null_major;
+	disk->first_minor = index;
+	disk->fops = &null_fops;
+	disk->private_data = nullb;
+	disk->queue = nullb->q;
+	disk->flags |= GENHD_FL_SUPPRESS_PARTITION_INFO;
+	sprintf(disk->disk_name, "nullb%d", index);
+	sprintf(disk->devfs_name, "nullb/%d", index);
+	set_capacity(disk, (sector_t) gb << (30 - 9));
+
+	list_add_tail(&nullb->list, &nullb_list);
+	add_disk(disk);
+	return 0;
+
+out_queue:
+	blk_cleanup_queue(nullb->q);
+out_pool:
+	if (nullb->cmd_pool)
+		mempool_destroy(nullb->cmd_pool);
+out_free:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static void null_cleanup_cpus(void)
+{
+	int i;
+
+	for_each_cpu(i) {
+		struct nullb_cpu *nc = &per_cpu(nullb_cpus, i);
+
+		tasklet_kill(&nc->tasklet);
+		del_timer_sync(&nc->timer);
+	}
+}
+
+static void __exit null_exit(void)
+{
+	while (!list_empty(&nullb_list))
+		null_del_dev(list_entry(nullb_list.next, struct nullb, list));
+	null_cleanup_cpus();
+	kmem_cache_destroy(nullb_cmd_cachep);
+	devfs_remove("nullb");
+	unregister_blkdev(null_major, "nullb");
+}
+
+static int __init null_init(void)
+{
+	unsigned int i;
+	int err;
+
+	if (bs > PAGE_SIZE || bs < 512 || (bs & (bs - 1))) {
+		printk(KERN_WARNING "null_blk: invalid block size %d, "
+		       "using 512\n", bs);
+		bs = 512;
+	}
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_MQ) {
+		printk(KERN_WARNING "null_blk: invalid queue_mode %d, "
+		       "using blk-mq\n", queue_mode);
+		queue_mode = NULL_Q_MQ;
+	}
+	if (irqmode < NULL_IRQ_NONE || irqmode > NULL_IRQ_TIMER) {
+		printk(KERN_WARNING "null_blk: invalid irqmode %d, "
+		       "using softirq\n", irqmode);
+		irqmode = NULL_IRQ_SOFTIRQ;
+	}
+	if (hw_queue_depth < 1)
+		hw_queue_depth = 1;
+	if (submit_queues <= 0 || submit_queues > num_online_cpus())
+		submit_queues = num_online_cpus();
+
+	completion_jiffies = (completion_nsec + TICK_NSEC - 1) / TICK_NSEC;
+	if (!completion_jiffies)
+		completion_jiffies = 1;
+
+	for_each_cpu(i) {
+		struct nullb_cpu *nc = &per_cpu(nullb_cpus, i);
+
+		spin_lock_init(&nc->lock);
+		INIT_LIST_HEAD(&nc->list);
+		tasklet_init(&nc->tasklet, null_tasklet_fn, (unsigned long) nc);
+		init_timer(&nc->timer);
+		nc->timer.function = null_timer_fn;
+		nc->timer.data = (unsigned long) nc;
+	}
+
+	nullb_cmd_cachep = kmem_cache_create("nullb_cmd",
+			sizeof(struct nullb_cmd), 0, 0, NULL, NULL);
+	if (!nullb_cmd_cachep)
+		return -ENOMEM;
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0) {
+		err = null_major;
+		goto out_cache;
+	}
+	devfs_mk_dir("nullb");
+
+	for (i = 0; i < nr_devices; i++) {
+		err = null_add_dev(i);
+		if (err)
+			goto out_dev;
+	}
+
+	printk(KERN_INFO "null_blk: %d devices of %dGB, queue_mode %d, "
+	       "irqmode %d, depth %d, %d byte blocks\n", nr_devices, gb,
+	       queue_mode, irqmode, hw_queue_depth, bs);
+	return 0;
+
+out_dev:
+	while (!list_empty(&nullb_list))
+		null_del_dev(list_entry(nullb_list.next, struct nullb, list));
+	devfs_remove("nullb");
+	unregister_blkdev(null_major, "nullb");
+out_cache:
+	kmem_cache_destroy(nullb_cmd_cachep);
+	return err;
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+module_param(queue_mode, int, 0);
+MODULE_PARM_DESC(queue_mode, "0 = bio, 1 = request_fn queue, 2 = blk-mq (default)");
+module_param(irqmode, int, 0);
+MODULE_PARM_DESC(irqmode, "Completion: 0 = immediate, 1 = softirq (default), 2 = timer");
+module_param(completion_nsec, ulong, 0);
+MODULE_PARM_DESC(completion_nsec, "Completion latency in ns for irqmode=2, rounded up to jiffies.");
+module_param(hw_queue_depth, int, 0);
+MODULE_PARM_DESC(hw_queue_depth, "Commands in flight per device, or per blk-mq hardware queue.");
+module_param(submit_queues, int, 0);
+MODULE_PARM_DESC(submit_queues, "blk-mq hardware queues, default one per online cpu.");
+module_param(nr_devices, int, 0);
+MODULE_PARM_DESC(nr_devices, "Number of devices.");
+module_param(gb, int, 0);
+MODULE_PARM_DESC(gb, "Size of each device in GB.");
+module_param(bs, int, 0);
+MODULE_PARM_DESC(bs, "Logical block size in bytes.");
+MODULE_LICENSE("GPL");
@@ -53,6 +53,7 @@
 #include <linux/devfs_fs_kernel.h>
 #include <linux/pagemap.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/genhd.h>
 #include <linux/buffer_head.h>		/* for invalidate_bdev() */
 #include <linux/backing-dev.h>
@@ -88,6 +89,13 @@ int rd_size = CONFIG_BLK_DEV_RAM_SIZE;		/* Size of the RAM disks */
  */
 int rd_blocksize = BLOCK_SIZE;			/* blocksize of the RAM disks */
 
+/*
+ * With rd_hw_queues set, the RAM disks take requests through that many
+ * blk-mq hardware queues instead of one bio at a time in
+ * rd_make_request().
+ */
+static int rd_hw_queues;
+
 /*
  * Copyright (C) 2000 Linus Torvalds.
  *               2000 Transmeta Corp.
@@ -295,6 +303,46 @@ fail:
 	return 0;
 } 
 
+/*
+ * blk-mq variant of rd_make_request().  The page cache allocations in
+ * rd_blkdev_pagecache_IO() may sleep, hence BLK_MQ_F_SHOULD_SLEEP.
+ */
+static int rd_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct address_space *mapping = rq->bio->bi_bdev->bd_inode->i_mapping;
+	sector_t sector = rq->sector;
+	int rw = rq_data_dir(rq);
+	struct bio_vec *bvec;
+	struct bio *bio;
+	int ret = 0, i;
+
+	if (sector + rq->nr_sectors > get_capacity(rq->rq_disk)) {
+		ret = -EIO;
+		goto out;
+	}
+
+	rq_for_each_bio(bio, rq) {
+		bio_for_each_segment(bvec, bio, i) {
+			ret |= rd_blkdev_pagecache_IO(rw, bvec, sector, mapping);
+			sector += bvec->bv_len >> 9;
+		}
+	}
+out:
+	blk_mq_end_io(rq, ret ? -EIO : 0);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops rd_mq_ops = {
+	.queue_rq	= rd_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+static struct blk_mq_reg rd_mq_reg = {
+	.ops		= &rd_mq_ops,
+	.queue_depth	= BLKDEV_MAX_RQ,
+	.flags		= BLK_MQ_F_SHOULD_SLEEP,
+};
+
 static int rd_ioctl(struct inode *inode, struct file *file,
 			unsigned int cmd, unsigned long arg)
 {
@@ -446,11 +494,17 @@ static int __init rd_init(void)
 	for (i = 0; i < CONFIG_BLK_DEV_RAM_COUNT; i++) {
 		struct gendisk *disk = rd_disks[i];
 
-		rd_queue[i] = blk_alloc_queue(GFP_KERNEL);
-		if (!rd_queue[i])
-			goto out_queue;
-
-		blk_queue_make_request(rd_queue[i], &rd_make_request);
+		if (rd_hw_queues > 0) {
+			rd_mq_reg.nr_hw_queues = rd_hw_queues;
+			rd_queue[i] = blk_mq_init_queue(&rd_mq_reg, NULL);
+			if (!rd_queue[i])
+				goto out_queue;
+		} else {
+			rd_queue[i] = blk_alloc_queue(GFP_KERNEL);
+			if (!rd_queue[i])
+				goto out_queue;
+			blk_queue_make_request(rd_queue[i], &rd_make_request);
+		}
 		blk_queue_hardsect_size(rd_queue[i], rd_blocksize);
 
 		/* rd_size is given in kB */
@@ -469,6 +523,8 @@ static int __init rd_init(void)
 	printk("RAMDISK driver initialized: "
 		"%d RAM disks of %dK size %d blocksize\n",
 		CONFIG_BLK_DEV_RAM_COUNT, rd_size, rd_blocksize);
+	if (rd_hw_queues > 0)
+		printk("RAMDISK: %d blk-mq hardware queues\n", rd_hw_queues);
 
 	return 0;
 out_queue:
@@ -500,9 +556,15 @@ static int __init ramdisk_blocksize(char *str)
 	rd_blocksize = simple_strtol(str,NULL,0);
 	return 1;
 }
+static int __init ramdisk_hw_queues(char *str)
+{
+	rd_hw_queues = simple_strtol(str,NULL,0);
+	return 1;
+}
 __setup("ramdisk=", ramdisk_size);
 __setup("ramdisk_size=", ramdisk_size2);
 __setup("ramdisk_blocksize=", ramdisk_blocksize);
+__setup("ramdisk_hw_queues=", ramdisk_hw_queues);
 #endif
 
 /* options - modular */
@@ -510,6 +572,8 @@ module_param(rd_size, int, 0);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
 module_param(rd_blocksize, int, 0);
 MODULE_PARM_DESC(rd_blocksize, "Blocksize of each RAM disk in bytes.");
+module_param(rd_hw_queues, int, 0);
+MODULE_PARM_DESC(rd_hw_queues, "Number of blk-mq hardware queues, 0 for none.");
 MODULE_ALIAS_BLOCKDEV_MAJOR(RAMDISK_MAJOR);
 
 MODULE_LICENSE("GPL");
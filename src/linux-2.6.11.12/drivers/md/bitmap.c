@@ -0,0 +1,674 @@
+/*
+ * bitmap.c: write-intent bitmap for md raid1 and raid4/5
+ *
+ * One bit per chunk of each member says that writes to the chunk may be
+ * in flight.  A bit is set on disk before the first write to its chunk
+ * is issued, and cleared a while after the last one completed, so that
+ * after a crash only the chunks whose bits are set need resyncing.
+ *
+ * The bitmap is kept on every member of an array with a 0.90 superblock,
+ * in the space reserved after the superblock, see bitmap.h.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/bio.h>
+#include <linux/seq_file.h>
+#include <linux/raid/md.h>
+#include <linux/raid/bitmap.h>
+
+#define BITMAP_SB_BITS	(sizeof(bitmap_super_t) << 3)
+#define PAGE_BITS	(PAGE_SIZE << 3)
+#define PAGE_BIT_SHIFT	(PAGE_SHIFT + 3)
+
+/* the bit of chunk in the on-disk image, after the header */
+static inline unsigned long chunk_bit(unsigned long chunk)
+{
+	return chunk + BITMAP_SB_BITS;
+}
+
+static inline unsigned long chunk_page(unsigned long chunk)
+{
+	return chunk_bit(chunk) >> PAGE_BIT_SHIFT;
+}
+
+static inline void *chunk_addr(struct bitmap *bitmap, unsigned long chunk)
+{
+	return page_address(bitmap->pages[chunk_page(chunk)]);
+}
+
+static inline unsigned long chunk_offset(unsigned long chunk)
+{
+	return chunk_bit(chunk) & (PAGE_BITS - 1);
+}
+
+static unsigned long bitmap_chunks(sector_t size, int chunkshift)
+{
+	return (unsigned long)((size + (1 << chunkshift) - 1) >> chunkshift);
+}
+
+/*
+ * the counter of the chunk holding offset, and in *blocks the sectors
+ * from offset to the end of the chunk or of the members.
+ * NULL past the end.  Called with bitmap->lock held.
+ */
+static bitmap_counter_t *bitmap_get_counter(struct bitmap *bitmap,
+					    sector_t offset,
+					    unsigned long *chunkp, int *blocks)
+{
+	unsigned long chunk;
+	sector_t end;
+
+	if (offset >= bitmap->sync_size)
+		return NULL;
+
+	chunk = offset >> bitmap->chunkshift;
+	end = (sector_t)(chunk + 1) << bitmap->chunkshift;
+	if (end > bitmap->sync_size)
+		end = bitmap->sync_size;
+	*blocks = end - offset;
+	*chunkp = chunk;
+	return &bitmap->counters[chunk];
+}
+
+static void bitmap_set_chunk(struct bitmap *bitmap, unsigned long chunk)
+{
+	ext2_set_bit(chunk_offset(chunk), chunk_addr(bitmap, chunk));
+	set_bit(BITMAP_PAGE_DIRTY, &bitmap->page_attr[chunk_page(chunk)]);
+	bitmap->dirty_bits++;
+}
+
+static void bitmap_clear_chunk(struct bitmap *bitmap, unsigned long chunk)
+{
+	ext2_clear_bit(chunk_offset(chunk), chunk_addr(bitmap, chunk));
+	set_bit(BITMAP_PAGE_NEEDWRITE, &bitmap->page_attr[chunk_page(chunk)]);
+	bitmap->dirty_bits--;
+}
+
+static int bitmap_end_write_io(struct bio *bio, unsigned int bytes_done,
+			       int error)
+{
+	mdk_rdev_t *rdev = bio->bi_private;
+	mddev_t *mddev = rdev->mddev;
+	struct bitmap *bitmap = mddev->bitmap;
+
+	if (bio->bi_size)
+		return 1;
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		md_error(mddev, rdev);
+
+	rdev_dec_pending(rdev, mddev);
+	bio_put(bio);
+	if (atomic_dec_and_test(&bitmap->pending_writes))
+		wake_up(&bitmap->write_wait);
+	return 0;
+}
+
+/*
+ * write the pages whose attributes have any of mask set to every working
+ * member, and wait for them.  Pages are picked under the lock, so a bit
+ * set after that marks its page dirty again for the next writer; and the
+ * next writer waits for this one on write_sem, so nobody returns before
+ * the bits it set are on disk.
+ */
+static void bitmap_write_pages(struct bitmap *bitmap, unsigned long mask)
+{
+	mddev_t *mddev = bitmap->mddev;
+	unsigned long i;
+
+	down(&bitmap->write_sem);
+	for (i = 0; i < bitmap->nr_pages; i++) {
+		mdk_rdev_t *rdev;
+		struct list_head *tmp;
+		int size;
+
+		spin_lock_irq(&bitmap->lock);
+		if (!(bitmap->page_attr[i] & mask)) {
+			spin_unlock_irq(&bitmap->lock);
+			continue;
+		}
+		clear_bit(BITMAP_PAGE_DIRTY, &bitmap->page_attr[i]);
+		clear_bit(BITMAP_PAGE_NEEDWRITE, &bitmap->page_attr[i]);
+		spin_unlock_irq(&bitmap->lock);
+
+		size = min(PAGE_SIZE, bitmap->bytes - i * PAGE_SIZE);
+		ITERATE_RDEV(mddev, rdev, tmp) {
+			struct bio *bio;
+
+			if (rdev->raid_disk < 0 || rdev->faulty)
+				continue;
+
+			bio = bio_alloc(GFP_NOIO, 1);
+			bio->bi_bdev = rdev->bdev;
+			bio->bi_sector = (rdev->sb_offset << 1) +
+				mddev->bitmap_offset + (i << (PAGE_SHIFT - 9));
+			bio_add_page(bio, bitmap->pages[i], size, 0);
+			bio->bi_private = rdev;
+			bio->bi_end_io = bitmap_end_write_io;
+
+			atomic_inc(&rdev->nr_pending);
+			atomic_inc(&bitmap->pending_writes);
+			submit_bio(WRITE | (1 << BIO_RW_SYNC), bio);
+		}
+	}
+	wait_event(bitmap->write_wait,
+		   atomic_read(&bitmap->pending_writes) == 0);
+	up(&bitmap->write_sem);
+}
+
+/*
+ * take the chunks that went idle one step towards clear: 2 to 1 on this
+ * pass, 1 to 0 (clearing the bit) on the next, so a chunk has been idle
+ * for at least one daemon_sleep before its bit goes.
+ */
+static void bitmap_clear_pass(struct bitmap *bitmap)
+{
+	unsigned long j;
+
+	for (j = 0; j < bitmap->nr_pages; j++) {
+		unsigned long chunk, last;
+
+		spin_lock_irq(&bitmap->lock);
+		if (!test_and_clear_bit(BITMAP_PAGE_CLEAN,
+					&bitmap->page_attr[j])) {
+			spin_unlock_irq(&bitmap->lock);
+			continue;
+		}
+		chunk = j ? j * PAGE_BITS - BITMAP_SB_BITS : 0;
+		last = (j + 1) * PAGE_BITS - BITMAP_SB_BITS;
+		if (last > bitmap->chunks)
+			last = bitmap->chunks;
+		for (; chunk < last; chunk++) {
+			bitmap_counter_t *bmc = &bitmap->counters[chunk];
+
+			if (NEEDED(*bmc) || RESYNC(*bmc))
+				continue;
+			if (*bmc == 2) {
+				*bmc = 1;
+				set_bit(BITMAP_PAGE_CLEAN, &bitmap->page_attr[j]);
+			} else if (*bmc == 1) {
+				*bmc = 0;
+				bitmap_clear_chunk(bitmap, chunk);
+			}
+		}
+		spin_unlock_irq(&bitmap->lock);
+	}
+}
+
+/*
+ * called by the array's thread: every daemon_sleep seconds clear the bits
+ * of idle chunks and write them out.
+ */
+void bitmap_daemon_work(struct bitmap *bitmap)
+{
+	if (!bitmap_daemon_due(bitmap))
+		return;
+	bitmap->daemon_lastrun = jiffies;
+
+	bitmap_clear_pass(bitmap);
+	bitmap_write_pages(bitmap, 1 << BITMAP_PAGE_NEEDWRITE);
+}
+
+/*
+ * write out the bits set by bitmap_startwrite; the personality calls this
+ * before issuing the writes it has held back.
+ */
+void bitmap_unplug(struct bitmap *bitmap)
+{
+	if (bitmap == NULL)
+		return;
+	bitmap_write_pages(bitmap, 1 << BITMAP_PAGE_DIRTY);
+}
+
+/* clear every idle bit and write the lot, for a clean shutdown */
+void bitmap_flush(mddev_t *mddev)
+{
+	struct bitmap *bitmap = mddev->bitmap;
+
+	if (bitmap == NULL)
+		return;
+	bitmap_clear_pass(bitmap);
+	bitmap_clear_pass(bitmap);
+	bitmap_write_pages(bitmap, (1 << BITMAP_PAGE_DIRTY) |
+			   (1 << BITMAP_PAGE_NEEDWRITE));
+}
+
+/* called from md_update_sb with the array's new event count */
+void bitmap_update_sb(struct bitmap *bitmap)
+{
+	bitmap_super_t *sb;
+
+	if (bitmap == NULL)
+		return;
+	sb = page_address(bitmap->pages[0]);
+	sb->events = cpu_to_le64(bitmap->mddev->events);
+	set_bit(BITMAP_PAGE_NEEDWRITE, &bitmap->page_attr[0]);
+	bitmap_write_pages(bitmap, 1 << BITMAP_PAGE_NEEDWRITE);
+}
+
+/* a member was added: give it the whole bitmap */
+void bitmap_write_all(struct bitmap *bitmap)
+{
+	unsigned long i;
+
+	if (bitmap == NULL)
+		return;
+	for (i = 0; i < bitmap->nr_pages; i++)
+		set_bit(BITMAP_PAGE_NEEDWRITE, &bitmap->page_attr[i]);
+	bitmap_write_pages(bitmap, 1 << BITMAP_PAGE_NEEDWRITE);
+}
+
+void bitmap_startwrite(struct bitmap *bitmap, sector_t offset,
+		       unsigned long sectors)
+{
+	if (bitmap == NULL)
+		return;
+
+	while (sectors) {
+		bitmap_counter_t *bmc;
+		unsigned long chunk;
+		int blocks;
+
+		spin_lock_irq(&bitmap->lock);
+		bmc = bitmap_get_counter(bitmap, offset, &chunk, &blocks);
+		if (!bmc) {
+			spin_unlock_irq(&bitmap->lock);
+			return;
+		}
+
+		if (COUNTER(*bmc) == COUNTER_MAX) {
+			/* too many writes on this chunk, wait for some */
+			DEFINE_WAIT(wait);
+
+			prepare_to_wait(&bitmap->overflow_wait, &wait,
+					TASK_UNINTERRUPTIBLE);
+			spin_unlock_irq(&bitmap->lock);
+			bitmap->mddev->queue->unplug_fn(bitmap->mddev->queue);
+			schedule();
+			finish_wait(&bitmap->overflow_wait, &wait);
+			continue;
+		}
+
+		switch (COUNTER(*bmc)) {
+		case 0:
+			bitmap_set_chunk(bitmap, chunk);
+			*bmc += 2;
+			break;
+		case 1:
+			*bmc += 1;
+			break;
+		}
+		(*bmc)++;
+		spin_unlock_irq(&bitmap->lock);
+
+		offset += blocks;
+		if (sectors > blocks)
+			sectors -= blocks;
+		else
+			sectors = 0;
+	}
+}
+
+/*
+ * may be called from interrupt context.  A failed write leaves the chunk
+ * to be resynced, whatever happens to the member it failed on.
+ */
+void bitmap_endwrite(struct bitmap *bitmap, sector_t offset,
+		     unsigned long sectors, int success)
+{
+	if (bitmap == NULL)
+		return;
+
+	while (sectors) {
+		bitmap_counter_t *bmc;
+		unsigned long chunk, flags;
+		int blocks;
+
+		spin_lock_irqsave(&bitmap->lock, flags);
+		bmc = bitmap_get_counter(bitmap, offset, &chunk, &blocks);
+		if (!bmc) {
+			spin_unlock_irqrestore(&bitmap->lock, flags);
+			return;
+		}
+
+		if (!success)
+			*bmc |= NEEDED_MASK;
+		if (COUNTER(*bmc) == COUNTER_MAX)
+			wake_up(&bitmap->overflow_wait);
+		(*bmc)--;
+		if (COUNTER(*bmc) <= 2)
+			set_bit(BITMAP_PAGE_CLEAN,
+				&bitmap->page_attr[chunk_page(chunk)]);
+		spin_unlock_irqrestore(&bitmap->lock, flags);
+
+		offset += blocks;
+		if (sectors > blocks)
+			sectors -= blocks;
+		else
+			sectors = 0;
+	}
+}
+
+/*
+ * does the chunk at offset need resyncing?  *blocks is set to the sectors
+ * the answer holds for.  Without a bitmap everything does.
+ */
+int bitmap_start_sync(struct bitmap *bitmap, sector_t offset, int *blocks)
+{
+	bitmap_counter_t *bmc;
+	unsigned long chunk;
+	int rv = 1;
+
+	if (bitmap == NULL) {
+		*blocks = 1024;
+		return 1;
+	}
+
+	spin_lock_irq(&bitmap->lock);
+	bmc = bitmap_get_counter(bitmap, offset, &chunk, blocks);
+	if (!bmc)
+		*blocks = 1024;
+	else if (RESYNC(*bmc))
+		rv = 1;
+	else if (NEEDED(*bmc)) {
+		*bmc |= RESYNC_MASK;
+		*bmc &= ~NEEDED_MASK;
+	} else
+		rv = 0;
+	spin_unlock_irq(&bitmap->lock);
+	return rv;
+}
+
+/*
+ * the chunk at offset is resynced, or the resync was aborted in it and it
+ * stays NEEDED.
+ */
+void bitmap_end_sync(struct bitmap *bitmap, sector_t offset, int *blocks,
+		     int aborted)
+{
+	bitmap_counter_t *bmc;
+	unsigned long chunk, flags;
+
+	if (bitmap == NULL) {
+		*blocks = 1024;
+		return;
+	}
+
+	spin_lock_irqsave(&bitmap->lock, flags);
+	bmc = bitmap_get_counter(bitmap, offset, &chunk, blocks);
+	if (!bmc)
+		*blocks = 1024;
+	else if (RESYNC(*bmc)) {
+		*bmc &= ~RESYNC_MASK;
+		if (aborted)
+			*bmc |= NEEDED_MASK;
+		else if (*bmc <= 2) {
+			*bmc = 1;
+			set_bit(BITMAP_PAGE_CLEAN,
+				&bitmap->page_attr[chunk_page(chunk)]);
+		}
+	}
+	spin_unlock_irqrestore(&bitmap->lock, flags);
+}
+
+/* the resync has finished: every chunk it started on is in sync */
+void bitmap_close_sync(struct bitmap *bitmap)
+{
+	sector_t sector = 0;
+	int blocks;
+
+	if (bitmap == NULL)
+		return;
+	while (sector < bitmap->sync_size) {
+		bitmap_end_sync(bitmap, sector, &blocks, 0);
+		sector += blocks;
+	}
+}
+
+void bitmap_status(struct seq_file *seq, struct bitmap *bitmap)
+{
+	unsigned long dirty;
+
+	if (bitmap == NULL)
+		return;
+	spin_lock_irq(&bitmap->lock);
+	dirty = bitmap->dirty_bits;
+	spin_unlock_irq(&bitmap->lock);
+
+	seq_printf(seq, "\n      bitmap: %lu/%lu chunks dirty, %luKB chunk",
+		   dirty, bitmap->chunks, 1UL << (bitmap->chunkshift - 1));
+}
+
+static void bitmap_free(struct bitmap *bitmap)
+{
+	unsigned long i;
+
+	if (bitmap->pages) {
+		for (i = 0; i < bitmap->nr_pages; i++)
+			if (bitmap->pages[i])
+				__free_page(bitmap->pages[i]);
+		kfree(bitmap->pages);
+	}
+	if (bitmap->page_attr)
+		kfree(bitmap->page_attr);
+	if (bitmap->counters)
+		vfree(bitmap->counters);
+	kfree(bitmap);
+}
+
+/* the chunk size of a new bitmap: the smallest that fits the members */
+static unsigned long bitmap_new_chunksize(sector_t sync_size)
+{
+	unsigned long chunksize = BITMAP_MIN_CHUNK;
+
+	while (bitmap_chunks(sync_size, ffz(~(chunksize >> 9))) >
+	       (BITMAP_MAX_BYTES - sizeof(bitmap_super_t)) * 8)
+		chunksize <<= 1;
+	return chunksize;
+}
+
+/* read the bitmap header from a member; 0 if it is not one of ours */
+static int bitmap_read_sb(struct bitmap *bitmap, mdk_rdev_t *rdev)
+{
+	mddev_t *mddev = bitmap->mddev;
+	bitmap_super_t *sb = page_address(bitmap->pages[0]);
+	unsigned long chunksize;
+
+	if (!sync_page_io(rdev->bdev, (rdev->sb_offset << 1) +
+			  mddev->bitmap_offset, PAGE_SIZE,
+			  bitmap->pages[0], READ))
+		return 0;
+
+	chunksize = le32_to_cpu(sb->chunksize);
+	if (le32_to_cpu(sb->magic) != BITMAP_MAGIC ||
+	    le32_to_cpu(sb->version) != BITMAP_MAJOR ||
+	    memcmp(sb->uuid, mddev->uuid, 16) ||
+	    le64_to_cpu(sb->sync_size) != bitmap->sync_size ||
+	    chunksize < 512 || (chunksize & (chunksize - 1)))
+		return 0;
+	if (bitmap_chunks(bitmap->sync_size, ffz(~(chunksize >> 9))) >
+	    (BITMAP_MAX_BYTES - sizeof(bitmap_super_t)) * 8)
+		return 0;
+	return 1;
+}
+
+/*
+ * set up the bitmap of an array about to run, or running and quiesced:
+ * read it from the first in-sync member, or start a new one, and work
+ * out from it which chunks the coming resync has to cover.
+ */
+int bitmap_create(mddev_t *mddev)
+{
+	struct bitmap *bitmap;
+	bitmap_super_t *sb;
+	mdk_rdev_t *rdev, *src = NULL;
+	struct list_head *tmp;
+	unsigned long chunksize, chunk, i;
+	int valid = 0, stale = 0, all_dirty;
+
+	if (mddev->level != 1 && mddev->level != 4 && mddev->level != 5) {
+		printk(KERN_ERR "%s: write-intent bitmap needs raid1, "
+		       "raid4 or raid5\n", mdname(mddev));
+		return -EINVAL;
+	}
+	if (!mddev->persistent || mddev->major_version != 0) {
+		printk(KERN_ERR "%s: write-intent bitmap needs a 0.90 "
+		       "superblock\n", mdname(mddev));
+		return -EINVAL;
+	}
+
+	bitmap = kmalloc(sizeof(*bitmap), GFP_KERNEL);
+	if (!bitmap)
+		return -ENOMEM;
+	memset(bitmap, 0, sizeof(*bitmap));
+	bitmap->mddev = mddev;
+	bitmap->sync_size = (sector_t)mddev->size << 1;
+	spin_lock_init(&bitmap->lock);
+	init_waitqueue_head(&bitmap->overflow_wait);
+	init_waitqueue_head(&bitmap->write_wait);
+	init_MUTEX(&bitmap->write_sem);
+	atomic_set(&bitmap->pending_writes, 0);
+
+	/*
+	 * page 0 first, the header decides how many more there are; the
+	 * slots cover the largest bitmap, rounded up to whole pages
+	 */
+	bitmap->nr_pages = (BITMAP_MAX_BYTES + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	bitmap->pages = kmalloc(bitmap->nr_pages * sizeof(struct page *),
+				GFP_KERNEL);
+	bitmap->page_attr = kmalloc(bitmap->nr_pages * sizeof(unsigned long),
+				    GFP_KERNEL);
+	if (!bitmap->pages || !bitmap->page_attr)
+		goto nomem;
+	memset(bitmap->pages, 0, bitmap->nr_pages * sizeof(struct page *));
+	memset(bitmap->page_attr, 0,
+	       bitmap->nr_pages * sizeof(unsigned long));
+	bitmap->pages[0] = alloc_page(GFP_KERNEL);
+	if (!bitmap->pages[0])
+		goto nomem;
+
+	ITERATE_RDEV(mddev, rdev, tmp)
+		if (rdev->in_sync && !rdev->faulty) {
+			src = rdev;
+			break;
+		}
+	if (src)
+		valid = bitmap_read_sb(bitmap, src);
+
+	sb = page_address(bitmap->pages[0]);
+	if (valid) {
+		chunksize = le32_to_cpu(sb->chunksize);
+		bitmap->daemon_sleep = le32_to_cpu(sb->daemon_sleep);
+		if (bitmap->daemon_sleep < 1 || bitmap->daemon_sleep > 15)
+			bitmap->daemon_sleep = BITMAP_DAEMON_SLEEP;
+		stale = le64_to_cpu(sb->events) < mddev->events;
+	} else {
+		chunksize = bitmap_new_chunksize(bitmap->sync_size);
+		bitmap->daemon_sleep = BITMAP_DAEMON_SLEEP;
+		memset(sb, 0, PAGE_SIZE);
+		sb->magic = cpu_to_le32(BITMAP_MAGIC);
+		sb->version = cpu_to_le32(BITMAP_MAJOR);
+		memcpy(sb->uuid, mddev->uuid, 16);
+		sb->sync_size = cpu_to_le64(bitmap->sync_size);
+		sb->chunksize = cpu_to_le32(chunksize);
+		sb->daemon_sleep = cpu_to_le32(bitmap->daemon_sleep);
+	}
+	sb->events = cpu_to_le64(mddev->events);
+
+	bitmap->chunkshift = ffz(~(chunksize >> 9));
+	bitmap->chunks = bitmap_chunks(bitmap->sync_size, bitmap->chunkshift);
+	bitmap->bytes = (sizeof(bitmap_super_t) + (bitmap->chunks + 7) / 8 +
+			 511) & ~511UL;
+	bitmap->nr_pages = (bitmap->bytes + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+	for (i = 1; i < bitmap->nr_pages; i++) {
+		bitmap->pages[i] = alloc_page(GFP_KERNEL);
+		if (!bitmap->pages[i])
+			goto nomem;
+		if (!valid ||
+		    !sync_page_io(src->bdev, (src->sb_offset << 1) +
+				  mddev->bitmap_offset + (i << (PAGE_SHIFT - 9)),
+				  min(PAGE_SIZE, bitmap->bytes - i * PAGE_SIZE),
+				  bitmap->pages[i], READ)) {
+			/* a page we could not read says nothing */
+			memset(page_address(bitmap->pages[i]), 0, PAGE_SIZE);
+			if (valid)
+				stale = 1;
+		}
+	}
+
+	bitmap->counters = vmalloc(bitmap->chunks * sizeof(bitmap_counter_t));
+	if (!bitmap->counters)
+		goto nomem;
+	memset(bitmap->counters, 0, bitmap->chunks * sizeof(bitmap_counter_t));
+
+	/*
+	 * a bitmap we cannot trust, or a new one on an array that is not in
+	 * sync, covers everything.  Each set bit starts out idle, and needs
+	 * resyncing if the array was not shut down clean past it.
+	 */
+	all_dirty = stale || (!valid && mddev->recovery_cp != MaxSector);
+	for (chunk = 0; chunk < bitmap->chunks; chunk++) {
+		bitmap_counter_t *bmc = &bitmap->counters[chunk];
+		sector_t end = (sector_t)(chunk + 1) << bitmap->chunkshift;
+
+		if (all_dirty)
+			ext2_set_bit(chunk_offset(chunk),
+				     chunk_addr(bitmap, chunk));
+		else if (!ext2_test_bit(chunk_offset(chunk),
+					chunk_addr(bitmap, chunk)))
+			continue;
+
+		*bmc = 2;
+		bitmap->dirty_bits++;
+		if (mddev->recovery_cp != MaxSector &&
+		    end > mddev->recovery_cp)
+			*bmc |= NEEDED_MASK;
+		else
+			set_bit(BITMAP_PAGE_CLEAN,
+				&bitmap->page_attr[chunk_page(chunk)]);
+	}
+
+	mddev->bitmap = bitmap;
+	for (i = 0; i < bitmap->nr_pages; i++)
+		set_bit(BITMAP_PAGE_NEEDWRITE, &bitmap->page_attr[i]);
+	/* a read-only array writes it with its first write */
+	if (!mddev->ro)
+		bitmap_write_pages(bitmap, 1 << BITMAP_PAGE_NEEDWRITE);
+
+	printk(KERN_INFO "%s: %s bitmap, %lu of %lu %luKB chunks dirty\n",
+	       mdname(mddev), valid ? (stale ? "stale" : "loaded") : "new",
+	       bitmap->dirty_bits, bitmap->chunks, chunksize >> 10);
+	return 0;
+
+ nomem:
+	printk(KERN_ERR "%s: out of memory for the bitmap\n", mdname(mddev));
+	bitmap_free(bitmap);
+	return -ENOMEM;
+}
+
+void bitmap_destroy(mddev_t *mddev)
+{
+	struct bitmap *bitmap = mddev->bitmap;
+
+	if (bitmap == NULL)
+		return;
+	mddev->bitmap = NULL;
+	bitmap_free(bitmap);
+}
+
+EXPORT_SYMBOL(bitmap_startwrite);
+EXPORT_SYMBOL(bitmap_endwrite);
+EXPORT_SYMBOL(bitmap_start_sync);
+EXPORT_SYMBOL(bitmap_end_sync);
+EXPORT_SYMBOL(bitmap_close_sync);
+EXPORT_SYMBOL(bitmap_unplug);
@@ -13,7 +13,7 @@
 #include <linux/mempool.h>
 #include <linux/slab.h>
 #include <linux/crypto.h>
-#include <linux/workqueue.h>
+#include <linux/kthread.h>
 #include <asm/atomic.h>
 #include <asm/scatterlist.h>
 #include <asm/page.h>
@@ -29,7 +29,7 @@ struct crypt_io {
 	struct dm_target *target;
 	struct bio *bio;
 	struct bio *first_clone;
-	struct work_struct work;
+	struct list_head list;		/* on the kcryptd queue */
 	atomic_t pending;
 	int error;
 };
@@ -83,6 +83,16 @@ struct crypt_config {
 	unsigned int iv_size;
 
 	struct crypto_tfm *tfm;
+
+	/*
+	 * writes taken by kcryptd and not yet submitted, whether one
+	 * of them is a barrier, and the kcryptd scan in which a barrier
+	 * of ours was passed over; under _kcryptd_lock
+	 */
+	unsigned int writes_active;
+	int barrier_active;
+	unsigned long barrier_scan;
+
 	unsigned int key_size;
 	u8 key[0];
 };
@@ -90,6 +100,7 @@ struct crypt_config {
 #define MIN_IOS        256
 #define MIN_POOL_PAGES 32
 #define MIN_BIO_PAGES  8
+#define CRYPT_SG_MAX   16	/* bio_vecs converted per cipher call */
 
 static kmem_cache_t *_crypt_io_pool;
 
@@ -231,6 +242,25 @@ static struct crypt_iv_operations crypt_iv_essiv_ops = {
 };
 
 
+/*
+ * the IV of each sector of a crypt_convert_scatterlist() call
+ */
+struct crypt_iv_context {
+	struct crypt_config *cc;
+	sector_t sector;
+};
+
+static int crypt_iv_sector(void *data, u8 *iv, unsigned int n)
+{
+	struct crypt_iv_context *ivc = (struct crypt_iv_context *) data;
+
+	return ivc->cc->iv_gen_ops->generator(ivc->cc, iv, ivc->sector + n);
+}
+
+/*
+ * Convert length bytes of consecutive sectors, starting at sector,
+ * in one call into the cipher.
+ */
 static inline int
 crypt_convert_scatterlist(struct crypt_config *cc, struct scatterlist *out,
                           struct scatterlist *in, unsigned int length,
@@ -240,14 +270,19 @@ crypt_convert_scatterlist(struct crypt_config *cc, struct scatterlist *out,
 	int r;
 
 	if (cc->iv_gen_ops) {
-		r = cc->iv_gen_ops->generator(cc, iv, sector);
-		if (r < 0)
-			return r;
+		struct crypt_iv_context ivc = {
+			.cc = cc,
+			.sector = sector
+		};
 
 		if (write)
-			r = crypto_cipher_encrypt_iv(cc->tfm, out, in, length, iv);
+			r = crypto_cipher_encrypt_units(cc->tfm, out, in, length,
+			                                1 << SECTOR_SHIFT, iv,
+			                                crypt_iv_sector, &ivc);
 		else
-			r = crypto_cipher_decrypt_iv(cc->tfm, out, in, length, iv);
+			r = crypto_cipher_decrypt_units(cc->tfm, out, in, length,
+			                                1 << SECTOR_SHIFT, iv,
+			                                crypt_iv_sector, &ivc);
 	} else {
 		if (write)
 			r = crypto_cipher_encrypt(cc->tfm, out, in, length);
@@ -274,46 +309,81 @@ crypt_convert_init(struct crypt_config *cc, struct convert_context *ctx,
 }
 
 /*
- * Encrypt / decrypt data from one bio to another one (can be the same one)
+ * Map the next stretch of both bios, up to CRYPT_SG_MAX bio_vecs of
+ * either, onto scatterlists.  Returns the number of bytes mapped.
  */
-static int crypt_convert(struct crypt_config *cc,
-                         struct convert_context *ctx)
+static unsigned int crypt_convert_sg(struct convert_context *ctx,
+                                     struct scatterlist *sg_in,
+                                     struct scatterlist *sg_out)
 {
-	int r = 0;
+	struct scatterlist *in = NULL, *out = NULL;
+	unsigned int length = 0;
+	int nr_in = 0, nr_out = 0;
 
 	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 		struct bio_vec *bv_in = bio_iovec_idx(ctx->bio_in, ctx->idx_in);
 		struct bio_vec *bv_out = bio_iovec_idx(ctx->bio_out, ctx->idx_out);
-		struct scatterlist sg_in = {
-			.page = bv_in->bv_page,
-			.offset = bv_in->bv_offset + ctx->offset_in,
-			.length = 1 << SECTOR_SHIFT
-		};
-		struct scatterlist sg_out = {
-			.page = bv_out->bv_page,
-			.offset = bv_out->bv_offset + ctx->offset_out,
-			.length = 1 << SECTOR_SHIFT
-		};
+		unsigned int len = min(bv_in->bv_len - ctx->offset_in,
+		                       bv_out->bv_len - ctx->offset_out);
+
+		if ((!in && nr_in == CRYPT_SG_MAX) ||
+		    (!out && nr_out == CRYPT_SG_MAX))
+			break;
+
+		if (!in) {
+			in = &sg_in[nr_in++];
+			in->page = bv_in->bv_page;
+			in->offset = bv_in->bv_offset + ctx->offset_in;
+			in->length = 0;
+		}
+		if (!out) {
+			out = &sg_out[nr_out++];
+			out->page = bv_out->bv_page;
+			out->offset = bv_out->bv_offset + ctx->offset_out;
+			out->length = 0;
+		}
 
-		ctx->offset_in += sg_in.length;
+		in->length += len;
+		out->length += len;
+		length += len;
+
+		ctx->offset_in += len;
 		if (ctx->offset_in >= bv_in->bv_len) {
 			ctx->offset_in = 0;
 			ctx->idx_in++;
+			in = NULL;
 		}
 
-		ctx->offset_out += sg_out.length;
+		ctx->offset_out += len;
 		if (ctx->offset_out >= bv_out->bv_len) {
 			ctx->offset_out = 0;
 			ctx->idx_out++;
+			out = NULL;
 		}
+	}
+
+	return length;
+}
 
-		r = crypt_convert_scatterlist(cc, &sg_out, &sg_in, sg_in.length,
+/*
+ * Encrypt / decrypt data from one bio to another one (can be the same one)
+ */
+static int crypt_convert(struct crypt_config *cc,
+                         struct convert_context *ctx)
+{
+	struct scatterlist sg_in[CRYPT_SG_MAX];
+	struct scatterlist sg_out[CRYPT_SG_MAX];
+	unsigned int length;
+	int r = 0;
+
+	while((length = crypt_convert_sg(ctx, sg_in, sg_out))) {
+		r = crypt_convert_scatterlist(cc, sg_out, sg_in, length,
 		                              ctx->write, ctx->sector);
 		if (r < 0)
 			break;
 
-		ctx->sector++;
+		ctx->sector += length >> SECTOR_SHIFT;
 	}
 
 	return r;
@@ -459,33 +529,166 @@ static void dec_pending(struct crypt_io *io, int error)
 	mempool_free(io, cc->io_pool);
 }
 
+static void crypt_dispatch_io(struct crypt_io *io);
+
 /*
  * kcryptd:
  *
- * Needed because it would be very unwise to do decryption in an
- * interrupt context, so bios returning from read requests get
- * queued here.
+ * A pool of threads, one per cpu online at load time, that decrypt the
+ * reads and encrypt the writes.  Reads are queued here because it would
+ * be very unwise to decrypt in interrupt context, and they would all be
+ * decrypted on whichever cpu takes the disk's interrupts otherwise.
+ * Writes are queued here rather than encrypted in crypt_map(), so that a
+ * single writer is spread over all cpus too.  The threads are not bound
+ * to cpus; the scheduler spreads them out.
+ *
+ * The writes of a target are encrypted and submitted in parallel, in
+ * whatever order they finish, except around a barrier: a barrier is not
+ * taken until every write queued before it has been submitted, and no
+ * write queued after it is taken until it has been submitted.
+ */
+#define KCRYPTD_MAX	32
+
+static struct task_struct *_kcryptd_tasks[KCRYPTD_MAX];
+static int _kcryptd_nr;
+static LIST_HEAD(_kcryptd_ios);
+static unsigned long _kcryptd_scan;
+static DEFINE_SPINLOCK(_kcryptd_lock);
+static DECLARE_WAIT_QUEUE_HEAD(_kcryptd_wait);
+
+static void kcryptd_queue_io(struct crypt_io *io)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&_kcryptd_lock, flags);
+	list_add_tail(&io->list, &_kcryptd_ios);
+	spin_unlock_irqrestore(&_kcryptd_lock, flags);
+
+	wake_up(&_kcryptd_wait);
+}
+
+/*
+ * Take the first io that may be handled now off the queue.
+ * Called with _kcryptd_lock held.
  */
-static struct workqueue_struct *_kcryptd_workqueue;
+static struct crypt_io *kcryptd_dequeue(void)
+{
+	struct crypt_io *io;
+
+	_kcryptd_scan++;
+	list_for_each_entry(io, &_kcryptd_ios, list) {
+		struct crypt_config *cc =
+			(struct crypt_config *) io->target->private;
+
+		if (bio_data_dir(io->bio) == WRITE) {
+			if (cc->barrier_active ||
+			    cc->barrier_scan == _kcryptd_scan)
+				continue;
+
+			if (bio_barrier(io->bio)) {
+				if (cc->writes_active) {
+					/* keeps the writes behind it back */
+					cc->barrier_scan = _kcryptd_scan;
+					continue;
+				}
+				cc->barrier_active = 1;
+			}
+			cc->writes_active++;
+		}
+
+		list_del(&io->list);
 
-static void kcryptd_do_work(void *data)
+		/* there may be more for the others */
+		if (!list_empty(&_kcryptd_ios))
+			wake_up(&_kcryptd_wait);
+		return io;
+	}
+
+	return NULL;
+}
+
+static void kcryptd_do_work(struct crypt_io *io)
 {
-	struct crypt_io *io = (struct crypt_io *) data;
 	struct crypt_config *cc = (struct crypt_config *) io->target->private;
 	struct convert_context ctx;
 	int r;
 
-	crypt_convert_init(cc, &ctx, io->bio, io->bio,
-	                   io->bio->bi_sector - io->target->begin, 0);
-	r = crypt_convert(cc, &ctx);
+	if (bio_data_dir(io->bio) == READ) {
+		crypt_convert_init(cc, &ctx, io->bio, io->bio,
+		                   io->bio->bi_sector - io->target->begin, 0);
+		r = crypt_convert(cc, &ctx);
 
-	dec_pending(io, r);
+		dec_pending(io, r);
+		return;
+	}
+
+	/*
+	 * Keep the original bio from completing until we are done with
+	 * cc: once it has, a suspend can finish and crypt_dtr() free it.
+	 */
+	atomic_inc(&io->pending);
+	crypt_dispatch_io(io);
+
+	/* our caller rescans the queue for anything this lets through */
+	spin_lock_irq(&_kcryptd_lock);
+	cc->writes_active--;
+	if (bio_barrier(io->bio))
+		cc->barrier_active = 0;
+	spin_unlock_irq(&_kcryptd_lock);
+
+	dec_pending(io, 0);
 }
 
-static void kcryptd_queue_io(struct crypt_io *io)
+static int kcryptd(void *data)
+{
+	DEFINE_WAIT(wait);
+	struct crypt_io *io;
+
+	/* writes to swap on an encrypted device go through us */
+	current->flags |= PF_NOFREEZE;
+
+	while (!kthread_should_stop()) {
+		prepare_to_wait_exclusive(&_kcryptd_wait, &wait,
+		                          TASK_INTERRUPTIBLE);
+
+		spin_lock_irq(&_kcryptd_lock);
+		io = kcryptd_dequeue();
+		spin_unlock_irq(&_kcryptd_lock);
+
+		if (!io && !kthread_should_stop())
+			schedule();
+		finish_wait(&_kcryptd_wait, &wait);
+
+		if (io)
+			kcryptd_do_work(io);
+	}
+
+	return 0;
+}
+
+static void kcryptd_stop(void)
 {
-	INIT_WORK(&io->work, kcryptd_do_work, io);
-	queue_work(_kcryptd_workqueue, &io->work);
+	while (_kcryptd_nr)
+		kthread_stop(_kcryptd_tasks[--_kcryptd_nr]);
+}
+
+static int kcryptd_start(void)
+{
+	int nr = min(num_online_cpus(), KCRYPTD_MAX);
+
+	while (_kcryptd_nr < nr) {
+		struct task_struct *p;
+
+		p = kthread_create(kcryptd, NULL, "kcryptd/%d", _kcryptd_nr);
+		if (IS_ERR(p)) {
+			kcryptd_stop();
+			return PTR_ERR(p);
+		}
+		_kcryptd_tasks[_kcryptd_nr++] = p;
+		wake_up_process(p);
+	}
+
+	return 0;
 }
 
 /*
@@ -607,6 +810,9 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	}
 
 	cc->tfm = tfm;
+	cc->writes_active = 0;
+	cc->barrier_active = 0;
+	cc->barrier_scan = 0;
 
 	/*
 	 * Choose ivmode. Valid modes: "plain", "essiv:<esshash>".
@@ -800,22 +1006,22 @@ crypt_clone(struct crypt_config *cc, struct crypt_io *io, struct bio *bio,
 	return clone;
 }
 
-static int crypt_map(struct dm_target *ti, struct bio *bio,
-		     union map_info *map_context)
+/*
+ * Clone the bio onto the device, encrypting writes on the way, and
+ * submit the clones.  Reads are dispatched from crypt_map(), writes
+ * from kcryptd.
+ */
+static void crypt_dispatch_io(struct crypt_io *io)
 {
+	struct dm_target *ti = io->target;
 	struct crypt_config *cc = (struct crypt_config *) ti->private;
-	struct crypt_io *io = mempool_alloc(cc->io_pool, GFP_NOIO);
+	struct bio *bio = io->bio;
 	struct convert_context ctx;
 	struct bio *clone;
 	unsigned int remaining = bio->bi_size;
 	sector_t sector = bio->bi_sector - ti->begin;
 	unsigned int bvec_idx = 0;
-
-	io->target = ti;
-	io->bio = bio;
-	io->first_clone = NULL;
-	io->error = 0;
-	atomic_set(&io->pending, 1); /* hold a reference */
+	int error = 0;
 
 	if (bio_data_dir(bio) == WRITE)
 		crypt_convert_init(cc, &ctx, NULL, bio, sector, 1);
@@ -826,8 +1032,10 @@ static int crypt_map(struct dm_target *ti, struct bio *bio,
 	 */
 	while (remaining) {
 		clone = crypt_clone(cc, io, bio, sector, &bvec_idx, &ctx);
-		if (!clone)
-			goto cleanup;
+		if (!clone) {
+			error = -ENOMEM;
+			break;
+		}
 
 		if (!io->first_clone) {
 			/*
@@ -850,19 +1058,31 @@ static int crypt_map(struct dm_target *ti, struct bio *bio,
 			blk_congestion_wait(bio_data_dir(clone), HZ/100);
 	}
 
-	/* drop reference, clones could have returned before we reach this */
-	dec_pending(io, 0);
-	return 0;
+	/*
+	 * drop reference, clones could have returned before we reach this;
+	 * if none was dispatched this fails the bio
+	 */
+	dec_pending(io, error);
+}
 
-cleanup:
-	if (io->first_clone) {
-		dec_pending(io, -ENOMEM);
-		return 0;
-	}
+static int crypt_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct crypt_config *cc = (struct crypt_config *) ti->private;
+	struct crypt_io *io = mempool_alloc(cc->io_pool, GFP_NOIO);
 
-	/* if no bio has been dispatched yet, we can directly return the error */
-	mempool_free(io, cc->io_pool);
-	return -ENOMEM;
+	io->target = ti;
+	io->bio = bio;
+	io->first_clone = NULL;
+	io->error = 0;
+	atomic_set(&io->pending, 1); /* hold a reference */
+
+	if (bio_data_dir(bio) == WRITE)
+		kcryptd_queue_io(io);
+	else
+		crypt_dispatch_io(io);
+
+	return 0;
 }
 
 static int crypt_status(struct dm_target *ti, status_type_t type,
@@ -938,10 +1158,9 @@ static int __init dm_crypt_init(void)
 	if (!_crypt_io_pool)
 		return -ENOMEM;
 
-	_kcryptd_workqueue = create_workqueue("kcryptd");
-	if (!_kcryptd_workqueue) {
-		r = -ENOMEM;
-		DMERR(PFX "couldn't create kcryptd");
+	r = kcryptd_start();
+	if (r < 0) {
+		DMERR(PFX "couldn't start kcryptd");
 		goto bad1;
 	}
 
@@ -954,7 +1173,7 @@ static int __init dm_crypt_init(void)
 	return 0;
 
 bad2:
-	destroy_workqueue(_kcryptd_workqueue);
+	kcryptd_stop();
 bad1:
 	kmem_cache_destroy(_crypt_io_pool);
 	return r;
@@ -967,7 +1186,7 @@ static void __exit dm_crypt_exit(void)
 	if (r < 0)
 		DMERR(PFX "unregister failed %d", r);
 
-	destroy_workqueue(_kcryptd_workqueue);
+	kcryptd_stop();
 	kmem_cache_destroy(_crypt_io_pool);
 }
 
@@ -33,6 +33,7 @@
 #include <linux/config.h>
 #include <linux/linkage.h>
 #include <linux/raid/md.h>
+#include <linux/raid/bitmap.h>
 #include <linux/sysctl.h>
 #include <linux/devfs_fs_kernel.h>
 #include <linux/buffer_head.h> /* for invalidate_bdev */
@@ -329,7 +330,7 @@ static int bi_complete(struct bio *bio, unsigned int bytes_done, int error)
 	return 0;
 }
 
-static int sync_page_io(struct block_device *bdev, sector_t sector, int size,
+int sync_page_io(struct block_device *bdev, sector_t sector, int size,
 		   struct page *page, int rw)
 {
 	struct bio *bio = bio_alloc(GFP_KERNEL, 1);
@@ -599,6 +600,11 @@ static int super_90_validate(mddev_t *mddev, mdk_rdev_t *rdev)
 		memcpy(mddev->uuid+12,&sb->set_uuid3, 4);
 
 		mddev->max_disks = MD_SB_DISKS;
+
+		mddev->default_bitmap_offset = MD_SB_BYTES >> 9;
+		mddev->bitmap_offset = 0;
+		if (sb->state & (1<<MD_SB_BITMAP_PRESENT))
+			mddev->bitmap_offset = mddev->default_bitmap_offset;
 	} else {
 		__u64 ev1;
 		ev1 = md_event(sb);
@@ -679,6 +685,8 @@ static void super_90_sync(mddev_t *mddev, mdk_rdev_t *rdev)
 			sb->state = (1<< MD_SB_CLEAN);
 	} else
 		sb->recovery_cp = 0;
+	if (mddev->bitmap)
+		sb->state |= (1<<MD_SB_BITMAP_PRESENT);
 
 	sb->layout = mddev->layout;
 	sb->chunk_size = mddev->chunk_size;
@@ -1275,6 +1283,12 @@ repeat:
 	if (!mddev->persistent)
 		return;
 
+	/*
+	 * the bitmap carries the event count too; write it first so that
+	 * it is never older than the superblocks that point to it
+	 */
+	bitmap_update_sb(mddev->bitmap);
+
 	dprintk(KERN_INFO 
 		"md: updating %s RAID superblock on device (in sync %d)\n",
 		mdname(mddev),mddev->in_sync);
@@ -1619,13 +1633,27 @@ static int do_md_run(mddev_t * mddev)
 
 	mddev->resync_max_sectors = mddev->size << 1; /* may be over-ridden by personality */
 
+	/* ȼλͼԻģrunоͿõ */
+	if (mddev->bitmap_offset) {
+		err = bitmap_create(mddev);
+		if (err) {
+			module_put(mddev->pers->owner);
+			mddev->pers = NULL;
+			return err;
+		}
+	}
+
 	err = mddev->pers->run(mddev);/* صRAIDRUN豸 */
 	if (err) {
 		printk(KERN_ERR "md: pers->run() failed ...\n");
 		module_put(mddev->pers->owner);
 		mddev->pers = NULL;
+		bitmap_destroy(mddev);
 		return -EINVAL;
 	}
+	/* ̶߳пλ */
+	if (mddev->bitmap && mddev->thread)
+		mddev->thread->timeout = mddev->bitmap->daemon_sleep * HZ;
  	atomic_set(&mddev->writes_pending,0);
 	mddev->safemode = 0;
 	mddev->safemode_timer.function = md_safemode_timeout;
@@ -1714,6 +1742,10 @@ static int do_md_stop(mddev_t * mddev, int ro)
 
 		invalidate_partition(disk, 0);
 
+		/* ûдˣλͼеλ */
+		if (!mddev->ro)
+			bitmap_flush(mddev);
+
 		if (ro) {
 			err  = -ENXIO;
 			if (mddev->ro)
@@ -1744,6 +1776,9 @@ static int do_md_stop(mddev_t * mddev, int ro)
 		struct gendisk *disk;
 		printk(KERN_INFO "md: %s stopped.\n", mdname(mddev));
 
+		bitmap_destroy(mddev);
+		mddev->bitmap_offset = 0;
+
 		export_array(mddev);
 
 		mddev->array_size = 0;
@@ -1983,6 +2018,8 @@ static int get_array_info(mddev_t * mddev, void __user * arg)
 	info.state         = 0;
 	if (mddev->in_sync)
 		info.state = (1<<MD_SB_CLEAN);
+	if (mddev->bitmap)
+		info.state |= (1<<MD_SB_BITMAP_PRESENT);
 	info.active_disks  = active;
 	info.working_disks = working;
 	info.failed_disks  = failed;
@@ -2336,6 +2373,12 @@ static int set_array_info(mddev_t * mddev, mdu_array_info_t *info)
 
 	mddev->max_disks     = MD_SB_DISKS;
 
+	/* λͼڳ֮ */
+	mddev->default_bitmap_offset = MD_SB_BYTES >> 9;
+	mddev->bitmap_offset = 0;
+	if (info->state & (1<<MD_SB_BITMAP_PRESENT))
+		mddev->bitmap_offset = mddev->default_bitmap_offset;
+
 	mddev->sb_dirty      = 1;
 
 	/*
@@ -2372,9 +2415,54 @@ static int update_array_info(mddev_t *mddev, mdu_array_info_t *info)
 	if (mddev->size != info->size) cnt++;
 	if (mddev->raid_disks != info->raid_disks) cnt++;
 	if (mddev->layout != info->layout) cnt++;
+	if ((mddev->bitmap != NULL) !=
+	    ((info->state & (1<<MD_SB_BITMAP_PRESENT)) != 0)) cnt++;
 	if (cnt == 0) return 0;
 	if (cnt > 1) return -EINVAL;
 
+	/* the bitmap maps each member as it is laid out now: on raid4/5
+	 * the layout and the number of disks must stay, and on any level
+	 * the size
+	 */
+	if (mddev->bitmap &&
+	    (mddev->size != info->size ||
+	     (mddev->level != 1 && (mddev->layout != info->layout ||
+				    mddev->raid_disks != info->raid_disks))))
+		return -EBUSY;
+
+	if ((mddev->bitmap != NULL) !=
+	    ((info->state & (1<<MD_SB_BITMAP_PRESENT)) != 0)) {
+		/* add or remove the write-intent bitmap, with no requests
+		 * in flight that it should know about
+		 */
+		if (mddev->pers->quiesce == NULL)
+			return -EINVAL;
+		if (test_bit(MD_RECOVERY_RUNNING, &mddev->recovery) ||
+		    mddev->sync_thread)
+			return -EBUSY;
+		if (info->state & (1<<MD_SB_BITMAP_PRESENT)) {
+			mddev->bitmap_offset = mddev->default_bitmap_offset;
+			mddev->pers->quiesce(mddev, 1);
+			rv = bitmap_create(mddev);
+			mddev->pers->quiesce(mddev, 0);
+			if (rv) {
+				mddev->bitmap_offset = 0;
+				return rv;
+			}
+			mddev->thread->timeout =
+				mddev->bitmap->daemon_sleep * HZ;
+		} else {
+			mddev->pers->quiesce(mddev, 1);
+			bitmap_destroy(mddev);
+			mddev->pers->quiesce(mddev, 0);
+			mddev->bitmap_offset = 0;
+			mddev->thread->timeout = MAX_SCHEDULE_TIMEOUT;
+		}
+		/* MD_SB_BITMAP_PRESENT has to reach the disks now */
+		md_update_sb(mddev);
+		return 0;
+	}
+
 	if (mddev->layout != info->layout) {
 		/* Change layout
 		 * we don't need to do anything at the md level, the
@@ -2802,8 +2890,9 @@ int md_thread(void * arg)
 	while (thread->run) {
 		void (*run)(mddev_t *);
 
-		wait_event_interruptible(thread->wqueue,
-					 test_bit(THREAD_WAKEUP, &thread->flags));
+		wait_event_interruptible_timeout(thread->wqueue,
+						 test_bit(THREAD_WAKEUP, &thread->flags),
+						 thread->timeout);
 		if (current->flags & PF_FREEZE)
 			refrigerator(PF_FREEZE);
 
@@ -2849,6 +2938,7 @@ mdk_thread_t *md_register_thread(void (*run) (mddev_t *), mddev_t *mddev,
 	thread->run = run;
 	thread->mddev = mddev;
 	thread->name = name;
+	thread->timeout = MAX_SCHEDULE_TIMEOUT;
 	ret = kernel_thread(md_thread, thread, 0);
 	if (ret < 0) {
 		kfree(thread);
@@ -3107,6 +3197,7 @@ static int md_seq_show(struct seq_file *seq, void *v)
 				status_resync (seq, mddev);
 			else if (mddev->curr_resync == 1 || mddev->curr_resync == 2)
 				seq_printf(seq, "	resync=DELAYED");
+			bitmap_status(seq, mddev->bitmap);
 		}
 
 		seq_printf(seq, "\n");
@@ -3280,9 +3371,13 @@ static void md_do_sync(mddev_t *mddev)
 	sector_t max_sectors,j;
 	unsigned long mark[SYNC_MARKS];
 	sector_t mark_cnt[SYNC_MARKS];
+	/* ʵʶдĿ鲻ͬٶ */
+	sector_t io_mark_cnt[SYNC_MARKS];
+	sector_t io_sectors, io_resync_mark_cnt;
 	int last_mark,m;
 	struct list_head *tmp;
 	sector_t last_check;
+	int skipped = 0;
 
 	/* just incase thread restarts... */
 	if (test_bit(MD_RECOVERY_DONE, &mddev->recovery))
@@ -3367,13 +3462,16 @@ static void md_do_sync(mddev_t *mddev)
 		j = mddev->recovery_cp;
 	else
 		j = 0;
+	io_sectors = 0;
 	for (m = 0; m < SYNC_MARKS; m++) {
 		mark[m] = jiffies;
 		mark_cnt[m] = j;
+		io_mark_cnt[m] = 0;
 	}
 	last_mark = 0;
 	mddev->resync_mark = mark[last_mark];
 	mddev->resync_mark_cnt = mark_cnt[last_mark];
+	io_resync_mark_cnt = io_mark_cnt[last_mark];
 
 	/*
 	 * Tune reconstruction:
@@ -3396,12 +3494,18 @@ static void md_do_sync(mddev_t *mddev)
 	while (j < max_sectors) {
 		int sectors;
 
-		sectors = mddev->pers->sync_request(mddev, j, currspeed < sysctl_speed_limit_min);
+		skipped = 0;
+		sectors = mddev->pers->sync_request(mddev, j, &skipped,
+					currspeed < sysctl_speed_limit_min);
 		if (sectors < 0) {
 			set_bit(MD_RECOVERY_ERR, &mddev->recovery);
 			goto out;
 		}
-		atomic_add(sectors, &mddev->recovery_active);
+		/* a chunk the bitmap says is in sync is skipped without IO */
+		if (!skipped) {
+			atomic_add(sectors, &mddev->recovery_active);
+			io_sectors += sectors;
+		}
 		j += sectors;
 		if (j>1) mddev->curr_resync = j;
 
@@ -3421,8 +3525,10 @@ static void md_do_sync(mddev_t *mddev)
 
 			mddev->resync_mark = mark[next];
 			mddev->resync_mark_cnt = mark_cnt[next];
+			io_resync_mark_cnt = io_mark_cnt[next];
 			mark[next] = jiffies;
 			mark_cnt[next] = j - atomic_read(&mddev->recovery_active);
+			io_mark_cnt[next] = io_sectors - atomic_read(&mddev->recovery_active);
 			last_mark = next;
 		}
 
@@ -3449,7 +3555,7 @@ static void md_do_sync(mddev_t *mddev)
 		mddev->queue->unplug_fn(mddev->queue);
 		cond_resched();
 
-		currspeed = ((unsigned long)(j-mddev->resync_mark_cnt))/2/((jiffies-mddev->resync_mark)/HZ +1) +1;
+		currspeed = ((unsigned long)(io_sectors-io_resync_mark_cnt))/2/((jiffies-mddev->resync_mark)/HZ +1) +1;
 
 		if (currspeed > sysctl_speed_limit_min) {
 			if ((currspeed > sysctl_speed_limit_max) ||
@@ -3469,7 +3575,7 @@ static void md_do_sync(mddev_t *mddev)
 	wait_event(mddev->recovery_wait, !atomic_read(&mddev->recovery_active));
 
 	/* tell personality that we are finished */
-	mddev->pers->sync_request(mddev, max_sectors, 1);
+	mddev->pers->sync_request(mddev, max_sectors, &skipped, 1);
 
 	if (!test_bit(MD_RECOVERY_ERR, &mddev->recovery) &&
 	    mddev->curr_resync > 2 &&
@@ -3527,11 +3633,13 @@ void md_check_recovery(mddev_t *mddev)
 	if ( ! (
 		mddev->sb_dirty ||
 		test_bit(MD_RECOVERY_NEEDED, &mddev->recovery) ||
-		test_bit(MD_RECOVERY_DONE, &mddev->recovery)
+		test_bit(MD_RECOVERY_DONE, &mddev->recovery) ||
+		bitmap_daemon_due(mddev->bitmap)
 		))
 		return;
 	if (mddev_trylock(mddev)==0) {
 		int spares =0;
+		bitmap_daemon_work(mddev->bitmap);
 		if (mddev->sb_dirty)
 			md_update_sb(mddev);
 		if (test_bit(MD_RECOVERY_RUNNING, &mddev->recovery) &&
@@ -3578,9 +3686,11 @@ void md_check_recovery(mddev_t *mddev)
 			ITERATE_RDEV(mddev,rdev,rtmp)
 				if (rdev->raid_disk < 0
 				    && !rdev->faulty) {
-					if (mddev->pers->hot_add_disk(mddev,rdev))
+					if (mddev->pers->hot_add_disk(mddev,rdev)) {
 						spares++;
-					else
+						/* ³Աϻûλͼ */
+						bitmap_write_all(mddev->bitmap);
+					} else
 						break;
 				}
 		}
@@ -3789,3 +3899,4 @@ EXPORT_SYMBOL(md_wakeup_thread);
 EXPORT_SYMBOL(md_print_devices);
 EXPORT_SYMBOL(md_check_recovery);
 MODULE_LICENSE("GPL");
+MODULE_ALIAS("md");
@@ -22,7 +22,9 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include "dm-bio-list.h"
 #include <linux/raid/raid1.h>
+#include <linux/raid/bitmap.h>
 
 /*
  * Number of guaranteed r1bios in case of extreme VM load:
@@ -309,6 +311,10 @@ static int raid1_end_write_request(struct bio *bio, unsigned int bytes_done, int
 	 * already.
 	 */
 	if (atomic_dec_and_test(&r1_bio->remaining)) {
+		/* a write that failed everywhere leaves its chunk to resync */
+		bitmap_endwrite(r1_bio->mddev->bitmap, r1_bio->sector,
+				r1_bio->sectors,
+				test_bit(R1BIO_Uptodate, &r1_bio->state));
 		md_write_end(r1_bio->mddev);
 		raid_end_bio_io(r1_bio);
 	}
@@ -447,7 +453,12 @@ static void unplug_slaves(mddev_t *mddev)
 
 static void raid1_unplug(request_queue_t *q)
 {
-	unplug_slaves(q->queuedata);
+	mddev_t *mddev = q->queuedata;
+
+	unplug_slaves(mddev);
+	/* writes held back for the bitmap are issued by raid1d */
+	if (mddev->bitmap)
+		md_wakeup_thread(mddev->thread);
 }
 
 static int raid1_issue_flush(request_queue_t *q, struct gendisk *disk,
@@ -494,7 +505,7 @@ static void device_barrier(conf_t *conf, sector_t sect)
 	
 	if (!conf->barrier++) {
 		wait_event_lock_irq(conf->wait_idle, !conf->nr_pending,
-				    conf->resync_lock, unplug_slaves(conf->mddev));
+				    conf->resync_lock, raid1_unplug(conf->mddev->queue));
 		if (conf->nr_pending)
 			BUG();
 	}
@@ -512,6 +523,8 @@ static int make_request(request_queue_t *q, struct bio * bio)
 	r1bio_t *r1_bio;
 	struct bio *read_bio;
 	int i, disks;
+	struct bio_list bl;
+	unsigned long flags;
 
 	/*
 	 * Register the new request and wait if the reconstruction
@@ -596,6 +609,8 @@ static int make_request(request_queue_t *q, struct bio * bio)
 
 	atomic_set(&r1_bio->remaining, 1);
 	md_write_start(mddev);
+	bitmap_startwrite(mddev->bitmap, bio->bi_sector, r1_bio->sectors);
+	bio_list_init(&bl);
 	for (i = 0; i < disks; i++) {
 		struct bio *mbio;
 		if (!r1_bio->bios[i])
@@ -611,10 +626,26 @@ static int make_request(request_queue_t *q, struct bio * bio)
 		mbio->bi_private = r1_bio;
 
 		atomic_inc(&r1_bio->remaining);
-		generic_make_request(mbio);
+		if (mddev->bitmap)
+			bio_list_add(&bl, mbio);
+		else
+			generic_make_request(mbio);
+	}
+
+	/* with a bitmap the writes wait in raid1d for its bits to be on
+	 * disk; plugging the queue gathers more writes behind one bitmap
+	 * update
+	 */
+	if (bl.head) {
+		spin_lock_irqsave(&conf->device_lock, flags);
+		bio_list_merge(&conf->pending_bio_list, &bl);
+		blk_plug_device(mddev->queue);
+		spin_unlock_irqrestore(&conf->device_lock, flags);
 	}
 
 	if (atomic_dec_and_test(&r1_bio->remaining)) {
+		bitmap_endwrite(mddev->bitmap, r1_bio->sector, r1_bio->sectors,
+				test_bit(R1BIO_Uptodate, &r1_bio->state));
 		md_write_end(mddev);
 		raid_end_bio_io(r1_bio);
 	}
@@ -920,6 +951,22 @@ static void raid1d(mddev_t *mddev)
 	for (;;) {
 		char b[BDEVNAME_SIZE];
 		spin_lock_irqsave(&conf->device_lock, flags);
+		if (conf->pending_bio_list.head) {
+			bio = bio_list_get(&conf->pending_bio_list);
+			blk_remove_plug(mddev->queue);
+			spin_unlock_irqrestore(&conf->device_lock, flags);
+			/* the bits for these writes go to disk first */
+			bitmap_unplug(mddev->bitmap);
+
+			while (bio) {
+				struct bio *next = bio->bi_next;
+				bio->bi_next = NULL;
+				generic_make_request(bio);
+				bio = next;
+			}
+			unplug = 1;
+			continue;
+		}
 		if (list_empty(head))
 			break;
 		r1_bio = list_entry(head->prev, r1bio_t, retry_list);
@@ -993,7 +1040,7 @@ static int init_resync(conf_t *conf)
  * that can be installed to exclude normal IO requests.
  */
 
-static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
+static int sync_request(mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster)
 {
 	conf_t *conf = mddev_to_conf(mddev);
 	mirror_info_t *mirror;
@@ -1003,6 +1050,7 @@ static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
 	int disk;
 	int i;
 	int write_targets = 0;
+	int sync_blocks;
 
 	if (!conf->r1buf_pool)
 		if (init_resync(conf))
@@ -1010,10 +1058,26 @@ static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
 
 	max_sector = mddev->size << 1;
 	if (sector_nr >= max_sector) {
+		/* the chunk an interrupted resync stopped in has to be
+		 * done again; the ones before it are in sync
+		 */
+		if (mddev->curr_resync < max_sector)
+			bitmap_end_sync(mddev->bitmap, mddev->curr_resync,
+					&sync_blocks, 1);
+		bitmap_close_sync(mddev->bitmap);
 		close_sync(conf);
 		return 0;
 	}
 
+	/* a resync skips the chunks the bitmap has clean; a recovery
+	 * rebuilds everything
+	 */
+	if (!bitmap_start_sync(mddev->bitmap, sector_nr, &sync_blocks) &&
+	    test_bit(MD_RECOVERY_SYNC, &mddev->recovery)) {
+		*skipped = 1;
+		return sync_blocks;
+	}
+
 	/*
 	 * If there is non-resync activity waiting for us then
 	 * put in a delay to throttle resync.
@@ -1212,6 +1276,7 @@ static int run(mddev_t *mddev)
 	conf->mddev = mddev;
 	spin_lock_init(&conf->device_lock);
 	INIT_LIST_HEAD(&conf->retry_list);
+	bio_list_init(&conf->pending_bio_list);
 	if (conf->working_disks == 1)
 		mddev->recovery_cp = MaxSector;
 
@@ -1369,7 +1434,7 @@ static int raid1_reshape(mddev_t *mddev, int raid_disks)
 	spin_lock_irq(&conf->resync_lock);
 	conf->barrier++;
 	wait_event_lock_irq(conf->wait_idle, !conf->nr_pending,
-			    conf->resync_lock, unplug_slaves(mddev));
+			    conf->resync_lock, raid1_unplug(mddev->queue));
 	spin_unlock_irq(&conf->resync_lock);
 
 	/* ok, everything is stopped */
@@ -1399,6 +1464,31 @@ static int raid1_reshape(mddev_t *mddev, int raid_disks)
 	return 0;
 }
 
+static void raid1_quiesce(mddev_t *mddev, int state)
+{
+	conf_t *conf = mddev_to_conf(mddev);
+
+	switch(state) {
+	case 1:
+		/* hold new requests at the barrier and wait for the
+		 * ones in flight, as raid1_reshape does
+		 */
+		spin_lock_irq(&conf->resync_lock);
+		conf->barrier++;
+		wait_event_lock_irq(conf->wait_idle, !conf->nr_pending,
+				    conf->resync_lock, raid1_unplug(mddev->queue));
+		spin_unlock_irq(&conf->resync_lock);
+		break;
+	case 0:
+		spin_lock_irq(&conf->resync_lock);
+		conf->barrier--;
+		spin_unlock_irq(&conf->resync_lock);
+		wake_up(&conf->wait_resume);
+		wake_up(&conf->wait_idle);
+		break;
+	}
+}
+
 
 static mdk_personality_t raid1_personality =
 {
@@ -1415,6 +1505,7 @@ static mdk_personality_t raid1_personality =
 	.sync_request	= sync_request,
 	.resize		= raid1_resize,
 	.reshape	= raid1_reshape,
+	.quiesce	= raid1_quiesce,
 };
 
 static int __init raid_init(void)
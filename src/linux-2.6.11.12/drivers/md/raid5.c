@@ -20,6 +20,7 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/raid/raid5.h>
+#include <linux/raid/bitmap.h>
 #include <linux/highmem.h>
 #include <linux/bitops.h>
 #include <asm/atomic.h>
@@ -33,6 +34,7 @@
 #define STRIPE_SHIFT		(PAGE_SHIFT - 9)
 #define STRIPE_SECTORS		(STRIPE_SIZE>>9)
 #define	IO_THRESHOLD		1
+#define STRIPE_BATCH		8	/* stripes handled per device_lock round */
 #define HASH_PAGES		1
 #define HASH_PAGES_ORDER	0
 #define NR_HASH			(HASH_PAGES * PAGE_SIZE / sizeof(struct stripe_head *))
@@ -69,6 +71,21 @@
 
 static void print_raid5_conf (raid5_conf_t *conf);
 
+/*
+ * Wake the next worker thread, round robin, for a stripe just put on
+ * handle_list.  raid5d is woken too: it handles stripes as well, and
+ * it is the one that activates delayed stripes and checks for recovery.
+ */
+static inline void raid5_wakeup_worker(raid5_conf_t *conf)
+{
+	CHECK_DEVLOCK();
+	if (conf->nr_workers) {
+		md_wakeup_thread(conf->workers[conf->next_worker]);
+		if (++conf->next_worker == conf->nr_workers)
+			conf->next_worker = 0;
+	}
+}
+
 static inline void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	/* ֻüΪ0󣬲ƶ */
@@ -80,9 +97,17 @@ static inline void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 		if (test_bit(STRIPE_HANDLE, &sh->state)) {/* Ҫ */
 			if (test_bit(STRIPE_DELAYED, &sh->state))/* ŵӳٴʹ */
 				list_add_tail(&sh->lru, &conf->delayed_list);
-			else
+			else if (test_bit(STRIPE_BIT_DELAY, &sh->state) &&
+				 sh->bm_seq - conf->seq_write > 0) {
+				/* λͼûд̣һν */
+				list_add_tail(&sh->lru, &conf->bitmap_list);
+				blk_plug_device(conf->mddev->queue);
+			} else {
+				clear_bit(STRIPE_BIT_DELAY, &sh->state);
 				list_add_tail(&sh->lru, &conf->handle_list);
+			}
 			md_wakeup_thread(conf->mddev->thread);
+			raid5_wakeup_worker(conf);
 		} else {/* Ѿϣŵǻ */
 			if (test_and_clear_bit(STRIPE_PREREAD_ACTIVE, &sh->state)) {
 				atomic_dec(&conf->preread_active_stripes);
@@ -250,6 +275,10 @@ static struct stripe_head *get_active_stripe(raid5_conf_t *conf, sector_t sector
 	spin_lock_irq(&conf->device_lock);
 
 	do {
+		/* raid5_quiesceҪȴ */
+		wait_event_lock_irq(conf->wait_for_stripe,
+				    conf->quiesce == 0,
+				    conf->device_lock, /* nothing */);
 		/* ڹϣв鿴ָǷ */
 		sh = __find_stripe(conf, sector);
 		if (!sh) {/* ڹϣвڶӦ */
@@ -815,6 +844,7 @@ static int add_stripe_bio(struct stripe_head *sh, struct bio *bi, int dd_idx, in
 {
 	struct bio **bip;
 	raid5_conf_t *conf = sh->raid_conf;
+	int firstwrite = 0;
 
 	PRINTK("adding bh b#%llu to stripe s#%llu\n",
 		(unsigned long long)bi->bi_sector,
@@ -823,9 +853,11 @@ static int add_stripe_bio(struct stripe_head *sh, struct bio *bi, int dd_idx, in
 
 	spin_lock(&sh->lock);
 	spin_lock_irq(&conf->device_lock);
-	if (forwrite)/* ҵҪӵ */
+	if (forwrite) {/* ҵҪӵ */
 		bip = &sh->dev[dd_idx].towrite;
-	else
+		if (*bip == NULL)
+			firstwrite = 1;
+	} else
 		bip = &sh->dev[dd_idx].toread;
 	/* BIOҵĵط- */
 	while (*bip && (*bip)->bi_sector < bi->bi_sector) {
@@ -851,6 +883,16 @@ static int add_stripe_bio(struct stripe_head *sh, struct bio *bi, int dd_idx, in
 		(unsigned long long)bi->bi_sector,
 		(unsigned long long)sh->sector, dd_idx);
 
+	/* ÿڵһдʱλдʱhandle_stripe */
+	if (conf->mddev->bitmap && firstwrite) {
+		bitmap_startwrite(conf->mddev->bitmap, sh->sector,
+				  STRIPE_SECTORS);
+		spin_lock_irq(&conf->device_lock);
+		sh->bm_seq = conf->seq_flush + 1;
+		set_bit(STRIPE_BIT_DELAY, &sh->state);
+		spin_unlock_irq(&conf->device_lock);
+	}
+
 	if (forwrite) {/* д󣬼Ƿ񸲸Ǳ */
 		/* check if page is covered */
 		sector_t sector = sh->dev[dd_idx].sector;
@@ -986,7 +1028,12 @@ static void handle_stripe(struct stripe_head *sh)
 			/* fail all writes first */
 			bi = sh->dev[i].towrite;
 			sh->dev[i].towrite = NULL;
-			if (bi) to_write--;
+			if (bi) {
+				to_write--;
+				/* дʧܣλλ */
+				bitmap_endwrite(conf->mddev->bitmap, sh->sector,
+						STRIPE_SECTORS, 0);
+			}
 
 			if (test_and_clear_bit(R5_Overlap, &sh->dev[i].flags))
 				wake_up(&conf->wait_for_overlap);
@@ -1004,6 +1051,9 @@ static void handle_stripe(struct stripe_head *sh)
 			/* and fail all 'written' */
 			bi = sh->dev[i].written;
 			sh->dev[i].written = NULL;
+			if (bi)
+				bitmap_endwrite(conf->mddev->bitmap, sh->sector,
+						STRIPE_SECTORS, 0);
 			while (bi && bi->bi_sector < sh->dev[i].sector + STRIPE_SECTORS) {
 				struct bio *bi2 = r5_next_bio(bi, sh->dev[i].sector);
 				clear_bit(BIO_UPTODATE, &bi->bi_flags);
@@ -1077,6 +1127,8 @@ static void handle_stripe(struct stripe_head *sh)
 				    }
 				    wbi = wbi2;
 			    }
+			    bitmap_endwrite(conf->mddev->bitmap, sh->sector,
+					    STRIPE_SECTORS, 1);
 			    spin_unlock_irq(&conf->device_lock);
 		    }
 		}
@@ -1201,8 +1253,15 @@ static void handle_stripe(struct stripe_head *sh)
 					}
 				}
 			}
+		/* the bits for a new write must reach the disk before
+		 * the write does; __release_stripe parks us on
+		 * bitmap_list until they have
+		 */
+		if (test_bit(STRIPE_BIT_DELAY, &sh->state))
+			set_bit(STRIPE_HANDLE, &sh->state);
 		/* now if nothing is locked, and if we have enough data, we can start a write request */
-		if (locked == 0 && (rcw == 0 ||rmw == 0)) {/* ûĴ̣ҪĴΪ0˵Ѿȫڴ棬ʼУ */
+		if (locked == 0 && (rcw == 0 ||rmw == 0) &&
+		    !test_bit(STRIPE_BIT_DELAY, &sh->state)) {/* ûĴ̣ҪĴΪ0˵Ѿȫڴ棬ʼУ */
 			PRINTK("Computing parity...\n");
 			compute_parity(sh, rcw==0 ? RECONSTRUCT_WRITE : READ_MODIFY_WRITE);
 			/* now every locked buffer is ready to be written */
@@ -1353,6 +1412,21 @@ static inline void raid5_activate_delayed(raid5_conf_t *conf)
 	}
 }
 
+/* λͼѾд̣ѵȴŻشʱdevice_lock */
+static void raid5_activate_bit_delay(raid5_conf_t *conf)
+{
+	struct list_head head;
+
+	list_add(&head, &conf->bitmap_list);
+	list_del_init(&conf->bitmap_list);
+	while (!list_empty(&head)) {
+		struct stripe_head *sh = list_entry(head.next, struct stripe_head, lru);
+		list_del_init(&sh->lru);
+		atomic_inc(&sh->count);
+		__release_stripe(conf, sh);
+	}
+}
+
 static void unplug_slaves(mddev_t *mddev)
 {
 	raid5_conf_t *conf = mddev_to_conf(mddev);
@@ -1385,8 +1459,11 @@ static void raid5_unplug_device(request_queue_t *q)
 
 	spin_lock_irqsave(&conf->device_lock, flags);
 
-	if (blk_remove_plug(q))
+	if (blk_remove_plug(q)) {
+		/* raid5dѴǰλλͼд */
+		conf->seq_flush++;
 		raid5_activate_delayed(conf);
+	}
 	md_wakeup_thread(mddev->thread);
 
 	spin_unlock_irqrestore(&conf->device_lock, flags);
@@ -1510,7 +1587,7 @@ static int make_request (request_queue_t *q, struct bio * bi)
 }
 
 /* FIXME go_faster isn't used */
-static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
+static int sync_request (mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 	struct stripe_head *sh;
@@ -1522,13 +1599,26 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
 	sector_t first_sector;
 	int raid_disks = conf->raid_disks;
 	int data_disks = raid_disks-1;
+	sector_t max_sector = mddev->size << 1;
+	int sync_blocks;
 
-	if (sector_nr >= mddev->size <<1) {
+	if (sector_nr >= max_sector) {
 		/* just being told to finish up .. nothing much to do */
+		if (mddev->curr_resync < max_sector)
+			bitmap_end_sync(mddev->bitmap, mddev->curr_resync,
+					&sync_blocks, 1);
+		bitmap_close_sync(mddev->bitmap);
 		unplug_slaves(mddev);
 		return 0;
 	}
 
+	/* ͬʱλͼиɾĿ飬ָʱȫؽ */
+	if (!bitmap_start_sync(mddev->bitmap, sector_nr, &sync_blocks) &&
+	    test_bit(MD_RECOVERY_SYNC, &mddev->recovery)) {
+		*skipped = 1;
+		return sync_blocks;
+	}
+
 	x = sector_nr;
 	chunk_offset = sector_div(x, sectors_per_chunk);
 	stripe = x;
@@ -1556,6 +1646,89 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
 	return STRIPE_SECTORS;
 }
 
+/*
+ * Take up to STRIPE_BATCH stripes off handle_list, handle them, and put
+ * them back on the lists, taking device_lock once per batch instead of
+ * twice per stripe.  Stripes are taken in list order, so a run of
+ * adjacent full-stripe writes has its parity computed and its writes
+ * queued to the member disks together, where they can merge.
+ * Called with device_lock held, returns with it held.
+ */
+static int raid5_handle_batch(raid5_conf_t *conf)
+{
+	struct stripe_head *batch[STRIPE_BATCH];
+	int i, cnt = 0;
+
+	while (cnt < STRIPE_BATCH && !list_empty(&conf->handle_list)) {
+		struct stripe_head *sh;
+
+		sh = list_entry(conf->handle_list.next, struct stripe_head, lru);
+		list_del_init(&sh->lru);
+		atomic_inc(&sh->count);
+		if (atomic_read(&sh->count)!= 1)
+			BUG();
+		batch[cnt++] = sh;
+	}
+	spin_unlock_irq(&conf->device_lock);
+
+	for (i = 0; i < cnt; i++)
+		handle_stripe(batch[i]);
+
+	spin_lock_irq(&conf->device_lock);
+	for (i = 0; i < cnt; i++)
+		__release_stripe(conf, batch[i]);
+
+	return cnt;
+}
+
+/*
+ * Worker threads only handle stripes, on whichever cpu the scheduler
+ * puts them, so that parity work for a busy array is not bound to the
+ * one cpu raid5d runs on.  handle_stripe() is already safe against
+ * itself: make_request() calls it too, and sh->lock serialises them.
+ */
+static void raid5_worker(mddev_t *mddev)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	int handled = 0;
+
+	spin_lock_irq(&conf->device_lock);
+	while (!list_empty(&conf->handle_list))
+		handled += raid5_handle_batch(conf);
+	spin_unlock_irq(&conf->device_lock);
+
+	if (handled)
+		unplug_slaves(mddev);
+}
+
+static void raid5_start_workers(raid5_conf_t *conf)
+{
+	int n = min_t(int, num_online_cpus() - 1, RAID5_MAX_WORKERS);
+
+	while (conf->nr_workers < n) {
+		mdk_thread_t *t = md_register_thread(raid5_worker, conf->mddev,
+						     "%s_raid5w");
+		if (!t)
+			break;	/* make do with fewer */
+		spin_lock_irq(&conf->device_lock);
+		conf->workers[conf->nr_workers++] = t;
+		spin_unlock_irq(&conf->device_lock);
+	}
+}
+
+static void raid5_stop_workers(raid5_conf_t *conf)
+{
+	int i, n = conf->nr_workers;
+
+	spin_lock_irq(&conf->device_lock);
+	conf->nr_workers = 0;
+	conf->next_worker = 0;
+	spin_unlock_irq(&conf->device_lock);
+
+	for (i = 0; i < n; i++)
+		md_unregister_thread(conf->workers[i]);
+}
+
 /*
  * This is our raid5 kernel thread.
  *
@@ -1566,7 +1739,6 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
 /* RAID5ػ߳ */
 static void raid5d (mddev_t *mddev)
 {
-	struct stripe_head *sh;
 	raid5_conf_t *conf = mddev_to_conf(mddev);
 	int handled;
 
@@ -1579,7 +1751,15 @@ static void raid5d (mddev_t *mddev)
 	handled = 0;
 	spin_lock_irq(&conf->device_lock);
 	while (1) {/* пܵ */
-		struct list_head *first;
+		if (conf->seq_flush != conf->seq_write) {
+			/* λͼд̺ٷеȴ */
+			int seq = conf->seq_flush;
+			spin_unlock_irq(&conf->device_lock);
+			bitmap_unplug(mddev->bitmap);
+			spin_lock_irq(&conf->device_lock);
+			conf->seq_write = seq;
+			raid5_activate_bit_delay(conf);
+		}
 
 		if (list_empty(&conf->handle_list) &&
 		    atomic_read(&conf->preread_active_stripes) < IO_THRESHOLD &&
@@ -1590,23 +1770,7 @@ static void raid5d (mddev_t *mddev)
 		if (list_empty(&conf->handle_list))/* Ϊգ˳ */
 			break;
 
-		/* ȡһ */
-		first = conf->handle_list.next;
-		sh = list_entry(first, struct stripe_head, lru);
-
-		list_del_init(first);
-		atomic_inc(&sh->count);
-		if (atomic_read(&sh->count)!= 1)
-			BUG();
-		spin_unlock_irq(&conf->device_lock);
-		
-		handled++;
-		/*  */
-		handle_stripe(sh);
-		/* ʵ */
-		release_stripe(sh);
-
-		spin_lock_irq(&conf->device_lock);
+		handled += raid5_handle_batch(conf);
 	}
 	PRINTK("%d stripes handled\n", handled);
 
@@ -1648,6 +1812,7 @@ static int run (mddev_t *mddev)
 	init_waitqueue_head(&conf->wait_for_overlap);
 	INIT_LIST_HEAD(&conf->handle_list);
 	INIT_LIST_HEAD(&conf->delayed_list);
+	INIT_LIST_HEAD(&conf->bitmap_list);
 	INIT_LIST_HEAD(&conf->inactive_list);
 	atomic_set(&conf->active_stripes, 0);
 	atomic_set(&conf->preread_active_stripes, 0);
@@ -1726,10 +1891,12 @@ static int run (mddev_t *mddev)
 	}
 memory = conf->max_nr_stripes * (sizeof(struct stripe_head) +
 		 conf->raid_disks * ((sizeof(struct bio) + PAGE_SIZE))) / 1024;
+	raid5_start_workers(conf);
 	if (grow_stripes(conf, conf->max_nr_stripes)) {
 		printk(KERN_ERR 
 			"raid5: couldn't allocate %dkB for buffers\n", memory);
 		shrink_stripes(conf);
+		raid5_stop_workers(conf);
 		md_unregister_thread(mddev->thread);
 		goto abort;
 	} else
@@ -1781,6 +1948,7 @@ static int stop (mddev_t *mddev)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 
+	raid5_stop_workers(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	shrink_stripes(conf);
@@ -1961,6 +2129,29 @@ static int raid5_resize(mddev_t *mddev, sector_t sectors)
 	return 0;
 }
 
+static void raid5_quiesce(mddev_t *mddev, int state)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+
+	switch(state) {
+	case 1: /* stop all writes */
+		spin_lock_irq(&conf->device_lock);
+		conf->quiesce = 1;
+		wait_event_lock_irq(conf->wait_for_stripe,
+				    atomic_read(&conf->active_stripes) == 0,
+				    conf->device_lock,
+				    raid5_unplug_device(mddev->queue));
+		spin_unlock_irq(&conf->device_lock);
+		break;
+	case 0: /* re-enable writes */
+		spin_lock_irq(&conf->device_lock);
+		conf->quiesce = 0;
+		wake_up(&conf->wait_for_stripe);
+		spin_unlock_irq(&conf->device_lock);
+		break;
+	}
+}
+
 static mdk_personality_t raid5_personality=
 {
 	.name		= "raid5",
@@ -1975,6 +2166,7 @@ static mdk_personality_t raid5_personality=
 	.spare_active	= raid5_spare_active,
 	.sync_request	= sync_request,
 	.resize		= raid5_resize,
+	.quiesce	= raid5_quiesce,
 };
 
 static int __init raid5_init (void)
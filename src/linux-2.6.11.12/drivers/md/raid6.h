@@ -102,9 +102,20 @@ extern const u8 raid6_gfexp[256]      __attribute__((aligned(256)));
 extern const u8 raid6_gfinv[256]      __attribute__((aligned(256)));
 extern const u8 raid6_gfexi[256]      __attribute__((aligned(256)));
 
-/* Recovery routines */
-void raid6_2data_recov(int disks, size_t bytes, int faila, int failb, void **ptrs);
-void raid6_datap_recov(int disks, size_t bytes, int faila, void **ptrs);
+/* Recovery routine choices */
+struct raid6_recov_calls {
+	void (*data2)(int, size_t, int, int, void **); /* Two data blocks */
+	void (*datap)(int, size_t, int, void **);      /* Data block and P */
+	int  (*valid)(void);	/* Returns 1 if this routine set is usable */
+	const char *name;	/* Name of this routine set */
+};
+
+/* Selected recovery routines, chosen by raid6_select_algo() */
+extern struct raid6_recov_calls raid6_recov_call;
+
+/* Recovery routine list */
+extern const struct raid6_recov_calls * const raid6_recov_algos[];
+
 void raid6_dual_recov(int disks, size_t bytes, int faila, int failb, void **ptrs);
 
 /* Some definitions to allow code to be compiled for testing in userspace */
@@ -22,6 +22,7 @@
 #endif
 
 struct raid6_calls raid6_call;
+struct raid6_recov_calls raid6_recov_call;
 
 /* Various routine sets */
 extern const struct raid6_calls raid6_intx1;
@@ -73,6 +74,17 @@ const struct raid6_calls * const raid6_algos[] = {
 	NULL
 };
 
+extern const struct raid6_recov_calls raid6_recov_intx1;
+extern const struct raid6_recov_calls raid6_recov_sse2;
+
+const struct raid6_recov_calls * const raid6_recov_algos[] = {
+	&raid6_recov_intx1,
+#if defined(__i386__) || defined(__x86_64__)
+	&raid6_recov_sse2,
+#endif
+	NULL
+};
+
 #ifdef __KERNEL__
 #define RAID6_TIME_JIFFIES_LG2	4
 #else
@@ -80,6 +92,49 @@ const struct raid6_calls * const raid6_algos[] = {
 #define RAID6_TIME_JIFFIES_LG2	9
 #endif
 
+/* Time the recovery of two failed data blocks with each routine set,
+   using the syndrome routine already chosen, and pick the fastest.
+   dptrs[0] and dptrs[1] must be writable. */
+static void __init raid6_select_recov(int disks, void **dptrs)
+{
+	const struct raid6_recov_calls * const * algo;
+	const struct raid6_recov_calls * best;
+	unsigned long perf, bestperf;
+	unsigned long j0, j1;
+
+	bestperf = 0;  best = NULL;
+
+	for ( algo = raid6_recov_algos ; *algo ; algo++ ) {
+		if ( !(*algo)->valid || (*algo)->valid() ) {
+			perf = 0;
+
+			preempt_disable();
+			j0 = jiffies;
+			while ( (j1 = jiffies) == j0 )
+				cpu_relax();
+			while ( (jiffies-j1) < (1 << RAID6_TIME_JIFFIES_LG2) ) {
+				(*algo)->data2(disks, PAGE_SIZE, 0, 1, dptrs);
+				perf++;
+			}
+			preempt_enable();
+
+			if ( perf > bestperf ) {
+				best = *algo;
+				bestperf = perf;
+			}
+			printk("raid6: recov %-8s %5ld MB/s\n", (*algo)->name,
+			       (perf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
+		}
+	}
+
+	/* intx1 is always valid, so there is a best */
+	printk("raid6: using recovery algorithm %s (%ld MB/s)\n",
+	       best->name,
+	       (bestperf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
+
+	raid6_recov_call = *best;
+}
+
 /* Try to pick the best algorithm */
 /* This code uses the gfmul table as convenient data set to abuse */
 
@@ -99,8 +154,9 @@ int __init raid6_select_algo(void)
 		dptrs[i] = ((char *)raid6_gfmul) + PAGE_SIZE*i;
 	}
 
-	/* Normal code - use a 2-page allocation to avoid D$ conflict */
-	syndromes = (void *) __get_free_pages(GFP_KERNEL, 1);
+	/* Normal code - use a 2-page allocation to avoid D$ conflict,
+	   and 2 more pages for the recovery test to write to */
+	syndromes = (void *) __get_free_pages(GFP_KERNEL, 2);
 
 	if ( !syndromes ) {
 		printk("raid6: Yikes!  No memory available.\n");
@@ -147,7 +203,13 @@ int __init raid6_select_algo(void)
 
 	raid6_call = *best;
 
-	free_pages((unsigned long)syndromes, 1);
+	if ( best ) {
+		dptrs[0] = syndromes + 2*PAGE_SIZE;
+		dptrs[1] = syndromes + 3*PAGE_SIZE;
+		raid6_select_recov(disks, dptrs);
+	}
+
+	free_pages((unsigned long)syndromes, 2);
 
 	return best ? 0 : -EINVAL;
 }
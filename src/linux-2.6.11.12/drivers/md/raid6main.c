@@ -38,6 +38,7 @@
 #define STRIPE_SHIFT		(PAGE_SHIFT - 9)
 #define STRIPE_SECTORS		(STRIPE_SIZE>>9)
 #define	IO_THRESHOLD		1
+#define STRIPE_BATCH		8	/* stripes handled per device_lock round */
 #define HASH_PAGES		1
 #define HASH_PAGES_ORDER	0
 #define NR_HASH			(HASH_PAGES * PAGE_SIZE / sizeof(struct stripe_head *))
@@ -88,6 +89,21 @@ static inline int raid6_next_disk(int disk, int raid_disks)
 
 static void print_raid6_conf (raid6_conf_t *conf);
 
+/*
+ * Wake the next worker thread, round robin, for a stripe just put on
+ * handle_list.  raid6d is woken too: it handles stripes as well, and
+ * it is the one that activates delayed stripes and checks for recovery.
+ */
+static inline void raid6_wakeup_worker(raid6_conf_t *conf)
+{
+	CHECK_DEVLOCK();
+	if (conf->nr_workers) {
+		md_wakeup_thread(conf->workers[conf->next_worker]);
+		if (++conf->next_worker == conf->nr_workers)
+			conf->next_worker = 0;
+	}
+}
+
 static inline void __release_stripe(raid6_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -101,6 +117,7 @@ static inline void __release_stripe(raid6_conf_t *conf, struct stripe_head *sh)
 			else
 				list_add_tail(&sh->lru, &conf->handle_list);
 			md_wakeup_thread(conf->mddev->thread);
+			raid6_wakeup_worker(conf);
 		} else {
 			if (test_and_clear_bit(STRIPE_PREREAD_ACTIVE, &sh->state)) {
 				atomic_dec(&conf->preread_active_stripes);
@@ -884,10 +901,10 @@ static void compute_block_2(struct stripe_head *sh, int dd_idx1, int dd_idx2)
 
 		if ( failb == disks-2 ) {
 			/* We're missing D+P. */
-			raid6_datap_recov(disks, STRIPE_SIZE, faila, ptrs);
+			raid6_recov_call.datap(disks, STRIPE_SIZE, faila, ptrs);
 		} else {
 			/* We're missing D+D. */
-			raid6_2data_recov(disks, STRIPE_SIZE, faila, failb, ptrs);
+			raid6_recov_call.data2(disks, STRIPE_SIZE, faila, failb, ptrs);
 		}
 
 		/* Both the above update both missing blocks */
@@ -1634,7 +1651,7 @@ static int make_request (request_queue_t *q, struct bio * bi)
 }
 
 /* FIXME go_faster isn't used */
-static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
+static int sync_request (mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster)
 {
 	raid6_conf_t *conf = (raid6_conf_t *) mddev->private;
 	struct stripe_head *sh;
@@ -1680,6 +1697,89 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
 	return STRIPE_SECTORS;
 }
 
+/*
+ * Take up to STRIPE_BATCH stripes off handle_list, handle them, and put
+ * them back on the lists, taking device_lock once per batch instead of
+ * twice per stripe.  Stripes are taken in list order, so a run of
+ * adjacent full-stripe writes has its parity computed and its writes
+ * queued to the member disks together, where they can merge.
+ * Called with device_lock held, returns with it held.
+ */
+static int raid6_handle_batch(raid6_conf_t *conf)
+{
+	struct stripe_head *batch[STRIPE_BATCH];
+	int i, cnt = 0;
+
+	while (cnt < STRIPE_BATCH && !list_empty(&conf->handle_list)) {
+		struct stripe_head *sh;
+
+		sh = list_entry(conf->handle_list.next, struct stripe_head, lru);
+		list_del_init(&sh->lru);
+		atomic_inc(&sh->count);
+		if (atomic_read(&sh->count)!= 1)
+			BUG();
+		batch[cnt++] = sh;
+	}
+	spin_unlock_irq(&conf->device_lock);
+
+	for (i = 0; i < cnt; i++)
+		handle_stripe(batch[i]);
+
+	spin_lock_irq(&conf->device_lock);
+	for (i = 0; i < cnt; i++)
+		__release_stripe(conf, batch[i]);
+
+	return cnt;
+}
+
+/*
+ * Worker threads only handle stripes, on whichever cpu the scheduler
+ * puts them, so that parity work for a busy array is not bound to the
+ * one cpu raid6d runs on.  handle_stripe() is already safe against
+ * itself: make_request() calls it too, and sh->lock serialises them.
+ */
+static void raid6_worker(mddev_t *mddev)
+{
+	raid6_conf_t *conf = mddev_to_conf(mddev);
+	int handled = 0;
+
+	spin_lock_irq(&conf->device_lock);
+	while (!list_empty(&conf->handle_list))
+		handled += raid6_handle_batch(conf);
+	spin_unlock_irq(&conf->device_lock);
+
+	if (handled)
+		unplug_slaves(mddev);
+}
+
+static void raid6_start_workers(raid6_conf_t *conf)
+{
+	int n = min_t(int, num_online_cpus() - 1, RAID5_MAX_WORKERS);
+
+	while (conf->nr_workers < n) {
+		mdk_thread_t *t = md_register_thread(raid6_worker, conf->mddev,
+						     "%s_raid6w");
+		if (!t)
+			break;	/* make do with fewer */
+		spin_lock_irq(&conf->device_lock);
+		conf->workers[conf->nr_workers++] = t;
+		spin_unlock_irq(&conf->device_lock);
+	}
+}
+
+static void raid6_stop_workers(raid6_conf_t *conf)
+{
+	int i, n = conf->nr_workers;
+
+	spin_lock_irq(&conf->device_lock);
+	conf->nr_workers = 0;
+	conf->next_worker = 0;
+	spin_unlock_irq(&conf->device_lock);
+
+	for (i = 0; i < n; i++)
+		md_unregister_thread(conf->workers[i]);
+}
+
 /*
  * This is our raid6 kernel thread.
  *
@@ -1689,7 +1789,6 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
  */
 static void raid6d (mddev_t *mddev)
 {
-	struct stripe_head *sh;
 	raid6_conf_t *conf = mddev_to_conf(mddev);
 	int handled;
 
@@ -1701,8 +1800,6 @@ static void raid6d (mddev_t *mddev)
 	handled = 0;
 	spin_lock_irq(&conf->device_lock);
 	while (1) {
-		struct list_head *first;
-
 		if (list_empty(&conf->handle_list) &&
 		    atomic_read(&conf->preread_active_stripes) < IO_THRESHOLD &&
 		    !blk_queue_plugged(mddev->queue) &&
@@ -1712,20 +1809,7 @@ static void raid6d (mddev_t *mddev)
 		if (list_empty(&conf->handle_list))
 			break;
 
-		first = conf->handle_list.next;
-		sh = list_entry(first, struct stripe_head, lru);
-
-		list_del_init(first);
-		atomic_inc(&sh->count);
-		if (atomic_read(&sh->count)!= 1)
-			BUG();
-		spin_unlock_irq(&conf->device_lock);
-
-		handled++;
-		handle_stripe(sh);
-		release_stripe(sh);
-
-		spin_lock_irq(&conf->device_lock);
+		handled += raid6_handle_batch(conf);
 	}
 	PRINTK("%d stripes handled\n", handled);
 
@@ -1851,10 +1935,12 @@ static int run (mddev_t *mddev)
 
 	memory = conf->max_nr_stripes * (sizeof(struct stripe_head) +
 		 conf->raid_disks * ((sizeof(struct bio) + PAGE_SIZE))) / 1024;
+	raid6_start_workers(conf);
 	if (grow_stripes(conf, conf->max_nr_stripes)) {
 		printk(KERN_ERR
 		       "raid6: couldn't allocate %dkB for buffers\n", memory);
 		shrink_stripes(conf);
+		raid6_stop_workers(conf);
 		md_unregister_thread(mddev->thread);
 		goto abort;
 	} else
@@ -1906,6 +1992,7 @@ static int stop (mddev_t *mddev)
 {
 	raid6_conf_t *conf = (raid6_conf_t *) mddev->private;
 
+	raid6_stop_workers(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	shrink_stripes(conf);
@@ -21,8 +21,8 @@
 #include "raid6.h"
 
 /* Recover two failed data blocks. */
-void raid6_2data_recov(int disks, size_t bytes, int faila, int failb,
-		       void **ptrs)
+static void raid6_2data_recov_intx1(int disks, size_t bytes, int faila,
+				    int failb, void **ptrs)
 {
 	u8 *p, *q, *dp, *dq;
 	u8 px, qx, db;
@@ -68,7 +68,8 @@ void raid6_2data_recov(int disks, size_t bytes, int faila, int failb,
 
 
 /* Recover failure of one data block plus the P block */
-void raid6_datap_recov(int disks, size_t bytes, int faila, void **ptrs)
+static void raid6_datap_recov_intx1(int disks, size_t bytes, int faila,
+				    void **ptrs)
 {
 	u8 *p, *q, *dq;
 	const u8 *qmul;		/* Q multiplier table */
@@ -98,6 +99,12 @@ void raid6_datap_recov(int disks, size_t bytes, int faila, void **ptrs)
 	}
 }
 
+const struct raid6_recov_calls raid6_recov_intx1 = {
+	raid6_2data_recov_intx1,
+	raid6_datap_recov_intx1,
+	NULL,			/* always valid */
+	"intx1"
+};
 
 #ifndef __KERNEL__		/* Testing only */
 
@@ -122,10 +129,10 @@ void raid6_dual_recov(int disks, size_t bytes, int faila, int failb, void **ptrs
 	} else {
 		if ( failb == disks-2 ) {
 			/* data+P failure. */
-			raid6_datap_recov(disks, bytes, faila, ptrs);
+			raid6_recov_call.datap(disks, bytes, faila, ptrs);
 		} else {
 			/* data+data failure. */
-			raid6_2data_recov(disks, bytes, faila, failb, ptrs);
+			raid6_recov_call.data2(disks, bytes, faila, failb, ptrs);
 		}
 	}
 }
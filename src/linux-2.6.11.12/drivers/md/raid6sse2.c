@@ -167,6 +167,135 @@ const struct raid6_calls raid6_sse2x2 = {
 	1			/* Has cache hints */
 };
 
+/*
+ * SSE-2 recovery.  There is no byte shuffle in SSE-2 to do the table
+ * lookups of raid6recov.c sixteen at a time, so multiply by the constant
+ * by shift-and-add instead: one multiply by {02}, as in the syndrome
+ * code above, per bit of the constant.
+ */
+
+/* %xmm3 ^= c * %xmm2.  Clobbers %xmm2 and %xmm5; %xmm0 must hold x1d */
+static inline void raid6_sse2_mul_acc(u8 c)
+{
+	while ( c ) {
+		if ( c & 1 )
+			asm volatile("pxor %xmm2,%xmm3");
+		c >>= 1;
+		if ( c ) {
+			asm volatile("pxor %xmm5,%xmm5");
+			asm volatile("pcmpgtb %xmm2,%xmm5");
+			asm volatile("paddb %xmm2,%xmm2");
+			asm volatile("pand %xmm0,%xmm5");
+			asm volatile("pxor %xmm5,%xmm2");
+		}
+	}
+}
+
+/* Recover two failed data blocks. */
+static void raid6_sse2_2data_recov(int disks, size_t bytes, int faila,
+				   int failb, void **ptrs)
+{
+	u8 *p, *q, *dp, *dq;
+	u8 pbmul, qmul;
+	raid6_sse_save_t sa;
+	size_t d;
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data pages
+	   Use the dead data pages as temporary storage for
+	   delta p and delta q */
+	dp = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-2] = dp;
+	dq = (u8 *)ptrs[failb];
+	ptrs[failb] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dp;
+	ptrs[failb]   = dq;
+	ptrs[disks-2] = p;
+	ptrs[disks-1] = q;
+
+	/* The multipliers the table code picks rows of raid6_gfmul for */
+	pbmul = raid6_gfexi[failb-faila];
+	qmul  = raid6_gfinv[raid6_gfexp[faila]^raid6_gfexp[failb]];
+
+	raid6_before_sse2(&sa);
+
+	asm volatile("movdqa %0,%%xmm0" : : "m" (raid6_sse_constants.x1d[0]));
+
+	for ( d = 0 ; d < bytes ; d += 16 ) {
+		asm volatile("movdqa %0,%%xmm1" : : "m" (p[d]));
+		asm volatile("pxor %0,%%xmm1" : : "m" (dp[d]));	/* px */
+		asm volatile("movdqa %0,%%xmm2" : : "m" (q[d]));
+		asm volatile("pxor %0,%%xmm2" : : "m" (dq[d]));
+		asm volatile("pxor %xmm3,%xmm3");
+		raid6_sse2_mul_acc(qmul);				/* qx */
+		asm volatile("movdqa %xmm1,%xmm2");
+		raid6_sse2_mul_acc(pbmul);			/* B = pbmul*px ^ qx */
+		asm volatile("movdqa %%xmm3,%0" : "=m" (dq[d]));
+		asm volatile("pxor %xmm3,%xmm1");			/* A = B ^ px */
+		asm volatile("movdqa %%xmm1,%0" : "=m" (dp[d]));
+	}
+
+	raid6_after_sse2(&sa);
+}
+
+/* Recover failure of one data block plus the P block */
+static void raid6_sse2_datap_recov(int disks, size_t bytes, int faila,
+				   void **ptrs)
+{
+	u8 *p, *q, *dq;
+	u8 qmul;
+	raid6_sse_save_t sa;
+	size_t d;
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data page
+	   Use the dead data page as temporary storage for delta q */
+	dq = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dq;
+	ptrs[disks-1] = q;
+
+	qmul  = raid6_gfinv[raid6_gfexp[faila]];
+
+	raid6_before_sse2(&sa);
+
+	asm volatile("movdqa %0,%%xmm0" : : "m" (raid6_sse_constants.x1d[0]));
+
+	for ( d = 0 ; d < bytes ; d += 16 ) {
+		asm volatile("movdqa %0,%%xmm2" : : "m" (q[d]));
+		asm volatile("pxor %0,%%xmm2" : : "m" (dq[d]));
+		asm volatile("pxor %xmm3,%xmm3");
+		raid6_sse2_mul_acc(qmul);
+		asm volatile("movdqa %%xmm3,%0" : "=m" (dq[d]));
+		asm volatile("pxor %0,%%xmm3" : : "m" (p[d]));
+		asm volatile("movdqa %%xmm3,%0" : "=m" (p[d]));
+	}
+
+	raid6_after_sse2(&sa);
+}
+
+const struct raid6_recov_calls raid6_recov_sse2 = {
+	raid6_sse2_2data_recov,
+	raid6_sse2_datap_recov,
+	raid6_have_sse2,
+	"sse2"
+};
+
 #endif
 
 #ifdef __x86_64__
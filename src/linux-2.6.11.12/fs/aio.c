@@ -28,6 +28,7 @@
 #include <linux/aio.h>
 #include <linux/highmem.h>
 #include <linux/workqueue.h>
+#include <linux/blkdev.h>
 #include <linux/security.h>
 
 #include <asm/kmap_types.h>
@@ -1665,6 +1666,7 @@ asmlinkage long sys_io_submit(aio_context_t ctx_id, long nr,
 			      struct iocb __user * __user *iocbpp)
 {
 	struct kioctx *ctx;
+	struct blk_plug plug;
 	long ret = 0;
 	int i;
 
@@ -1693,6 +1695,7 @@ asmlinkage long sys_io_submit(aio_context_t ctx_id, long nr,
 	/*
 	 * еÿһiocbִӲ
      */
+	blk_start_plug(&plug);
 	for (i=0; i<nr; i++) {
 		struct iocb __user *user_iocb;
 		struct iocb tmp;
@@ -1711,6 +1714,7 @@ asmlinkage long sys_io_submit(aio_context_t ctx_id, long nr,
 		if (ret)
 			break;
 	}
+	blk_finish_plug(&plug);
 
 	put_ioctx(ctx);
 	return i ? i : ret;
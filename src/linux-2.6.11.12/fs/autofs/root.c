@@ -118,7 +118,7 @@ static int try_to_fill_dentry(struct dentry *dentry, struct super_block *sb, str
 			/* Failed, but leave pending for next time */
 			return 1;
 		}
-		dentry->d_inode = inode;
+		d_instantiate(dentry, inode);
 	}
 
 	/* If this is a directory that isn't a mount point, bitch at the
@@ -1051,10 +1051,12 @@ static int fsync_buffers_list(spinlock_t *lock, struct list_head *list)
 {
 	struct buffer_head *bh;
 	struct list_head tmp;
+	struct blk_plug plug;
 	int err = 0, err2;
 
 	INIT_LIST_HEAD(&tmp);
 
+	blk_start_plug(&plug);
 	spin_lock(lock);
 	while (!list_empty(list)) {
 		bh = BH_ENTRY(list->next);
@@ -1077,6 +1079,9 @@ static int fsync_buffers_list(spinlock_t *lock, struct list_head *list)
 			}
 		}
 	}
+	spin_unlock(lock);
+	blk_finish_plug(&plug);
+	spin_lock(lock);
 
 	while (!list_empty(&tmp)) {
 		bh = BH_ENTRY(tmp.prev);
@@ -3316,8 +3321,11 @@ int submit_bh(int rw, struct buffer_head * bh)
  */
 void ll_rw_block(int rw, int nr, struct buffer_head *bhs[])
 {
+	struct blk_plug plug;
 	int i;
 
+	blk_start_plug(&plug);
+
 	/**
 	 * лײѭ
 	 */
@@ -3376,6 +3384,7 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhs[])
 		 */
 		put_bh(bh);
 	}
+	blk_finish_plug(&plug);
 
 	/*
 	 * ݴͽʱںִлײb_end_io
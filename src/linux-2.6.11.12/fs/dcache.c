@@ -32,6 +32,9 @@
 #include <linux/seqlock.h>
 #include <linux/swap.h>
 #include <linux/bootmem.h>
+#include <linux/percpu.h>
+#include <linux/sysctl.h>
+#include <asm/div64.h>
 
 /* #define DCACHE_DEBUG 1 */
 
@@ -72,16 +75,169 @@ static unsigned int d_hash_shift;
  * Ŀ¼ɢбһָ飬ÿָһͬɢֵdentry
  */
 static struct hlist_head *dentry_hashtable;
-/**
- * δʹĿ¼
+
+/*
+ * Adding to and removing from the hash chains is serialised by a lock
+ * per group of chains rather than by dcache_lock, so that d_rehash()
+ * does not need the latter.  Lookups walk the chains under RCU and take
+ * neither.  Lock order: dcache_lock, d_lock, chain lock.
  */
-static LIST_HEAD(dentry_unused);
+#ifdef CONFIG_SMP
+#if NR_CPUS >= 16
+#define D_HASH_LOCKS	256
+#else
+#define D_HASH_LOCKS	64
+#endif
+#else
+#define D_HASH_LOCKS	1
+#endif
+
+static struct d_hash_lock {
+	spinlock_t lock;
+} ____cacheline_aligned_in_smp d_hash_locks[D_HASH_LOCKS] = {
+	[0 ... D_HASH_LOCKS-1] = { .lock = SPIN_LOCK_UNLOCKED }
+};
 
 /* Statistics gathering. */
 struct dentry_stat_t dentry_stat = {
 	.age_limit = 45,
 };
 
+/*
+ * Unused dentries are kept on LRU lists per superblock, most recent
+ * first: the positive ones on sb->s_dentry_lru, the negative ones on
+ * sb->s_dentry_neg.  The superblocks that have any are strung on
+ * dentry_lru_sbs and dentry_neg_sbs, which prune_dcache() goes round.
+ * A filesystem keeps at most sysctl_dentry_negative_max unused negative
+ * dentries (0: no limit), and prune_dcache() weighs them against the
+ * positive ones by sysctl_dentry_negative_pressure.
+ *
+ * Putting a dentry on a list takes its d_lock and then the superblock's
+ * s_dentry_lru_lock, so that dput() can do it without dcache_lock.
+ * Taking one off needs dcache_lock as well: under dcache_lock, the
+ * dentries found on a list, and their superblocks, stay where they are.
+ * Which list a dentry is on follows from d_inode, so whoever changes
+ * d_inode takes the dentry off its list first.  dentry_sbs_lock nests
+ * inside s_dentry_lru_lock and covers the two lists of superblocks.
+ *
+ * Lookups leave the dentries they find on their lists; prune_dcache()
+ * and friends drop those in use as they come across them.
+ */
+static LIST_HEAD(dentry_lru_sbs);
+static LIST_HEAD(dentry_neg_sbs);
+static DEFINE_SPINLOCK(dentry_sbs_lock);
+int sysctl_dentry_negative_max = 65536;
+int sysctl_dentry_negative_pressure = 100;
+
+/* unused dentries, and how many are negative; see dentry_lru_count() */
+struct dentry_lru_stat {
+	int unused;
+	int negative;
+};
+static DEFINE_PER_CPU(struct dentry_lru_stat, dentry_lru_stats);
+
+struct dentry_neg_stat {
+	unsigned long hits;
+	unsigned long misses;
+};
+static DEFINE_PER_CPU(struct dentry_neg_stat, dentry_neg_stats);
+
+void dentry_neg_account(int hit)
+{
+	struct dentry_neg_stat *stat = &get_cpu_var(dentry_neg_stats);
+
+	if (hit)
+		stat->hits++;
+	else
+		stat->misses++;
+	put_cpu_var(dentry_neg_stats);
+}
+
+/* Called with d_lock held. */
+static void dentry_lru_add(struct dentry *dentry, int tail)
+{
+	struct super_block *sb = dentry->d_sb;
+	struct list_head *lru = &sb->s_dentry_lru;
+	struct list_head *sbs = &sb->s_lru_sbs;
+	struct list_head *all = &dentry_lru_sbs;
+	struct dentry_lru_stat *stat;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	stat = &__get_cpu_var(dentry_lru_stats);
+	if (!dentry->d_inode) {
+		lru = &sb->s_dentry_neg;
+		sbs = &sb->s_neg_sbs;
+		all = &dentry_neg_sbs;
+		sb->s_nr_dentry_neg++;
+		stat->negative++;
+	}
+	if (list_empty(lru)) {
+		spin_lock(&dentry_sbs_lock);
+		list_add_tail(sbs, all);
+		spin_unlock(&dentry_sbs_lock);
+	}
+	if (tail)
+		list_add_tail(&dentry->d_lru, lru);
+	else
+		list_add(&dentry->d_lru, lru);
+	stat->unused++;
+	spin_unlock(&sb->s_dentry_lru_lock);
+}
+
+/* Called with dcache_lock and d_lock held. */
+static void dentry_lru_del(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+	struct list_head *lru = &sb->s_dentry_lru;
+	struct list_head *sbs = &sb->s_lru_sbs;
+	struct dentry_lru_stat *stat;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	stat = &__get_cpu_var(dentry_lru_stats);
+	list_del_init(&dentry->d_lru);
+	stat->unused--;
+	if (!dentry->d_inode) {
+		lru = &sb->s_dentry_neg;
+		sbs = &sb->s_neg_sbs;
+		sb->s_nr_dentry_neg--;
+		stat->negative--;
+	}
+	if (list_empty(lru)) {
+		spin_lock(&dentry_sbs_lock);
+		list_del_init(sbs);
+		spin_unlock(&dentry_sbs_lock);
+	}
+	spin_unlock(&sb->s_dentry_lru_lock);
+}
+
+/*
+ * The per-cpu counts of racing adds and deletes may sum to a little
+ * less than nothing for a moment.
+ */
+static void dentry_lru_count(int *unused, int *negative)
+{
+	int cpu;
+
+	*unused = *negative = 0;
+	for_each_cpu(cpu) {
+		*unused += per_cpu(dentry_lru_stats, cpu).unused;
+		*negative += per_cpu(dentry_lru_stats, cpu).negative;
+	}
+	if (*unused < 0)
+		*unused = 0;
+	if (*negative < 0)
+		*negative = 0;
+}
+
+/* Would one more unused negative dentry put @sb over the limit? */
+static inline int dentry_neg_full(struct super_block *sb)
+{
+	return sysctl_dentry_negative_max &&
+	       sb->s_nr_dentry_neg >= sysctl_dentry_negative_max;
+}
+
+static void dentry_neg_trim(struct super_block *sb);
+
 static void d_callback(struct rcu_head *head)
 {
 	struct dentry * dentry = container_of(head, struct dentry, d_rcu);
@@ -173,6 +329,29 @@ void dput(struct dentry *dentry)
 repeat:
 	if (atomic_read(&dentry->d_count) == 1)
 		might_sleep();
+	if (!atomic_dec_and_lock(&dentry->d_count, &dentry->d_lock))
+		return;
+
+	/*
+	 * The common case is a hashed dentry that stays cached: all it
+	 * needs is to be on its LRU list, and d_lock is enough to see to
+	 * that.  Anything else needs dcache_lock, which nests outside
+	 * d_lock, so take the reference back and drop it again under
+	 * dcache_lock.
+	 */
+	if (!d_unhashed(dentry) &&
+	    !(dentry->d_op && dentry->d_op->d_delete) &&
+	    (dentry->d_inode || !dentry_neg_full(dentry->d_sb))) {
+		if (list_empty(&dentry->d_lru)) {
+			dentry->d_flags |= DCACHE_REFERENCED;
+			dentry_lru_add(dentry, 0);
+		}
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+	atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
+
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
@@ -195,10 +374,11 @@ repeat:
 		goto kill_it;
   	if (list_empty(&dentry->d_lru)) {
   		dentry->d_flags |= DCACHE_REFERENCED;
-  		list_add(&dentry->d_lru, &dentry_unused);
-  		dentry_stat.nr_unused++;
+		dentry_lru_add(dentry, 0);
   	}
  	spin_unlock(&dentry->d_lock);
+	if (!dentry->d_inode)
+		dentry_neg_trim(dentry->d_sb);
 	spin_unlock(&dcache_lock);
 	return;
 
@@ -211,10 +391,8 @@ kill_it: {
 		/* If dentry was on d_lru list
 		 * delete it from there
 		 */
-  		if (!list_empty(&dentry->d_lru)) {
-  			list_del(&dentry->d_lru);
-  			dentry_stat.nr_unused--;
-  		}
+  		if (!list_empty(&dentry->d_lru))
+			dentry_lru_del(dentry);
   		list_del(&dentry->d_child);
 		dentry_stat.nr_dentry--;	/* For d_free, below */
 		/*drops the locks, at that point nobody can reach this dentry */
@@ -285,15 +463,15 @@ int d_invalidate(struct dentry * dentry)
 	return 0;
 }
 
-/* This should be called _only_ with dcache_lock held */
+/*
+ * This should be called _only_ with dcache_lock held.  Like a lookup,
+ * it leaves the dentry on its LRU list: some callers hold its d_lock,
+ * which taking it off would need.
+ */
 
 static inline struct dentry * __dget_locked(struct dentry *dentry)
 {
 	atomic_inc(&dentry->d_count);
-	if (!list_empty(&dentry->d_lru)) {
-		dentry_stat.nr_unused--;
-		list_del_init(&dentry->d_lru);
-	}
 	return dentry;
 }
 
@@ -431,64 +609,160 @@ static inline void prune_one_dentry(struct dentry * dentry)
 /**
  * ЧĿ¼ա
  */ 
+/*
+ * Deal with the oldest dentry on one of @sb's lists, @lru: take it off
+ * the list if it is in use, give it another round if it was referenced
+ * and @force is not set, free it otherwise.  Returns 0 if @lru was
+ * empty.  Called with dcache_lock held, which is dropped and retaken
+ * when the dentry is freed.
+ */
+static int prune_lru_tail(struct super_block *sb, struct list_head *lru,
+			  int force)
+{
+	struct dentry *dentry;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	/**
+	 * ѾδĿ¼˳
+	 */
+	if (list_empty(lru)) {
+		spin_unlock(&sb->s_dentry_lru_lock);
+		return 0;
+	}
+	dentry = list_entry(lru->prev, struct dentry, d_lru);
+	spin_unlock(&sb->s_dentry_lru_lock);
+
+	/*
+	 * d_lock nests outside the LRU lock.  With dcache_lock held the
+	 * dentry stays on the list meanwhile; dput() can only have put
+	 * newer ones in front of it.
+	 */
+	spin_lock(&dentry->d_lock);
+	dentry_lru_del(dentry);
+
+	/*
+	 * We found an inuse dentry which was not removed from
+	 * the LRU because of laziness during lookup.  Do not free
+	 * it - just keep it off the list.
+	 */
+	if (atomic_read(&dentry->d_count)) {
+		spin_unlock(&dentry->d_lock);
+		return 1;
+	}
+	/* If the dentry was recently referenced, don't free it. */
+	if (!force && (dentry->d_flags & DCACHE_REFERENCED)) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		dentry_lru_add(dentry, 0);
+		spin_unlock(&dentry->d_lock);
+		return 1;
+	}
+	prune_one_dentry(dentry);
+	return 1;
+}
+
+/*
+ * Take the next superblock with unused dentries (@negative: negative
+ * ones) in turn.  Called with dcache_lock held, which keeps it around.
+ */
+static struct super_block *dentry_lru_next_sb(int negative)
+{
+	struct list_head *sbs = negative ? &dentry_neg_sbs : &dentry_lru_sbs;
+	struct super_block *sb = NULL;
+
+	spin_lock(&dentry_sbs_lock);
+	if (!list_empty(sbs)) {
+		if (negative)
+			sb = list_entry(sbs->next, struct super_block,
+					s_neg_sbs);
+		else
+			sb = list_entry(sbs->next, struct super_block,
+					s_lru_sbs);
+		list_move_tail(sbs->next, sbs);
+	}
+	spin_unlock(&dentry_sbs_lock);
+	return sb;
+}
+
 static void prune_dcache(int count)
 {
+	int negative = 0;
+	int nr_unused, nr_negative;
+
+	dentry_lru_count(&nr_unused, &nr_negative);
 	spin_lock(&dcache_lock);
+	/*
+	 * Negative dentries get their share of @count in proportion to
+	 * how many of the unused dentries they are, scaled by
+	 * sysctl_dentry_negative_pressure (100: no preference).  They are
+	 * taken round-robin from the superblocks; whatever they do not
+	 * use up goes to the positive ones.
+	 */
+	if (nr_unused > 0 && nr_negative > 0) {
+		unsigned long long share;
+
+		share = (unsigned long long)count * nr_negative *
+			sysctl_dentry_negative_pressure;
+		do_div(share, (unsigned long)nr_unused * 100);
+		negative = share < count ? (int)share : count;
+	}
+	count -= negative;
+	for (; negative; negative--) {
+		struct super_block *sb;
+
+		cond_resched_lock(&dcache_lock);
+		sb = dentry_lru_next_sb(1);
+		if (!sb)
+			break;
+		prune_lru_tail(sb, &sb->s_dentry_neg, 0);
+	}
+	count += negative;
 	/**
-	 * ɨδĿ¼(dentry_unused)һֱͷŶɨϡ
+	 * ɨδĿ¼һֱͷŶɨϡ
 	 */
 	for (; count ; count--) {
-		struct dentry *dentry;
-		struct list_head *tmp;
+		struct super_block *sb;
 
 		cond_resched_lock(&dcache_lock);
-
-		tmp = dentry_unused.prev;
-		/**
-		 * ѾδĿ¼˳
-		 */
-		if (tmp == &dentry_unused)
+		sb = dentry_lru_next_sb(0);
+		if (!sb)
 			break;
-		list_del_init(tmp);
-		prefetch(dentry_unused.prev);
- 		dentry_stat.nr_unused--;
-		dentry = list_entry(tmp, struct dentry, d_lru);
-
- 		spin_lock(&dentry->d_lock);
-		/*
-		 * We found an inuse dentry which was not removed from
-		 * dentry_unused because of laziness during lookup.  Do not free
-		 * it - just keep it off the dentry_unused list.
-		 */
- 		if (atomic_read(&dentry->d_count)) {
- 			spin_unlock(&dentry->d_lock);
-			continue;
-		}
-		/* If the dentry was recently referenced, don't free it. */
-		if (dentry->d_flags & DCACHE_REFERENCED) {
-			dentry->d_flags &= ~DCACHE_REFERENCED;
- 			list_add(&dentry->d_lru, &dentry_unused);
- 			dentry_stat.nr_unused++;
- 			spin_unlock(&dentry->d_lock);
-			continue;
-		}
-		prune_one_dentry(dentry);
+		prune_lru_tail(sb, &sb->s_dentry_lru, 0);
 	}
 	spin_unlock(&dcache_lock);
 }
 
 /*
- * Shrink the dcache for the specified super block.
- * This allows us to unmount a device without disturbing
- * the dcache for the other devices.
- *
- * This implementation makes just two traversals of the
- * unused list.  On the first pass we move the selected
- * dentries to the most recent end, and on the second
- * pass we free them.  The second pass must restart after
- * each dput(), but since the target dentries are all at
- * the end, it's really just a single traversal.
+ * Free what select_parent() and shrink_dcache_anon() just moved to the
+ * old end of the unused lists: @negative of the @found dentries are on
+ * @sb's negative list.  Called with dcache_lock held.
  */
+static void prune_selected(struct super_block *sb, int found, int negative)
+{
+	found -= negative;
+	for (; negative; negative--) {
+		cond_resched_lock(&dcache_lock);
+		if (!prune_lru_tail(sb, &sb->s_dentry_neg, 0))
+			break;
+	}
+	for (; found; found--) {
+		cond_resched_lock(&dcache_lock);
+		if (!prune_lru_tail(sb, &sb->s_dentry_lru, 0))
+			break;
+	}
+}
+
+/*
+ * Keep @sb within sysctl_dentry_negative_max unused negative dentries by
+ * freeing the oldest one, referenced or not.  Called from dput() with
+ * dcache_lock held, which may be dropped and retaken.
+ */
+static void dentry_neg_trim(struct super_block *sb)
+{
+	if (!sysctl_dentry_negative_max ||
+	    sb->s_nr_dentry_neg <= sysctl_dentry_negative_max)
+		return;
+	prune_lru_tail(sb, &sb->s_dentry_neg, 1);
+}
 
 /**
  * shrink_dcache_sb - shrink dcache for a superblock
@@ -496,51 +770,17 @@ static void prune_dcache(int count)
  *
  * Shrink the dcache for the specified super block. This
  * is used to free the dcache before unmounting a file
- * system
+ * system.  The unused dentries are all on the superblock's
+ * own lists.
  */
 
 void shrink_dcache_sb(struct super_block * sb)
 {
-	struct list_head *tmp, *next;
-	struct dentry *dentry;
-
-	/*
-	 * Pass one ... move the dentries for the specified
-	 * superblock to the most recent end of the unused list.
-	 */
 	spin_lock(&dcache_lock);
-	next = dentry_unused.next;
-	while (next != &dentry_unused) {
-		tmp = next;
-		next = tmp->next;
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		list_del(tmp);
-		list_add(tmp, &dentry_unused);
-	}
-
-	/*
-	 * Pass two ... free the dentries for this superblock.
-	 */
-repeat:
-	next = dentry_unused.next;
-	while (next != &dentry_unused) {
-		tmp = next;
-		next = tmp->next;
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		dentry_stat.nr_unused--;
-		list_del_init(tmp);
-		spin_lock(&dentry->d_lock);
-		if (atomic_read(&dentry->d_count)) {
-			spin_unlock(&dentry->d_lock);
-			continue;
-		}
-		prune_one_dentry(dentry);
-		goto repeat;
-	}
+	while (prune_lru_tail(sb, &sb->s_dentry_neg, 1))
+		cond_resched_lock(&dcache_lock);
+	while (prune_lru_tail(sb, &sb->s_dentry_lru, 1))
+		cond_resched_lock(&dcache_lock);
 	spin_unlock(&dcache_lock);
 }
 
@@ -605,17 +845,19 @@ positive:
  *
  * It returns zero iff there are no unused children,
  * otherwise  it returns the number of children moved to
- * the end of the unused list. This may not be the total
+ * the end of the unused lists, *negative of them to the
+ * superblock's negative list. This may not be the total
  * number of unused children, because select_parent can
  * drop the lock and return early due to latency
  * constraints.
  */
-static int select_parent(struct dentry * parent)
+static int select_parent(struct dentry * parent, int *negative)
 {
 	struct dentry *this_parent = parent;
 	struct list_head *next;
 	int found = 0;
 
+	*negative = 0;
 	spin_lock(&dcache_lock);
 repeat:
 	next = this_parent->d_subdirs.next;
@@ -625,19 +867,20 @@ resume:
 		struct dentry *dentry = list_entry(tmp, struct dentry, d_child);
 		next = tmp->next;
 
-		if (!list_empty(&dentry->d_lru)) {
-			dentry_stat.nr_unused--;
-			list_del_init(&dentry->d_lru);
-		}
+		spin_lock(&dentry->d_lock);
+		if (!list_empty(&dentry->d_lru))
+			dentry_lru_del(dentry);
 		/* 
 		 * move only zero ref count dentries to the end 
 		 * of the unused list for prune_dcache
 		 */
 		if (!atomic_read(&dentry->d_count)) {
-			list_add(&dentry->d_lru, dentry_unused.prev);
-			dentry_stat.nr_unused++;
+			dentry_lru_add(dentry, 1);
+			if (!dentry->d_inode)
+				(*negative)++;
 			found++;
 		}
+		spin_unlock(&dentry->d_lock);
 
 		/*
 		 * We can return to the caller if we have found some (this
@@ -685,10 +928,13 @@ out:
  
 void shrink_dcache_parent(struct dentry * parent)
 {
-	int found;
+	int found, negative;
 
-	while ((found = select_parent(parent)) != 0)
-		prune_dcache(found);
+	while ((found = select_parent(parent, &negative)) != 0) {
+		spin_lock(&dcache_lock);
+		prune_selected(parent->d_sb, found, negative);
+		spin_unlock(&dcache_lock);
+	}
 }
 
 /**
@@ -704,29 +950,32 @@ void shrink_dcache_parent(struct dentry * parent)
 void shrink_dcache_anon(struct hlist_head *head)
 {
 	struct hlist_node *lp;
-	int found;
+	struct super_block *sb = NULL;
+	int found, negative;
 	do {
-		found = 0;
+		found = negative = 0;
 		spin_lock(&dcache_lock);
 		hlist_for_each(lp, head) {
 			struct dentry *this = hlist_entry(lp, struct dentry, d_hash);
-			if (!list_empty(&this->d_lru)) {
-				dentry_stat.nr_unused--;
-				list_del_init(&this->d_lru);
-			}
+			sb = this->d_sb;
+			spin_lock(&this->d_lock);
+			if (!list_empty(&this->d_lru))
+				dentry_lru_del(this);
 
 			/* 
 			 * move only zero ref count dentries to the end 
 			 * of the unused list for prune_dcache
 			 */
 			if (!atomic_read(&this->d_count)) {
-				list_add_tail(&this->d_lru, &dentry_unused);
-				dentry_stat.nr_unused++;
+				dentry_lru_add(this, 1);
+				if (!this->d_inode)
+					negative++;
 				found++;
 			}
+			spin_unlock(&this->d_lock);
 		}
+		prune_selected(sb, found, negative);
 		spin_unlock(&dcache_lock);
-		prune_dcache(found);
 	} while(found);
 }
 
@@ -752,6 +1001,8 @@ void shrink_dcache_anon(struct hlist_head *head)
  */
 static int shrink_dcache_memory(int nr, unsigned int gfp_mask)
 {
+	int unused, negative;
+
 	/**
 	 * nrΪ0ʾϲúֻҪ֪ɱͷŵڴýڴա
 	 */
@@ -774,7 +1025,39 @@ static int shrink_dcache_memory(int nr, unsigned int gfp_mask)
 	 * ֵΪС100ʹshrink_slab()Ŀ¼ٻյҳڴLRUлյҳ
 	 * ֵΪ100ʹshrink_slab()Ŀ¼ٻյҳڴLRUлյҳ
 	 */
-	return (dentry_stat.nr_unused / 100) * sysctl_vfs_cache_pressure;
+	dentry_lru_count(&unused, &negative);
+	return (unused / 100) * sysctl_vfs_cache_pressure;
+}
+
+/*
+ * /proc/sys/fs/dentry-negative-lookups: lookups answered by a negative
+ * dentry, and lookups that went to the filesystem and came back empty.
+ */
+int proc_dentry_neg_lookups(ctl_table *table, int write, struct file *filp,
+			    void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	unsigned long lookups[2] = { 0, 0 };
+	ctl_table tmp = *table;
+	int cpu;
+
+	for_each_cpu(cpu) {
+		lookups[0] += per_cpu(dentry_neg_stats, cpu).hits;
+		lookups[1] += per_cpu(dentry_neg_stats, cpu).misses;
+	}
+	tmp.data = lookups;
+	tmp.maxlen = sizeof(lookups);
+	return proc_doulongvec_minmax(&tmp, write, filp, buffer, lenp, ppos);
+}
+
+/*
+ * /proc/sys/fs/dentry-state: the unused counts are kept per cpu, bring
+ * them up to date first.
+ */
+int proc_dentry_state(ctl_table *table, int write, struct file *filp,
+		      void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	dentry_lru_count(&dentry_stat.nr_unused, &dentry_stat.nr_negative);
+	return proc_dointvec(table, write, filp, buffer, lenp, ppos);
 }
 
 /**
@@ -872,11 +1155,26 @@ void d_instantiate(struct dentry *entry, struct inode * inode)
 {
 	if (!list_empty(&entry->d_alias)) BUG();
 	spin_lock(&dcache_lock);
+	__d_instantiate(entry, inode);
+	spin_unlock(&dcache_lock);
+	security_d_instantiate(entry, inode);
+}
+
+/*
+ * d_instantiate() for callers that already hold dcache_lock.  Which LRU
+ * an unused dentry is on follows from d_inode, so it comes off its list
+ * before d_inode changes.  The caller does security_d_instantiate()
+ * once it has dropped the lock.
+ */
+void __d_instantiate(struct dentry *entry, struct inode *inode)
+{
 	if (inode)
 		list_add(&entry->d_alias, &inode->i_dentry);
+	spin_lock(&entry->d_lock);
+	if (!list_empty(&entry->d_lru))
+		dentry_lru_del(entry);
 	entry->d_inode = inode;
-	spin_unlock(&dcache_lock);
-	security_d_instantiate(entry, inode);
+	spin_unlock(&entry->d_lock);
 }
 
 /**
@@ -920,7 +1218,11 @@ struct dentry *d_instantiate_unique(struct dentry *entry, struct inode *inode)
 	}
 	list_add(&entry->d_alias, &inode->i_dentry);
 do_negative:
+	spin_lock(&entry->d_lock);
+	if (!list_empty(&entry->d_lru))
+		dentry_lru_del(entry);
 	entry->d_inode = inode;
+	spin_unlock(&entry->d_lock);
 	spin_unlock(&dcache_lock);
 	security_d_instantiate(entry, inode);
 	return NULL;
@@ -961,6 +1263,39 @@ static inline struct hlist_head *d_hash(struct dentry *parent,
 	return dentry_hashtable + (hash & D_HASHMASK);
 }
 
+static inline spinlock_t *d_hash_lock(struct hlist_head *list)
+{
+	return &d_hash_locks[(list - dentry_hashtable) &
+			     (D_HASH_LOCKS - 1)].lock;
+}
+
+static inline void __d_unhash(struct dentry *dentry)
+{
+	if (!(dentry->d_flags & DCACHE_UNHASHED)) {
+		dentry->d_flags |= DCACHE_UNHASHED;
+		hlist_del_rcu(&dentry->d_hash);
+	}
+}
+
+/*
+ * Called with dcache_lock held.  Disconnected dentries sit on their
+ * superblock's s_anon list rather than on a hash chain; that list is
+ * still covered by dcache_lock, the chain lock taken for them here is
+ * merely redundant.
+ */
+void __d_drop(struct dentry *dentry)
+{
+	spinlock_t *lock;
+
+	if (!(dentry->d_flags & DCACHE_UNHASHED)) {
+		lock = d_hash_lock(d_hash(dentry->d_parent,
+					  dentry->d_name.hash));
+		spin_lock(lock);
+		__d_unhash(dentry);
+		spin_unlock(lock);
+	}
+}
+
 /**
  * d_alloc_anon - allocate an anonymous dentry
  * @inode: inode to allocate the dentry for
@@ -1057,9 +1392,7 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
 			d_move(new, dentry);
 			iput(inode);
 		} else {
-			/* d_instantiate takes dcache_lock, so we do it by hand */
-			list_add(&dentry->d_alias, &inode->i_dentry);
-			dentry->d_inode = inode;
+			__d_instantiate(dentry, inode);
 			spin_unlock(&dcache_lock);
 			security_d_instantiate(dentry, inode);
 			d_rehash(dentry);
@@ -1090,10 +1423,9 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
  * rcu_read_lock() and rcu_read_unlock() are used to disable preemption while
  * lookup is going on.
  *
- * dentry_unused list is not updated even if lookup finds the required dentry
- * in there. It is updated in places such as prune_dcache, shrink_dcache_sb,
- * select_parent and __dget_locked. This laziness saves lookup from dcache_lock
- * acquisition.
+ * The LRU lists are not updated even if lookup finds the required dentry
+ * in there. They are updated in places such as prune_dcache, shrink_dcache_sb
+ * and select_parent. This laziness saves lookup from taking the LRU locks.
  *
  * d_lookup() is protected against the concurrent renames in some unrelated
  * directory using the seqlockt_t rename_lock.
@@ -1182,6 +1514,42 @@ next:
  	return found;
 }
 
+/*
+ * __d_lookup_rcu - lockless variant of __d_lookup for the RCU path walk.
+ *
+ * Neither d_lock nor a reference is taken: the caller must be inside
+ * rcu_read_lock() and must check rename_lock before it trusts the result,
+ * since a concurrent d_move can change the name under us.  Parents with
+ * ->d_compare are not handled here.
+ */
+struct dentry * __d_lookup_rcu(struct dentry * parent, struct qstr * name)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_head *head = d_hash(parent,hash);
+	struct hlist_node *node;
+
+	hlist_for_each_rcu(node, head) {
+		struct dentry *dentry;
+
+		dentry = hlist_entry(node, struct dentry, d_hash);
+
+		if (dentry->d_name.hash != hash)
+			continue;
+		if (dentry->d_parent != parent)
+			continue;
+		if (dentry->d_name.len != len)
+			continue;
+		if (memcmp(dentry->d_name.name, str, len))
+			continue;
+		if (d_unhashed(dentry))
+			return NULL;
+		return dentry;
+	}
+	return NULL;
+}
+
 /**
  * d_validate - verify dentry provided from insecure source
  * @dentry: The dentry alleged to be valid child of @dparent
@@ -1208,16 +1576,17 @@ int d_validate(struct dentry *dentry, struct dentry *dparent)
 
 	spin_lock(&dcache_lock);
 	base = d_hash(dparent, dentry->d_name.hash);
-	hlist_for_each(lhp,base) { 
-		/* hlist_for_each_rcu() not required for d_hash list
-		 * as it is parsed under dcache_lock
-		 */
+	rcu_read_lock();
+	hlist_for_each_rcu(lhp,base) {
+		/* d_rehash() adds to the chain without dcache_lock */
 		if (dentry == hlist_entry(lhp, struct dentry, d_hash)) {
+			rcu_read_unlock();
 			__dget_locked(dentry);
 			spin_unlock(&dcache_lock);
 			return 1;
 		}
 	}
+	rcu_read_unlock();
 	spin_unlock(&dcache_lock);
 out:
 	return 0;
@@ -1252,6 +1621,8 @@ void d_delete(struct dentry * dentry)
 	spin_lock(&dcache_lock);
 	spin_lock(&dentry->d_lock);
 	if (atomic_read(&dentry->d_count) == 1) {
+		if (!list_empty(&dentry->d_lru))
+			dentry_lru_del(dentry);
 		dentry_iput(dentry);
 		return;
 	}
@@ -1279,13 +1650,16 @@ static void __d_rehash(struct dentry * entry, struct hlist_head *list)
  
 void d_rehash(struct dentry * entry)
 {
-	struct hlist_head *list = d_hash(entry->d_parent, entry->d_name.hash);
+	struct hlist_head *list;
+	spinlock_t *lock;
 
-	spin_lock(&dcache_lock);
 	spin_lock(&entry->d_lock);
+	list = d_hash(entry->d_parent, entry->d_name.hash);
+	lock = d_hash_lock(list);
+	spin_lock(lock);
 	__d_rehash(entry, list);
+	spin_unlock(lock);
 	spin_unlock(&entry->d_lock);
-	spin_unlock(&dcache_lock);
 }
 
 #define do_switch(x,y) do { \
@@ -1363,6 +1737,7 @@ static void switch_names(struct dentry *dentry, struct dentry *target)
 void d_move(struct dentry * dentry, struct dentry * target)
 {
 	struct hlist_head *list;
+	spinlock_t *old_lock, *new_lock;
 
 	if (!dentry->d_inode)
 		printk(KERN_WARNING "VFS: moving negative dcache entry\n");
@@ -1380,6 +1755,19 @@ void d_move(struct dentry * dentry, struct dentry * target)
 		spin_lock(&target->d_lock);
 	}
 
+	list = d_hash(target->d_parent, target->d_name.hash);
+	old_lock = d_hash_lock(d_hash(dentry->d_parent, dentry->d_name.hash));
+	new_lock = d_hash_lock(list);
+	if (old_lock == new_lock)
+		spin_lock(new_lock);
+	else if (old_lock < new_lock) {
+		spin_lock(old_lock);
+		spin_lock(new_lock);
+	} else {
+		spin_lock(new_lock);
+		spin_lock(old_lock);
+	}
+
 	/* Move the dentry to the target hash queue, if on different bucket */
 	if (dentry->d_flags & DCACHE_UNHASHED)
 		goto already_unhashed;
@@ -1387,11 +1775,14 @@ void d_move(struct dentry * dentry, struct dentry * target)
 	hlist_del_rcu(&dentry->d_hash);
 
 already_unhashed:
-	list = d_hash(target->d_parent, target->d_name.hash);
 	__d_rehash(dentry, list);
 
 	/* Unhash the target: dput() will then get rid of it */
-	__d_drop(target);
+	__d_unhash(target);
+
+	spin_unlock(new_lock);
+	if (old_lock != new_lock)
+		spin_unlock(old_lock);
 
 	list_del(&dentry->d_child);
 	list_del(&target->d_child);
@@ -1816,7 +2207,7 @@ void __init vfs_caches_init(unsigned long mempages)
 			SLAB_HWCACHE_ALIGN|SLAB_PANIC, NULL, NULL);
 
 	filp_cachep = kmem_cache_create("filp", sizeof(struct file), 0,
-			SLAB_HWCACHE_ALIGN|SLAB_PANIC, filp_ctor, filp_dtor);
+			SLAB_HWCACHE_ALIGN|SLAB_PANIC, NULL, NULL);
 
 	dcache_init(mempages);
 	inode_init(mempages);
@@ -1826,6 +2217,8 @@ void __init vfs_caches_init(unsigned long mempages)
 	chrdev_init();
 }
 
+EXPORT_SYMBOL(__d_drop);
+EXPORT_SYMBOL(__d_instantiate);
 EXPORT_SYMBOL(d_alloc);
 EXPORT_SYMBOL(d_alloc_anon);
 EXPORT_SYMBOL(d_alloc_root);
@@ -303,6 +303,40 @@ ext3_permission(struct inode *inode, int mask, struct nameidata *nd)
 	return generic_permission(inode, mask, ext3_check_acl);
 }
 
+/*
+ * As ext3_check_acl(), but only from the cache: reading the ACL in may
+ * sleep.  -ECHILD gets past generic_permission() and sends the RCU path
+ * walk back to ext3_permission().
+ */
+static int
+ext3_check_acl_rcu(struct inode *inode, int mask)
+{
+	struct posix_acl *acl;
+	int error;
+
+	if (!test_opt(inode->i_sb, POSIX_ACL))
+		return -EAGAIN;
+	acl = ext3_iget_acl(inode, &EXT3_I(inode)->i_acl);
+	if (acl == EXT3_ACL_NOT_CACHED)
+		return -ECHILD;
+	if (!acl)
+		return -EAGAIN;
+	error = posix_acl_permission(inode, acl, mask);
+	posix_acl_release(acl);
+	return error;
+}
+
+/*
+ * Inode operation permission_rcu().
+ *
+ * Called under rcu_read_lock(); ext3 inodes are freed through RCU.
+ */
+int
+ext3_permission_rcu(struct inode *inode, int mask)
+{
+	return generic_permission(inode, mask, ext3_check_acl_rcu);
+}
+
 /*
  * Initialize the ACLs of a new inode. Called from ext3_new_inode.
  *
@@ -59,6 +59,7 @@ static inline int ext3_acl_count(size_t size)
 
 /* acl.c */
 extern int ext3_permission (struct inode *, int, struct nameidata *);
+extern int ext3_permission_rcu (struct inode *, int);
 extern int ext3_acl_chmod (struct inode *);
 extern int ext3_init_acl (handle_t *, struct inode *, struct inode *);
 
@@ -68,6 +69,7 @@ extern void exit_ext3_acl(void);
 #else  /* CONFIG_EXT3_FS_POSIX_ACL */
 #include <linux/sched.h>
 #define ext3_permission NULL
+#define ext3_permission_rcu NULL
 
 static inline int
 ext3_acl_chmod(struct inode *inode)
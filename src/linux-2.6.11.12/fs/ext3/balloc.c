@@ -73,14 +73,81 @@ struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 	return gdp + desc;
 }
 
+/*
+ * Number of blocks at the start of a group taken by the superblock and
+ * group descriptor table backups, reserved GDT blocks included.
+ */
+static unsigned long ext3_group_sb_blocks(struct super_block *sb, int group)
+{
+	struct ext3_super_block *es = EXT3_SB(sb)->s_es;
+	unsigned long desc_per_block = EXT3_DESC_PER_BLOCK(sb);
+	unsigned long metagroup = group / desc_per_block;
+	unsigned long first_meta_bg = le32_to_cpu(es->s_first_meta_bg);
+	unsigned long first, num = 0;
+
+	if (!EXT3_HAS_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_META_BG) ||
+	    metagroup < first_meta_bg) {
+		if (!ext3_bg_has_super(sb, group))
+			return 0;
+		if (EXT3_HAS_INCOMPAT_FEATURE(sb,
+					EXT3_FEATURE_INCOMPAT_META_BG))
+			num = first_meta_bg;
+		else
+			num = ext3_bg_num_gdb(sb, group);
+		return 1 + num + le16_to_cpu(es->s_reserved_gdt_blocks);
+	}
+
+	/* meta_bg: one descriptor block in each of three groups */
+	first = metagroup * desc_per_block;
+	if (group == first || group == first + 1 ||
+	    group == first + desc_per_block - 1)
+		num = 1;
+	return ext3_bg_has_super(sb, group) + num;
+}
+
+/*
+ * Build the block bitmap of a group which mke2fs left uninitialised:
+ * only the group's own metadata is in use, plus the bits past the end
+ * of the filesystem in the last group.
+ */
+static void ext3_init_block_bitmap(struct super_block *sb,
+				   struct buffer_head *bh, int block_group,
+				   struct ext3_group_desc *desc)
+{
+	struct ext3_super_block *es = EXT3_SB(sb)->s_es;
+	unsigned long group_blocks = EXT3_BLOCKS_PER_GROUP(sb);
+	unsigned long start, bit_max, i;
+
+	start = block_group * group_blocks +
+		le32_to_cpu(es->s_first_data_block);
+
+	memset(bh->b_data, 0, sb->s_blocksize);
+
+	bit_max = ext3_group_sb_blocks(sb, block_group);
+	for (i = 0; i < bit_max; i++)
+		ext3_set_bit(i, bh->b_data);
+
+	ext3_set_bit(le32_to_cpu(desc->bg_block_bitmap) - start, bh->b_data);
+	ext3_set_bit(le32_to_cpu(desc->bg_inode_bitmap) - start, bh->b_data);
+	for (i = 0; i < EXT3_SB(sb)->s_itb_per_group; i++)
+		ext3_set_bit(le32_to_cpu(desc->bg_inode_table) - start + i,
+			     bh->b_data);
+
+	if (block_group == EXT3_SB(sb)->s_groups_count - 1)
+		group_blocks = le32_to_cpu(es->s_blocks_count) - start;
+	for (i = group_blocks; i < sb->s_blocksize * 8; i++)
+		ext3_set_bit(i, bh->b_data);
+}
+
 /*
  * Read the bitmap for a given block_group, reading into the specified 
- * slot in the superblock's bitmap cache.
+ * slot in the superblock's bitmap cache.  The bitmap of a group still
+ * flagged BLOCK_UNINIT is never read: it is built in memory instead.
  *
  * Return buffer_head on success or NULL in case of failure.
  */
-static struct buffer_head *
-read_block_bitmap(struct super_block *sb, unsigned int block_group)
+struct buffer_head *
+ext3_read_block_bitmap(struct super_block *sb, unsigned int block_group)
 {
 	struct ext3_group_desc * desc;
 	struct buffer_head * bh = NULL;
@@ -88,9 +155,22 @@ read_block_bitmap(struct super_block *sb, unsigned int block_group)
 	desc = ext3_get_group_desc (sb, block_group, NULL);
 	if (!desc)
 		goto error_out;
-	bh = sb_bread(sb, le32_to_cpu(desc->bg_block_bitmap));
+	if (EXT3_HAS_RO_COMPAT_FEATURE(sb, EXT3_FEATURE_RO_COMPAT_GDT_CSUM) &&
+	    (desc->bg_flags & cpu_to_le16(EXT3_BG_BLOCK_UNINIT))) {
+		bh = sb_getblk(sb, le32_to_cpu(desc->bg_block_bitmap));
+		if (bh && !buffer_uptodate(bh)) {
+			lock_buffer(bh);
+			if (!buffer_uptodate(bh)) {
+				ext3_init_block_bitmap(sb, bh, block_group,
+						       desc);
+				set_buffer_uptodate(bh);
+			}
+			unlock_buffer(bh);
+		}
+	} else
+		bh = sb_bread(sb, le32_to_cpu(desc->bg_block_bitmap));
 	if (!bh)
-		ext3_error (sb, "read_block_bitmap",
+		ext3_error (sb, "ext3_read_block_bitmap",
 			    "Cannot read block bitmap - "
 			    "block_group = %d, block_bitmap = %u",
 			    block_group, le32_to_cpu(desc->bg_block_bitmap));
@@ -318,7 +398,7 @@ do_more:
 		count -= overflow;
 	}
 	brelse(bitmap_bh);
-	bitmap_bh = read_block_bitmap(sb, block_group);
+	bitmap_bh = ext3_read_block_bitmap(sb, block_group);
 	if (!bitmap_bh)
 		goto error_return;
 	gdp = ext3_get_group_desc (sb, block_group, &gd_bh);
@@ -430,6 +510,9 @@ do_more:
 	gdp->bg_free_blocks_count =
 		cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) +
 			*pdquot_freed_blocks);
+	/* the bitmap we just journaled is the real one now */
+	gdp->bg_flags &= cpu_to_le16(~EXT3_BG_BLOCK_UNINIT);
+	gdp->bg_checksum = ext3_group_desc_csum(sbi, block_group, gdp);
 	spin_unlock(sb_bgl_lock(sbi, block_group));
 	percpu_counter_mod(&sbi->s_freeblocks_counter, count);
 
@@ -613,12 +696,19 @@ claim_block(spinlock_t *lock, int block, struct buffer_head *bh)
  * If we failed to allocate the desired block then we may end up crossing to a
  * new bitmap.  In that case we must release write access to the old one via
  * ext3_journal_release_buffer(), else we'll run out of credits.
+ *
+ * *count is the number of blocks wanted.  Once the first block is claimed,
+ * the blocks following it are claimed too while they are free and inside
+ * the window, up to *count, and *count is set to the number claimed.  It
+ * is left alone on failure.
  */
 static int
 ext3_try_to_allocate(struct super_block *sb, handle_t *handle, int group,
-	struct buffer_head *bitmap_bh, int goal, struct ext3_reserve_window *my_rsv)
+	struct buffer_head *bitmap_bh, int goal, unsigned long *count,
+	struct ext3_reserve_window *my_rsv)
 {
 	int group_first_block, start, end;
+	unsigned long num;
 
 	/* we do allocation within the reservation window if we have a window */
 	if (my_rsv) {
@@ -676,7 +766,16 @@ repeat:
 			goto fail_access;
 		goto repeat;
 	}
-	return goal;
+	num = 1;
+	goal++;
+	while (num < *count && goal < end &&
+	       ext3_test_allocatable(goal, bitmap_bh) &&
+	       claim_block(sb_bgl_lock(EXT3_SB(sb), group), goal, bitmap_bh)) {
+		num++;
+		goal++;
+	}
+	*count = num;
+	return goal - num;
 fail_access:
 	return -1;
 }
@@ -985,7 +1084,7 @@ static int
 ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 			unsigned int group, struct buffer_head *bitmap_bh,
 			int goal, struct ext3_reserve_window_node * my_rsv,
-			int *errp)
+			unsigned long *count, int *errp)
 {
 	spinlock_t *rsv_lock;
 	unsigned long group_first_block;
@@ -1014,7 +1113,8 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 	 * or last attempt to allocate a block with reservation turned on failed
 	 */
 	if (my_rsv == NULL ) {
-		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal, NULL);
+		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal,
+					   count, NULL);
 		goto out;
 	}
 	rsv_lock = &EXT3_SB(sb)->s_rsv_window_lock;
@@ -1054,6 +1154,14 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 
 		if (rsv_is_empty(&rsv_copy) || (ret < 0) ||
 			!goal_in_my_reservation(&rsv_copy, goal, group, sb)) {
+			/*
+			 * A multi-block request gets a window large enough
+			 * to hold it.
+			 */
+			if (atomic_read(&my_rsv->rsv_goal_size) < *count)
+				atomic_set(&my_rsv->rsv_goal_size,
+					   min_t(unsigned long, *count,
+						 EXT3_MAX_RESERVE_BLOCKS));
 			spin_lock(rsv_lock);
 			write_seqlock(&my_rsv->rsv_seqlock);
 			ret = alloc_new_reservation(my_rsv, goal, sb,
@@ -1072,7 +1180,7 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 		    || (rsv_copy._rsv_end < group_first_block))
 			BUG();
 		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal,
-					   &rsv_copy);
+					   count, &rsv_copy);
 		if (ret >= 0) {
 			if (!read_seqretry(&my_rsv->rsv_seqlock, seq))
 				atomic_inc(&my_rsv->rsv_alloc_hit);
@@ -1096,11 +1204,18 @@ out:
 	return ret;
 }
 
-static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
+/*
+ * Blocks promised to delayed allocation are not free for anyone else.
+ * An allocation for @delayed buffers draws on its own promise.
+ */
+static int ext3_has_free_blocks(struct ext3_sb_info *sbi, int delayed)
 {
-	int free_blocks, root_blocks;
+	long free_blocks, root_blocks;
 
 	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+	if (!delayed)
+		free_blocks -= percpu_counter_read_positive(
+					&sbi->s_dirtyblocks_counter);
 	root_blocks = le32_to_cpu(sbi->s_es->s_r_blocks_count);
 	if (free_blocks < root_blocks + 1 && !capable(CAP_SYS_RESOURCE) &&
 		sbi->s_resuid != current->fsuid &&
@@ -1118,7 +1233,7 @@ static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
  */
 int ext3_should_retry_alloc(struct super_block *sb, int *retries)
 {
-	if (!ext3_has_free_blocks(EXT3_SB(sb)) || (*retries)++ > 3)
+	if (!ext3_has_free_blocks(EXT3_SB(sb), 0) || (*retries)++ > 3)
 		return 0;
 
 	jbd_debug(1, "%s: retrying operation after ENOSPC\n", sb->s_id);
@@ -1127,15 +1242,57 @@ int ext3_should_retry_alloc(struct super_block *sb, int *retries)
 }
 
 /*
- * ext3_new_block uses a goal block to assist allocation.  If the goal is
+ * Delayed allocation promises blocks at write() time and allocates them
+ * at writeback.  Outstanding promises are counted in s_dirtyblocks_counter.
+ * A promise is refused once the free blocks not already promised come
+ * close to the reserved pool.  The writer then allocates at once and gets
+ * its ENOSPC from write() rather than losing data at writeback.  The margin
+ * covers the drift of the per-cpu counters and the index blocks the
+ * delayed writes will need.
+ *
+ * The caller also charges the quota of the promised blocks at once, so
+ * that EDQUOT too comes from write(); ext3_new_blocks() does not charge
+ * them again when they are allocated.
+ */
+int ext3_claim_delayed_blocks(struct super_block *sb, unsigned long count)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	long free_blocks, dirty_blocks, root_blocks;
+
+	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+	dirty_blocks = percpu_counter_read_positive(&sbi->s_dirtyblocks_counter);
+	root_blocks = le32_to_cpu(sbi->s_es->s_r_blocks_count);
+	if (free_blocks - dirty_blocks - (dirty_blocks >> 6) - (long)count <
+			root_blocks + 2 * FBC_BATCH * num_online_cpus())
+		return -ENOSPC;
+	percpu_counter_mod(&sbi->s_dirtyblocks_counter, count);
+	return 0;
+}
+
+void ext3_release_delayed_blocks(struct super_block *sb, unsigned long count)
+{
+	percpu_counter_mod(&EXT3_SB(sb)->s_dirtyblocks_counter, -(long)count);
+}
+
+/*
+ * ext3_new_blocks uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
  * This function also updates quota and i_blocks field.
+ *
+ * Up to *count blocks are allocated, contiguous from the returned block
+ * and within one group; *count is set to the number actually allocated.
+ * The bitmap and group descriptor are dirtied once for the whole run.
+ * If the quota does not allow for *count blocks, the run is shortened.
+ *
+ * @delayed blocks were promised, and their quota charged, when they were
+ * written: they may use the promised space and are not charged again.
  */
-int ext3_new_block(handle_t *handle, struct inode *inode,
-			unsigned long goal, int *errp)
+int ext3_new_blocks(handle_t *handle, struct inode *inode,
+			unsigned long goal, unsigned long *count, int delayed,
+			int *errp)
 {
 	struct buffer_head *bitmap_bh = NULL;
 	struct buffer_head *gdp_bh;
@@ -1147,6 +1304,8 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	int fatal = 0, err;
 	int performed_allocation = 0;
 	int free_blocks;
+	unsigned long num = *count;
+	unsigned long charged = 0;
 	struct super_block *sb;
 	struct ext3_group_desc *gdp;
 	struct ext3_super_block *es;
@@ -1167,11 +1326,18 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	}
 
 	/*
-	 * Check quota for allocation of this block.
+	 * Check quota for allocation of these blocks, settling for fewer
+	 * if that is all the quota allows.
 	 */
-	if (DQUOT_ALLOC_BLOCK(inode, 1)) {
-		*errp = -EDQUOT;
-		return 0;
+	if (!delayed) {
+		while (DQUOT_ALLOC_BLOCK(inode, num)) {
+			if (num == 1) {
+				*errp = -EDQUOT;
+				return 0;
+			}
+			num >>= 1;
+		}
+		charged = num;
 	}
 
 	sbi = EXT3_SB(sb);
@@ -1189,7 +1355,7 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	if (test_opt(sb, RESERVATION) &&
 		S_ISREG(inode->i_mode) && (windowsz > 0))
 		my_rsv = rsv;
-	if (!ext3_has_free_blocks(sbi)) {
+	if (!ext3_has_free_blocks(sbi, delayed)) {
 		*errp = -ENOSPC;
 		goto out;
 	}
@@ -1212,11 +1378,12 @@ retry:
 	if (free_blocks > 0) {
 		ret_block = ((goal - le32_to_cpu(es->s_first_data_block)) %
 				EXT3_BLOCKS_PER_GROUP(sb));
-		bitmap_bh = read_block_bitmap(sb, group_no);
+		bitmap_bh = ext3_read_block_bitmap(sb, group_no);
 		if (!bitmap_bh)
 			goto io_error;
 		ret_block = ext3_try_to_allocate_with_rsv(sb, handle, group_no,
-					bitmap_bh, ret_block, my_rsv, &fatal);
+					bitmap_bh, ret_block, my_rsv, &num,
+					&fatal);
 		if (fatal)
 			goto out;
 		if (ret_block >= 0)
@@ -1249,11 +1416,11 @@ retry:
 			continue;
 
 		brelse(bitmap_bh);
-		bitmap_bh = read_block_bitmap(sb, group_no);
+		bitmap_bh = ext3_read_block_bitmap(sb, group_no);
 		if (!bitmap_bh)
 			goto io_error;
 		ret_block = ext3_try_to_allocate_with_rsv(sb, handle, group_no,
-					bitmap_bh, -1, my_rsv, &fatal);
+					bitmap_bh, -1, my_rsv, &num, &fatal);
 		if (fatal)
 			goto out;
 		if (ret_block >= 0) 
@@ -1288,13 +1455,15 @@ allocated:
 	target_block = ret_block + group_no * EXT3_BLOCKS_PER_GROUP(sb)
 				+ le32_to_cpu(es->s_first_data_block);
 
-	if (target_block == le32_to_cpu(gdp->bg_block_bitmap) ||
-	    target_block == le32_to_cpu(gdp->bg_inode_bitmap) ||
+	if (in_range(le32_to_cpu(gdp->bg_block_bitmap), target_block, num) ||
+	    in_range(le32_to_cpu(gdp->bg_inode_bitmap), target_block, num) ||
 	    in_range(target_block, le32_to_cpu(gdp->bg_inode_table),
+		      EXT3_SB(sb)->s_itb_per_group) ||
+	    in_range(target_block + num - 1, le32_to_cpu(gdp->bg_inode_table),
 		      EXT3_SB(sb)->s_itb_per_group))
 		ext3_error(sb, "ext3_new_block",
 			    "Allocating block in system zone - "
-			    "block = %u", target_block);
+			    "blocks from %u, length %lu", target_block, num);
 
 	performed_allocation = 1;
 
@@ -1313,10 +1482,14 @@ allocated:
 	jbd_lock_bh_state(bitmap_bh);
 	spin_lock(sb_bgl_lock(sbi, group_no));
 	if (buffer_jbd(bitmap_bh) && bh2jh(bitmap_bh)->b_committed_data) {
-		if (ext3_test_bit(ret_block,
-				bh2jh(bitmap_bh)->b_committed_data)) {
-			printk("%s: block was unexpectedly set in "
-				"b_committed_data\n", __FUNCTION__);
+		int i;
+
+		for (i = 0; i < num; i++) {
+			if (ext3_test_bit(ret_block + i,
+					bh2jh(bitmap_bh)->b_committed_data)) {
+				printk("%s: block was unexpectedly set in "
+					"b_committed_data\n", __FUNCTION__);
+			}
 		}
 	}
 	ext3_debug("found bit %d\n", ret_block);
@@ -1327,7 +1500,7 @@ allocated:
 	/* ret_block was blockgroup-relative.  Now it becomes fs-relative */
 	ret_block = target_block;
 
-	if (ret_block >= le32_to_cpu(es->s_blocks_count)) {
+	if (ret_block + num - 1 >= le32_to_cpu(es->s_blocks_count)) {
 		ext3_error(sb, "ext3_new_block",
 			    "block(%d) >= blocks count(%d) - "
 			    "block_group = %d, es == %p ", ret_block,
@@ -1345,9 +1518,12 @@ allocated:
 
 	spin_lock(sb_bgl_lock(sbi, group_no));
 	gdp->bg_free_blocks_count =
-			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - 1);
+			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - num);
+	/* the bitmap we just journaled is the real one now */
+	gdp->bg_flags &= cpu_to_le16(~EXT3_BG_BLOCK_UNINIT);
+	gdp->bg_checksum = ext3_group_desc_csum(sbi, group_no, gdp);
 	spin_unlock(sb_bgl_lock(sbi, group_no));
-	percpu_counter_mod(&sbi->s_freeblocks_counter, -1);
+	percpu_counter_mod(&sbi->s_freeblocks_counter, -num);
 
 	BUFFER_TRACE(gdp_bh, "journal_dirty_metadata for group descriptor");
 	err = ext3_journal_dirty_metadata(handle, gdp_bh);
@@ -1360,6 +1536,10 @@ allocated:
 
 	*errp = 0;
 	brelse(bitmap_bh);
+	/* give back the quota of the blocks we could not get */
+	if (num < charged)
+		DQUOT_FREE_BLOCK(inode, charged - num);
+	*count = num;
 	return ret_block;
 
 io_error:
@@ -1372,12 +1552,20 @@ out:
 	/*
 	 * Undo the block allocation
 	 */
-	if (!performed_allocation)
-		DQUOT_FREE_BLOCK(inode, 1);
+	if (!performed_allocation && charged)
+		DQUOT_FREE_BLOCK(inode, charged);
 	brelse(bitmap_bh);
 	return 0;
 }
 
+int ext3_new_block(handle_t *handle, struct inode *inode,
+			unsigned long goal, int *errp)
+{
+	unsigned long count = 1;
+
+	return ext3_new_blocks(handle, inode, goal, &count, 0, errp);
+}
+
 unsigned long ext3_count_free_blocks(struct super_block *sb)
 {
 	unsigned long desc_count;
@@ -1400,7 +1588,7 @@ unsigned long ext3_count_free_blocks(struct super_block *sb)
 			continue;
 		desc_count += le16_to_cpu(gdp->bg_free_blocks_count);
 		brelse(bitmap_bh);
-		bitmap_bh = read_block_bitmap(sb, i);
+		bitmap_bh = ext3_read_block_bitmap(sb, i);
 		if (bitmap_bh == NULL)
 			continue;
 
@@ -1509,7 +1697,7 @@ void ext3_check_blocks_bitmap (struct super_block * sb)
 			continue;
 		desc_count += le16_to_cpu(gdp->bg_free_blocks_count);
 		brelse(bitmap_bh);
-		bitmap_bh = read_block_bitmap(sb, i);
+		bitmap_bh = ext3_read_block_bitmap(sb, i);
 		if (bitmap_bh == NULL)
 			continue;
 
@@ -28,6 +28,8 @@
 #include <linux/smp_lock.h>
 #include <linux/slab.h>
 #include <linux/rbtree.h>
+#include <linux/security.h>
+#include <asm/uaccess.h>
 
 static unsigned char ext3_filetype_table[] = {
 	DT_UNKNOWN, DT_REG, DT_DIR, DT_CHR, DT_BLK, DT_FIFO, DT_SOCK, DT_LNK
@@ -241,10 +243,37 @@ out:
  * a 64-bit version of the system call or the 32-bit version of the
  * system call.  Worse yet, NFSv2 only allows for a 32-bit readdir
  * cookie.  Sigh.
+ *
+ * EXT3_IOC_READDIR_PLUS passes its cookie in a 64-bit field of its
+ * own, so directories read through it switch to positions carrying
+ * the minor hash as well (info->cookie64).
  */
-#define hash2pos(major, minor)	(major >> 1)
-#define pos2maj_hash(pos)	((pos << 1) & 0xffffffff)
-#define pos2min_hash(pos)	(0)
+static inline loff_t hash2pos(struct dir_private_info *info,
+			      __u32 major, __u32 minor)
+{
+	if (info->cookie64)
+		return ((__u64)(major >> 1) << 32) | minor;
+	return major >> 1;
+}
+
+static inline __u32 pos2maj_hash(struct dir_private_info *info, loff_t pos)
+{
+	if (info->cookie64)
+		return ((pos >> 32) << 1) & 0xffffffff;
+	return (pos << 1) & 0xffffffff;
+}
+
+static inline __u32 pos2min_hash(struct dir_private_info *info, loff_t pos)
+{
+	if (info->cookie64)
+		return pos & 0xffffffff;
+	return 0;
+}
+
+static inline loff_t htree_eof(struct dir_private_info *info)
+{
+	return info->cookie64 ? EXT3_HTREE_EOF_64BIT : EXT3_HTREE_EOF;
+}
 
 /*
  * This structure holds the nodes of the red-black tree used to store
@@ -317,8 +346,9 @@ static struct dir_private_info *create_dir_info(loff_t pos)
 	p->curr_node = NULL;
 	p->extra_fname = NULL;
 	p->last_pos = 0;
-	p->curr_hash = pos2maj_hash(pos);
-	p->curr_minor_hash = pos2min_hash(pos);
+	p->cookie64 = 0;
+	p->curr_hash = pos2maj_hash(p, pos);
+	p->curr_minor_hash = pos2min_hash(p, pos);
 	p->next_hash = 0;
 	return p;
 }
@@ -410,7 +440,7 @@ static int call_filldir(struct file * filp, void * dirent,
 		printk("call_filldir: called with null fname?!?\n");
 		return 0;
 	}
-	curr_pos = hash2pos(fname->hash, fname->minor_hash);
+	curr_pos = hash2pos(info, fname->hash, fname->minor_hash);
 	while (fname) {
 		error = filldir(dirent, fname->name,
 				fname->name_len, curr_pos, 
@@ -441,7 +471,7 @@ static int ext3_dx_readdir(struct file * filp,
 		filp->private_data = info;
 	}
 
-	if (filp->f_pos == EXT3_HTREE_EOF)
+	if (filp->f_pos == htree_eof(info))
 		return 0;	/* EOF */
 
 	/* Some one has messed with f_pos; reset the world */
@@ -449,8 +479,8 @@ static int ext3_dx_readdir(struct file * filp,
 		free_rb_tree_fname(&info->root);
 		info->curr_node = NULL;
 		info->extra_fname = NULL;
-		info->curr_hash = pos2maj_hash(filp->f_pos);
-		info->curr_minor_hash = pos2min_hash(filp->f_pos);
+		info->curr_hash = pos2maj_hash(info, filp->f_pos);
+		info->curr_minor_hash = pos2min_hash(info, filp->f_pos);
 	}
 
 	/*
@@ -481,7 +511,7 @@ static int ext3_dx_readdir(struct file * filp,
 			if (ret < 0)
 				return ret;
 			if (ret == 0) {
-				filp->f_pos = EXT3_HTREE_EOF;
+				filp->f_pos = htree_eof(info);
 				break;
 			}
 			info->curr_node = rb_first(&info->root);
@@ -496,7 +526,7 @@ static int ext3_dx_readdir(struct file * filp,
 		info->curr_node = rb_next(info->curr_node);
 		if (!info->curr_node) {
 			if (info->next_hash == ~0) {
-				filp->f_pos = EXT3_HTREE_EOF;
+				filp->f_pos = htree_eof(info);
 				break;
 			}
 			info->curr_hash = info->next_hash;
@@ -517,3 +547,191 @@ static int ext3_release_dir (struct inode * inode, struct file * filp)
 }
 
 #endif
+
+/*
+ * EXT3_IOC_READDIR_PLUS.  Entries come back in hash order, which has
+ * nothing to do with where their inodes live, so stat()ing them one
+ * after another seeks all over the inode tables.  Each batch is sorted
+ * by inode number and readahead is started on the inode table blocks
+ * it covers, in ascending order, before it is handed to the caller.
+ */
+struct readdir_plus_buf {
+	char	*buf;
+	int	size;
+	int	used;
+	int	count;
+	int	error;
+};
+
+static int filldir_plus(void *__buf, const char *name, int namlen,
+			loff_t offset, ino_t ino, unsigned int d_type)
+{
+	struct readdir_plus_buf *rp = __buf;
+	struct ext3_dirent_plus *de;
+	int reclen = EXT3_DIRENT_PLUS_LEN(namlen);
+
+	if (rp->used + reclen > rp->size) {
+		rp->error = -EINVAL;
+		return -EINVAL;
+	}
+	de = (struct ext3_dirent_plus *) (rp->buf + rp->used);
+	/* the whole record goes to user space, padding included */
+	memset(de, 0, reclen);
+	de->d_ino = ino;
+	de->d_reclen = reclen;
+	de->d_namelen = namlen;
+	de->d_type = d_type;
+	memcpy(de->d_name, name, namlen);
+	rp->used += reclen;
+	rp->count++;
+	return 0;
+}
+
+static void sort_by_ino(struct ext3_dirent_plus **v, int n)
+{
+	struct ext3_dirent_plus *t;
+	int gap, i, j;
+
+	for (gap = n / 2; gap > 0; gap /= 2)
+		for (i = gap; i < n; i++)
+			for (j = i - gap; j >= 0 &&
+			     v[j]->d_ino > v[j + gap]->d_ino; j -= gap) {
+				t = v[j];
+				v[j] = v[j + gap];
+				v[j + gap] = t;
+			}
+}
+
+/* v[] is sorted by inode number, so the blocks come out ascending */
+static void prefetch_inode_tables(struct super_block *sb,
+				  struct ext3_dirent_plus **v, int n)
+{
+	unsigned long max_ino = le32_to_cpu(EXT3_SB(sb)->s_es->s_inodes_count);
+	unsigned long ino, block, offset, last = 0;
+	struct ext3_group_desc *gdp;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ino = v[i]->d_ino;
+		if (ino == 0 || ino > max_ino || ext3_inode_unused(sb, ino))
+			continue;
+		gdp = ext3_get_group_desc(sb,
+				(ino - 1) / EXT3_INODES_PER_GROUP(sb), NULL);
+		if (!gdp)
+			continue;
+		offset = ((ino - 1) % EXT3_INODES_PER_GROUP(sb)) *
+			EXT3_INODE_SIZE(sb);
+		block = le32_to_cpu(gdp->bg_inode_table) +
+			(offset >> EXT3_BLOCK_SIZE_BITS(sb));
+		if (block != last)
+			sb_breadahead(sb, block);
+		last = block;
+	}
+}
+
+int ext3_readdir_plus(struct file *filp, struct ext3_readdir_plus __user *arg)
+{
+	struct inode *inode = filp->f_dentry->d_inode;
+	struct ext3_readdir_plus rp;
+	struct readdir_plus_buf buf;
+	struct ext3_dirent_plus **v = NULL;
+	char __user *ubuf;
+	loff_t cookie;
+	int i, count, off, err;
+
+	if (!S_ISDIR(inode->i_mode))
+		return -ENOTDIR;
+	if (copy_from_user(&rp, arg, sizeof(rp)))
+		return -EFAULT;
+	if (rp.rp_bufsize > EXT3_READDIR_PLUS_MAX)
+		rp.rp_bufsize = EXT3_READDIR_PLUS_MAX;
+	if (rp.rp_bufsize < EXT3_DIRENT_PLUS_LEN(1))
+		return -EINVAL;
+	ubuf = (char __user *) (unsigned long) rp.rp_buf;
+	if (!access_ok(VERIFY_WRITE, ubuf, rp.rp_bufsize))
+		return -EFAULT;
+	err = security_file_permission(filp, MAY_READ);
+	if (err)
+		return err;
+
+	buf.buf = kmalloc(rp.rp_bufsize, GFP_KERNEL);
+	if (!buf.buf)
+		return -ENOMEM;
+	buf.size = rp.rp_bufsize;
+	buf.used = 0;
+	buf.count = 0;
+	buf.error = 0;
+
+	/*
+	 * As in vfs_readdir(), i_sem is held across ->readdir.  Here it
+	 * also covers the cookie setup and f_pos, against a readdir of the
+	 * same file running in parallel.
+	 */
+	down(&inode->i_sem);
+#ifdef CONFIG_EXT3_INDEX
+	if (!filp->private_data) {
+		filp->private_data = create_dir_info(0);
+		if (!filp->private_data) {
+			up(&inode->i_sem);
+			kfree(buf.buf);
+			return -ENOMEM;
+		}
+	}
+	if (!((struct dir_private_info *) filp->private_data)->cookie64) {
+		struct dir_private_info *info = filp->private_data;
+
+		/* f_pos changes format: drop whatever is cached */
+		info->cookie64 = 1;
+		info->last_pos = -1;
+	}
+#endif
+
+	filp->f_pos = rp.rp_cookie;
+	err = -ENOENT;
+	if (!IS_DEADDIR(inode)) {
+		/* a linear directory is returned one block per ->readdir call */
+		do {
+			count = buf.count;
+			err = ext3_readdir(filp, &buf, filldir_plus);
+		} while (err >= 0 && !buf.error && buf.count != count);
+		file_accessed(filp);
+	}
+	cookie = filp->f_pos;
+	up(&inode->i_sem);
+
+	if (buf.count)
+		err = 0;
+	else if (err >= 0)
+		err = buf.error;
+	if (err < 0 || !buf.count)
+		goto out;
+
+	err = -ENOMEM;
+	v = kmalloc(buf.count * sizeof(*v), GFP_KERNEL);
+	if (!v)
+		goto out;
+	for (i = 0, off = 0; i < buf.count; i++) {
+		v[i] = (struct ext3_dirent_plus *) (buf.buf + off);
+		off += v[i]->d_reclen;
+	}
+	sort_by_ino(v, buf.count);
+	prefetch_inode_tables(inode->i_sb, v, buf.count);
+
+	err = -EFAULT;
+	for (i = 0, off = 0; i < buf.count; i++) {
+		if (__copy_to_user(ubuf + off, v[i], v[i]->d_reclen))
+			goto out;
+		off += v[i]->d_reclen;
+	}
+	err = 0;
+out:
+	if (!err) {
+		rp.rp_cookie = cookie;
+		rp.rp_count = buf.count;
+		if (copy_to_user(arg, &rp, sizeof(rp)))
+			err = -EFAULT;
+	}
+	kfree(v);
+	kfree(buf.buf);
+	return err;
+}
@@ -0,0 +1,1114 @@
+/*
+ *  linux/fs/ext3/extents.c
+ *
+ * Extent-based block mapping for ext3.
+ *
+ * The tree is rooted in i_data of the inode.  Index nodes and leaves
+ * are whole filesystem blocks, allocated and freed like indirect blocks
+ * and journalled as metadata.  Changes to the tree hold truncate_sem
+ * exclusive; plain lookups hold it shared.
+ *
+ * Blocks are still allocated one at a time; a new block which continues
+ * the extent to its left (the common case for sequential writes) just
+ * makes that extent longer.
+ */
+
+#include <linux/fs.h>
+#include <linux/time.h>
+#include <linux/jbd.h>
+#include <linux/ext3_jbd.h>
+#include <linux/ext3_extents.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/quotaops.h>
+#include <linux/buffer_head.h>
+
+static int ext3_ext_check_header(struct inode *inode,
+				 struct ext3_extent_header *eh, int depth)
+{
+	const char *error_msg;
+
+	if (unlikely(le16_to_cpu(eh->eh_magic) != EXT3_EXT_MAGIC)) {
+		error_msg = "invalid magic";
+		goto corrupted;
+	}
+	if (unlikely(le16_to_cpu(eh->eh_depth) != depth)) {
+		error_msg = "unexpected eh_depth";
+		goto corrupted;
+	}
+	if (unlikely(eh->eh_max == 0)) {
+		error_msg = "invalid eh_max";
+		goto corrupted;
+	}
+	if (unlikely(le16_to_cpu(eh->eh_entries) > le16_to_cpu(eh->eh_max))) {
+		error_msg = "invalid eh_entries";
+		goto corrupted;
+	}
+	if (unlikely(depth && eh->eh_entries == 0)) {
+		error_msg = "empty index node";
+		goto corrupted;
+	}
+	return 0;
+
+corrupted:
+	ext3_error(inode->i_sb, "ext3_ext_check_header",
+		   "bad extent header in inode #%lu: %s - magic %x, "
+		   "entries %u, max %u, depth %u(%d)", inode->i_ino, error_msg,
+		   le16_to_cpu(eh->eh_magic), le16_to_cpu(eh->eh_entries),
+		   le16_to_cpu(eh->eh_max), le16_to_cpu(eh->eh_depth), depth);
+	return -EIO;
+}
+
+static inline int ext3_ext_space_block(struct inode *inode)
+{
+	return (inode->i_sb->s_blocksize - sizeof(struct ext3_extent_header))
+			/ sizeof(struct ext3_extent);
+}
+
+static inline int ext3_ext_space_block_idx(struct inode *inode)
+{
+	return (inode->i_sb->s_blocksize - sizeof(struct ext3_extent_header))
+			/ sizeof(struct ext3_extent_idx);
+}
+
+static inline int ext3_ext_space_root(struct inode *inode)
+{
+	return (sizeof(EXT3_I(inode)->i_data) -
+			sizeof(struct ext3_extent_header))
+			/ sizeof(struct ext3_extent);
+}
+
+static inline int ext3_ext_space_root_idx(struct inode *inode)
+{
+	return (sizeof(EXT3_I(inode)->i_data) -
+			sizeof(struct ext3_extent_header))
+			/ sizeof(struct ext3_extent_idx);
+}
+
+/*
+ * The root is part of the inode, which is logged by ext3_mark_inode_dirty();
+ * every other node is a metadata buffer.
+ */
+static int ext3_ext_get_access(handle_t *handle, struct inode *inode,
+			       struct ext3_ext_path *path)
+{
+	if (path->p_bh)
+		return ext3_journal_get_write_access(handle, path->p_bh);
+	return 0;
+}
+
+static int ext3_ext_dirty(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path)
+{
+	if (path->p_bh)
+		return ext3_journal_dirty_metadata(handle, path->p_bh);
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
+static void ext3_ext_drop_refs(struct ext3_ext_path *path)
+{
+	int depth = path->p_depth;
+	int i;
+
+	for (i = 0; i <= depth; i++, path++) {
+		if (path->p_bh) {
+			brelse(path->p_bh);
+			path->p_bh = NULL;
+		}
+	}
+}
+
+static inline void ext3_ext_invalidate_cache(struct inode *inode)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+
+	spin_lock(&ei->i_cached_extent_lock);
+	ei->i_cached_extent.ec_len = 0;
+	spin_unlock(&ei->i_cached_extent_lock);
+}
+
+static inline void ext3_ext_put_in_cache(struct inode *inode, __u32 block,
+					 __u32 len, __u32 start)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	struct ext3_ext_cache *cex = &ei->i_cached_extent;
+
+	spin_lock(&ei->i_cached_extent_lock);
+	cex->ec_block = block;
+	cex->ec_len = len;
+	cex->ec_start = start;
+	spin_unlock(&ei->i_cached_extent_lock);
+}
+
+/*
+ * Copy the cached extent to @ex if it maps @block.  Lookups running in
+ * parallel may be replacing it, hence the copy.
+ */
+static inline int ext3_ext_in_cache(struct inode *inode, unsigned long block,
+				    struct ext3_ext_cache *ex)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	struct ext3_ext_cache *cex = &ei->i_cached_extent;
+	int ret = 0;
+
+	spin_lock(&ei->i_cached_extent_lock);
+	if (cex->ec_len && block >= cex->ec_block &&
+	    block < cex->ec_block + cex->ec_len) {
+		*ex = *cex;
+		ret = 1;
+	}
+	spin_unlock(&ei->i_cached_extent_lock);
+	return ret;
+}
+
+/*
+ * Binary search for the last index whose key is <= @block.  The first
+ * index is taken if @block lies before all of them.
+ */
+static void ext3_ext_binsearch_idx(struct ext3_ext_path *path,
+				   unsigned long block)
+{
+	struct ext3_extent_header *eh = path->p_hdr;
+	struct ext3_extent_idx *l, *r, *m;
+
+	l = EXT_FIRST_INDEX(eh) + 1;
+	r = EXT_LAST_INDEX(eh);
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ei_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	path->p_idx = l - 1;
+}
+
+/*
+ * Binary search for the last extent starting at or before @block, or the
+ * first one if @block lies before all of them.  NULL for an empty leaf.
+ */
+static void ext3_ext_binsearch(struct ext3_ext_path *path,
+			       unsigned long block)
+{
+	struct ext3_extent_header *eh = path->p_hdr;
+	struct ext3_extent *l, *r, *m;
+
+	if (eh->eh_entries == 0) {
+		path->p_ext = NULL;
+		return;
+	}
+
+	l = EXT_FIRST_EXTENT(eh) + 1;
+	r = EXT_LAST_EXTENT(eh);
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ee_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	path->p_ext = l - 1;
+}
+
+/*
+ * Start an empty tree in a new inode's i_data.  The caller marks the
+ * inode dirty.
+ */
+void ext3_ext_tree_init(struct inode *inode)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+
+	eh->eh_depth = 0;
+	eh->eh_entries = 0;
+	eh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	eh->eh_max = cpu_to_le16(ext3_ext_space_root(inode));
+	eh->eh_generation = 0;
+	ext3_ext_invalidate_cache(inode);
+}
+
+/*
+ * Walk from the root to the leaf covering @block.  @path is reused if
+ * given, otherwise allocated with room for one more level, in case an
+ * insertion has to grow the tree.
+ */
+static struct ext3_ext_path *
+ext3_ext_find_extent(struct inode *inode, unsigned long block,
+		     struct ext3_ext_path *path)
+{
+	struct ext3_extent_header *eh;
+	struct buffer_head *bh;
+	int depth, i, ppos = 0, alloc = 0;
+
+	eh = ext_inode_hdr(inode);
+	depth = ext_depth(inode);
+	if (ext3_ext_check_header(inode, eh, depth))
+		return ERR_PTR(-EIO);
+
+	if (!path) {
+		path = kmalloc(sizeof(struct ext3_ext_path) * (depth + 2),
+			       GFP_NOFS);
+		if (!path)
+			return ERR_PTR(-ENOMEM);
+		alloc = 1;
+	}
+	path[0].p_hdr = eh;
+	path[0].p_bh = NULL;
+	path[0].p_depth = depth;
+
+	for (i = depth; i > 0; i--) {
+		ext3_ext_binsearch_idx(path + ppos, block);
+		path[ppos].p_ext = NULL;
+
+		bh = sb_bread(inode->i_sb,
+			      le32_to_cpu(path[ppos].p_idx->ei_leaf));
+		if (!bh)
+			goto err;
+		eh = ext_block_hdr(bh);
+		ppos++;
+		path[ppos].p_bh = bh;
+		path[ppos].p_hdr = eh;
+		if (ext3_ext_check_header(inode, eh, i - 1))
+			goto err;
+	}
+	path[ppos].p_idx = NULL;
+	ext3_ext_binsearch(path + ppos, block);
+	return path;
+
+err:
+	path[0].p_depth = ppos;
+	ext3_ext_drop_refs(path);
+	path[0].p_depth = depth;
+	if (alloc)
+		kfree(path);
+	return ERR_PTR(-EIO);
+}
+
+/*
+ * Pick a physical block near @block's neighbours in the tree, or in the
+ * inode's group when the tree is empty.
+ */
+static unsigned long ext3_ext_find_goal(struct inode *inode,
+					struct ext3_ext_path *path,
+					unsigned long block)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long bg_start;
+	unsigned long colour;
+
+	if (path) {
+		int depth = path->p_depth;
+		struct ext3_extent *ex = path[depth].p_ext;
+
+		if (ex) {
+			unsigned long ee_block = le32_to_cpu(ex->ee_block);
+			unsigned long ee_start = le32_to_cpu(ex->ee_start);
+
+			if (block > ee_block)
+				return ee_start + (block - ee_block);
+			return ee_start - (ee_block - block);
+		}
+		/* an empty leaf: stay close to the leaf itself */
+		if (path[depth].p_bh)
+			return path[depth].p_bh->b_blocknr;
+	}
+
+	bg_start = (ei->i_block_group * EXT3_BLOCKS_PER_GROUP(inode->i_sb)) +
+		le32_to_cpu(EXT3_SB(inode->i_sb)->s_es->s_first_data_block);
+	colour = (current->pid % 16) *
+			(EXT3_BLOCKS_PER_GROUP(inode->i_sb) / 16);
+	return bg_start + colour + block;
+}
+
+/*
+ * The first logical block mapped after the extent @path points at, or
+ * EXT_MAX_BLOCK if there is none.  Bounds the hole a new extent may fill.
+ */
+static unsigned long
+ext3_ext_next_allocated_block(struct ext3_ext_path *path)
+{
+	int depth = path->p_depth;
+
+	while (depth >= 0) {
+		if (depth == path->p_depth) {
+			if (path[depth].p_ext &&
+			    path[depth].p_ext != EXT_LAST_EXTENT(path[depth].p_hdr))
+				return le32_to_cpu(path[depth].p_ext[1].ee_block);
+		} else {
+			if (path[depth].p_idx != EXT_LAST_INDEX(path[depth].p_hdr))
+				return le32_to_cpu(path[depth].p_idx[1].ei_block);
+		}
+		depth--;
+	}
+	return EXT_MAX_BLOCK;
+}
+
+static int ext3_can_extents_be_merged(struct ext3_extent *ex1,
+				      struct ext3_extent *ex2)
+{
+	unsigned long len1 = le16_to_cpu(ex1->ee_len);
+	unsigned long len2 = le16_to_cpu(ex2->ee_len);
+
+	if (le32_to_cpu(ex1->ee_block) + len1 != le32_to_cpu(ex2->ee_block))
+		return 0;
+	if (len1 + len2 > EXT3_EXT_MAX_LEN)
+		return 0;
+	return le32_to_cpu(ex1->ee_start) + len1 == le32_to_cpu(ex2->ee_start);
+}
+
+/*
+ * Insert an index to the node at @logical into @curp, next to p_idx.
+ */
+static int ext3_ext_insert_index(handle_t *handle, struct inode *inode,
+				 struct ext3_ext_path *curp,
+				 unsigned long logical, unsigned long ptr)
+{
+	struct ext3_extent_idx *ix;
+	int len, err;
+
+	if (logical == le32_to_cpu(curp->p_idx->ei_block)) {
+		ext3_error(inode->i_sb, "ext3_ext_insert_index",
+			   "inode #%lu: index %lu already present",
+			   inode->i_ino, logical);
+		return -EIO;
+	}
+
+	err = ext3_ext_get_access(handle, inode, curp);
+	if (err)
+		return err;
+
+	if (logical > le32_to_cpu(curp->p_idx->ei_block))
+		ix = curp->p_idx + 1;
+	else
+		ix = curp->p_idx;
+	len = EXT_LAST_INDEX(curp->p_hdr) - ix + 1;
+	BUG_ON(ix + len > EXT_MAX_INDEX(curp->p_hdr));
+	if (len > 0)
+		memmove(ix + 1, ix, len * sizeof(struct ext3_extent_idx));
+
+	ix->ei_block = cpu_to_le32(logical);
+	ix->ei_leaf = cpu_to_le32(ptr);
+	ix->ei_leaf_hi = 0;
+	ix->ei_unused = 0;
+	curp->p_hdr->eh_entries =
+		cpu_to_le16(le16_to_cpu(curp->p_hdr->eh_entries) + 1);
+
+	return ext3_ext_dirty(handle, inode, curp);
+}
+
+/*
+ * Get a fresh tree block and start it as an empty node at @depth.  The
+ * buffer is returned locked with create access taken.
+ */
+static struct buffer_head *ext3_ext_new_node(handle_t *handle,
+					     struct inode *inode,
+					     unsigned long block, int depth,
+					     int *err)
+{
+	struct ext3_extent_header *neh;
+	struct buffer_head *bh;
+
+	bh = sb_getblk(inode->i_sb, block);
+	if (!bh) {
+		*err = -EIO;
+		return NULL;
+	}
+	lock_buffer(bh);
+	*err = ext3_journal_get_create_access(handle, bh);
+	if (*err) {
+		unlock_buffer(bh);
+		brelse(bh);
+		return NULL;
+	}
+	memset(bh->b_data, 0, inode->i_sb->s_blocksize);
+	neh = ext_block_hdr(bh);
+	neh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	neh->eh_depth = cpu_to_le16(depth);
+	if (depth)
+		neh->eh_max = cpu_to_le16(ext3_ext_space_block_idx(inode));
+	else
+		neh->eh_max = cpu_to_le16(ext3_ext_space_block(inode));
+	return bh;
+}
+
+static int ext3_ext_finish_node(handle_t *handle, struct buffer_head *bh)
+{
+	int err;
+
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+	err = ext3_journal_dirty_metadata(handle, bh);
+	brelse(bh);
+	return err;
+}
+
+/*
+ * The leaf on @path is full, and level @at has room for one more index.
+ * Give each level below @at a new right sibling, move the entries to the
+ * right of the insertion point over, and hook the new subtree into @at.
+ */
+static int ext3_ext_split(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path,
+			  struct ext3_extent *newext, int at)
+{
+	struct buffer_head *bh;
+	struct ext3_extent_header *neh;
+	struct ext3_extent_idx *fidx;
+	int depth = ext_depth(inode);
+	unsigned long *ablocks;
+	unsigned long border, newblock, oldblock;
+	int i, a, m, err = 0;
+
+	/*
+	 * Everything from @border up goes to the new subtree.  If we are
+	 * appending, that is just the new extent.
+	 */
+	if (path[depth].p_ext != EXT_LAST_EXTENT(path[depth].p_hdr))
+		border = le32_to_cpu(path[depth].p_ext[1].ee_block);
+	else
+		border = le32_to_cpu(newext->ee_block);
+
+	/*
+	 * Allocate all the blocks first, so that failure leaves the tree
+	 * untouched.
+	 */
+	ablocks = kmalloc(sizeof(unsigned long) * depth, GFP_NOFS);
+	if (!ablocks)
+		return -ENOMEM;
+	memset(ablocks, 0, sizeof(unsigned long) * depth);
+	for (a = 0; a < depth - at; a++) {
+		ablocks[a] = ext3_new_block(handle, inode,
+				ext3_ext_find_goal(inode, path,
+					le32_to_cpu(newext->ee_block)), &err);
+		if (!ablocks[a])
+			goto cleanup;
+	}
+
+	/*
+	 * Copy the entries from the insertion point on into the new
+	 * nodes, but leave them in the old ones until the new subtree is
+	 * linked in: a failure before that leaves the tree as it was.
+	 */
+
+	/* the new leaf */
+	newblock = ablocks[--a];
+	bh = ext3_ext_new_node(handle, inode, newblock, 0, &err);
+	if (!bh)
+		goto cleanup;
+	neh = ext_block_hdr(bh);
+	m = EXT_LAST_EXTENT(path[depth].p_hdr) - path[depth].p_ext;
+	if (m) {
+		memmove(EXT_FIRST_EXTENT(neh), path[depth].p_ext + 1,
+			sizeof(struct ext3_extent) * m);
+		neh->eh_entries = cpu_to_le16(m);
+	}
+	err = ext3_ext_finish_node(handle, bh);
+	if (err)
+		goto cleanup;
+
+	/* the new index nodes, bottom up */
+	for (i = depth - 1; i > at; i--) {
+		oldblock = newblock;
+		newblock = ablocks[--a];
+		bh = ext3_ext_new_node(handle, inode, newblock, depth - i,
+				       &err);
+		if (!bh)
+			goto cleanup;
+		neh = ext_block_hdr(bh);
+		fidx = EXT_FIRST_INDEX(neh);
+		fidx->ei_block = cpu_to_le32(border);
+		fidx->ei_leaf = cpu_to_le32(oldblock);
+		m = EXT_LAST_INDEX(path[i].p_hdr) - path[i].p_idx;
+		if (m)
+			memmove(fidx + 1, path[i].p_idx + 1,
+				sizeof(struct ext3_extent_idx) * m);
+		neh->eh_entries = cpu_to_le16(m + 1);
+		err = ext3_ext_finish_node(handle, bh);
+		if (err)
+			goto cleanup;
+	}
+
+	err = ext3_ext_insert_index(handle, inode, path + at, border, newblock);
+	if (err)
+		goto cleanup;
+	/* the new blocks are in the tree now */
+	memset(ablocks, 0, sizeof(unsigned long) * depth);
+
+	/* drop the copied entries from the old nodes */
+	for (i = depth; i > at; i--) {
+		if (i == depth)
+			m = EXT_LAST_EXTENT(path[i].p_hdr) - path[i].p_ext;
+		else
+			m = EXT_LAST_INDEX(path[i].p_hdr) - path[i].p_idx;
+		if (!m)
+			continue;
+		err = ext3_ext_get_access(handle, inode, path + i);
+		if (err)
+			break;
+		path[i].p_hdr->eh_entries = cpu_to_le16(
+			le16_to_cpu(path[i].p_hdr->eh_entries) - m);
+		err = ext3_ext_dirty(handle, inode, path + i);
+		if (err)
+			break;
+	}
+
+cleanup:
+	if (err) {
+		/* free the blocks we did not get to link into the tree */
+		for (i = 0; i < depth; i++) {
+			if (!ablocks[i])
+				continue;
+			ext3_free_blocks(handle, inode, ablocks[i], 1);
+		}
+	}
+	kfree(ablocks);
+	return err;
+}
+
+/*
+ * The whole tree is full: move the root into a new block and make the
+ * root a single index pointing to it.
+ */
+static int ext3_ext_grow_indepth(handle_t *handle, struct inode *inode,
+				 struct ext3_ext_path *path,
+				 struct ext3_extent *newext)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+	struct ext3_extent_header *neh;
+	struct ext3_extent_idx *fidx;
+	struct buffer_head *bh;
+	unsigned long newblock;
+	int depth = ext_depth(inode);
+	int err = 0;
+
+	newblock = ext3_new_block(handle, inode,
+			ext3_ext_find_goal(inode, path,
+				le32_to_cpu(newext->ee_block)), &err);
+	if (!newblock)
+		return err;
+
+	bh = ext3_ext_new_node(handle, inode, newblock, depth, &err);
+	if (!bh) {
+		ext3_free_blocks(handle, inode, newblock, 1);
+		return err;
+	}
+	neh = ext_block_hdr(bh);
+	memcpy(EXT_FIRST_INDEX(neh), EXT_FIRST_INDEX(eh),
+	       sizeof(EXT3_I(inode)->i_data) -
+			sizeof(struct ext3_extent_header));
+	neh->eh_entries = eh->eh_entries;
+	err = ext3_ext_finish_node(handle, bh);
+	if (err)
+		return err;
+
+	/*
+	 * ei_block and ee_block share the first word of an entry, so the
+	 * first key is still in place.
+	 */
+	fidx = EXT_FIRST_INDEX(eh);
+	fidx->ei_leaf = cpu_to_le32(newblock);
+	fidx->ei_leaf_hi = 0;
+	fidx->ei_unused = 0;
+	eh->eh_entries = cpu_to_le16(1);
+	eh->eh_max = cpu_to_le16(ext3_ext_space_root_idx(inode));
+	eh->eh_depth = cpu_to_le16(depth + 1);
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
+/*
+ * Make room in the leaf where @newext belongs: split the tree below the
+ * lowest level with a free index slot, or grow the tree if there is none.
+ * @path is looked up again on return.
+ */
+static int ext3_ext_create_new_leaf(handle_t *handle, struct inode *inode,
+				    struct ext3_ext_path *path,
+				    struct ext3_extent *newext)
+{
+	struct ext3_ext_path *ret;
+	int depth, i, err;
+
+repeat:
+	i = depth = ext_depth(inode);
+	while (i > 0 && !EXT_HAS_FREE_INDEX(path + i))
+		i--;
+
+	if (EXT_HAS_FREE_INDEX(path + i))
+		err = ext3_ext_split(handle, inode, path, newext, i);
+	else
+		err = ext3_ext_grow_indepth(handle, inode, path, newext);
+	if (err)
+		return err;
+
+	ext3_ext_drop_refs(path);
+	ret = ext3_ext_find_extent(inode, le32_to_cpu(newext->ee_block), path);
+	if (IS_ERR(ret))
+		return PTR_ERR(ret);
+
+	/* after growing, the old root may now be a full leaf below it */
+	depth = ext_depth(inode);
+	if (!EXT_HAS_FREE_INDEX(path + depth))
+		goto repeat;
+	return 0;
+}
+
+/*
+ * After an insertion at the start of a leaf, lower the keys leading to it.
+ */
+static int ext3_ext_correct_indexes(handle_t *handle, struct inode *inode,
+				    struct ext3_ext_path *path)
+{
+	int depth = ext_depth(inode);
+	__le32 border;
+	int k, err;
+
+	if (!depth)
+		return 0;
+
+	border = EXT_FIRST_EXTENT(path[depth].p_hdr)->ee_block;
+	for (k = depth - 1; k >= 0; k--) {
+		if (le32_to_cpu(path[k].p_idx->ei_block) <= le32_to_cpu(border))
+			break;
+		err = ext3_ext_get_access(handle, inode, path + k);
+		if (err)
+			return err;
+		path[k].p_idx->ei_block = border;
+		err = ext3_ext_dirty(handle, inode, path + k);
+		if (err)
+			return err;
+		if (path[k].p_idx != EXT_FIRST_INDEX(path[k].p_hdr))
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Add @newext to the tree.  @path must lead to the leaf where it belongs.
+ */
+static int ext3_ext_insert_extent(handle_t *handle, struct inode *inode,
+				  struct ext3_ext_path *path,
+				  struct ext3_extent *newext)
+{
+	struct ext3_extent_header *eh;
+	struct ext3_extent *ex, *nearex;
+	int depth, len, err;
+
+	ext3_ext_invalidate_cache(inode);
+
+	depth = ext_depth(inode);
+	ex = path[depth].p_ext;
+
+	/* the common case: the new block continues the extent to its left */
+	if (ex && ext3_can_extents_be_merged(ex, newext)) {
+		err = ext3_ext_get_access(handle, inode, path + depth);
+		if (err)
+			return err;
+		ex->ee_len = cpu_to_le16(le16_to_cpu(ex->ee_len) +
+					 le16_to_cpu(newext->ee_len));
+		eh = path[depth].p_hdr;
+		nearex = ex;
+		goto merge;
+	}
+
+	eh = path[depth].p_hdr;
+	if (le16_to_cpu(eh->eh_entries) >= le16_to_cpu(eh->eh_max)) {
+		err = ext3_ext_create_new_leaf(handle, inode, path, newext);
+		if (err)
+			return err;
+		depth = ext_depth(inode);
+		eh = path[depth].p_hdr;
+	}
+
+	err = ext3_ext_get_access(handle, inode, path + depth);
+	if (err)
+		return err;
+
+	nearex = path[depth].p_ext;
+	if (!nearex)
+		nearex = EXT_FIRST_EXTENT(eh);
+	else if (le32_to_cpu(newext->ee_block) > le32_to_cpu(nearex->ee_block))
+		nearex++;
+	len = EXT_LAST_EXTENT(eh) - nearex + 1;
+	if (len > 0)
+		memmove(nearex + 1, nearex, len * sizeof(struct ext3_extent));
+	eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) + 1);
+	*nearex = *newext;
+
+merge:
+	/* the grown extent may now reach its right neighbour */
+	while (nearex < EXT_LAST_EXTENT(eh) &&
+	       ext3_can_extents_be_merged(nearex, nearex + 1)) {
+		nearex->ee_len = cpu_to_le16(le16_to_cpu(nearex->ee_len) +
+					     le16_to_cpu(nearex[1].ee_len));
+		len = EXT_LAST_EXTENT(eh) - (nearex + 1);
+		if (len > 0)
+			memmove(nearex + 1, nearex + 2,
+				len * sizeof(struct ext3_extent));
+		eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) - 1);
+	}
+
+	err = ext3_ext_correct_indexes(handle, inode, path);
+	if (err)
+		return err;
+	return ext3_ext_dirty(handle, inode, path + depth);
+}
+
+/*
+ * ext3_ext_get_blocks - map up to @max_blocks blocks from @iblock
+ *
+ * Returns the number of blocks mapped into @bh_result, 0 for a hole when
+ * @create is 0, or a negative error.  A hole is filled with a single
+ * extent of up to @max_blocks contiguous blocks, as many as one
+ * ext3_new_blocks() call returns.  If @bh_result is BH_Delay, the blocks
+ * are for delayed buffers, whose space and quota were taken at write().
+ */
+int ext3_ext_get_blocks(handle_t *handle, struct inode *inode,
+			unsigned long iblock, unsigned long max_blocks,
+			struct buffer_head *bh_result, int create,
+			int extend_disksize)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	struct ext3_ext_path *path = NULL;
+	struct ext3_extent newex, *ex;
+	struct ext3_ext_cache cex;
+	unsigned long newblock = 0, allocated = 0, next;
+	int delayed = buffer_delay(bh_result);
+	int err = 0, depth, freed;
+
+	J_ASSERT(handle != NULL || create == 0);
+
+	if (create)
+		down_write(&ei->truncate_sem);
+	else
+		down_read(&ei->truncate_sem);
+
+	if (ext3_ext_in_cache(inode, iblock, &cex)) {
+		newblock = cex.ec_start + (iblock - cex.ec_block);
+		allocated = cex.ec_len - (iblock - cex.ec_block);
+		clear_buffer_new(bh_result);
+		goto out;
+	}
+
+	path = ext3_ext_find_extent(inode, iblock, NULL);
+	if (IS_ERR(path)) {
+		err = PTR_ERR(path);
+		path = NULL;
+		goto out2;
+	}
+
+	depth = ext_depth(inode);
+	ex = path[depth].p_ext;
+	if (ex) {
+		unsigned long ee_block = le32_to_cpu(ex->ee_block);
+		unsigned long ee_start = le32_to_cpu(ex->ee_start);
+		unsigned long ee_len = le16_to_cpu(ex->ee_len);
+
+		if (iblock >= ee_block && iblock < ee_block + ee_len) {
+			newblock = ee_start + (iblock - ee_block);
+			allocated = ee_len - (iblock - ee_block);
+			ext3_ext_put_in_cache(inode, ee_block, ee_len,
+					      ee_start);
+			clear_buffer_new(bh_result);
+			goto out;
+		}
+	}
+
+	/* a hole: plain lookups stop here */
+	if (!create)
+		goto out2;
+
+	/* fill the hole up to the next mapped block, at most */
+	next = ext3_ext_next_allocated_block(path);
+	if (ex && iblock < le32_to_cpu(ex->ee_block))
+		next = le32_to_cpu(ex->ee_block);
+	allocated = min(next - iblock, max_blocks);
+	if (allocated > EXT3_EXT_MAX_LEN)
+		allocated = EXT3_EXT_MAX_LEN;
+
+	newblock = ext3_new_blocks(handle, inode,
+				   ext3_ext_find_goal(inode, path, iblock),
+				   &allocated, delayed, &err);
+	if (!newblock)
+		goto out2;
+
+	newex.ee_block = cpu_to_le32(iblock);
+	newex.ee_len = cpu_to_le16(allocated);
+	newex.ee_start = cpu_to_le32(newblock);
+	newex.ee_start_hi = 0;
+	err = ext3_ext_insert_extent(handle, inode, path, &newex);
+	if (err) {
+		/* delayed buffers stay delayed, and keep their quota */
+		if (delayed)
+			ext3_free_blocks_sb(handle, inode->i_sb, newblock,
+					    allocated, &freed);
+		else
+			ext3_free_blocks(handle, inode, newblock, allocated);
+		goto out2;
+	}
+
+	/* i_disksize growing is protected by truncate_sem */
+	if (extend_disksize && inode->i_size > ei->i_disksize)
+		ei->i_disksize = inode->i_size;
+	set_buffer_new(bh_result);
+
+out:
+	if (allocated > max_blocks)
+		allocated = max_blocks;
+	map_bh(bh_result, inode->i_sb, newblock);
+out2:
+	if (path) {
+		ext3_ext_drop_refs(path);
+		kfree(path);
+	}
+	if (create)
+		up_write(&ei->truncate_sem);
+	else
+		up_read(&ei->truncate_sem);
+	return err ? err : allocated;
+}
+
+/*
+ * Credits to insert one extent: the path, plus a new block and its bitmap
+ * and group descriptor for every level a split may add, plus the root
+ * growing, plus the data block's bitmap and group descriptor and the inode.
+ */
+int ext3_ext_calc_credits_for_insert(struct inode *inode)
+{
+	int depth = ext_depth(inode);
+
+	return (depth + 1) + 3 * (depth + 2) + 2 + 1;
+}
+
+int ext3_ext_writepage_trans_blocks(struct inode *inode, int num)
+{
+	int needed;
+
+	needed = num * ext3_ext_calc_credits_for_insert(inode);
+	if (ext3_should_journal_data(inode))
+		needed += num;
+	/* the superblock */
+	needed += 1;
+#ifdef CONFIG_QUOTA
+	needed += 2 * EXT3_QUOTA_TRANS_BLOCKS;
+#endif
+	return needed;
+}
+
+/*
+ * Credits to free one extent (or tree block) during truncate: the path,
+ * bitmaps and group descriptors of two groups, the superblock and inode.
+ */
+static int ext3_ext_trunc_credits(struct inode *inode)
+{
+	int needed = ext_depth(inode) + 1 + 4 + 2;
+
+#ifdef CONFIG_QUOTA
+	needed += 2 * EXT3_QUOTA_TRANS_BLOCKS;
+#endif
+	return needed;
+}
+
+/*
+ * Make sure the handle can take @needed more buffers.  If it cannot be
+ * extended, commit what we have: the tree is consistent between extents.
+ */
+static int ext3_ext_truncate_extend_restart(handle_t *handle,
+					    struct inode *inode, int needed)
+{
+	int err;
+
+	if (handle->h_buffer_credits > needed)
+		return 0;
+	err = ext3_journal_extend(handle, needed);
+	if (err <= 0)
+		return err;
+	ext3_mark_inode_dirty(handle, inode);
+	return ext3_journal_restart(handle, needed);
+}
+
+/*
+ * The node at @path has become empty: free it and drop its index, which
+ * is the last one in the parent since we remove from the right.
+ */
+static int ext3_ext_rm_idx(handle_t *handle, struct inode *inode,
+			   struct ext3_ext_path *path)
+{
+	struct ext3_ext_path *parent = path - 1;
+	unsigned long leaf = le32_to_cpu(parent->p_idx->ei_leaf);
+	int err;
+
+	err = ext3_ext_truncate_extend_restart(handle, inode,
+					       ext3_ext_trunc_credits(inode));
+	if (err)
+		return err;
+	err = ext3_ext_get_access(handle, inode, parent);
+	if (err)
+		return err;
+	parent->p_hdr->eh_entries =
+		cpu_to_le16(le16_to_cpu(parent->p_hdr->eh_entries) - 1);
+	err = ext3_ext_dirty(handle, inode, parent);
+	if (err)
+		return err;
+
+	/* ext3_forget() eats the buffer reference */
+	ext3_forget(handle, 1, inode, path->p_bh, leaf);
+	path->p_bh = NULL;
+	ext3_free_blocks(handle, inode, leaf, 1);
+	return 0;
+}
+
+/*
+ * Free the blocks of the leaf at the bottom of @path from logical block
+ * @start on, trimming or dropping extents from the right.
+ */
+static int ext3_ext_rm_leaf(handle_t *handle, struct inode *inode,
+			    struct ext3_ext_path *path, unsigned long start)
+{
+	int depth = ext_depth(inode);
+	struct ext3_extent_header *eh = path[depth].p_hdr;
+	struct ext3_extent *ex;
+	int err = 0;
+
+	ex = EXT_LAST_EXTENT(eh);
+	while (ex >= EXT_FIRST_EXTENT(eh)) {
+		unsigned long ee_block = le32_to_cpu(ex->ee_block);
+		unsigned long ee_start = le32_to_cpu(ex->ee_start);
+		unsigned long ee_len = le16_to_cpu(ex->ee_len);
+		unsigned long keep, nr;
+
+		if (ee_block + ee_len <= start)
+			break;
+		keep = ee_block >= start ? 0 : start - ee_block;
+
+		err = ext3_ext_truncate_extend_restart(handle, inode,
+					ext3_ext_trunc_credits(inode));
+		if (err)
+			break;
+		err = ext3_ext_get_access(handle, inode, path + depth);
+		if (err)
+			break;
+
+		/* revoke what may be in the journal, as ext3_clear_blocks() */
+		for (nr = ee_start + keep; nr < ee_start + ee_len; nr++) {
+			struct buffer_head *bh;
+
+			bh = sb_find_get_block(inode->i_sb, nr);
+			ext3_forget(handle, 0, inode, bh, nr);
+		}
+		ext3_free_blocks(handle, inode, ee_start + keep, ee_len - keep);
+
+		if (keep)
+			ex->ee_len = cpu_to_le16(keep);
+		else
+			eh->eh_entries =
+				cpu_to_le16(le16_to_cpu(eh->eh_entries) - 1);
+		err = ext3_ext_dirty(handle, inode, path + depth);
+		if (err)
+			break;
+		ex--;
+	}
+
+	if (!err && eh->eh_entries == 0 && path[depth].p_bh)
+		err = ext3_ext_rm_idx(handle, inode, path + depth);
+	return err;
+}
+
+/*
+ * Does the index node at @path have more children to visit?  We stop at
+ * the first child that survived the truncate: everything to its left is
+ * below the truncation point.
+ */
+static inline int ext3_ext_more_to_rm(struct ext3_ext_path *path)
+{
+	if (path->p_idx < EXT_FIRST_INDEX(path->p_hdr))
+		return 0;
+	if (le16_to_cpu(path->p_hdr->eh_entries) == path->p_entries)
+		return 0;
+	return 1;
+}
+
+/*
+ * Release every block at or beyond logical block @start.  Called from
+ * ext3_truncate() with truncate_sem held; may restart the transaction.
+ */
+int ext3_ext_remove_space(handle_t *handle, struct inode *inode,
+			  unsigned long start)
+{
+	int depth = ext_depth(inode);
+	struct ext3_ext_path *path;
+	int i = 0, err = 0;
+
+	ext3_ext_invalidate_cache(inode);
+
+	path = kmalloc(sizeof(struct ext3_ext_path) * (depth + 1), GFP_NOFS);
+	if (!path)
+		return -ENOMEM;
+	memset(path, 0, sizeof(struct ext3_ext_path) * (depth + 1));
+	path[0].p_hdr = ext_inode_hdr(inode);
+	path[0].p_depth = depth;
+	if (ext3_ext_check_header(inode, path[0].p_hdr, depth)) {
+		err = -EIO;
+		goto out;
+	}
+
+	/* depth first, right to left */
+	while (i >= 0 && err == 0) {
+		if (i == depth) {
+			err = ext3_ext_rm_leaf(handle, inode, path, start);
+			brelse(path[i].p_bh);
+			path[i].p_bh = NULL;
+			i--;
+			continue;
+		}
+
+		if (!path[i].p_idx) {
+			/* first visit: start at the rightmost child */
+			path[i].p_idx = EXT_LAST_INDEX(path[i].p_hdr);
+			path[i].p_entries =
+				le16_to_cpu(path[i].p_hdr->eh_entries) + 1;
+		} else {
+			path[i].p_idx--;
+		}
+
+		if (ext3_ext_more_to_rm(path + i)) {
+			struct buffer_head *bh;
+
+			bh = sb_bread(inode->i_sb,
+				      le32_to_cpu(path[i].p_idx->ei_leaf));
+			if (!bh) {
+				err = -EIO;
+				break;
+			}
+			if (ext3_ext_check_header(inode, ext_block_hdr(bh),
+						  depth - i - 1)) {
+				brelse(bh);
+				err = -EIO;
+				break;
+			}
+			memset(path + i + 1, 0, sizeof(*path));
+			path[i + 1].p_bh = bh;
+			path[i + 1].p_hdr = ext_block_hdr(bh);
+			path[i].p_entries =
+				le16_to_cpu(path[i].p_hdr->eh_entries);
+			i++;
+		} else {
+			/* done with this node; drop it if nothing is left */
+			if (path[i].p_hdr->eh_entries == 0 && i > 0)
+				err = ext3_ext_rm_idx(handle, inode, path + i);
+			brelse(path[i].p_bh);
+			path[i].p_bh = NULL;
+			i--;
+		}
+	}
+
+	/* a tree truncated to nothing shrinks back to a leaf in the inode */
+	if (!err && path[0].p_hdr->eh_entries == 0 && depth) {
+		struct ext3_extent_header *eh = ext_inode_hdr(inode);
+
+		eh->eh_depth = 0;
+		eh->eh_max = cpu_to_le16(ext3_ext_space_root(inode));
+		err = ext3_mark_inode_dirty(handle, inode);
+	}
+out:
+	ext3_ext_drop_refs(path);
+	kfree(path);
+	return err;
+}
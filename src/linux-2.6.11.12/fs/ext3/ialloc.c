@@ -17,6 +17,7 @@
 #include <linux/jbd.h>
 #include <linux/ext3_fs.h>
 #include <linux/ext3_jbd.h>
+#include <linux/ext3_extents.h>
 #include <linux/stat.h>
 #include <linux/string.h>
 #include <linux/quotaops.h>
@@ -48,6 +49,10 @@
  * Read the inode allocation bitmap for a given block_group, reading
  * into the specified slot in the superblock's bitmap cache.
  *
+ * The bitmap of a group flagged INODE_UNINIT has never been written:
+ * all its inodes are free, so it is built in memory instead, with the
+ * bits past the last inode of the group set.
+ *
  * Return buffer_head of bitmap on success or NULL.
  */
 static struct buffer_head *
@@ -55,12 +60,28 @@ read_inode_bitmap(struct super_block * sb, unsigned long block_group)
 {
 	struct ext3_group_desc *desc;
 	struct buffer_head *bh = NULL;
+	int i;
 
 	desc = ext3_get_group_desc(sb, block_group, NULL);
 	if (!desc)
 		goto error_out;
 
-	bh = sb_bread(sb, le32_to_cpu(desc->bg_inode_bitmap));
+	if (EXT3_HAS_RO_COMPAT_FEATURE(sb, EXT3_FEATURE_RO_COMPAT_GDT_CSUM) &&
+	    (desc->bg_flags & cpu_to_le16(EXT3_BG_INODE_UNINIT))) {
+		bh = sb_getblk(sb, le32_to_cpu(desc->bg_inode_bitmap));
+		if (bh && !buffer_uptodate(bh)) {
+			lock_buffer(bh);
+			if (!buffer_uptodate(bh)) {
+				memset(bh->b_data, 0, sb->s_blocksize);
+				for (i = EXT3_INODES_PER_GROUP(sb);
+				     i < sb->s_blocksize * 8; i++)
+					ext3_set_bit(i, bh->b_data);
+				set_buffer_uptodate(bh);
+			}
+			unlock_buffer(bh);
+		}
+	} else
+		bh = sb_bread(sb, le32_to_cpu(desc->bg_inode_bitmap));
 	if (!bh)
 		ext3_error(sb, "read_inode_bitmap",
 			    "Cannot read inode bitmap - "
@@ -169,6 +190,8 @@ void ext3_free_inode (handle_t *handle, struct inode * inode)
 			if (is_directory)
 				gdp->bg_used_dirs_count = cpu_to_le16(
 				  le16_to_cpu(gdp->bg_used_dirs_count) - 1);
+			gdp->bg_checksum = ext3_group_desc_csum(sbi,
+							block_group, gdp);
 			spin_unlock(sb_bgl_lock(sbi, block_group));
 			percpu_counter_inc(&sbi->s_freeinodes_counter);
 			if (is_directory)
@@ -433,6 +456,7 @@ struct inode *ext3_new_inode(handle_t *handle, struct inode * dir, int mode)
 	struct ext3_sb_info *sbi;
 	int err = 0;
 	struct inode *ret;
+	unsigned long offset, used;
 	int i;
 
 	/* Cannot create files in a deleted directory */
@@ -514,6 +538,7 @@ repeat_in_this_group:
 	goto out;
 
 got:
+	offset = ino;
 	ino += group * EXT3_INODES_PER_GROUP(sb) + 1;
 	if (ino < EXT3_FIRST_INO(sb) || ino > le32_to_cpu(es->s_inodes_count)) {
 		ext3_error (sb, "ext3_new_inode",
@@ -533,6 +558,17 @@ got:
 		gdp->bg_used_dirs_count =
 			cpu_to_le16(le16_to_cpu(gdp->bg_used_dirs_count) + 1);
 	}
+	if (EXT3_HAS_RO_COMPAT_FEATURE(sb, EXT3_FEATURE_RO_COMPAT_GDT_CSUM)) {
+		/* the bitmap is about to be written for real */
+		gdp->bg_flags &= cpu_to_le16(~EXT3_BG_INODE_UNINIT);
+		/* and the inode table is now in use up to this inode */
+		used = EXT3_INODES_PER_GROUP(sb) -
+			le16_to_cpu(gdp->bg_itable_unused);
+		if (offset >= used)
+			gdp->bg_itable_unused = cpu_to_le16(
+				EXT3_INODES_PER_GROUP(sb) - offset - 1);
+		gdp->bg_checksum = ext3_group_desc_csum(sbi, group, gdp);
+	}
 	spin_unlock(sb_bgl_lock(sbi, group));
 	BUFFER_TRACE(bh2, "call ext3_journal_dirty_metadata");
 	err = ext3_journal_dirty_metadata(handle, bh2);
@@ -566,7 +602,7 @@ got:
 	ei->i_dir_start_lookup = 0;
 	ei->i_disksize = 0;
 
-	ei->i_flags = EXT3_I(dir)->i_flags & ~EXT3_INDEX_FL;
+	ei->i_flags = EXT3_I(dir)->i_flags & ~(EXT3_INDEX_FL|EXT3_EXTENTS_FL);
 	if (S_ISLNK(mode))
 		ei->i_flags &= ~(EXT3_IMMUTABLE_FL|EXT3_APPEND_FL);
 	/* dirsync only applies to directories */
@@ -586,6 +622,10 @@ got:
 	atomic_set(&ei->i_rsv_window.rsv_alloc_hit, 0);
 	seqlock_init(&ei->i_rsv_window.rsv_seqlock);
 	ei->i_block_group = group;
+	if (S_ISREG(mode) && test_opt(sb, EXTENTS)) {
+		ei->i_flags |= EXT3_EXTENTS_FL;
+		ext3_ext_tree_init(inode);
+	}
 
 	ext3_set_inode_flags(inode);
 	if (IS_DIRSYNC(inode))
@@ -693,6 +733,30 @@ out:
 	return inode;
 }
 
+/*
+ * Returns 1 if the on-disk slot of inode ino has never been written:
+ * its group is flagged INODE_UNINIT, or it lies in the unused tail of
+ * the group's inode table.  Such a slot holds whatever was on the disk
+ * before mkfs, and must not be trusted.
+ */
+int ext3_inode_unused(struct super_block *sb, unsigned long ino)
+{
+	struct ext3_group_desc *gdp;
+	unsigned long block_group, offset;
+
+	if (!EXT3_HAS_RO_COMPAT_FEATURE(sb, EXT3_FEATURE_RO_COMPAT_GDT_CSUM))
+		return 0;
+	block_group = (ino - 1) / EXT3_INODES_PER_GROUP(sb);
+	offset = (ino - 1) % EXT3_INODES_PER_GROUP(sb);
+	gdp = ext3_get_group_desc(sb, block_group, NULL);
+	if (!gdp)
+		return 0;
+	if (gdp->bg_flags & cpu_to_le16(EXT3_BG_INODE_UNINIT))
+		return 1;
+	return offset >= EXT3_INODES_PER_GROUP(sb) -
+			 le16_to_cpu(gdp->bg_itable_unused);
+}
+
 unsigned long ext3_count_free_inodes (struct super_block * sb)
 {
 	unsigned long desc_count;
@@ -26,6 +26,7 @@
 #include <linux/fs.h>
 #include <linux/time.h>
 #include <linux/ext3_jbd.h>
+#include <linux/ext3_extents.h>
 #include <linux/jbd.h>
 #include <linux/smp_lock.h>
 #include <linux/highuid.h>
@@ -262,6 +263,17 @@ static inline int verify_chain(Indirect *from, Indirect *to)
 	return (from > to);
 }
 
+/*
+ * End of the array of block numbers which @ind->p points into: the direct
+ * blocks in the inode, or the indirect block @ind->bh.
+ */
+static inline __le32 *ext3_chain_end(struct inode *inode, Indirect *ind)
+{
+	if (!ind->bh)
+		return EXT3_I(inode)->i_data + EXT3_NDIR_BLOCKS;
+	return (__le32 *)ind->bh->b_data + EXT3_ADDR_PER_BLOCK(inode->i_sb);
+}
+
 /**
  *	ext3_block_to_path - parse the block number into array of offsets
  *	@inode: inode in question (we are only interested in its superblock)
@@ -693,11 +705,17 @@ err_out:
  * akpm: `handle' can be NULL if create == 0.
  *
  * The BKL may not be held on entry here.  Be sure to take it early.
+ *
+ * An existing block is mapped together with the physically contiguous
+ * blocks following it in the same indirect block, up to @maxblocks.
+ * Returns the number of blocks mapped, 0 for a hole if @create is 0, or
+ * a negative error.  Extent-mapped inodes are handed to extents.c.
  */
 
 static int
-ext3_get_block_handle(handle_t *handle, struct inode *inode, sector_t iblock,
-		struct buffer_head *bh_result, int create, int extend_disksize)
+ext3_get_blocks_handle(handle_t *handle, struct inode *inode, sector_t iblock,
+		unsigned long maxblocks, struct buffer_head *bh_result,
+		int create, int extend_disksize)
 {
 	int err = -EIO;
 	int offsets[4];
@@ -705,12 +723,17 @@ ext3_get_block_handle(handle_t *handle, struct inode *inode, sector_t iblock,
 	Indirect *partial;
 	unsigned long goal;
 	int left;
-	int boundary = 0;
-	int depth = ext3_block_to_path(inode, iblock, offsets, &boundary);
+	int count = 1;
+	int depth;
 	struct ext3_inode_info *ei = EXT3_I(inode);
 
 	J_ASSERT(handle != NULL || create == 0);
 
+	if (ext3_inode_has_extents(inode))
+		return ext3_ext_get_blocks(handle, inode, iblock, maxblocks,
+					   bh_result, create, extend_disksize);
+
+	depth = ext3_block_to_path(inode, iblock, offsets, NULL);
 	if (depth == 0)
 		goto out;
 
@@ -719,11 +742,23 @@ reread:
 
 	/* Simplest case - block found, no allocation needed */
 	if (!partial) {
+		unsigned long first = le32_to_cpu(chain[depth-1].key);
+		__le32 *p = chain[depth-1].p + 1;
+		__le32 *end = ext3_chain_end(inode, chain + depth - 1);
+
 		clear_buffer_new(bh_result);
+		while (count < maxblocks && p < end &&
+		       le32_to_cpu(*p) == first + count) {
+			count++;
+			p++;
+		}
 got_it:
 		map_bh(bh_result, inode->i_sb, le32_to_cpu(chain[depth-1].key));
-		if (boundary)
+		/* the last block mapped ends its indirect block */
+		if (chain[depth-1].p + count == ext3_chain_end(inode,
+							chain + depth - 1))
 			set_buffer_boundary(bh_result);
+		err = count;
 		/* Clean up and exit */
 		partial = chain+depth-1; /* the whole chain */
 		goto cleanup;
@@ -751,9 +786,9 @@ out:
 		goto changed;
 
 	goal = 0;
-	down(&ei->truncate_sem);
+	down_write(&ei->truncate_sem);
 	if (ext3_find_goal(inode, iblock, chain, partial, &goal) < 0) {
-		up(&ei->truncate_sem);
+		up_write(&ei->truncate_sem);
 		goto changed;
 	}
 
@@ -778,7 +813,7 @@ out:
 	 * concurrent ext3_get_block() -bzzz */
 	if (!err && extend_disksize && inode->i_size > ei->i_disksize)
 		ei->i_disksize = inode->i_size;
-	up(&ei->truncate_sem);
+	up_write(&ei->truncate_sem);
 	if (err == -EAGAIN)
 		goto changed;
 	if (err)
@@ -797,6 +832,27 @@ changed:
 	goto reread;
 }
 
+/*
+ * A delayed buffer got its block: give back the space promised for it.
+ * Its quota was charged at write() and now pays for the real block.
+ */
+static inline void ext3_da_clear_delay(struct inode *inode,
+				       struct buffer_head *bh)
+{
+	if (test_clear_buffer_delay(bh))
+		ext3_release_delayed_blocks(inode->i_sb, 1);
+}
+
+/* A delayed buffer's data is gone: give back its space and quota. */
+static inline void ext3_da_drop_delay(struct inode *inode,
+				      struct buffer_head *bh)
+{
+	if (test_clear_buffer_delay(bh)) {
+		ext3_release_delayed_blocks(inode->i_sb, 1);
+		DQUOT_FREE_BLOCK(inode, 1);
+	}
+}
+
 static int ext3_get_block(struct inode *inode, sector_t iblock,
 			struct buffer_head *bh_result, int create)
 {
@@ -807,8 +863,74 @@ static int ext3_get_block(struct inode *inode, sector_t iblock,
 		handle = ext3_journal_current_handle();
 		J_ASSERT(handle != 0);
 	}
-	ret = ext3_get_block_handle(handle, inode, iblock,
+	ret = ext3_get_blocks_handle(handle, inode, iblock, 1,
 				bh_result, create, 1);
+	if (ret > 0) {
+		ext3_da_clear_delay(inode, bh_result);
+		ret = 0;
+	}
+	return ret;
+}
+
+/*
+ * Delayed allocation ("delalloc" mount option, extent-mapped files in
+ * ordered and writeback mode).  prepare_write maps the blocks that exist;
+ * for a hole it only promises the space, charges the quota, and marks the
+ * buffer BH_Delay, leaving it unmapped.  ext3_da_writepage() later allocates the delayed
+ * blocks of the page together with those of the dirty pages after it, so
+ * a sequentially written file gets one allocation, and one extent, per
+ * run rather than one per block.
+ */
+static int ext3_da_get_block_prep(struct inode *inode, sector_t iblock,
+			struct buffer_head *bh_result, int create)
+{
+	struct page *page = bh_result->b_page;
+	int ret;
+
+	if (buffer_delay(bh_result))
+		return 0;
+	ret = ext3_get_blocks_handle(NULL, inode, iblock, 1, bh_result, 0, 0);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	ret = ext3_claim_delayed_blocks(inode->i_sb, 1);
+	if (ret)
+		return ret;
+	if (DQUOT_ALLOC_BLOCK(inode, 1)) {
+		ext3_release_delayed_blocks(inode->i_sb, 1);
+		return -EDQUOT;
+	}
+	set_buffer_delay(bh_result);
+	/* nothing is ever read into a delayed buffer: it starts as zeroes */
+	if (!PageUptodate(page)) {
+		void *kaddr = kmap_atomic(page, KM_USER0);
+
+		memset(kaddr + bh_offset(bh_result), 0, bh_result->b_size);
+		flush_dcache_page(page);
+		kunmap_atomic(kaddr, KM_USER0);
+		set_buffer_uptodate(bh_result);
+	}
+	return 0;
+}
+
+/*
+ * get_block for writeback of delayed allocation pages.  Unlike
+ * ext3_get_block() it leaves i_disksize alone; ext3_da_writepage() moves
+ * it once the page is written.
+ */
+static int ext3_da_get_block_write(struct inode *inode, sector_t iblock,
+			struct buffer_head *bh_result, int create)
+{
+	handle_t *handle = ext3_journal_current_handle();
+	int ret;
+
+	J_ASSERT(handle != 0);
+	ret = ext3_get_blocks_handle(handle, inode, iblock, 1,
+				bh_result, create, 0);
+	if (ret > 0) {
+		ext3_da_clear_delay(inode, bh_result);
+		ret = 0;
+	}
 	return ret;
 }
 
@@ -851,10 +973,15 @@ ext3_direct_io_get_blocks(struct inode *inode, sector_t iblock,
 	}
 
 get_block:
-	if (ret == 0)
-		ret = ext3_get_block_handle(handle, inode, iblock,
+	if (ret == 0) {
+		ret = ext3_get_blocks_handle(handle, inode, iblock, max_blocks,
 					bh_result, create, 0);
-	bh_result->b_size = (1 << inode->i_blkbits);
+		if (ret > 0) {
+			bh_result->b_size = (ret << inode->i_blkbits);
+			ret = 0;
+		} else
+			bh_result->b_size = (1 << inode->i_blkbits);
+	}
 	return ret;
 }
 
@@ -872,8 +999,11 @@ struct buffer_head *ext3_getblk(handle_t *handle, struct inode * inode,
 	dummy.b_state = 0;
 	dummy.b_blocknr = -1000;
 	buffer_trace_init(&dummy.b_history);
-	*errp = ext3_get_block_handle(handle, inode, block, &dummy, create, 1);
-	if (!*errp && buffer_mapped(&dummy)) {
+	err = ext3_get_blocks_handle(handle, inode, block, 1, &dummy, create, 1);
+	if (err > 0)
+		err = 0;
+	*errp = err;
+	if (!err && buffer_mapped(&dummy)) {
 		struct buffer_head *bh;
 		bh = sb_getblk(inode->i_sb, dummy.b_blocknr);
 		if (buffer_new(&dummy)) {
@@ -1134,6 +1264,38 @@ static int ext3_journalled_commit_write(struct file *file,
 	return ret;
 }
 
+static int ext3_da_prepare_write(struct file *file, struct page *page,
+			      unsigned from, unsigned to)
+{
+	int ret;
+
+	/* nested inside a transaction: allocate now, like the other modes */
+	if (ext3_journal_current_handle())
+		return ext3_prepare_write(file, page, from, to);
+
+	ret = block_prepare_write(page, from, to, ext3_da_get_block_prep);
+	/* too little space left to promise: allocate now, ENOSPC and all */
+	if (ret == -ENOSPC)
+		ret = ext3_prepare_write(file, page, from, to);
+	return ret;
+}
+
+/*
+ * If prepare_write had to allocate, ext3_prepare_write() left a handle
+ * open and we finish as the inode's data mode does.  Otherwise nothing
+ * needs journalling yet: i_disksize follows the data at writeback.
+ */
+static int ext3_da_commit_write(struct file *file, struct page *page,
+			     unsigned from, unsigned to)
+{
+	if (ext3_journal_current_handle()) {
+		if (ext3_should_order_data(page->mapping->host))
+			return ext3_ordered_commit_write(file, page, from, to);
+		return ext3_writeback_commit_write(file, page, from, to);
+	}
+	return generic_commit_write(file, page, from, to);
+}
+
 /* 
  * bmap() is special.  It gets used by applications such as lilo and by
  * the swapper to find the on-disk block of a specific piece of data.
@@ -1148,12 +1310,18 @@ static int ext3_journalled_commit_write(struct file *file,
  * So, if we see any bmap calls here on a modified, data-journaled file,
  * take extra steps to flush any blocks which might be in the cache. 
  */
+static struct address_space_operations ext3_da_aops;
+
 static sector_t ext3_bmap(struct address_space *mapping, sector_t block)
 {
 	struct inode *inode = mapping->host;
 	journal_t *journal;
 	int err;
 
+	/* delayed blocks have no address until they are written */
+	if (mapping->a_ops == &ext3_da_aops)
+		filemap_write_and_wait(mapping);
+
 	if (EXT3_I(inode)->i_state & EXT3_STATE_JDATA) {
 		/* 
 		 * This is a REALLY heavyweight approach, but the use of
@@ -1409,6 +1577,204 @@ out_unlock:
 	goto out;
 }
 
+/* dirty pages gathered behind the one being written, at most */
+#define EXT3_DA_MAX_PAGES	32
+
+/* The delayed buffers at the start of @page, up to the first other one. */
+static unsigned ext3_da_leading_delayed(struct page *page)
+{
+	struct buffer_head *bh, *head;
+	unsigned n = 0;
+
+	bh = head = page_buffers(page);
+	do {
+		if (!buffer_delay(bh))
+			break;
+		n++;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return n;
+}
+
+/*
+ * Called from writepage with @page locked and a handle open.  Allocate the
+ * delayed blocks of @page, from its first delayed buffer, in one run with
+ * those of the dirty pages following it.  Those pages are only trylocked.
+ * The run ends at the first page we cannot take, at the first buffer that
+ * is not delayed, or when the handle cannot be extended for another
+ * insert.  Whatever stays delayed is allocated by its own writepage.
+ *
+ * In ordered mode the buffers mapped here on the other pages are filed
+ * with this transaction, so their data reaches disk before the
+ * allocation commits.
+ */
+static void ext3_da_map_run(handle_t *handle, struct page *page, int order)
+{
+	struct address_space *mapping = page->mapping;
+	struct inode *inode = mapping->host;
+	int bits = PAGE_CACHE_SHIFT - inode->i_blkbits;
+	int needed = ext3_writepage_trans_blocks(inode);
+	struct page *pages[EXT3_DA_MAX_PAGES + 1];
+	struct buffer_head *bh, *head, *start, map;
+	unsigned long first, count = 0, done = 0;
+	int nr = 1, i, n, ret;
+
+	first = (unsigned long)page->index << bits;
+	start = head = page_buffers(page);
+	while (!buffer_delay(start)) {
+		start = start->b_this_page;
+		if (start == head)
+			return;
+		first++;
+	}
+	bh = start;
+	do {
+		count++;
+		bh = bh->b_this_page;
+	} while (bh != head && buffer_delay(bh));
+	pages[0] = page;
+
+	/* a run reaching the end of a page may go on into the next one */
+	while (nr <= EXT3_DA_MAX_PAGES &&
+	       first + count == (unsigned long)(page->index + nr) << bits) {
+		struct page *next = find_get_page(mapping, page->index + nr);
+
+		if (!next)
+			break;
+		if (TestSetPageLocked(next)) {
+			page_cache_release(next);
+			break;
+		}
+		n = 0;
+		if (next->mapping == mapping && PageDirty(next) &&
+		    !PageWriteback(next) && page_has_buffers(next))
+			n = ext3_da_leading_delayed(next);
+		if (!n) {
+			unlock_page(next);
+			page_cache_release(next);
+			break;
+		}
+		pages[nr++] = next;
+		count += n;
+	}
+
+	bh = start;
+	i = 0;
+	while (done < count) {
+		/* keep a page's worth of credits for the rest of writepage */
+		n = needed + ext3_ext_calc_credits_for_insert(inode) -
+			handle->h_buffer_credits;
+		if (n > 0 && ext3_journal_extend(handle, n))
+			break;
+
+		/* delayed: the space and quota are already ours */
+		map.b_state = 1 << BH_Delay;
+		buffer_trace_init(&map.b_history);
+		ret = ext3_get_blocks_handle(handle, inode, first + done,
+					     count - done, &map, 1, 0);
+		if (ret <= 0)
+			break;
+		for (n = 0; n < ret; n++) {
+			bh->b_bdev = map.b_bdev;
+			bh->b_blocknr = map.b_blocknr + n;
+			set_buffer_mapped(bh);
+			ext3_da_clear_delay(inode, bh);
+			if (buffer_new(&map))
+				unmap_underlying_metadata(bh->b_bdev,
+							  bh->b_blocknr);
+			if (order && i > 0)
+				ext3_journal_dirty_data(handle, bh);
+			bh = bh->b_this_page;
+			if (bh == page_buffers(pages[i]) && i + 1 < nr)
+				bh = page_buffers(pages[++i]);
+		}
+		done += ret;
+	}
+
+	for (i = 1; i < nr; i++) {
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+}
+
+/*
+ * Writepage for delayed allocation, in ordered or writeback mode.  Once
+ * the page is written (or, in ordered mode, filed with the transaction)
+ * i_disksize is moved up to its end, never past i_size.
+ */
+static int ext3_da_writepage(struct page *page,
+				struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	struct buffer_head *page_bufs, *bh;
+	int order = ext3_should_order_data(inode);
+	handle_t *handle = NULL;
+	loff_t end;
+	int ret = 0;
+	int err;
+
+	J_ASSERT(PageLocked(page));
+
+	if (ext3_journal_current_handle())
+		goto out_fail;
+
+	handle = ext3_journal_start(inode, ext3_writepage_trans_blocks(inode));
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out_fail;
+	}
+
+	if (!page_has_buffers(page)) {
+		create_empty_buffers(page, inode->i_sb->s_blocksize,
+				(1 << BH_Dirty)|(1 << BH_Uptodate));
+	}
+	page_bufs = page_buffers(page);
+	ext3_da_map_run(handle, page, order);
+
+	end = ((loff_t)page->index + 1) << PAGE_CACHE_SHIFT;
+	walk_page_buffers(handle, page_bufs, 0,
+			PAGE_CACHE_SIZE, NULL, bget_one);
+
+	ret = block_write_full_page(page, ext3_da_get_block_write, wbc);
+
+	/* as in ext3_ordered_writepage(), only page_bufs is safe from here */
+	if (ret) {
+		/* delayed buffers writeback gave up on have lost their data */
+		bh = page_bufs;
+		do {
+			if (!buffer_dirty(bh))
+				ext3_da_drop_delay(inode, bh);
+			bh = bh->b_this_page;
+		} while (bh != page_bufs);
+	}
+	if (ret == 0 && order)
+		ret = walk_page_buffers(handle, page_bufs, 0, PAGE_CACHE_SIZE,
+					NULL, journal_dirty_data_fn);
+	walk_page_buffers(handle, page_bufs, 0,
+			PAGE_CACHE_SIZE, NULL, bput_one);
+
+	if (ret == 0) {
+		down_write(&ei->truncate_sem);
+		if (end > i_size_read(inode))
+			end = i_size_read(inode);
+		if (end > ei->i_disksize) {
+			ei->i_disksize = end;
+			ret = ext3_mark_inode_dirty(handle, inode);
+		}
+		up_write(&ei->truncate_sem);
+	}
+	err = ext3_journal_stop(handle);
+	if (!ret)
+		ret = err;
+	return ret;
+
+out_fail:
+	redirty_page_for_writepage(wbc, page);
+	unlock_page(page);
+	return ret;
+}
+
 /*
  * ext3ļϵͳreadpage
  * mpage_readpageҪװΪҪһget_blockַΪҵȷĿĵַget_blockļʼĿתΪڴ̷пλõ߼ 
@@ -1438,6 +1804,25 @@ static int ext3_invalidatepage(struct page *page, unsigned long offset)
 	return journal_invalidatepage(journal, page, offset);
 }
 
+/* Truncated delayed buffers give back the space and quota promised them. */
+static int ext3_da_invalidatepage(struct page *page, unsigned long offset)
+{
+	struct inode *inode = page->mapping->host;
+	struct buffer_head *bh, *head;
+	unsigned long curr_off = 0;
+
+	if (page_has_buffers(page)) {
+		bh = head = page_buffers(page);
+		do {
+			if (offset <= curr_off)
+				ext3_da_drop_delay(inode, bh);
+			curr_off += bh->b_size;
+			bh = bh->b_this_page;
+		} while (bh != head);
+	}
+	return ext3_invalidatepage(page, offset);
+}
+
 static int ext3_releasepage(struct page *page, int wait)
 {
 	journal_t *journal = EXT3_JOURNAL(page->mapping->host);
@@ -1580,9 +1965,25 @@ static struct address_space_operations ext3_journalled_aops = {
 	.releasepage	= ext3_releasepage,
 };
 
+static struct address_space_operations ext3_da_aops = {
+	.readpage	= ext3_readpage,
+	.readpages	= ext3_readpages,
+	.writepage	= ext3_da_writepage,
+	.sync_page	= block_sync_page,
+	.prepare_write	= ext3_da_prepare_write,
+	.commit_write	= ext3_da_commit_write,
+	.bmap		= ext3_bmap,
+	.invalidatepage	= ext3_da_invalidatepage,
+	.releasepage	= ext3_releasepage,
+	.direct_IO	= ext3_direct_IO,
+};
+
 void ext3_set_aops(struct inode *inode)
 {
-	if (ext3_should_order_data(inode))
+	if (test_opt(inode->i_sb, DELALLOC) && ext3_inode_has_extents(inode) &&
+	    !ext3_should_journal_data(inode))
+		inode->i_mapping->a_ops = &ext3_da_aops;
+	else if (ext3_should_order_data(inode))
 		inode->i_mapping->a_ops = &ext3_ordered_aops;
 	else if (ext3_should_writeback_data(inode))
 		inode->i_mapping->a_ops = &ext3_writeback_aops;
@@ -1633,7 +2034,7 @@ static int ext3_block_truncate_page(handle_t *handle, struct page *page,
 		BUFFER_TRACE(bh, "unmapped");
 		ext3_get_block(inode, iblock, bh, 0);
 		/* unmapped? It's a hole - nothing to do */
-		if (!buffer_mapped(bh)) {
+		if (!buffer_mapped(bh) && !buffer_delay(bh)) {
 			BUFFER_TRACE(bh, "still unmapped");
 			goto unlock;
 		}
@@ -1670,7 +2071,8 @@ static int ext3_block_truncate_page(handle_t *handle, struct page *page,
 	if (ext3_should_journal_data(inode)) {
 		err = ext3_journal_dirty_metadata(handle, bh);
 	} else {
-		if (ext3_should_order_data(inode))
+		/* a delayed buffer is filed when writeback maps it */
+		if (ext3_should_order_data(inode) && buffer_mapped(bh))
 			err = ext3_journal_dirty_data(handle, bh);
 		mark_buffer_dirty(bh);
 	}
@@ -2111,6 +2513,16 @@ void ext3_truncate(struct inode * inode)
 	if (page)
 		ext3_block_truncate_page(handle, page, mapping, inode->i_size);
 
+	if (ext3_inode_has_extents(inode)) {
+		/* see below for the orphan list and i_disksize */
+		if (ext3_orphan_add(handle, inode))
+			goto out_stop;
+		ei->i_disksize = inode->i_size;
+		down_write(&ei->truncate_sem);
+		ext3_ext_remove_space(handle, inode, last_block);
+		goto out_unlock;
+	}
+
 	n = ext3_block_to_path(inode, last_block, offsets, NULL);
 	if (n == 0)
 		goto out_stop;	/* error */
@@ -2140,7 +2552,7 @@ void ext3_truncate(struct inode * inode)
 	 * From here we block out all ext3_get_block() callers who want to
 	 * modify the block allocation tree.
 	 */
-	down(&ei->truncate_sem);
+	down_write(&ei->truncate_sem);
 
 	if (n == 1) {		/* direct blocks */
 		ext3_free_data(handle, inode, NULL, i_data+offsets[0],
@@ -2204,7 +2616,8 @@ do_indirects:
 		case EXT3_TIND_BLOCK:
 			;
 	}
-	up(&ei->truncate_sem);
+out_unlock:
+	up_write(&ei->truncate_sem);
 	inode->i_mtime = inode->i_ctime = CURRENT_TIME_SEC;
 	ext3_mark_inode_dirty(handle, inode);
 
@@ -2425,6 +2838,10 @@ void ext3_read_inode(struct inode * inode)
 #endif
 	ei->i_rsv_window.rsv_end = EXT3_RESERVE_WINDOW_NOT_ALLOCATED;
 
+	/* a stale handle may point into a part of the inode table that
+	 * mkfs never zeroed */
+	if (ext3_inode_unused(inode->i_sb, inode->i_ino))
+		goto bad_inode;
 	if (__ext3_get_inode_loc(inode, &iloc, 0))
 		goto bad_inode;
 	bh = iloc.bh;
@@ -2642,6 +3059,20 @@ static int ext3_do_update_inode(handle_t *handle,
 			}
 		}
 	}
+	if (ext3_inode_has_extents(inode) &&
+	    !EXT3_HAS_INCOMPAT_FEATURE(inode->i_sb,
+				       EXT3_FEATURE_INCOMPAT_EXTENTS)) {
+		struct super_block *sb = inode->i_sb;
+
+		/* The first extent-mapped inode: old kernels must keep off */
+		err = ext3_journal_get_write_access(handle, EXT3_SB(sb)->s_sbh);
+		if (err)
+			goto out_brelse;
+		EXT3_SET_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_EXTENTS);
+		sb->s_dirt = 1;
+		handle->h_sync = 1;
+		err = ext3_journal_dirty_metadata(handle, EXT3_SB(sb)->s_sbh);
+	}
 	raw_inode->i_generation = cpu_to_le32(inode->i_generation);
 	if (S_ISCHR(inode->i_mode) || S_ISBLK(inode->i_mode)) {
 		if (old_valid_dev(inode->i_rdev)) {
@@ -2847,6 +3278,9 @@ static int ext3_writepage_trans_blocks(struct inode *inode)
 	int indirects = (EXT3_NDIR_BLOCKS % bpp) ? 5 : 3;
 	int ret;
 
+	if (ext3_inode_has_extents(inode))
+		return ext3_ext_writepage_trans_blocks(inode, bpp);
+
 	if (ext3_should_journal_data(inode))
 		ret = 3 * (bpp + indirects) + 2;
 	else
@@ -3024,6 +3458,10 @@ int ext3_change_inode_journal_flag(struct inode *inode, int val)
 	if (is_journal_aborted(journal) || IS_RDONLY(inode))
 		return -EROFS;
 
+	/* data=journal has no delayed allocation: get the blocks now */
+	if (val && inode->i_mapping->a_ops == &ext3_da_aops)
+		filemap_write_and_wait(inode->i_mapping);
+
 	journal_lock_updates(journal);
 	journal_flush(journal);
 
@@ -218,6 +218,9 @@ flags_err:
 
 		return err;
 	}
+	case EXT3_IOC_READDIR_PLUS:
+		return ext3_readdir_plus(filp,
+				(struct ext3_readdir_plus __user *) arg);
 
 
 	default:
@@ -2364,6 +2364,7 @@ struct inode_operations ext3_dir_inode_operations = {
 	.removexattr	= generic_removexattr,
 #endif
 	.permission	= ext3_permission,
+	.permission_rcu	= ext3_permission_rcu,
 };
 
 struct inode_operations ext3_special_inode_operations = {
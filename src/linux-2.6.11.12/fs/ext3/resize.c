@@ -807,6 +807,10 @@ int ext3_group_add(struct super_block *sb, struct ext3_new_group_data *input)
 	gdp->bg_inode_table = cpu_to_le32(input->inode_table);
 	gdp->bg_free_blocks_count = cpu_to_le16(input->free_blocks_count);
 	gdp->bg_free_inodes_count = cpu_to_le16(EXT3_INODES_PER_GROUP(sb));
+	gdp->bg_used_dirs_count = 0;
+	gdp->bg_flags = 0;
+	gdp->bg_itable_unused = 0;
+	gdp->bg_checksum = ext3_group_desc_csum(sbi, input->group, gdp);
 
 	/*
 	 * Make the new blocks and inodes valid next.  We do this before
@@ -898,6 +902,7 @@ int ext3_group_extend(struct super_block *sb, struct ext3_super_block *es,
 	unsigned long last;
 	int add;
 	struct buffer_head * bh;
+	struct buffer_head *bitmap_bh;
 	handle_t *handle;
 	int err, freed_blocks;
 
@@ -949,6 +954,14 @@ int ext3_group_extend(struct super_block *sb, struct ext3_super_block *es,
 	}
 	brelse(bh);
 
+	/* If the last group's bitmap was never initialised, build it
+	 * against the old size and hold on to it: built after the size
+	 * changes, it would show the blocks we free below as free
+	 * already. */
+	bitmap_bh = ext3_read_block_bitmap(sb, o_groups_count - 1);
+	if (!bitmap_bh)
+		return -EIO;
+
 	/* We will update the superblock, one block bitmap, and
 	 * one group descriptor via ext3_free_blocks().
 	 */
@@ -992,5 +1005,6 @@ int ext3_group_extend(struct super_block *sb, struct ext3_super_block *es,
 	update_backups(sb, EXT3_SB(sb)->s_sbh->b_blocknr, (char *)es,
 		       sizeof(struct ext3_super_block));
 exit_put:
+	brelse(bitmap_bh);
 	return err;
 } /* ext3_group_extend */
@@ -35,6 +35,7 @@
 #include <linux/mount.h>
 #include <linux/namei.h>
 #include <linux/quotaops.h>
+#include <linux/crc16.h>
 #include <asm/uaccess.h>
 #include "xattr.h"
 #include "acl.h"
@@ -42,6 +43,7 @@
 static int ext3_load_journal(struct super_block *, struct ext3_super_block *);
 static int ext3_create_journal(struct super_block *, struct ext3_super_block *,
 			       int);
+static void ext3_set_journal_checksums(struct super_block *, journal_t *);
 static void ext3_commit_super (struct super_block * sb,
 			       struct ext3_super_block * es,
 			       int sync);
@@ -393,6 +395,7 @@ static void ext3_put_super (struct super_block * sb)
 	percpu_counter_destroy(&sbi->s_freeblocks_counter);
 	percpu_counter_destroy(&sbi->s_freeinodes_counter);
 	percpu_counter_destroy(&sbi->s_dirs_counter);
+	percpu_counter_destroy(&sbi->s_dirtyblocks_counter);
 	brelse(sbi->s_sbh);
 #ifdef CONFIG_QUOTA
 	for (i = 0; i < MAXQUOTAS; i++) {
@@ -442,13 +445,27 @@ static struct inode *ext3_alloc_inode(struct super_block *sb)
 	ei->i_default_acl = EXT3_ACL_NOT_CACHED;
 #endif
 	ei->i_rsv_window.rsv_end = EXT3_RESERVE_WINDOW_NOT_ALLOCATED;
+	ei->i_cached_extent.ec_len = 0;
 	ei->vfs_inode.i_version = 1;
 	return &ei->vfs_inode;
 }
 
+static void ext3_i_callback(struct rcu_head *head)
+{
+	struct ext3_inode_info *ei;
+
+	ei = container_of(head, struct ext3_inode_info, i_rcu);
+	kmem_cache_free(ext3_inode_cachep, ei);
+}
+
+/*
+ * The RCU path walk may still be looking at i_mode and i_op of an inode
+ * whose dentry it found just before the unlink, so the memory is handed
+ * back only after a grace period.
+ */
 static void ext3_destroy_inode(struct inode *inode)
 {
-	kmem_cache_free(ext3_inode_cachep, EXT3_I(inode));
+	call_rcu(&EXT3_I(inode)->i_rcu, ext3_i_callback);
 }
 
 static void init_once(void * foo, kmem_cache_t * cachep, unsigned long flags)
@@ -461,7 +478,8 @@ static void init_once(void * foo, kmem_cache_t * cachep, unsigned long flags)
 #ifdef CONFIG_EXT3_FS_XATTR
 		init_rwsem(&ei->xattr_sem);
 #endif
-		init_MUTEX(&ei->truncate_sem);
+		init_rwsem(&ei->truncate_sem);
+		spin_lock_init(&ei->i_cached_extent_lock);
 		inode_init_once(&ei->vfs_inode);
 	}
 }
@@ -479,6 +497,7 @@ static int init_inodecache(void)
 
 static void destroy_inodecache(void)
 {
+	rcu_barrier();
 	if (kmem_cache_destroy(ext3_inode_cachep))
 		printk(KERN_INFO "ext3_inode_cache: not all structures were freed\n");
 }
@@ -486,16 +505,24 @@ static void destroy_inodecache(void)
 static void ext3_clear_inode(struct inode *inode)
 {
 #ifdef CONFIG_EXT3_FS_POSIX_ACL
-       if (EXT3_I(inode)->i_acl &&
-           EXT3_I(inode)->i_acl != EXT3_ACL_NOT_CACHED) {
-               posix_acl_release(EXT3_I(inode)->i_acl);
-               EXT3_I(inode)->i_acl = EXT3_ACL_NOT_CACHED;
-       }
-       if (EXT3_I(inode)->i_default_acl &&
-           EXT3_I(inode)->i_default_acl != EXT3_ACL_NOT_CACHED) {
-               posix_acl_release(EXT3_I(inode)->i_default_acl);
-               EXT3_I(inode)->i_default_acl = EXT3_ACL_NOT_CACHED;
-       }
+	struct posix_acl *acl, *default_acl;
+
+	/*
+	 * The RCU path walk may still be looking at this inode without a
+	 * reference; it takes its own on the ACL under i_lock, so take the
+	 * ACLs away under i_lock before dropping ours.
+	 */
+	spin_lock(&inode->i_lock);
+	acl = EXT3_I(inode)->i_acl;
+	default_acl = EXT3_I(inode)->i_default_acl;
+	EXT3_I(inode)->i_acl = EXT3_ACL_NOT_CACHED;
+	EXT3_I(inode)->i_default_acl = EXT3_ACL_NOT_CACHED;
+	spin_unlock(&inode->i_lock);
+
+	if (acl && acl != EXT3_ACL_NOT_CACHED)
+		posix_acl_release(acl);
+	if (default_acl && default_acl != EXT3_ACL_NOT_CACHED)
+		posix_acl_release(default_acl);
 #endif
 	ext3_discard_reservation(inode);
 }
@@ -582,6 +609,9 @@ enum {
 	Opt_usrjquota, Opt_grpjquota, Opt_offusrjquota, Opt_offgrpjquota,
 	Opt_jqfmt_vfsold, Opt_jqfmt_vfsv0,
 	Opt_ignore, Opt_barrier, Opt_err, Opt_resize,
+	Opt_extents, Opt_noextents, Opt_delalloc, Opt_nodelalloc,
+	Opt_journal_checksum, Opt_journal_async_commit,
+	Opt_min_batch_time, Opt_max_batch_time,
 };
 
 static match_table_t tokens = {
@@ -612,6 +642,8 @@ static match_table_t tokens = {
 	{Opt_noreservation, "noreservation"},
 	{Opt_noload, "noload"},
 	{Opt_commit, "commit=%u"},
+	{Opt_min_batch_time, "min_batch_time=%u"},
+	{Opt_max_batch_time, "max_batch_time=%u"},
 	{Opt_journal_update, "journal=update"},
 	{Opt_journal_inum, "journal=%u"},
 	{Opt_abort, "abort"},
@@ -629,6 +661,12 @@ static match_table_t tokens = {
 	{Opt_ignore, "quota"},
 	{Opt_ignore, "usrquota"},
 	{Opt_barrier, "barrier=%u"},
+	{Opt_extents, "extents"},
+	{Opt_noextents, "noextents"},
+	{Opt_delalloc, "delalloc"},
+	{Opt_nodelalloc, "nodelalloc"},
+	{Opt_journal_checksum, "journal_checksum"},
+	{Opt_journal_async_commit, "journal_async_commit"},
 	{Opt_err, NULL},
 	{Opt_resize, "resize"},
 };
@@ -807,6 +845,20 @@ static int parse_options (char * options, struct super_block *sb,
 				option = JBD_DEFAULT_MAX_COMMIT_AGE;
 			sbi->s_commit_interval = HZ * option;
 			break;
+		case Opt_min_batch_time:
+			if (match_int(&args[0], &option))
+				return 0;
+			if (option < 0)
+				return 0;
+			sbi->s_min_batch_time = option;
+			break;
+		case Opt_max_batch_time:
+			if (match_int(&args[0], &option))
+				return 0;
+			if (option < 0)
+				return 0;
+			sbi->s_max_batch_time = option;
+			break;
 		case Opt_data_journal:
 			data_opt = EXT3_MOUNT_JOURNAL_DATA;
 			goto datacheck;
@@ -913,6 +965,25 @@ clear_qf_name:
 			else
 				clear_opt(sbi->s_mount_opt, BARRIER);
 			break;
+		case Opt_extents:
+			set_opt(sbi->s_mount_opt, EXTENTS);
+			break;
+		case Opt_noextents:
+			clear_opt(sbi->s_mount_opt, EXTENTS);
+			break;
+		case Opt_delalloc:
+			set_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_nodelalloc:
+			clear_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_journal_checksum:
+			set_opt(sbi->s_mount_opt, JOURNAL_CHECKSUM);
+			break;
+		case Opt_journal_async_commit:
+			set_opt(sbi->s_mount_opt, JOURNAL_ASYNC_COMMIT);
+			set_opt(sbi->s_mount_opt, JOURNAL_CHECKSUM);
+			break;
 		case Opt_ignore:
 			break;
 		case Opt_resize:
@@ -1017,6 +1088,41 @@ static int ext3_setup_super(struct super_block *sb, struct ext3_super_block *es,
 	return res;
 }
 
+/*
+ * Group descriptor checksum: crc16 over the filesystem uuid, the group
+ * number and the descriptor up to the checksum field.  Without it the
+ * uninit flags could not be trusted, so it is only kept with
+ * RO_COMPAT_GDT_CSUM.
+ */
+__le16 ext3_group_desc_csum(struct ext3_sb_info *sbi, __u32 block_group,
+			    struct ext3_group_desc *gdp)
+{
+	__u16 crc = 0;
+
+	if (sbi->s_es->s_feature_ro_compat &
+	    cpu_to_le32(EXT3_FEATURE_RO_COMPAT_GDT_CSUM)) {
+		int offset = offsetof(struct ext3_group_desc, bg_checksum);
+		__le32 le_group = cpu_to_le32(block_group);
+
+		crc = crc16(~0, sbi->s_es->s_uuid, sizeof(sbi->s_es->s_uuid));
+		crc = crc16(crc, (__u8 *)&le_group, sizeof(le_group));
+		crc = crc16(crc, (__u8 *)gdp, offset);
+	}
+
+	return cpu_to_le16(crc);
+}
+
+int ext3_group_desc_csum_verify(struct ext3_sb_info *sbi, __u32 block_group,
+				struct ext3_group_desc *gdp)
+{
+	if ((sbi->s_es->s_feature_ro_compat &
+	     cpu_to_le32(EXT3_FEATURE_RO_COMPAT_GDT_CSUM)) &&
+	    (gdp->bg_checksum != ext3_group_desc_csum(sbi, block_group, gdp)))
+		return 0;
+
+	return 1;
+}
+
 /* Called at mount-time, super-block is locked */
 static int ext3_check_descriptors (struct super_block * sb)
 {
@@ -1066,6 +1172,14 @@ static int ext3_check_descriptors (struct super_block * sb)
 					le32_to_cpu(gdp->bg_inode_table));
 			return 0;
 		}
+		if (!ext3_group_desc_csum_verify(sbi, i, gdp)) {
+			ext3_error (sb, "ext3_check_descriptors",
+				    "Checksum for group %d failed (%u!=%u)",
+				    i, le16_to_cpu(ext3_group_desc_csum(sbi,
+						i, gdp)),
+				    le16_to_cpu(gdp->bg_checksum));
+			return 0;
+		}
 		block += EXT3_BLOCKS_PER_GROUP(sb);
 		gdp++;
 	}
@@ -1310,6 +1424,8 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 
 	sbi->s_resuid = le16_to_cpu(es->s_def_resuid);
 	sbi->s_resgid = le16_to_cpu(es->s_def_resgid);
+	sbi->s_min_batch_time = JBD_DEFAULT_MIN_BATCH_TIME;
+	sbi->s_max_batch_time = JBD_DEFAULT_MAX_BATCH_TIME;
 
 	set_opt(sbi->s_mount_opt, RESERVATION);
 
@@ -1468,6 +1584,7 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 	percpu_counter_init(&sbi->s_freeblocks_counter);
 	percpu_counter_init(&sbi->s_freeinodes_counter);
 	percpu_counter_init(&sbi->s_dirs_counter);
+	percpu_counter_init(&sbi->s_dirtyblocks_counter);
 	bgl_lock_init(&sbi->s_blockgroup_lock);
 
 	for (i = 0; i < db_count; i++) {
@@ -1563,6 +1680,9 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 		break;
 	}
 
+	if (!(sb->s_flags & MS_RDONLY))
+		ext3_set_journal_checksums(sb, sbi->s_journal);
+
 	/*
 	 * The journal_load will have done any necessary log recovery,
 	 * so we can safely mount the rest of the filesystem now.
@@ -1652,6 +1772,8 @@ static void ext3_init_journal_params(struct super_block *sb, journal_t *journal)
 	/* We could also set up an ext3-specific default for the commit
 	 * interval here, but for now we'll just fall back to the jbd
 	 * default. */
+	journal->j_min_batch_time = sbi->s_min_batch_time;
+	journal->j_max_batch_time = sbi->s_max_batch_time;
 
 	spin_lock(&journal->j_state_lock);
 	if (test_opt(sb, BARRIER))
@@ -1661,6 +1783,39 @@ static void ext3_init_journal_params(struct super_block *sb, journal_t *journal)
 	spin_unlock(&journal->j_state_lock);
 }
 
+/*
+ * Bring the journal's commit checksum features in line with the mount
+ * options.  This has to reach the journal superblock before the first
+ * commit, or recovery would not know to verify the commit records.
+ */
+static void ext3_set_journal_checksums(struct super_block *sb,
+				       journal_t *journal)
+{
+	int ok = 1;
+
+	if (test_opt(sb, JOURNAL_ASYNC_COMMIT)) {
+		ok = journal_set_features(journal,
+				JFS_FEATURE_COMPAT_CHECKSUM, 0,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+	} else if (test_opt(sb, JOURNAL_CHECKSUM)) {
+		ok = journal_set_features(journal,
+				JFS_FEATURE_COMPAT_CHECKSUM, 0, 0);
+		journal_clear_features(journal, 0, 0,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+	} else {
+		journal_clear_features(journal,
+				JFS_FEATURE_COMPAT_CHECKSUM, 0,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+	}
+	if (!ok) {
+		printk(KERN_WARNING "EXT3-fs: journal on %s does not support "
+		       "commit checksums\n", sb->s_id);
+		clear_opt(EXT3_SB(sb)->s_mount_opt, JOURNAL_CHECKSUM);
+		clear_opt(EXT3_SB(sb)->s_mount_opt, JOURNAL_ASYNC_COMMIT);
+	}
+	journal_update_superblock(journal, 1);
+}
+
 static journal_t *ext3_get_journal(struct super_block *sb, int journal_inum)
 {
 	struct inode *journal_inode;
@@ -2017,7 +2172,7 @@ static int ext3_sync_fs(struct super_block *sb, int wait)
 	sb->s_dirt = 0;
 	if (journal_start_commit(EXT3_SB(sb)->s_journal, &target)) {
 		if (wait)
-			log_wait_commit(EXT3_SB(sb)->s_journal, target);
+			log_wait_durable(EXT3_SB(sb)->s_journal, target);
 	}
 	return 0;
 }
@@ -2063,6 +2218,7 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 {
 	struct ext3_super_block * es;
 	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	unsigned long old_opts = sbi->s_mount_opt;
 	unsigned long tmp;
 	unsigned long n_blocks_count = 0;
 
@@ -2072,6 +2228,20 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 	if (!parse_options(data, sb, &tmp, &n_blocks_count, 1))
 		return -EINVAL;
 
+	/*
+	 * The commit record format cannot change under a live journal.
+	 * On a read-only filesystem the checksum options take effect when
+	 * it goes read-write.
+	 */
+	if (!(sb->s_flags & MS_RDONLY) &&
+	    ((sbi->s_mount_opt ^ old_opts) & (EXT3_MOUNT_JOURNAL_CHECKSUM |
+					      EXT3_MOUNT_JOURNAL_ASYNC_COMMIT))) {
+		printk(KERN_ERR "EXT3-fs: %s: cannot change journal checksum "
+		       "options on a read-write remount\n", sb->s_id);
+		sbi->s_mount_opt = old_opts;
+		return -EINVAL;
+	}
+
 	if (sbi->s_mount_opt & EXT3_MOUNT_ABORT)
 		ext3_abort(sb, __FUNCTION__, "Abort forced by user");
 
@@ -2124,6 +2294,7 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 			sbi->s_mount_state = le16_to_cpu(es->s_state);
 			if ((ret = ext3_group_extend(sb, es, n_blocks_count)))
 				return ret;
+			ext3_set_journal_checksums(sb, sbi->s_journal);
 			if (!ext3_setup_super (sb, es, 0))
 				sb->s_flags &= ~MS_RDONLY;
 		}
@@ -2133,12 +2304,17 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 
 static int ext3_statfs (struct super_block * sb, struct kstatfs * buf)
 {
-	struct ext3_super_block *es = EXT3_SB(sb)->s_es;
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	struct ext3_super_block *es = sbi->s_es;
 	unsigned long overhead;
+	long free, dirty;
 	int i;
 
 	if (test_opt (sb, MINIX_DF))
 		overhead = 0;
+	else if (sbi->s_blocks_last == le32_to_cpu(es->s_blocks_count))
+		/* only a resize changes the overhead */
+		overhead = sbi->s_overhead_last;
 	else {
 		unsigned long ngroups;
 		ngroups = EXT3_SB(sb)->s_groups_count;
@@ -2170,17 +2346,28 @@ static int ext3_statfs (struct super_block * sb, struct kstatfs * buf)
 		 * bitmap, and an inode table.
 		 */
 		overhead += (ngroups * (2 + EXT3_SB(sb)->s_itb_per_group));
+		sbi->s_overhead_last = overhead;
+		sbi->s_blocks_last = le32_to_cpu(es->s_blocks_count);
 	}
 
+	/*
+	 * The per-cpu counters are good enough for statfs(): summing the
+	 * group descriptors means touching every group on each call.
+	 * Blocks promised to delayed allocation are not free any more.
+	 */
+	free = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+	dirty = percpu_counter_read_positive(&sbi->s_dirtyblocks_counter);
+	free = free > dirty ? free - dirty : 0;
+
 	buf->f_type = EXT3_SUPER_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = le32_to_cpu(es->s_blocks_count) - overhead;
-	buf->f_bfree = ext3_count_free_blocks (sb);
+	buf->f_bfree = free;
 	buf->f_bavail = buf->f_bfree - le32_to_cpu(es->s_r_blocks_count);
 	if (buf->f_bfree < le32_to_cpu(es->s_r_blocks_count))
 		buf->f_bavail = 0;
 	buf->f_files = le32_to_cpu(es->s_inodes_count);
-	buf->f_ffree = ext3_count_free_inodes (sb);
+	buf->f_ffree = percpu_counter_read_positive(&sbi->s_freeinodes_counter);
 	buf->f_namelen = EXT3_NAME_LEN;
 	return 0;
 }
@@ -2481,7 +2668,7 @@ static struct file_system_type ext3_fs_type = {
 	.name		= "ext3",
 	.get_sb		= ext3_get_sb,
 	.kill_sb	= kill_block_super,
-	.fs_flags	= FS_REQUIRES_DEV,
+	.fs_flags	= FS_REQUIRES_DEV | FS_INODE_RCU,
 };
 
 static int __init init_ext3_fs(void)
@@ -16,6 +16,10 @@
 #include <linux/eventpoll.h>
 #include <linux/mount.h>
 #include <linux/cdev.h>
+#include <linux/percpu.h>
+#include <linux/percpu_counter.h>
+#include <linux/rcupdate.h>
+#include <linux/sysctl.h>
 
 /* sysctl tunables... */
 /**
@@ -34,34 +38,53 @@ EXPORT_SYMBOL(files_stat); /* Needed by unix.o */
 /* public. Not pretty! */
  __cacheline_aligned_in_smp DEFINE_SPINLOCK(files_lock);
 
-static DEFINE_SPINLOCK(filp_count_lock);
+/*
+ * Open files are counted per cpu; files_stat.nr_files is only brought
+ * up to date when somebody reads /proc/sys/fs/file-nr.
+ */
+static struct percpu_counter nr_files __cacheline_aligned_in_smp;
+
+/* protects this cpu's slice of every superblock's s_files */
+static DEFINE_PER_CPU(spinlock_t, files_sb_lock);
+
+static void file_free_rcu(struct rcu_head *head)
+{
+	struct file *f = container_of(head, struct file, f_rcuhead);
+	kmem_cache_free(filp_cachep, f);
+}
 
-/* slab constructors and destructors are called from arbitrary
- * context and must be fully threaded - use a local spinlock
- * to protect files_stat.nr_files
+/*
+ * A lockless fget() may still hold a pointer to the file, taken from
+ * an fd array before the descriptor was closed: keep the memory
+ * around for a grace period so that its f_count can still be read.
  */
-void filp_ctor(void * objp, struct kmem_cache_s *cachep, unsigned long cflags)
+static inline void file_free(struct file *f)
 {
-	if ((cflags & (SLAB_CTOR_VERIFY|SLAB_CTOR_CONSTRUCTOR)) ==
-	    SLAB_CTOR_CONSTRUCTOR) {
-		unsigned long flags;
-		spin_lock_irqsave(&filp_count_lock, flags);
-		files_stat.nr_files++;
-		spin_unlock_irqrestore(&filp_count_lock, flags);
-	}
+	percpu_counter_mod(&nr_files, -1);
+	call_rcu(&f->f_rcuhead, file_free_rcu);
 }
 
-void filp_dtor(void * objp, struct kmem_cache_s *cachep, unsigned long dflags)
+/*
+ * Approximate number of open files, within NR_CPUS * FBC_BATCH of
+ * the real one.
+ */
+int get_nr_files(void)
 {
-	unsigned long flags;
-	spin_lock_irqsave(&filp_count_lock, flags);
-	files_stat.nr_files--;
-	spin_unlock_irqrestore(&filp_count_lock, flags);
+	long n = percpu_counter_read(&nr_files);
+
+	return n > 0 ? n : 0;
 }
 
-static inline void file_free(struct file *f)
+EXPORT_SYMBOL(get_nr_files);
+
+/*
+ * Handler for /proc/sys/fs/file-nr.
+ */
+int proc_nr_files(ctl_table *table, int write, struct file *filp,
+		  void __user *buffer, size_t *lenp, loff_t *ppos)
 {
-	kmem_cache_free(filp_cachep, f);
+	files_stat.nr_files = get_nr_files();
+	return proc_dointvec(table, write, filp, buffer, lenp, ppos);
 }
 
 /* Find an unused file structure and return a pointer to it.
@@ -79,13 +102,14 @@ struct file *get_empty_filp(void)
 	/*
 	 * Privileged users can go above max_files
 	 */
-	if (files_stat.nr_files < files_stat.max_files ||
+	if (get_nr_files() < files_stat.max_files ||
 				capable(CAP_SYS_ADMIN)) {
 		/**
 		 * ļ
 		 */
 		f = kmem_cache_alloc(filp_cachep, GFP_KERNEL);
 		if (f) {
+			percpu_counter_mod(&nr_files, 1);
 			/*
 			 * ʼسԱ
 			 */
@@ -101,6 +125,7 @@ struct file *get_empty_filp(void)
 			rwlock_init(&f->f_owner.lock);
 			/* f->f_version: 0 */
 			INIT_LIST_HEAD(&f->f_list);
+			f->f_sb_list_cpu = -1;
 			f->f_maxcount = INT_MAX;
 			return f;
 		}
@@ -185,10 +210,47 @@ void fastcall __fput(struct file *file)
  * ں˿ʼʹһļʱںṩfget()Թ
  * ݽļļĵַü
  */
-struct file fastcall *fget(unsigned int fd)
+#ifdef __HAVE_ARCH_CMPXCHG
+/*
+ * Take a reference unless the last one is already gone.  A file
+ * whose f_count has dropped to zero is on its way to file_free()
+ * and must not be revived.
+ */
+static inline int get_file_not_zero(struct file *file)
+{
+	int c, old;
+
+	c = atomic_read(&file->f_count);
+	for (;;) {
+		if (unlikely(c == 0))
+			return 0;
+		old = cmpxchg(&file->f_count.counter, c, c + 1);
+		if (likely(old == c))
+			return 1;
+		c = old;
+	}
+}
+
+/*
+ * The fd array and the files in it are both freed only after a grace
+ * period, so they can be looked at under rcu_read_lock() without
+ * files->file_lock.
+ */
+static struct file *__fget(struct files_struct *files, unsigned int fd)
+{
+	struct file *file;
+
+	rcu_read_lock();
+	file = fcheck_files(files, fd);
+	if (file && !get_file_not_zero(file))
+		file = NULL;
+	rcu_read_unlock();
+	return file;
+}
+#else
+static struct file *__fget(struct files_struct *files, unsigned int fd)
 {
 	struct file *file;
-	struct files_struct *files = current->files;
 
 	spin_lock(&files->file_lock);
 	file = fcheck_files(files, fd);
@@ -197,6 +259,12 @@ struct file fastcall *fget(unsigned int fd)
 	spin_unlock(&files->file_lock);
 	return file;
 }
+#endif
+
+struct file fastcall *fget(unsigned int fd)
+{
+	return __fget(current->files, fd);
+}
 
 EXPORT_SYMBOL(fget);
 
@@ -219,13 +287,9 @@ struct file fastcall *fget_light(unsigned int fd, int *fput_needed)
 	if (likely((atomic_read(&files->count) == 1))) {
 		file = fcheck_files(files, fd);
 	} else {
-		spin_lock(&files->file_lock);
-		file = fcheck_files(files, fd);
-		if (file) {
-			get_file(file);
+		file = __fget(files, fd);
+		if (file)
 			*fput_needed = 1;
-		}
-		spin_unlock(&files->file_lock);
 	}
 	return file;
 }
@@ -240,10 +304,41 @@ void put_filp(struct file *file)
 	}
 }
 
+/*
+ * Put a newly opened file on its superblock's list for this cpu.
+ */
+void file_sb_list_add(struct file *file, struct super_block *sb)
+{
+	int cpu = get_cpu();
+	spinlock_t *lock = &per_cpu(files_sb_lock, cpu);
+
+	spin_lock(lock);
+	list_add(&file->f_list, per_cpu_ptr(sb->s_files, cpu));
+	file->f_sb_list_cpu = cpu;
+	spin_unlock(lock);
+	put_cpu();
+}
+
+/*
+ * The file may have been added on another cpu: f_sb_list_cpu says
+ * whose lock covers it.
+ */
+static void file_sb_list_del(struct file *file)
+{
+	spinlock_t *lock = &per_cpu(files_sb_lock, file->f_sb_list_cpu);
+
+	spin_lock(lock);
+	list_del_init(&file->f_list);
+	file->f_sb_list_cpu = -1;
+	spin_unlock(lock);
+}
+
 void file_move(struct file *file, struct list_head *list)
 {
 	if (!list)
 		return;
+	if (file->f_sb_list_cpu >= 0)
+		file_sb_list_del(file);
 	file_list_lock();
 	list_move(&file->f_list, list);
 	file_list_unlock();
@@ -251,21 +346,41 @@ void file_move(struct file *file, struct list_head *list)
 
 void file_kill(struct file *file)
 {
-	if (!list_empty(&file->f_list)) {
+	if (file->f_sb_list_cpu >= 0) {
+		file_sb_list_del(file);
+	} else if (!list_empty(&file->f_list)) {
 		file_list_lock();
 		list_del_init(&file->f_list);
 		file_list_unlock();
 	}
 }
 
+void sb_files_lock_all(void)
+{
+	int cpu;
+
+	preempt_disable();
+	for_each_cpu(cpu)
+		_raw_spin_lock(&per_cpu(files_sb_lock, cpu));
+}
+
+void sb_files_unlock_all(void)
+{
+	int cpu;
+
+	for_each_cpu(cpu)
+		_raw_spin_unlock(&per_cpu(files_sb_lock, cpu));
+	preempt_enable();
+}
+
 int fs_may_remount_ro(struct super_block *sb)
 {
-	struct list_head *p;
+	struct file *file;
+	int cpu;
 
 	/* Check that no files are currently opened for writing. */
-	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file *file = list_entry(p, struct file, f_list);
+	sb_files_lock_all();
+	sb_files_for_each(sb, cpu, file) {
 		struct inode *inode = file->f_dentry->d_inode;
 
 		/* File with pending delete? */
@@ -276,16 +391,17 @@ int fs_may_remount_ro(struct super_block *sb)
 		if (S_ISREG(inode->i_mode) && (file->f_mode & FMODE_WRITE))
 			goto too_bad;
 	}
-	file_list_unlock();
+	sb_files_unlock_all();
 	return 1; /* Tis' cool bro. */
 too_bad:
-	file_list_unlock();
+	sb_files_unlock_all();
 	return 0;
 }
 
 void __init files_init(unsigned long mempages)
 { 
 	int n; 
+	int cpu;
 	/* One file with associated inode and dcache is very roughly 1K. 
 	 * Per default don't use more than 10% of our memory for files. 
 	 */ 
@@ -294,4 +410,8 @@ void __init files_init(unsigned long mempages)
 	files_stat.max_files = n; 
 	if (files_stat.max_files < NR_FILE)
 		files_stat.max_files = NR_FILE;
+
+	for_each_cpu(cpu)
+		spin_lock_init(&per_cpu(files_sb_lock, cpu));
+	percpu_counter_init(&nr_files);
 } 
@@ -21,6 +21,9 @@
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/smp_lock.h>
+#include <linux/highmem.h>
+#include <linux/blkdev.h>
+#include <linux/crc32.h>
 
 /*
  * Default IO end handler for temporary BJ_IO buffer_heads.
@@ -35,6 +38,152 @@ static void journal_end_buffer_io_sync(struct buffer_head *bh, int uptodate)
 	unlock_buffer(bh);
 }
 
+/*
+ * Fold a log block into the running checksum of the transaction.  The
+ * block may be a copy-out of a highmem metadata page, so map it.
+ */
+static __u32 jbd_checksum_data(__u32 crc32_sum, struct buffer_head *bh)
+{
+	char *addr;
+	__u32 checksum;
+
+	addr = kmap_atomic(bh->b_page, KM_USER0);
+	checksum = crc32_be(crc32_sum,
+		(void *)(addr + offset_in_page(bh->b_data)), bh->b_size);
+	kunmap_atomic(addr, KM_USER0);
+
+	return checksum;
+}
+
+/*
+ * Start the write of the commit record for @commit_transaction.  If the
+ * journal carries commit checksums, @crc32_sum covers every descriptor
+ * and metadata block logged by the transaction, which lets recovery tell
+ * a complete transaction from one whose commit block reached the disk
+ * ahead of the blocks it commits.
+ *
+ * Returns the commit block, still to be waited upon, or NULL if the
+ * journal is (or now has been) aborted.
+ */
+static struct journal_head *
+journal_submit_commit_record(journal_t *journal,
+			     transaction_t *commit_transaction,
+			     __u32 crc32_sum)
+{
+	struct journal_head *descriptor;
+	struct commit_header *tmp;
+	struct buffer_head *bh;
+
+	if (is_journal_aborted(journal))
+		return NULL;
+
+	descriptor = journal_get_descriptor_buffer(journal);
+	if (!descriptor) {
+		__journal_abort_hard(journal);
+		return NULL;
+	}
+
+	bh = jh2bh(descriptor);
+	tmp = (struct commit_header *)bh->b_data;
+	tmp->h_magic = cpu_to_be32(JFS_MAGIC_NUMBER);
+	tmp->h_blocktype = cpu_to_be32(JFS_COMMIT_BLOCK);
+	tmp->h_sequence = cpu_to_be32(commit_transaction->t_tid);
+
+	if (JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM)) {
+		tmp->h_chksum_type = JFS_CRC32_CHKSUM;
+		tmp->h_chksum_size = JFS_CRC32_CHKSUM_SIZE;
+		tmp->h_chksum[0] = cpu_to_be32(crc32_sum);
+	}
+
+	JBUFFER_TRACE(descriptor, "submit commit block");
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = journal_end_buffer_io_sync;
+	/*
+	 * An asynchronous commit record is not ordered against the blocks
+	 * before it; the cache is flushed once they are all done instead.
+	 */
+	if ((journal->j_flags & JFS_BARRIER) &&
+	    !JFS_HAS_INCOMPAT_FEATURE(journal,
+				      JFS_FEATURE_INCOMPAT_ASYNC_COMMIT))
+		set_buffer_ordered(bh);
+	submit_bh(WRITE, bh);
+	clear_buffer_ordered(bh);
+
+	return descriptor;
+}
+
+/*
+ * Wait for the commit record to reach the disk, falling back to a plain
+ * write if the device turned the barrier down.
+ */
+static int journal_wait_on_commit_record(journal_t *journal,
+					 struct journal_head *descriptor)
+{
+	struct buffer_head *bh = jh2bh(descriptor);
+	int ret = 0;
+
+	wait_on_buffer(bh);
+
+	/* is it possible for another commit to fail at roughly
+	 * the same time as this one?  If so, we don't want to
+	 * trust the barrier flag in the super, but instead want
+	 * to remember if we sent a barrier request
+	 */
+	if (buffer_eopnotsupp(bh)) {
+		char b[BDEVNAME_SIZE];
+
+		printk(KERN_WARNING
+			"JBD: barrier-based sync failed on %s - "
+			"disabling barriers\n",
+			bdevname(journal->j_dev, b));
+		spin_lock(&journal->j_state_lock);
+		journal->j_flags &= ~JFS_BARRIER;
+		spin_unlock(&journal->j_state_lock);
+
+		/* And try again, without the barrier */
+		clear_buffer_eopnotsupp(bh);
+		lock_buffer(bh);
+		set_buffer_uptodate(bh);
+		bh->b_end_io = journal_end_buffer_io_sync;
+		submit_bh(WRITE, bh);
+		wait_on_buffer(bh);
+	}
+	if (unlikely(!buffer_uptodate(bh)))
+		ret = -EIO;
+
+	put_bh(bh);		/* One for getblk() */
+	journal_put_journal_head(descriptor);
+	return ret;
+}
+
+/*
+ * Account the time from the start of a commit until its commit record
+ * was known to be on disk.  Called under j_state_lock.
+ */
+static void journal_account_commit(journal_t *journal, unsigned long start)
+{
+	unsigned long delta = jiffies - start;
+	int slot;
+
+	slot = fls(jiffies_to_msecs(delta));
+	if (slot >= JBD_COMMIT_HIST_SLOTS)
+		slot = JBD_COMMIT_HIST_SLOTS - 1;
+	journal->j_commit_hist[slot]++;
+	journal->j_commit_count++;
+	journal->j_commit_time += delta;
+	if (delta > journal->j_commit_max)
+		journal->j_commit_max = delta;
+
+	/* Weight the newest commit by a quarter in the running average */
+	if (journal->j_average_commit_time)
+		journal->j_average_commit_time =
+			(delta + journal->j_average_commit_time * 3) / 4;
+	else
+		journal->j_average_commit_time = delta;
+}
+
 /*
  * When an ext3-ordered file is truncated, it is possible that many pages are
  * not sucessfully freed, because they are attached to a committing transaction.
@@ -103,7 +252,11 @@ void journal_commit_transaction(journal_t *journal)
 {
 	transaction_t *commit_transaction;
 	struct journal_head *jh, *new_jh, *descriptor;
+	struct journal_head *commit_record = NULL;
+	unsigned long start_time = jiffies;
+	__u32 crc32_sum = ~0;
 	struct buffer_head *wbuf[64];
+	struct blk_plug plug;
 	int bufs;
 	int flags;
 	int err;
@@ -361,6 +514,11 @@ write_out_data:
 	 */
 	commit_transaction->t_state = T_COMMIT;
 
+	/*
+	 * The log blocks are contiguous: plug so that the submit_bh()s
+	 * below reach the queue as a few large requests.
+	 */
+	blk_start_plug(&plug);
 	descriptor = NULL;
 	bufs = 0;
 	while (commit_transaction->t_buffers) {
@@ -506,6 +664,10 @@ start_journal_io:
 				clear_buffer_dirty(bh);
 				set_buffer_uptodate(bh);
 				bh->b_end_io = journal_end_buffer_io_sync;
+				if (JFS_HAS_COMPAT_FEATURE(journal,
+						JFS_FEATURE_COMPAT_CHECKSUM))
+					crc32_sum =
+					    jbd_checksum_data(crc32_sum, bh);
 				submit_bh(WRITE, bh);
 			}
 			cond_resched();
@@ -516,6 +678,17 @@ start_journal_io:
 			bufs = 0;
 		}
 	}
+	blk_finish_plug(&plug);
+
+	/*
+	 * With asynchronous commit, the commit record goes out right behind
+	 * the blocks it covers; its checksum stands in for the ordering we
+	 * would otherwise get by waiting for them first.
+	 */
+	if (JFS_HAS_INCOMPAT_FEATURE(journal,
+				     JFS_FEATURE_INCOMPAT_ASYNC_COMMIT))
+		commit_record = journal_submit_commit_record(journal,
+					commit_transaction, crc32_sum);
 
 	/* Lo and behold: we have just managed to send a transaction to
            the log.  Before we can commit it, wait for the IO so far to
@@ -616,79 +789,50 @@ wait_for_iobuf:
 
 	jbd_debug(3, "JBD: commit phase 6\n");
 
-	if (is_journal_aborted(journal))
-		goto skip_commit;
-
-	/* Done it all: now write the commit record.  We should have
-	 * cleaned up our previous buffers by now, so if we are in abort
-	 * mode we can now just skip the rest of the journal write
-	 * entirely. */
-
-	descriptor = journal_get_descriptor_buffer(journal);
-	if (!descriptor) {
-		__journal_abort_hard(journal);
-		goto skip_commit;
-	}
-
-	/* AKPM: buglet - add `i' to tmp! */
-	for (i = 0; i < jh2bh(descriptor)->b_size; i += 512) {
-		journal_header_t *tmp =
-			(journal_header_t*)jh2bh(descriptor)->b_data;
-		tmp->h_magic = cpu_to_be32(JFS_MAGIC_NUMBER);
-		tmp->h_blocktype = cpu_to_be32(JFS_COMMIT_BLOCK);
-		tmp->h_sequence = cpu_to_be32(commit_transaction->t_tid);
+	/* Done it all: now write the commit record, unless it is already
+	 * on its way.  We should have cleaned up our previous buffers by
+	 * now, so if we are in abort mode we can now just skip the rest
+	 * of the journal write entirely. */
+
+	if (!JFS_HAS_INCOMPAT_FEATURE(journal,
+				      JFS_FEATURE_INCOMPAT_ASYNC_COMMIT))
+		commit_record = journal_submit_commit_record(journal,
+					commit_transaction, crc32_sum);
+	if (commit_record) {
+		int ret = journal_wait_on_commit_record(journal,
+							commit_record);
+		if (unlikely(ret))
+			err = ret;
 	}
 
-	JBUFFER_TRACE(descriptor, "write commit block");
-	{
-		struct buffer_head *bh = jh2bh(descriptor);
-		int ret;
-		int barrier_done = 0;
-
-		set_buffer_dirty(bh);
-		if (journal->j_flags & JFS_BARRIER) {
-			set_buffer_ordered(bh);
-			barrier_done = 1;
-		}
-		ret = sync_dirty_buffer(bh);
-		/* is it possible for another commit to fail at roughly
-		 * the same time as this one?  If so, we don't want to
-		 * trust the barrier flag in the super, but instead want
-		 * to remember if we sent a barrier request
-		 */
-		if (ret == -EOPNOTSUPP && barrier_done) {
-			char b[BDEVNAME_SIZE];
+	/* The commit record was not ordered behind the rest of the
+	 * transaction, so push the whole lot out of the drive's cache. */
+	if (commit_record && !err &&
+	    JFS_HAS_INCOMPAT_FEATURE(journal,
+				     JFS_FEATURE_INCOMPAT_ASYNC_COMMIT) &&
+	    (journal->j_flags & JFS_BARRIER))
+		blkdev_issue_flush(journal->j_dev, NULL);
 
-			printk(KERN_WARNING
-				"JBD: barrier-based sync failed on %s - "
-				"disabling barriers\n",
-				bdevname(journal->j_dev, b));
-			spin_lock(&journal->j_state_lock);
-			journal->j_flags &= ~JFS_BARRIER;
-			spin_unlock(&journal->j_state_lock);
+	if (err)
+		__journal_abort_hard(journal);
 
-			/* And try again, without the barrier */
-			clear_buffer_ordered(bh);
-			set_buffer_uptodate(bh);
-			set_buffer_dirty(bh);
-			ret = sync_dirty_buffer(bh);
-		}
-		if (unlikely(ret == -EIO))
-			err = -EIO;
-		put_bh(bh);		/* One for getblk() */
-		journal_put_journal_head(descriptor);
-	}
+	/*
+	 * The transaction is now safe on disk.  Let fsync() and friends
+	 * go: filing the buffers for checkpoint below can take a while on
+	 * a big transaction and need not hold them up.
+	 */
+	spin_lock(&journal->j_state_lock);
+	journal->j_durable_sequence = commit_transaction->t_tid;
+	if (commit_record && !err)
+		journal_account_commit(journal, start_time);
+	spin_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_wait_done_commit);
 
 	/* End of a transaction!  Finally, we can do checkpoint
            processing: any buffers committed as a result of this
            transaction can be removed from any checkpoint list it was on
            before. */
 
-skip_commit: /* The journal should be unlocked by now. */
-
-	if (err)
-		__journal_abort_hard(journal);
-
 	jbd_debug(3, "JBD: commit phase 7\n");
 
 	J_ASSERT(commit_transaction->t_sync_datalist == NULL);
@@ -62,6 +62,7 @@ EXPORT_SYMBOL(journal_update_format);
 EXPORT_SYMBOL(journal_check_used_features);
 EXPORT_SYMBOL(journal_check_available_features);
 EXPORT_SYMBOL(journal_set_features);
+EXPORT_SYMBOL(journal_clear_features);
 EXPORT_SYMBOL(journal_create);
 EXPORT_SYMBOL(journal_load);
 EXPORT_SYMBOL(journal_destroy);
@@ -72,6 +73,7 @@ EXPORT_SYMBOL(journal_errno);
 EXPORT_SYMBOL(journal_ack_err);
 EXPORT_SYMBOL(journal_clear_err);
 EXPORT_SYMBOL(log_wait_commit);
+EXPORT_SYMBOL(log_wait_durable);
 EXPORT_SYMBOL(journal_start_commit);
 EXPORT_SYMBOL(journal_force_commit_nested);
 EXPORT_SYMBOL(journal_wipe);
@@ -81,6 +83,8 @@ EXPORT_SYMBOL(journal_try_to_free_buffers);
 EXPORT_SYMBOL(journal_force_commit);
 
 static int journal_convert_superblock_v1(journal_t *, journal_superblock_t *);
+static void jbd_create_journal_proc_entry(journal_t *);
+static void jbd_remove_journal_proc_entry(journal_t *);
 
 /*
  * Helper function used to manage commit timeouts
@@ -562,6 +566,35 @@ int log_wait_commit(journal_t *journal, tid_t tid)
 	return err;
 }
 
+/*
+ * Wait for the commit record of a transaction to reach the disk.  Unlike
+ * log_wait_commit() this does not wait for the commit thread to finish
+ * with the transaction, so it is enough for data integrity but not for
+ * callers which need the transaction's buffers released.
+ */
+int log_wait_durable(journal_t *journal, tid_t tid)
+{
+	int err = 0;
+
+	spin_lock(&journal->j_state_lock);
+	while (tid_gt(tid, journal->j_durable_sequence)) {
+		jbd_debug(1, "JBD: want %d, j_durable_sequence=%d\n",
+				  tid, journal->j_durable_sequence);
+		wake_up(&journal->j_wait_commit);
+		spin_unlock(&journal->j_state_lock);
+		wait_event(journal->j_wait_done_commit,
+				!tid_gt(tid, journal->j_durable_sequence));
+		spin_lock(&journal->j_state_lock);
+	}
+	spin_unlock(&journal->j_state_lock);
+
+	if (unlikely(is_journal_aborted(journal))) {
+		printk(KERN_EMERG "journal commit I/O error\n");
+		err = -EIO;
+	}
+	return err;
+}
+
 /*
  * Log buffer allocation routines:
  */
@@ -678,6 +711,8 @@ static journal_t * journal_init_common (void)
 	spin_lock_init(&journal->j_state_lock);
 
 	journal->j_commit_interval = (HZ * JBD_DEFAULT_MAX_COMMIT_AGE);
+	journal->j_min_batch_time = JBD_DEFAULT_MIN_BATCH_TIME;
+	journal->j_max_batch_time = JBD_DEFAULT_MAX_BATCH_TIME;
 
 	/* The journal is marked for error until we succeed with recovery! */
 	journal->j_flags = JFS_ABORT;
@@ -822,6 +857,7 @@ static int journal_reset(journal_t *journal)
 	journal->j_tail_sequence = journal->j_transaction_sequence;
 	journal->j_commit_sequence = journal->j_transaction_sequence - 1;
 	journal->j_commit_request = journal->j_commit_sequence;
+	journal->j_durable_sequence = journal->j_commit_sequence;
 
 	journal->j_max_transaction_buffers = journal->j_maxlen / 4;
 
@@ -1091,6 +1127,7 @@ int journal_load(journal_t *journal)
 
 	journal->j_flags &= ~JFS_ABORT;
 	journal->j_flags |= JFS_LOADED;
+	jbd_create_journal_proc_entry(journal);
 	return 0;
 
 recovery_error:
@@ -1137,6 +1174,7 @@ void journal_destroy(journal_t *journal)
 		brelse(journal->j_sb_buffer);
 	}
 
+	jbd_remove_journal_proc_entry(journal);
 	if (journal->j_inode)
 		iput(journal->j_inode);
 	if (journal->j_revoke)
@@ -1235,6 +1273,28 @@ int journal_set_features (journal_t *journal, unsigned long compat,
 	return 1;
 }
 
+/**
+ * void journal_clear_features () - Clear a given journal feature in the
+ *				    superblock
+ *
+ * Clear a given journal feature as present on the
+ * superblock.
+ */
+void journal_clear_features (journal_t *journal, unsigned long compat,
+			     unsigned long ro, unsigned long incompat)
+{
+	journal_superblock_t *sb;
+
+	jbd_debug(1, "Clear features 0x%lx/0x%lx/0x%lx\n",
+		  compat, ro, incompat);
+
+	sb = journal->j_superblock;
+
+	sb->s_feature_compat    &= ~cpu_to_be32(compat);
+	sb->s_feature_ro_compat &= ~cpu_to_be32(ro);
+	sb->s_feature_incompat  &= ~cpu_to_be32(incompat);
+}
+
 
 /**
  * int journal_update_format () - Update on-disk journal structure.
@@ -1892,6 +1952,108 @@ static void __exit remove_jbd_proc_entry(void)
 
 #endif
 
+/*
+ * Per-journal commit statistics, in /proc/fs/jbd/<device>
+ */
+#ifdef CONFIG_PROC_FS
+
+static struct proc_dir_entry *proc_jbd_stats;
+
+static int read_jbd_commit_stats(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	journal_t *journal = data;
+	unsigned long hist[JBD_COMMIT_HIST_SLOTS];
+	unsigned long nr, total, max, average, waits;
+	int len = 0;
+	int i;
+
+	spin_lock(&journal->j_state_lock);
+	memcpy(hist, journal->j_commit_hist, sizeof(hist));
+	nr = journal->j_commit_count;
+	total = journal->j_commit_time;
+	max = journal->j_commit_max;
+	average = journal->j_average_commit_time;
+	waits = journal->j_batch_waits;
+	spin_unlock(&journal->j_state_lock);
+
+	len += sprintf(page + len, "commits:     %lu\n", nr);
+	len += sprintf(page + len, "average ms:  %u\n",
+		       nr ? jiffies_to_msecs(total / nr) : 0);
+	len += sprintf(page + len, "max ms:      %u\n",
+		       jiffies_to_msecs(max));
+	len += sprintf(page + len, "recent ms:   %u\n",
+		       jiffies_to_msecs(average));
+	len += sprintf(page + len, "batch waits: %lu\n", waits);
+	len += sprintf(page + len, "async:       %s\n",
+		       JFS_HAS_INCOMPAT_FEATURE(journal,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT) ?
+		       "yes" : "no");
+	for (i = 0; i < JBD_COMMIT_HIST_SLOTS - 1; i++)
+		len += sprintf(page + len, "  <%ums:\t%lu\n",
+			       1U << i, hist[i]);
+	len += sprintf(page + len, " >=%ums:\t%lu\n",
+		       1U << (JBD_COMMIT_HIST_SLOTS - 2), hist[i]);
+
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+	return len;
+}
+
+static void jbd_create_journal_proc_entry(journal_t *journal)
+{
+	char b[BDEVNAME_SIZE];
+
+	if (!proc_jbd_stats || journal->j_proc_entry)
+		return;
+	journal->j_proc_entry =
+		create_proc_read_entry(journal_dev_name(journal, b), 0444,
+				       proc_jbd_stats, read_jbd_commit_stats,
+				       journal);
+}
+
+static void jbd_remove_journal_proc_entry(journal_t *journal)
+{
+	char b[BDEVNAME_SIZE];
+
+	if (!journal->j_proc_entry)
+		return;
+	remove_proc_entry(journal_dev_name(journal, b), proc_jbd_stats);
+	journal->j_proc_entry = NULL;
+}
+
+static void __init create_jbd_stats_dir(void)
+{
+	proc_jbd_stats = proc_mkdir("jbd", proc_root_fs);
+}
+
+static void __exit remove_jbd_stats_dir(void)
+{
+	if (proc_jbd_stats)
+		remove_proc_entry("jbd", proc_root_fs);
+}
+
+#else
+
+static void jbd_create_journal_proc_entry(journal_t *journal)
+{
+}
+
+static void jbd_remove_journal_proc_entry(journal_t *journal)
+{
+}
+
+#define create_jbd_stats_dir() do {} while (0)
+#define remove_jbd_stats_dir() do {} while (0)
+
+#endif
+
 kmem_cache_t *jbd_handle_cache;
 
 static int __init journal_init_handle_cache(void)
@@ -1946,6 +2108,7 @@ static int __init journal_init(void)
 	if (ret != 0)
 		journal_destroy_caches();
 	create_jbd_proc_entry();
+	create_jbd_stats_dir();
 	return ret;
 }
 
@@ -1956,6 +2119,7 @@ static void __exit journal_exit(void)
 	if (n)
 		printk(KERN_EMERG "JBD: leaked %d journal_heads!\n", n);
 #endif
+	remove_jbd_stats_dir();
 	remove_jbd_proc_entry();
 	journal_destroy_caches();
 }
@@ -21,6 +21,7 @@
 #include <linux/jbd.h>
 #include <linux/errno.h>
 #include <linux/slab.h>
+#include <linux/crc32.h>
 #endif
 
 /*
@@ -307,12 +308,45 @@ int journal_skip_recovery(journal_t *journal)
 	return err;
 }
 
+/*
+ * Fold a descriptor block and the log blocks it describes into the
+ * running checksum of a transaction, as the commit code did when it
+ * wrote them out.
+ */
+static int calc_chksums(journal_t *journal, struct buffer_head *bh,
+			unsigned long *next_log_block, __u32 *crc32_sum)
+{
+	int i, num_blks, err;
+	unsigned long io_block;
+	struct buffer_head *obh;
+
+	num_blks = count_tags(bh, journal->j_blocksize);
+	/* Calculate checksum of the descriptor block. */
+	*crc32_sum = crc32_be(*crc32_sum, (void *)bh->b_data, bh->b_size);
+
+	for (i = 0; i < num_blks; i++) {
+		io_block = (*next_log_block)++;
+		wrap(journal, *next_log_block);
+		err = jread(&obh, journal, io_block);
+		if (err) {
+			printk(KERN_ERR "JBD: IO error %d recovering block "
+				"%lu in log\n", err, io_block);
+			return -EIO;
+		}
+		*crc32_sum = crc32_be(*crc32_sum, (void *)obh->b_data,
+				      obh->b_size);
+		brelse(obh);
+	}
+	return 0;
+}
+
 static int do_one_pass(journal_t *journal,
 			struct recovery_info *info, enum passtype pass)
 {
 	unsigned int		first_commit_ID, next_commit_ID;
 	unsigned long		next_log_block;
 	int			err, success = 0;
+	__u32			crc32_sum = ~0; /* Transactional Checksums */
 	journal_superblock_t *	sb;
 	journal_header_t * 	tmp;
 	struct buffer_head *	bh;
@@ -412,6 +446,17 @@ static int do_one_pass(journal_t *journal,
 			 * in pass REPLAY; otherwise, just skip over the
 			 * blocks it describes. */
 			if (pass != PASS_REPLAY) {
+				if (pass == PASS_SCAN &&
+				    JFS_HAS_COMPAT_FEATURE(journal,
+					    JFS_FEATURE_COMPAT_CHECKSUM)) {
+					err = calc_chksums(journal, bh,
+							   &next_log_block,
+							   &crc32_sum);
+					brelse(bh);
+					if (err)
+						goto failed;
+					continue;
+				}
 				next_log_block +=
 					count_tags(bh, journal->j_blocksize);
 				wrap(journal, next_log_block);
@@ -508,7 +553,40 @@ static int do_one_pass(journal_t *journal,
 		case JFS_COMMIT_BLOCK:
 			/* Found an expected commit block: not much to
 			 * do other than move on to the next sequence
-			 * number. */
+			 * number.  In the scan pass, check the commit
+			 * checksum first: a mismatch means the commit
+			 * record reached the disk without some of the
+			 * blocks it covers. */
+			if (pass == PASS_SCAN &&
+			    JFS_HAS_COMPAT_FEATURE(journal,
+				    JFS_FEATURE_COMPAT_CHECKSUM)) {
+				struct commit_header *cbh =
+					(struct commit_header *)bh->b_data;
+				unsigned found_chksum =
+					be32_to_cpu(cbh->h_chksum[0]);
+
+				if (cbh->h_chksum_type == JFS_CRC32_CHKSUM &&
+				    cbh->h_chksum_size ==
+						JFS_CRC32_CHKSUM_SIZE &&
+				    found_chksum != crc32_sum) {
+					/*
+					 * With asynchronous commit this is
+					 * expected after a crash: the log
+					 * ends here.  Otherwise the record
+					 * was written after its blocks, so
+					 * complain but trust it.
+					 */
+					if (JFS_HAS_INCOMPAT_FEATURE(journal,
+					    JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+						brelse(bh);
+						goto done;
+					}
+					printk(KERN_ERR "JBD: commit block "
+						"checksum mismatch, transaction "
+						"%u\n", next_commit_ID);
+				}
+				crc32_sum = ~0;
+			}
 			brelse(bh);
 			next_commit_ID++;
 			continue;
@@ -50,6 +50,7 @@ get_transaction(journal_t *journal, transaction_t *transaction)
 	transaction->t_state = T_RUNNING;
 	transaction->t_tid = journal->j_transaction_sequence++;
 	transaction->t_expires = jiffies + journal->j_commit_interval;
+	transaction->t_start_time = jiffies;
 	spin_lock_init(&transaction->t_handle_lock);
 
 	/* Set up the commit timer for the new transaction. */
@@ -1307,7 +1308,8 @@ int journal_stop(handle_t *handle)
 {
 	transaction_t *transaction = handle->h_transaction;
 	journal_t *journal = transaction->t_journal;
-	int old_handle_count, err;
+	int err;
+	pid_t pid;
 
 	J_ASSERT(transaction->t_updates > 0);
 	J_ASSERT(journal_current_handle() == handle);
@@ -1328,18 +1330,44 @@ int journal_stop(handle_t *handle)
 	/*
 	 * Implement synchronous transaction batching.  If the handle
 	 * was synchronous, don't force a commit immediately.  Let's
-	 * yield and let another thread piggyback onto this transaction.
-	 * Keep doing that while new threads continue to arrive.
-	 * It doesn't cost much - we're about to run a commit and sleep
-	 * on IO anyway.  Speeds up many-threaded, many-dir operations
-	 * by 30x or more...
+	 * yield and let other threads piggyback onto this transaction.
+	 *
+	 * How long to wait is measured rather than guessed: a commit
+	 * costs about j_average_commit_time, so holding the transaction
+	 * open until it is that old costs at most one more commit's worth
+	 * of latency, and any fsync() arriving meanwhile rides along for
+	 * free instead of paying for a commit of its own.  On a fast
+	 * device the average is small and so is the wait.
+	 *
+	 * Only bother when someone else is around to join: another
+	 * handle is open on the transaction, or the last synchronous
+	 * update came from a different process.  A lone process doing
+	 * fsync() in a loop never waits.
 	 */
-	if (handle->h_sync) {
-		do {
-			old_handle_count = transaction->t_handle_count;
+	pid = current->pid;
+	if (handle->h_sync && (journal->j_last_sync_writer != pid ||
+			       transaction->t_updates > 1)) {
+		unsigned long commit_time, trans_time;
+
+		journal->j_last_sync_writer = pid;
+
+		spin_lock(&journal->j_state_lock);
+		commit_time = journal->j_average_commit_time;
+		spin_unlock(&journal->j_state_lock);
+
+		commit_time = max_t(unsigned long, commit_time,
+				usecs_to_jiffies(journal->j_min_batch_time));
+		commit_time = min_t(unsigned long, commit_time,
+				usecs_to_jiffies(journal->j_max_batch_time));
+
+		trans_time = jiffies - transaction->t_start_time;
+		if (trans_time < commit_time) {
+			spin_lock(&journal->j_state_lock);
+			journal->j_batch_waits++;
+			spin_unlock(&journal->j_state_lock);
 			set_current_state(TASK_UNINTERRUPTIBLE);
-			schedule_timeout(1);
-		} while (old_handle_count != transaction->t_handle_count);
+			schedule_timeout(commit_time - trans_time);
+		}
 	}
 
 	current->journal_info = NULL;
@@ -1377,10 +1405,10 @@ int journal_stop(handle_t *handle)
 
 		/*
 		 * Special case: JFS_SYNC synchronous updates require us
-		 * to wait for the commit to complete.  
+		 * to wait for the commit to reach the disk.
 		 */
 		if (handle->h_sync && !(current->flags & PF_MEMALLOC))
-			err = log_wait_commit(journal, tid);
+			err = log_wait_durable(journal, tid);
 	} else {
 		spin_unlock(&transaction->t_handle_lock);
 		spin_unlock(&journal->j_state_lock);
@@ -816,8 +816,8 @@ retry:
 	 * pagevec_lookup_tagfind_get_pages_tagҳٻвҳ
 	 */
 	while (!done && (index <= end) &&
-			(nr_pages = pagevec_lookup_tag(&pvec, mapping, &index,
-			PAGECACHE_TAG_DIRTY,
+			(nr_pages = pagevec_lookup_tag_range(&pvec, mapping,
+			&index, end, PAGECACHE_TAG_DIRTY,
 			min(end - index, (pgoff_t)PAGEVEC_SIZE-1) + 1))) { /**/
 		unsigned i;
 
@@ -849,12 +849,6 @@ retry:
 				continue;
 			}
 
-			if (unlikely(is_range) && page->index > end) {
-				done = 1;
-				unlock_page(page);
-				continue;
-			}
-
 			/**
 			 * ҳPG_writeback־λʾҳѾˢµ̡
 			 * ȴIOݴϣwait_on_page_bitPG_writeback0֮ǰһֱǰ̡
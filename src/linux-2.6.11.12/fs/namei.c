@@ -432,8 +432,11 @@ static struct dentry * real_lookup(struct dentry * parent, struct qstr * name, s
 			result = dir->i_op->lookup(dir, dentry, nd);
 			if (result)
 				dput(dentry);
-			else
+			else {
 				result = dentry;
+				if (!dentry->d_inode)
+					dentry_neg_account(0);
+			}
 		}
 		up(&dir->i_sem);/* ͷ */
 		return result;
@@ -806,6 +809,8 @@ static int do_lookup(struct nameidata *nd, struct qstr *name,
 	/* Ŀ¼Ŀ¼ļϵͳҪԻеĿ¼У */
 	if (dentry->d_op && dentry->d_op->d_revalidate)
 		goto need_revalidate;
+	if (!dentry->d_inode)
+		dentry_neg_account(1);
 done:
 	path->mnt = mnt;
 	path->dentry = dentry;
@@ -1292,6 +1297,195 @@ set_it:
 	}
 }
 
+static inline int exec_permission_rcu(struct inode *inode)
+{
+#ifdef CONFIG_SECURITY
+	/* the LSM hook may look at i_security, which is not RCU-freed */
+	return -EAGAIN;
+#else
+	/* ext3 with POSIX ACLs, for one, answers from its cached ACL */
+	if (inode->i_op && inode->i_op->permission) {
+		if (!inode->i_op->permission_rcu)
+			return -EAGAIN;
+		return inode->i_op->permission_rcu(inode, MAY_EXEC);
+	}
+	return exec_permission_lite(inode, NULL);
+#endif
+}
+
+/*
+ * Try to look the whole path up without touching d_count of the dentries
+ * on the way.  Every component is found with __d_lookup_rcu() under
+ * rcu_read_lock(), and rename_lock tells us whether a d_move raced with
+ * the walk; only the final dentry and the vfsmount get a reference.
+ *
+ * On entry nd->mnt and nd->dentry hold the starting point *without*
+ * references; the caller keeps them pinned with current->fs->lock.
+ * Returns 0 with nd referenced as link_path_walk() would leave it,
+ * -ENOENT without references when a negative dentry answers the lookup,
+ * or -EAGAIN with nd untouched when the walk has to be redone the slow
+ * way: anything else that is not a plain hit in the dcache (misses,
+ * errors, symlinks, mountpoints, ->d_revalidate, a ->permission without
+ * ->permission_rcu) sends us back to link_path_walk().
+ */
+static int path_walk_rcu(const char *name, struct nameidata *nd)
+{
+	struct vfsmount *mnt = nd->mnt;
+	struct dentry *start = nd->dentry;
+	struct dentry *dentry = start;
+	unsigned int lookup_flags = nd->flags;
+	int last_type = LAST_ROOT;
+	struct inode *inode;
+	struct qstr this;
+	unsigned long seq;
+
+	if ((start->d_sb->s_type->fs_flags & (FS_INODE_RCU|FS_REVAL_DOT)) !=
+	    FS_INODE_RCU)
+		return -EAGAIN;
+
+	seq = read_seqbegin(&rename_lock);
+	rcu_read_lock();
+
+	while (*name=='/')
+		name++;
+	if (!*name)
+		goto found;
+
+	for(;;) {
+		struct dentry *next;
+		unsigned long hash;
+		unsigned int c;
+		int last = 0;
+
+		inode = dentry->d_inode;
+		if (!inode || exec_permission_rcu(inode))
+			goto fail;
+
+		this.name = name;
+		c = *(const unsigned char *)name;
+
+		hash = init_name_hash();
+		do {
+			name++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)name;
+		} while (c && (c != '/'));
+		this.len = name - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		if (!c)
+			last = 1;
+		else {
+			while (*++name == '/');
+			if (!*name) {
+				last = 1;
+				lookup_flags |= LOOKUP_FOLLOW | LOOKUP_DIRECTORY;
+			}
+		}
+
+		if (last && (lookup_flags & LOOKUP_PARENT)) {
+			last_type = LAST_NORM;
+			if (this.name[0] == '.' && this.len == 1)
+				last_type = LAST_DOT;
+			else if (this.name[0] == '.' && this.len == 2 &&
+				 this.name[1] == '.')
+				last_type = LAST_DOTDOT;
+			goto found;
+		}
+
+		if (this.name[0] == '.') switch (this.len) {
+			default:
+				break;
+			case 2:
+				if (this.name[1] != '.')
+					break;
+				if (dentry != current->fs->root ||
+				    mnt != current->fs->rootmnt) {
+					/* going to the covered mount needs refs */
+					if (dentry == mnt->mnt_root)
+						goto fail;
+					dentry = dentry->d_parent;
+					if (d_mountpoint(dentry))
+						goto fail;
+				}
+				/* fallthrough */
+			case 1:
+				if (last)
+					goto found;
+				continue;
+		}
+
+		if (dentry->d_op &&
+		    (dentry->d_op->d_hash || dentry->d_op->d_compare))
+			goto fail;
+		next = __d_lookup_rcu(dentry, &this);
+		if (!next || d_mountpoint(next))
+			goto fail;
+		if (next->d_op && next->d_op->d_revalidate)
+			goto fail;
+		inode = next->d_inode;
+		if (!inode)
+			goto negative;
+		if (!inode->i_op)
+			goto fail;
+		if (inode->i_op->follow_link &&
+		    (!last || (lookup_flags & LOOKUP_FOLLOW)))
+			goto fail;
+		dentry = next;
+		if (last) {
+			if ((lookup_flags & LOOKUP_DIRECTORY) &&
+			    !inode->i_op->lookup)
+				goto fail;
+			goto found;
+		}
+		if (!inode->i_op->lookup)
+			goto fail;
+	}
+
+found:
+	/*
+	 * A hashed dentry cannot be on its way to d_free(), so d_lock is
+	 * enough to pin it.  The starting point and the mount root are
+	 * pinned by our caller and the vfsmount even while unhashed.  Any
+	 * rename that slipped in after the check below is ordered after
+	 * this lookup.
+	 */
+	spin_lock(&dentry->d_lock);
+	if (read_seqretry(&rename_lock, seq) ||
+	    (d_unhashed(dentry) && dentry != start &&
+	     dentry != mnt->mnt_root)) {
+		spin_unlock(&dentry->d_lock);
+		goto fail;
+	}
+	atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
+	rcu_read_unlock();
+
+	nd->mnt = mntget(mnt);
+	nd->dentry = dentry;
+	if (last_type != LAST_ROOT) {
+		nd->last = this;
+		nd->last_type = last_type;
+	}
+	nd->flags &= ~LOOKUP_CONTINUE;
+	return 0;
+
+negative:
+	/*
+	 * A hashed negative dentry: link_path_walk() would fail with
+	 * -ENOENT here too, and nd is left as it would be after an error.
+	 */
+	rcu_read_unlock();
+	if (read_seqretry(&rename_lock, seq))
+		return -EAGAIN;
+	dentry_neg_account(1);
+	return -ENOENT;
+
+fail:
+	rcu_read_unlock();
+	return -EAGAIN;
+}
+
 /**
  * ·
  *		name:Ҫҵļ·
@@ -1325,19 +1519,33 @@ int fastcall path_lookup(const char *name, unsigned int flags, struct nameidata
 		/**
 		 * ͨcurrent->fs->rootmntcurrent->fs->rootøĿ¼
 		 */		
-		nd->mnt = mntget(current->fs->rootmnt);
-		nd->dentry = dget(current->fs->root);
+		nd->mnt = current->fs->rootmnt;
+		nd->dentry = current->fs->root;
 	} else {
 		/**
 		 * ӵǰĿ¼ʼңcurrent->fs->pwdmntcurrent->fs->pwdõǰ·
 		 */
-		nd->mnt = mntget(current->fs->pwdmnt);
-		nd->dentry = dget(current->fs->pwd);
+		nd->mnt = current->fs->pwdmnt;
+		nd->dentry = current->fs->pwd;
+	}
+	/*
+	 * fs->lock keeps the starting point alive while path_walk_rcu()
+	 * walks without references; fall back to the refcounted walk if it
+	 * cannot finish on its own.
+	 */
+	retval = path_walk_rcu(name, nd);
+	if (retval == -EAGAIN) {
+		mntget(nd->mnt);
+		dget(nd->dentry);
 	}
 	/**
 	 * ʱѾ˳ʼĿ¼ãͷˡ
 	 */
 	read_unlock(&current->fs->lock);
+	if (retval == -ENOENT)
+		return retval;
+	if (!retval)
+		goto out;
 	/**
 	 * ǰ̵ķӲҼгʼ
 	 */
@@ -1346,6 +1554,7 @@ int fastcall path_lookup(const char *name, unsigned int flags, struct nameidata
 	 * link_path_walkִ·ҡ
 	 */
 	retval = link_path_walk(name, nd);
+out:
 	if (unlikely(current->audit_context
 		     && nd && nd->dentry && nd->dentry->d_inode))
 		audit_inode(name,
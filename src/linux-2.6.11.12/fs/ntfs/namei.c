@@ -310,12 +310,11 @@ handle_name:
 	spin_lock(&dcache_lock);
 	if (list_empty(&dent_inode->i_dentry)) {
 		/*
-		 * Directory without a 'disconnected' dentry; we need to do
-		 * d_instantiate() by hand because it takes dcache_lock which
-		 * we already hold.
+		 * Directory without a 'disconnected' dentry; we need to use
+		 * __d_instantiate() because d_instantiate() takes dcache_lock
+		 * which we already hold.
 		 */
-		list_add(&real_dent->d_alias, &dent_inode->i_dentry);
-		real_dent->d_inode = dent_inode;
+		__d_instantiate(real_dent, dent_inode);
 		spin_unlock(&dcache_lock);
 		security_d_instantiate(real_dent, dent_inode);
 		ntfs_debug("Done.  (Already had negative directory dentry.)");
@@ -843,9 +843,9 @@ struct file *dentry_open(struct dentry *dentry, struct vfsmount *mnt, int flags)
 	 */
 	f->f_op = fops_get(inode->i_fop);
 	/**
-	 * file_moveļ뵽ļϵͳs_filesֶָĴļ
+	 * file_sb_list_addļ뵽ļϵͳs_filesֶָĴļ
 	 */
-	file_move(f, &inode->i_sb->s_files);
+	file_sb_list_add(f, inode->i_sb);
 
 	/**
 	 * ļϵͳopen壬һûж塣
@@ -988,7 +988,7 @@ void fastcall fd_install(unsigned int fd, struct file * file)
 	spin_lock(&files->file_lock);
 	if (unlikely(files->fd[fd] != NULL))
 		BUG();
-	files->fd[fd] = file;
+	rcu_assign_pointer(files->fd[fd], file);
 	spin_unlock(&files->file_lock);
 }
 
@@ -512,15 +512,15 @@ static int proc_register(struct proc_dir_entry * dir, struct proc_dir_entry * dp
  */
 static void proc_kill_inodes(struct proc_dir_entry *de)
 {
-	struct list_head *p;
 	struct super_block *sb = proc_mnt->mnt_sb;
+	struct file *filp;
+	int cpu;
 
 	/*
 	 * Actually it's a partial revoke().
 	 */
-	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file * filp = list_entry(p, struct file, f_list);
+	sb_files_lock_all();
+	sb_files_for_each(sb, cpu, filp) {
 		struct dentry * dentry = filp->f_dentry;
 		struct inode * inode;
 		struct file_operations *fops;
@@ -534,7 +534,7 @@ static void proc_kill_inodes(struct proc_dir_entry *de)
 		filp->f_op = NULL;
 		fops_put(fops);
 	}
-	file_list_unlock();
+	sb_files_unlock_all();
 }
 
 static struct proc_dir_entry *proc_create(struct proc_dir_entry **parent,
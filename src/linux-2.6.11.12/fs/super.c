@@ -37,6 +37,7 @@
 #include <linux/writeback.h>		/* for the emergency remount stuff */
 #include <linux/idr.h>
 #include <linux/kobject.h>
+#include <linux/percpu.h>
 #include <asm/uaccess.h>
 
 
@@ -59,17 +60,32 @@ static struct super_block *alloc_super(void)
 	static struct super_operations default_op;
 
 	if (s) {
+		int cpu;
+
 		memset(s, 0, sizeof(struct super_block));
+		s->s_files = alloc_percpu(struct list_head);
+		if (!s->s_files) {
+			kfree(s);
+			s = NULL;
+			goto out;
+		}
 		if (security_sb_alloc(s)) {
+			free_percpu(s->s_files);
 			kfree(s);
 			s = NULL;
 			goto out;
 		}
+		for_each_cpu(cpu)
+			INIT_LIST_HEAD(per_cpu_ptr(s->s_files, cpu));
 		INIT_LIST_HEAD(&s->s_dirty);
 		INIT_LIST_HEAD(&s->s_io);
-		INIT_LIST_HEAD(&s->s_files);
 		INIT_LIST_HEAD(&s->s_instances);
 		INIT_HLIST_HEAD(&s->s_anon);
+		spin_lock_init(&s->s_dentry_lru_lock);
+		INIT_LIST_HEAD(&s->s_dentry_lru);
+		INIT_LIST_HEAD(&s->s_lru_sbs);
+		INIT_LIST_HEAD(&s->s_dentry_neg);
+		INIT_LIST_HEAD(&s->s_neg_sbs);
 		INIT_LIST_HEAD(&s->s_inodes);
 		init_rwsem(&s->s_umount);
 		sema_init(&s->s_lock, 1);
@@ -100,6 +116,7 @@ out:
 static inline void destroy_super(struct super_block *s)
 {
 	security_sb_free(s);
+	free_percpu(s->s_files);
 	kfree(s);
 }
 
@@ -516,13 +533,14 @@ out:
 static void mark_files_ro(struct super_block *sb)
 {
 	struct file *f;
+	int cpu;
 
-	file_list_lock();
-	list_for_each_entry(f, &sb->s_files, f_list) {
+	sb_files_lock_all();
+	sb_files_for_each(sb, cpu, f) {
 		if (S_ISREG(f->f_dentry->d_inode->i_mode) && file_count(f))
 			f->f_mode &= ~FMODE_WRITE;
 	}
-	file_list_unlock();
+	sb_files_unlock_all();
 }
 
 /**
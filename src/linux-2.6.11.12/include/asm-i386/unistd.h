@@ -294,12 +294,14 @@
 #define __NR_add_key		286
 #define __NR_request_key	287
 #define __NR_keyctl		288
+#define __NR_ioprio_set		289
+#define __NR_ioprio_get		290
 
 /*
  * sys_call_tableĴСʾԿʵֵϵͳľ̬ƣʾʵʵֵϵͳø
  * ɱеһҲ԰sys_ni_syscall()ĵַ"δʵ"ϵͳõķ
  */
-#define NR_syscalls 289
+#define NR_syscalls 291
 
 /*
  * user-visible error numbers are in the range -1 - -128: see
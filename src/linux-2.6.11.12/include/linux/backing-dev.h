@@ -27,6 +27,21 @@ enum bdi_state {
 
 typedef int (congested_fn)(void *, int);
 
+/*
+ * Readahead events, counted per device for /sys/block/<dev>/queue/ra_stats.
+ * Bumped once per readahead decision rather than per page, and not exact
+ * on SMP.
+ */
+enum ra_stat_item {
+	RA_STAT_SYNC,		/* readahead on a cache miss */
+	RA_STAT_ASYNC,		/* readahead on hitting a PG_readahead page */
+	RA_STAT_CONTEXT,	/* stream found from pagecache history */
+	RA_STAT_RANDOM,		/* miss read as is, not part of a stream */
+	RA_STAT_THRASH,		/* readahead pages evicted before use */
+	RA_STAT_PAGES,		/* pages submitted for readahead */
+	RA_STAT_MAX,
+};
+
 /**
  * ߵڿ豸йݽṹ
  * ͨǶڿ豸
@@ -40,6 +55,7 @@ struct backing_dev_info {
 	void *congested_data;	/* Pointer to aux data for congested func */
 	void (*unplug_io_fn)(struct backing_dev_info *, struct page *);
 	void *unplug_io_data;
+	unsigned long ra_stat[RA_STAT_MAX];
 };
 
 extern struct backing_dev_info default_backing_dev_info;
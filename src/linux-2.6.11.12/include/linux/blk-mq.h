@@ -0,0 +1,129 @@
+#ifndef _LINUX_BLK_MQ_H
+#define _LINUX_BLK_MQ_H
+
+/*
+ * Multi-queue block layer.
+ *
+ * For devices fast enough that queue_lock and the elevator are the
+ * bottleneck.  Each cpu submits into its own software queue (blk_mq_ctx),
+ * with no lock shared with other cpus; every software queue is mapped onto
+ * one of the driver's hardware dispatch queues (blk_mq_hw_ctx), which
+ * hands requests straight to ->queue_rq() in submission order.  Requests
+ * are preallocated per hardware queue and identified by a tag, so that
+ * allocation is one bit in a bitmap rather than a mempool and a lock.
+ *
+ * There is no elevator: bios only merge into requests still on the
+ * submitting task's plug (see blk_start_plug()).
+ */
+
+#include <linux/blkdev.h>
+#include <linux/workqueue.h>
+#include <linux/cpumask.h>
+
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+	unsigned long		*bitmap;	/* tags in use */
+	unsigned int		*hint;		/* per-cpu: where to look next */
+	struct request		**rqs;		/* preallocated, by tag */
+	wait_queue_head_t	wait;		/* for a tag to be freed */
+};
+
+struct blk_mq_hw_ctx {
+	spinlock_t		lock;		/* protects dispatch */
+	struct list_head	dispatch;	/* handed back busy by ->queue_rq */
+	unsigned long		state;		/* BLK_MQ_S_* */
+	unsigned long		flags;		/* BLK_MQ_F_*, from blk_mq_reg */
+
+	struct work_struct	run_work;
+	cpumask_t		cpumask;	/* cpus mapped onto us */
+	unsigned int		queue_num;
+	void			*driver_data;	/* set by ->init_hctx */
+
+	request_queue_t		*queue;
+	struct blk_mq_tags	*tags;
+
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;	/* ctxs with requests queued */
+};
+
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* our bit in hctx->ctx_map */
+	struct blk_mq_hw_ctx	*hctx;
+} ____cacheline_aligned_in_smp;
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(request_queue_t *, int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+
+struct blk_mq_ops {
+	/*
+	 * Start a request.  Called without locks held but possibly with
+	 * preemption disabled: must not sleep unless BLK_MQ_F_SHOULD_SLEEP.
+	 */
+	queue_rq_fn		*queue_rq;
+	/*
+	 * Which hardware queue serves a cpu; blk_mq_map_queue() spreads
+	 * cpus round-robin.
+	 */
+	map_queue_fn		*map_queue;
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+};
+
+/* ->queue_rq() return values */
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* started, will be completed */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* out of resources, try later */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* fail it with -EIO */
+};
+
+/* blk_mq_hw_ctx->flags */
+#define BLK_MQ_F_SHOULD_SLEEP	(1UL << 0)	/* ->queue_rq may block */
+
+/* blk_mq_hw_ctx->state */
+#define BLK_MQ_S_STOPPED	0
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* tags per hardware queue */
+	unsigned int		cmd_size;	/* driver bytes after each request */
+	unsigned long		flags;		/* BLK_MQ_F_* */
+};
+
+extern request_queue_t *blk_mq_init_queue(struct blk_mq_reg *, void *);
+extern void blk_mq_free_queue(request_queue_t *);
+extern struct blk_mq_hw_ctx *blk_mq_map_queue(request_queue_t *, int);
+
+extern void blk_mq_insert_requests(request_queue_t *, struct list_head *);
+extern void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, int);
+extern void blk_mq_run_queues(request_queue_t *, int);
+extern void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+extern void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *);
+extern void blk_mq_start_stopped_hw_queues(request_queue_t *);
+
+extern void blk_mq_end_io(struct request *, int);
+
+/*
+ * Driver data allocated behind each request, cmd_size bytes of it.
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *) (rq + 1);
+}
+
+static inline struct request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return ((struct request *) pdu) - 1;
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#endif /* _LINUX_BLK_MQ_H */
@@ -20,6 +20,10 @@
 struct request_queue;
 typedef struct request_queue request_queue_t;
 struct elevator_queue;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
+struct blk_trace;
 /**
  * IOʹõIO㷨еelevatorָ
  */
@@ -249,6 +253,10 @@ struct request {
 	 * еڴع
 	 */
 	struct request_list *rl;
+	/*
+	 * blk-mq: the software queue the request was allocated on.
+	 */
+	struct blk_mq_ctx *mq_ctx;
 
 	/**
 	 * ȴݴֹɱ
@@ -689,6 +697,18 @@ struct request_queue
 	 */
 	struct blk_queue_tag	*queue_tags;
 
+	/*
+	 * Set up by blk_mq_init_queue(); NULL for queues whose requests go
+	 * through queue_lock and the elevator.
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx	*queue_ctx;	/* per-cpu software queues */
+	unsigned int		nr_hw_queues;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+
+	/* set up by BLKTRACESETUP, see include/linux/blktrace.h */
+	struct blk_trace	*blk_trace;
+
 	/**
 	 * еü
 	 */
@@ -898,6 +918,42 @@ static inline void blk_run_address_space(struct address_space *mapping)
 		blk_run_backing_dev(mapping->backing_dev_info, NULL);
 }
 
+/*
+ * Per-task plugging.  A task about to submit a batch of I/O puts a
+ * blk_plug on its own stack and hangs it off current->plug; requests
+ * built from its bios then collect on the plug instead of going to their
+ * queues one at a time, and can still take further bios as merges.
+ * They are handed to the queues by blk_finish_plug(), when the plug grows
+ * to BLK_MAX_PLUG_COUNT requests, or when the task goes to sleep in
+ * schedule().  Without a plug, __make_request() starts the queue at once.
+ *
+ *	struct blk_plug plug;
+ *
+ *	blk_start_plug(&plug);
+ *	... submit_bio() ...
+ *	blk_finish_plug(&plug);
+ */
+struct blk_plug {
+	struct list_head list;		/* requests, linked through queuelist */
+	unsigned int count;		/* entries on list */
+};
+#define BLK_MAX_PLUG_COUNT	16
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug_list(struct blk_plug *);
+extern int blk_attempt_plug_merge(struct blk_plug *, request_queue_t *,
+				  struct bio *);
+extern void blk_queue_merge_defaults(request_queue_t *);
+
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug && !list_empty(&plug->list))
+		blk_flush_plug_list(plug);
+}
+
 /*
  * end_request() and friends. Must be called with the request queue spinlock
  * acquired. All functions called within end_request() _must_be_ atomic.
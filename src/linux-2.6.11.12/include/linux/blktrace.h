@@ -0,0 +1,197 @@
+#ifndef _LINUX_BLKTRACE_H
+#define _LINUX_BLKTRACE_H
+
+/*
+ * Block I/O tracing.
+ *
+ * BLKTRACESETUP on a block device gives its queue a struct blk_trace and
+ * a debugfs directory, block/<name>/, with one file per cpu, trace<cpu>,
+ * from which the fixed size struct blk_io_trace records logged on that
+ * cpu are read.  Events are logged between BLKTRACESTART and BLKTRACESTOP;
+ * BLKTRACETEARDOWN removes it all.  See Documentation/block/blktrace.txt.
+ */
+
+#include <linux/types.h>
+
+/*
+ * Trace categories
+ */
+enum blktrace_cat {
+	BLK_TC_READ	= 1 << 0,	/* reads */
+	BLK_TC_WRITE	= 1 << 1,	/* writes */
+	BLK_TC_BARRIER	= 1 << 2,	/* barrier */
+	BLK_TC_SYNC	= 1 << 3,	/* sync */
+	BLK_TC_QUEUE	= 1 << 4,	/* queueing/merging */
+	BLK_TC_REQUEUE	= 1 << 5,	/* requeueing */
+	BLK_TC_ISSUE	= 1 << 6,	/* issue */
+	BLK_TC_COMPLETE	= 1 << 7,	/* completions */
+	BLK_TC_FS	= 1 << 8,	/* fs requests */
+	BLK_TC_PC	= 1 << 9,	/* pc requests */
+
+	BLK_TC_END	= 1 << 15,	/* only 16 bits, reminder */
+};
+
+#define BLK_TC_SHIFT		(16)
+#define BLK_TC_ACT(act)		((act) << BLK_TC_SHIFT)
+
+/*
+ * Basic trace actions
+ */
+enum blktrace_act {
+	__BLK_TA_QUEUE = 1,		/* queued */
+	__BLK_TA_BACKMERGE,		/* back merged to existing rq */
+	__BLK_TA_FRONTMERGE,		/* front merge to existing rq */
+	__BLK_TA_GETRQ,			/* allocated new request */
+	__BLK_TA_SLEEPRQ,		/* sleeping on rq allocation */
+	__BLK_TA_REQUEUE,		/* request requeued */
+	__BLK_TA_ISSUE,			/* sent to driver */
+	__BLK_TA_COMPLETE,		/* completed by driver */
+	__BLK_TA_PLUG,			/* queue was plugged */
+	__BLK_TA_UNPLUG_IO,		/* queue was unplugged by io */
+	__BLK_TA_UNPLUG_TIMER,		/* queue was unplugged by timer */
+	__BLK_TA_INSERT,		/* insert request */
+};
+
+/*
+ * Trace actions in full.  Additionally, read or write is masked
+ */
+#define BLK_TA_QUEUE		(__BLK_TA_QUEUE | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_BACKMERGE	(__BLK_TA_BACKMERGE | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_FRONTMERGE	(__BLK_TA_FRONTMERGE | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_GETRQ		(__BLK_TA_GETRQ | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_SLEEPRQ		(__BLK_TA_SLEEPRQ | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_REQUEUE		(__BLK_TA_REQUEUE | BLK_TC_ACT(BLK_TC_REQUEUE))
+#define BLK_TA_ISSUE		(__BLK_TA_ISSUE | BLK_TC_ACT(BLK_TC_ISSUE))
+#define BLK_TA_COMPLETE		(__BLK_TA_COMPLETE | BLK_TC_ACT(BLK_TC_COMPLETE))
+#define BLK_TA_PLUG		(__BLK_TA_PLUG | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_UNPLUG_IO	(__BLK_TA_UNPLUG_IO | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_UNPLUG_TIMER	(__BLK_TA_UNPLUG_TIMER | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_INSERT		(__BLK_TA_INSERT | BLK_TC_ACT(BLK_TC_QUEUE))
+
+#define BLK_IO_TRACE_MAGIC	0x65617400
+#define BLK_IO_TRACE_VERSION	0x07
+
+/*
+ * The trace itself
+ */
+struct blk_io_trace {
+	__u32 magic;		/* MAGIC << 8 | version */
+	__u32 sequence;		/* event number, per cpu */
+	__u64 time;		/* in nanoseconds */
+	__u64 sector;		/* disk offset */
+	__u32 bytes;		/* transfer length */
+	__u32 action;		/* what happened */
+	__u32 pid;		/* who did it */
+	__u32 device;		/* device number, major << 20 | minor */
+	__u32 cpu;		/* on what cpu did it happen */
+	__u16 error;		/* completion error */
+	__u16 pdu_len;		/* length of data after this trace */
+};
+
+/*
+ * User setup structure passed with BLKTRACESETUP
+ */
+struct blk_user_trace_setup {
+	char name[32];			/* output */
+	__u16 act_mask;			/* input */
+	__u32 buf_size;			/* input */
+	__u32 buf_nr;			/* input */
+	__u64 start_lba;
+	__u64 end_lba;
+	__u32 pid;
+};
+
+#ifdef __KERNEL__
+#include <linux/blkdev.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+enum {
+	Blktrace_setup = 1,
+	Blktrace_running,
+	Blktrace_stopped,
+};
+
+/*
+ * Records logged on one cpu, in a ring of mask + 1 of them.  head and
+ * tail only ever grow; a full ring drops new records rather than
+ * overwriting ones not yet read.
+ */
+struct blk_trace_buf {
+	spinlock_t		lock;
+	struct blk_io_trace	*recs;
+	unsigned int		mask;
+	unsigned int		head;
+	unsigned int		tail;
+	__u32			sequence;
+	unsigned long		dropped;
+	wait_queue_head_t	wait;
+	struct blk_trace	*bt;
+	struct dentry		*dentry;
+};
+
+struct blk_trace {
+	int			trace_state;
+	struct blk_trace_buf	*bufs;		/* per-cpu */
+	u16			act_mask;
+	u64			start_lba;
+	u64			end_lba;
+	u32			pid;
+	u32			dev;
+	atomic_t		refcnt;		/* ioctl side, and open files */
+	struct dentry		*dir;
+	struct dentry		*dropped_file;
+};
+
+#ifdef CONFIG_BLK_DEV_IO_TRACE
+extern int blk_trace_ioctl(struct block_device *, unsigned, char __user *);
+extern void blk_trace_shutdown(request_queue_t *);
+extern void __blk_add_trace(request_queue_t *, sector_t, int, u32, int);
+extern void __blk_add_trace_rq(request_queue_t *, struct request *, int,
+			       u32, int);
+extern void __blk_add_trace_bio(request_queue_t *, struct bio *, u32);
+
+/*
+ * The hooks only test q->blk_trace inline; everything else is out of
+ * line, so a queue that is not being traced pays one load and a branch.
+ */
+static inline void blk_add_trace_rq(request_queue_t *q, struct request *rq,
+				    u32 what)
+{
+	if (unlikely(q->blk_trace))
+		__blk_add_trace_rq(q, rq, rq->hard_nr_sectors << 9, what, 0);
+}
+
+static inline void blk_add_trace_complete(request_queue_t *q,
+					  struct request *rq, int bytes,
+					  int error)
+{
+	if (unlikely(q->blk_trace))
+		__blk_add_trace_rq(q, rq, bytes, BLK_TA_COMPLETE, error);
+}
+
+static inline void blk_add_trace_bio(request_queue_t *q, struct bio *bio,
+				     u32 what)
+{
+	if (unlikely(q->blk_trace))
+		__blk_add_trace_bio(q, bio, what);
+}
+
+/* for events about the queue rather than one request: plugging */
+static inline void blk_add_trace_generic(request_queue_t *q, u32 what)
+{
+	if (unlikely(q->blk_trace))
+		__blk_add_trace(q, 0, 0, what, 0);
+}
+#else
+#define blk_trace_ioctl(bdev, cmd, arg)			(-ENOTTY)
+#define blk_trace_shutdown(q)				do { } while (0)
+#define blk_add_trace_rq(q, rq, what)			do { } while (0)
+#define blk_add_trace_complete(q, rq, bytes, error)	do { } while (0)
+#define blk_add_trace_bio(q, bio, what)			do { } while (0)
+#define blk_add_trace_generic(q, what)			do { } while (0)
+#endif /* CONFIG_BLK_DEV_IO_TRACE */
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_BLKTRACE_H */
@@ -138,6 +138,9 @@ static inline int crypto_alg_available(const char *name, u32 flags)
  */
 struct crypto_tfm;
 
+/* writes the IV for unit n of a crypto_cipher_*_units() call into iv */
+typedef int (crypto_ivfn_t)(void *data, u8 *iv, unsigned int n);
+
 struct cipher_tfm {
 	void *cit_iv;
 	unsigned int cit_ivsize;
@@ -160,6 +163,16 @@ struct cipher_tfm {
 			   struct scatterlist *dst,
 			   struct scatterlist *src,
 			   unsigned int nbytes, u8 *iv);
+	int (*cit_encrypt_units)(struct crypto_tfm *tfm,
+	                         struct scatterlist *dst,
+	                         struct scatterlist *src,
+	                         unsigned int nbytes, unsigned int unit,
+	                         u8 *iv, crypto_ivfn_t *ivfn, void *data);
+	int (*cit_decrypt_units)(struct crypto_tfm *tfm,
+	                         struct scatterlist *dst,
+	                         struct scatterlist *src,
+	                         unsigned int nbytes, unsigned int unit,
+	                         u8 *iv, crypto_ivfn_t *ivfn, void *data);
 	void (*cit_xor_block)(u8 *dst, const u8 *src);
 };
 
@@ -351,6 +364,38 @@ static inline int crypto_cipher_decrypt_iv(struct crypto_tfm *tfm,
 	return tfm->crt_cipher.cit_decrypt_iv(tfm, dst, src, nbytes, iv);
 }
 
+/*
+ * Encrypt or decrypt nbytes as separate units of 'unit' bytes, each
+ * chained from its own IV: ivfn(data, iv, n) is called to fill in iv
+ * before unit n.  This does in one pass what would otherwise take a
+ * crypto_cipher_*_iv() call per unit, e.g. a whole bio of disk sectors.
+ */
+static inline int crypto_cipher_encrypt_units(struct crypto_tfm *tfm,
+                                              struct scatterlist *dst,
+                                              struct scatterlist *src,
+                                              unsigned int nbytes,
+                                              unsigned int unit, u8 *iv,
+                                              crypto_ivfn_t *ivfn, void *data)
+{
+	BUG_ON(crypto_tfm_alg_type(tfm) != CRYPTO_ALG_TYPE_CIPHER);
+	BUG_ON(tfm->crt_cipher.cit_mode == CRYPTO_TFM_MODE_ECB);
+	return tfm->crt_cipher.cit_encrypt_units(tfm, dst, src, nbytes, unit,
+	                                         iv, ivfn, data);
+}
+
+static inline int crypto_cipher_decrypt_units(struct crypto_tfm *tfm,
+                                              struct scatterlist *dst,
+                                              struct scatterlist *src,
+                                              unsigned int nbytes,
+                                              unsigned int unit, u8 *iv,
+                                              crypto_ivfn_t *ivfn, void *data)
+{
+	BUG_ON(crypto_tfm_alg_type(tfm) != CRYPTO_ALG_TYPE_CIPHER);
+	BUG_ON(tfm->crt_cipher.cit_mode == CRYPTO_TFM_MODE_ECB);
+	return tfm->crt_cipher.cit_decrypt_units(tfm, dst, src, nbytes, unit,
+	                                         iv, ivfn, data);
+}
+
 static inline void crypto_cipher_set_iv(struct crypto_tfm *tfm,
                                         const u8 *src, unsigned int len)
 {
@@ -8,6 +8,7 @@
 #include <linux/spinlock.h>
 #include <linux/cache.h>
 #include <linux/rcupdate.h>
+#include <linux/seqlock.h>
 #include <asm/bug.h>
 
 struct nameidata;
@@ -42,7 +43,8 @@ struct dentry_stat_t {
 	int nr_unused;
 	int age_limit;          /* age in seconds */
 	int want_pages;         /* pages requested by system */
-	int dummy[2];
+	int nr_negative;	/* unused negative dentries */
+	int dummy;
 };
 extern struct dentry_stat_t dentry_stat;
 
@@ -243,6 +245,7 @@ d_iput:		no		no		no       yes
 #define DCACHE_UNHASHED		0x0010	
 
 extern spinlock_t dcache_lock;
+extern seqlock_t rename_lock;
 
 /**
  * d_drop - drop a dentry
@@ -261,13 +264,7 @@ extern spinlock_t dcache_lock;
  * timeouts or autofs deletes).
  */
 
-static inline void __d_drop(struct dentry *dentry)
-{
-	if (!(dentry->d_flags & DCACHE_UNHASHED)) {
-		dentry->d_flags |= DCACHE_UNHASHED;
-		hlist_del_rcu(&dentry->d_hash);
-	}
-}
+extern void __d_drop(struct dentry *dentry);
 
 static inline void d_drop(struct dentry *dentry)
 {
@@ -285,6 +282,7 @@ static inline int dname_external(struct dentry *dentry)
  * These are the low-level FS interfaces to the dcache..
  */
 extern void d_instantiate(struct dentry *, struct inode *);
+extern void __d_instantiate(struct dentry *, struct inode *);
 extern struct dentry * d_instantiate_unique(struct dentry *, struct inode *);
 extern void d_delete(struct dentry *);
 
@@ -352,6 +350,7 @@ extern void d_move(struct dentry *, struct dentry *);
 /* appendix may either be NULL or be used for transname suffixes */
 extern struct dentry * d_lookup(struct dentry *, struct qstr *);
 extern struct dentry * __d_lookup(struct dentry *, struct qstr *);
+extern struct dentry * __d_lookup_rcu(struct dentry *, struct qstr *);
 
 /* validate "insecure" dentry pointer */
 extern int d_validate(struct dentry *, struct dentry *);
@@ -417,6 +416,17 @@ extern struct vfsmount *lookup_mnt(struct vfsmount *, struct dentry *);
 extern struct dentry *lookup_create(struct nameidata *nd, int is_dir);
 
 extern int sysctl_vfs_cache_pressure;
+extern int sysctl_dentry_negative_max;
+extern int sysctl_dentry_negative_pressure;
+
+/* lookups answered by a negative dentry, and lookups that created one */
+extern void dentry_neg_account(int hit);
+struct ctl_table;
+struct file;
+extern int proc_dentry_neg_lookups(struct ctl_table *, int, struct file *,
+				   void __user *, size_t *, loff_t *);
+extern int proc_dentry_state(struct ctl_table *, int, struct file *,
+			     void __user *, size_t *, loff_t *);
 
 #endif /* __KERNEL__ */
 
@@ -0,0 +1,118 @@
+/*
+ *  linux/include/linux/ext3_extents.h
+ *
+ * On-disk format and interfaces of extent-mapped ext3 inodes.
+ *
+ * An inode with EXT3_EXTENTS_FL set does not keep the classic
+ * direct/indirect block pointers in i_data.  Instead i_data holds the
+ * root of a tree, indexed by logical block number, whose leaves are
+ * extents: runs of logically and physically contiguous blocks.  A
+ * large sequentially written file needs a handful of extents where the
+ * indirect scheme needs one pointer per block.
+ */
+
+#ifndef _LINUX_EXT3_EXTENTS_H
+#define _LINUX_EXT3_EXTENTS_H
+
+#include <linux/ext3_jbd.h>
+
+/*
+ * Every tree node, the root in i_data included, starts with this header.
+ */
+struct ext3_extent_header {
+	__le16	eh_magic;	/* EXT3_EXT_MAGIC */
+	__le16	eh_entries;	/* number of valid entries */
+	__le16	eh_max;		/* capacity of the node in entries */
+	__le16	eh_depth;	/* 0 for a leaf, levels of index below otherwise */
+	__le32	eh_generation;	/* generation of the tree */
+};
+
+#define EXT3_EXT_MAGIC		0xf30a
+
+/*
+ * Leaf entry: ee_len blocks starting at logical block ee_block are
+ * stored at physical block ee_start.
+ */
+struct ext3_extent {
+	__le32	ee_block;	/* first logical block covered */
+	__le16	ee_len;		/* number of blocks covered */
+	__le16	ee_start_hi;	/* high 16 bits of physical block, always 0 */
+	__le32	ee_start;	/* low 32 bits of physical block */
+};
+
+/*
+ * Index entry: the subtree at physical block ei_leaf maps logical blocks
+ * from ei_block up to the key of the next index entry.
+ */
+struct ext3_extent_idx {
+	__le32	ei_block;	/* first logical block covered */
+	__le32	ei_leaf;	/* low 32 bits of the next level's block */
+	__le16	ei_leaf_hi;	/* high 16 bits of it, always 0 */
+	__u16	ei_unused;
+};
+
+/* longest extent we build; keeps the top bit of ee_len free */
+#define EXT3_EXT_MAX_LEN	(1UL << 15)
+
+/* no block is mapped at or after this one */
+#define EXT_MAX_BLOCK		0xffffffffUL
+
+/*
+ * One level of a lookup: the node and the entry within it leading to the
+ * block looked for.  p_bh is NULL for the root, which lives in the inode.
+ */
+struct ext3_ext_path {
+	__u16				p_depth;
+	int				p_entries;	/* truncate: entries seen going down */
+	struct ext3_extent		*p_ext;
+	struct ext3_extent_idx		*p_idx;
+	struct ext3_extent_header	*p_hdr;
+	struct buffer_head		*p_bh;
+};
+
+#define EXT_FIRST_EXTENT(__hdr__) \
+	((struct ext3_extent *) (((char *) (__hdr__)) +		\
+				 sizeof(struct ext3_extent_header)))
+#define EXT_FIRST_INDEX(__hdr__) \
+	((struct ext3_extent_idx *) (((char *) (__hdr__)) +	\
+				     sizeof(struct ext3_extent_header)))
+#define EXT_LAST_EXTENT(__hdr__) \
+	(EXT_FIRST_EXTENT((__hdr__)) + le16_to_cpu((__hdr__)->eh_entries) - 1)
+#define EXT_LAST_INDEX(__hdr__) \
+	(EXT_FIRST_INDEX((__hdr__)) + le16_to_cpu((__hdr__)->eh_entries) - 1)
+#define EXT_MAX_EXTENT(__hdr__) \
+	(EXT_FIRST_EXTENT((__hdr__)) + le16_to_cpu((__hdr__)->eh_max) - 1)
+#define EXT_MAX_INDEX(__hdr__) \
+	(EXT_FIRST_INDEX((__hdr__)) + le16_to_cpu((__hdr__)->eh_max) - 1)
+#define EXT_HAS_FREE_INDEX(__path__) \
+	(le16_to_cpu((__path__)->p_hdr->eh_entries) < \
+	 le16_to_cpu((__path__)->p_hdr->eh_max))
+
+static inline struct ext3_extent_header *ext_inode_hdr(struct inode *inode)
+{
+	return (struct ext3_extent_header *) EXT3_I(inode)->i_data;
+}
+
+static inline struct ext3_extent_header *ext_block_hdr(struct buffer_head *bh)
+{
+	return (struct ext3_extent_header *) bh->b_data;
+}
+
+static inline unsigned short ext_depth(struct inode *inode)
+{
+	return le16_to_cpu(ext_inode_hdr(inode)->eh_depth);
+}
+
+static inline int ext3_inode_has_extents(struct inode *inode)
+{
+	return EXT3_I(inode)->i_flags & EXT3_EXTENTS_FL;
+}
+
+extern void ext3_ext_tree_init(struct inode *);
+extern int ext3_ext_get_blocks(handle_t *, struct inode *, unsigned long,
+			       unsigned long, struct buffer_head *, int, int);
+extern int ext3_ext_remove_space(handle_t *, struct inode *, unsigned long);
+extern int ext3_ext_calc_credits_for_insert(struct inode *);
+extern int ext3_ext_writepage_trans_blocks(struct inode *, int);
+
+#endif /* _LINUX_EXT3_EXTENTS_H */
@@ -135,10 +135,19 @@ struct ext3_group_desc
 	__le16	bg_free_blocks_count;	/* Free blocks count */
 	__le16	bg_free_inodes_count;	/* Free inodes count */
 	__le16	bg_used_dirs_count;	/* Directories count */
-	__u16	bg_pad;
-	__le32	bg_reserved[3];
+	__le16	bg_flags;		/* EXT3_BG_flags (uninit_bg only) */
+	__le32	bg_reserved[2];
+	__le16	bg_itable_unused;	/* Unused inodes at the table's end */
+	__le16	bg_checksum;		/* crc16(s_uuid+group_num+desc) */
 };
 
+/*
+ * Group descriptor flags, only meaningful with RO_COMPAT_GDT_CSUM
+ */
+#define EXT3_BG_INODE_UNINIT	0x0001	/* Inode table/bitmap not in use */
+#define EXT3_BG_BLOCK_UNINIT	0x0002	/* Block bitmap not in use */
+#define EXT3_BG_INODE_ZEROED	0x0004	/* On-disk itable initialized to zero */
+
 /*
  * Macro-instructions used to manage group descriptors
  */
@@ -185,9 +194,10 @@ struct ext3_group_desc
 #define EXT3_NOTAIL_FL			0x00008000 /* file tail should not be merged */
 #define EXT3_DIRSYNC_FL			0x00010000 /* dirsync behaviour (directories only) */
 #define EXT3_TOPDIR_FL			0x00020000 /* Top of directory hierarchies*/
+#define EXT3_EXTENTS_FL			0x00080000 /* Inode uses extents */
 #define EXT3_RESERVED_FL		0x80000000 /* reserved for ext3 lib */
 
-#define EXT3_FL_USER_VISIBLE		0x0003DFFF /* User visible flags */
+#define EXT3_FL_USER_VISIBLE		0x000BDFFF /* User visible flags */
 #define EXT3_FL_USER_MODIFIABLE		0x000380FF /* User modifiable flags */
 
 /*
@@ -220,6 +230,34 @@ struct ext3_new_group_data {
 	__u32 free_blocks_count;
 };
 
+/*
+ * EXT3_IOC_READDIR_PLUS: read a batch of directory entries into
+ * rp_buf, sorted by inode number, and start readahead of the inode
+ * table blocks they live in.  rp_cookie is where to start (0 for the
+ * beginning) and is updated to where the next call should resume.
+ * For hashed directories it carries the minor hash as well, so it
+ * needs all 64 bits; once the ioctl has been used on an open
+ * directory, its f_pos is kept in that format for good.
+ */
+struct ext3_readdir_plus {
+	__u64 rp_cookie;	/* in: start position, out: resume position */
+	__u64 rp_buf;		/* user buffer for ext3_dirent_plus records */
+	__u32 rp_bufsize;	/* in: size of rp_buf */
+	__u32 rp_count;		/* out: number of records returned */
+};
+
+struct ext3_dirent_plus {
+	__u32 d_ino;
+	__u16 d_reclen;		/* offset of the next record */
+	__u8  d_namelen;
+	__u8  d_type;		/* DT_* */
+	char  d_name[0];	/* NUL terminated */
+};
+
+#define EXT3_DIRENT_PLUS_LEN(name_len) \
+	((sizeof(struct ext3_dirent_plus) + (name_len) + 1 + 3) & ~3)
+#define EXT3_READDIR_PLUS_MAX		(64 * 1024)
+
 
 /*
  * ioctl commands
@@ -230,6 +268,7 @@ struct ext3_new_group_data {
 #define	EXT3_IOC_SETVERSION		_IOW('f', 4, long)
 #define EXT3_IOC_GROUP_EXTEND		_IOW('f', 7, unsigned long)
 #define EXT3_IOC_GROUP_ADD		_IOW('f', 8,struct ext3_new_group_input)
+#define EXT3_IOC_READDIR_PLUS		_IOWR('f', 9, struct ext3_readdir_plus)
 #define	EXT3_IOC_GETVERSION_OLD		_IOR('v', 1, long)
 #define	EXT3_IOC_SETVERSION_OLD		_IOW('v', 2, long)
 #ifdef CONFIG_JBD_DEBUG
@@ -357,6 +396,10 @@ struct ext3_inode {
 #define EXT3_MOUNT_POSIX_ACL		0x08000	/* POSIX Access Control Lists */
 #define EXT3_MOUNT_RESERVATION		0x10000	/* Preallocation */
 #define EXT3_MOUNT_BARRIER		0x20000 /* Use block barriers */
+#define EXT3_MOUNT_EXTENTS		0x40000 /* New regular files use extents */
+#define EXT3_MOUNT_DELALLOC		0x80000 /* Delay allocation to writeback */
+#define EXT3_MOUNT_JOURNAL_CHECKSUM	0x100000 /* Checksum commit records */
+#define EXT3_MOUNT_JOURNAL_ASYNC_COMMIT	0x200000 /* Don't wait before commit */
 
 /* Compatibility, for having both ext2_fs.h and ext3_fs.h included at once */
 #ifndef _LINUX_EXT2_FS_H
@@ -538,20 +581,24 @@ static inline struct ext3_inode_info *EXT3_I(struct inode *inode)
 #define EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT3_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
 #define EXT3_FEATURE_RO_COMPAT_BTREE_DIR	0x0004
+#define EXT3_FEATURE_RO_COMPAT_GDT_CSUM		0x0010 /* uninit_bg */
 
 #define EXT3_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT3_FEATURE_INCOMPAT_FILETYPE		0x0002
 #define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004 /* Needs recovery */
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008 /* Journal device */
 #define EXT3_FEATURE_INCOMPAT_META_BG		0x0010
+#define EXT3_FEATURE_INCOMPAT_EXTENTS		0x0040 /* extent-mapped inodes */
 
 #define EXT3_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_EXT_ATTR
 #define EXT3_FEATURE_INCOMPAT_SUPP	(EXT3_FEATURE_INCOMPAT_FILETYPE| \
 					 EXT3_FEATURE_INCOMPAT_RECOVER| \
-					 EXT3_FEATURE_INCOMPAT_META_BG)
+					 EXT3_FEATURE_INCOMPAT_META_BG| \
+					 EXT3_FEATURE_INCOMPAT_EXTENTS)
 #define EXT3_FEATURE_RO_COMPAT_SUPP	(EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT3_FEATURE_RO_COMPAT_LARGE_FILE| \
-					 EXT3_FEATURE_RO_COMPAT_BTREE_DIR)
+					 EXT3_FEATURE_RO_COMPAT_BTREE_DIR| \
+					 EXT3_FEATURE_RO_COMPAT_GDT_CSUM)
 
 /*
  * Default values for user and/or group using reserved blocks
@@ -654,7 +701,8 @@ struct dx_hash_info
 	u32		*seed;
 };
 
-#define EXT3_HTREE_EOF	0x7fffffff
+#define EXT3_HTREE_EOF		0x7fffffff
+#define EXT3_HTREE_EOF_64BIT	0x7fffffffffffffffULL
 
 #ifdef __KERNEL__
 /*
@@ -691,6 +739,7 @@ struct dir_private_info {
 	__u32		curr_hash;
 	__u32		curr_minor_hash;
 	__u32		next_hash;
+	int		cookie64;	/* f_pos holds the minor hash too */
 };
 
 /*
@@ -714,16 +763,24 @@ struct dir_private_info {
 extern int ext3_bg_has_super(struct super_block *sb, int group);
 extern unsigned long ext3_bg_num_gdb(struct super_block *sb, int group);
 extern int ext3_new_block (handle_t *, struct inode *, unsigned long, int *);
+extern int ext3_new_blocks (handle_t *, struct inode *, unsigned long,
+			    unsigned long *, int, int *);
 extern void ext3_free_blocks (handle_t *, struct inode *, unsigned long,
 			      unsigned long);
 extern void ext3_free_blocks_sb (handle_t *, struct super_block *,
 				 unsigned long, unsigned long, int *);
 extern unsigned long ext3_count_free_blocks (struct super_block *);
 extern void ext3_check_blocks_bitmap (struct super_block *);
+extern struct buffer_head *ext3_read_block_bitmap(struct super_block *,
+						  unsigned int);
 extern struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 						    unsigned int block_group,
 						    struct buffer_head ** bh);
 extern int ext3_should_retry_alloc(struct super_block *sb, int *retries);
+extern int ext3_claim_delayed_blocks(struct super_block *sb,
+				     unsigned long count);
+extern void ext3_release_delayed_blocks(struct super_block *sb,
+					unsigned long count);
 extern void ext3_rsv_window_add(struct super_block *sb, struct ext3_reserve_window_node *rsv);
 
 /* dir.c */
@@ -734,6 +791,8 @@ extern int ext3_htree_store_dirent(struct file *dir_file, __u32 hash,
 				    __u32 minor_hash,
 				    struct ext3_dir_entry_2 *dirent);
 extern void ext3_htree_free_dir_info(struct dir_private_info *p);
+extern int ext3_readdir_plus(struct file *filp,
+			     struct ext3_readdir_plus __user *arg);
 
 /* fsync.c */
 extern int ext3_sync_file (struct file *, struct dentry *, int);
@@ -749,6 +808,7 @@ extern struct inode * ext3_orphan_get (struct super_block *, unsigned long);
 extern unsigned long ext3_count_free_inodes (struct super_block *);
 extern unsigned long ext3_count_dirs (struct super_block *);
 extern void ext3_check_inodes_bitmap (struct super_block *);
+extern int ext3_inode_unused(struct super_block *, unsigned long);
 extern unsigned long ext3_count_free (struct buffer_head *, unsigned);
 
 
@@ -796,6 +856,10 @@ extern void ext3_abort (struct super_block *, const char *, const char *, ...)
 extern void ext3_warning (struct super_block *, const char *, const char *, ...)
 	__attribute__ ((format (printf, 3, 4)));
 extern void ext3_update_dynamic_rev (struct super_block *sb);
+extern __le16 ext3_group_desc_csum(struct ext3_sb_info *sbi, __u32 group,
+				   struct ext3_group_desc *gdp);
+extern int ext3_group_desc_csum_verify(struct ext3_sb_info *sbi, __u32 group,
+				       struct ext3_group_desc *gdp);
 
 #define ext3_std_error(sb, errno)				\
 do {								\
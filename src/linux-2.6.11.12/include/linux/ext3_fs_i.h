@@ -19,6 +19,7 @@
 #include <linux/rwsem.h>
 #include <linux/rbtree.h>
 #include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 
 struct ext3_reserve_window {
 	__u32			_rsv_start;	/* First byte reserved */
@@ -39,6 +40,18 @@ struct ext3_reserve_window_node {
 /*
  * third extended file system inode data in memory
  */
+/*
+ * The extent most recently looked up in an extent-mapped inode, so that
+ * mapping consecutive blocks does not walk the tree each time.  Protected
+ * by i_cached_extent_lock, since lookups only hold truncate_sem shared;
+ * ec_len == 0 means nothing is cached.
+ */
+struct ext3_ext_cache {
+	__u32	ec_block;	/* first logical block */
+	__u32	ec_len;		/* number of blocks */
+	__u32	ec_start;	/* first physical block */
+};
+
 struct ext3_inode_info {
 	__le32	i_data[15];	/* unconverted */
 	__u32	i_flags;
@@ -125,8 +138,14 @@ struct ext3_inode_info {
 	 * consistent state which allows truncation of the orphans to restart
 	 * during recovery.  Hence we must fix the get_block-vs-truncate race
 	 * by other means, so we have truncate_sem.
+	 *
+	 * Plain lookups in an extent-mapped inode change nothing, so they
+	 * take it shared; everything else takes it exclusive.
 	 */
-	struct semaphore truncate_sem;
+	struct rw_semaphore truncate_sem;
+	struct ext3_ext_cache i_cached_extent;
+	spinlock_t i_cached_extent_lock;
+	struct rcu_head i_rcu;		/* deferred free, see FS_INODE_RCU */
 	struct inode vfs_inode;
 };
 
@@ -57,6 +57,9 @@ struct ext3_sb_info {
 	struct percpu_counter s_freeblocks_counter;
 	struct percpu_counter s_freeinodes_counter;
 	struct percpu_counter s_dirs_counter;
+	struct percpu_counter s_dirtyblocks_counter;	/* delayed allocation */
+	unsigned long s_overhead_last;	/* Last calculated overhead */
+	unsigned long s_blocks_last;	/* Last seen block count */
 	struct blockgroup_lock s_blockgroup_lock;
 
 	/* root of the per fs reservation window tree */
@@ -69,6 +72,8 @@ struct ext3_sb_info {
 	struct journal_s * s_journal;
 	struct list_head s_orphan;
 	unsigned long s_commit_interval;
+	unsigned int s_min_batch_time;	/* fsync batching bounds, in usecs */
+	unsigned int s_max_batch_time;
 	struct block_device *journal_bdev;
 #ifdef CONFIG_JBD_DEBUG
 	struct timer_list turn_ro_timer;	/* For turning read-only (crash simulation) */
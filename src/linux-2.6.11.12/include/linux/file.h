@@ -9,6 +9,7 @@
 #include <linux/posix_types.h>
 #include <linux/compiler.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 
 /*
  * The default fd array needs to be at least BITS_PER_LONG,
@@ -87,9 +88,6 @@ extern void FASTCALL(set_close_on_exec(unsigned int fd, int flag));
 extern void put_filp(struct file *);
 extern int get_unused_fd(void);
 extern void FASTCALL(put_unused_fd(unsigned int fd));
-struct kmem_cache_s;
-extern void filp_ctor(void * objp, struct kmem_cache_s *cachep, unsigned long cflags);
-extern void filp_dtor(void * objp, struct kmem_cache_s *cachep, unsigned long dflags);
 
 extern struct file ** alloc_fd_array(int);
 extern void free_fd_array(struct file **, int);
@@ -99,12 +97,22 @@ extern void free_fdset(fd_set *, int);
 
 extern int expand_files(struct files_struct *, int nr);
 
+/*
+ * Callers hold file_lock or rcu_read_lock(): expand_fd_array() publishes
+ * a new array before the max_fds covering it, and frees the old one only
+ * after a grace period.
+ */
 static inline struct file * fcheck_files(struct files_struct *files, unsigned int fd)
 {
 	struct file * file = NULL;
 
-	if (fd < files->max_fds)
-		file = files->fd[fd];
+	if (fd < files->max_fds) {
+		struct file **fds;
+
+		smp_rmb();
+		fds = rcu_dereference(files->fd);
+		file = rcu_dereference(fds[fd]);
+	}
 	return file;
 }
 
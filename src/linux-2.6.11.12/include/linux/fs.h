@@ -30,7 +30,7 @@
 
 /* And dynamically-tunable limits and defaults: */
 struct files_stat_struct {
-	int nr_files;		/* read only */
+	int nr_files;		/* read only, see get_nr_files() */
 	int nr_free_files;	/* read only */
 	int max_files;		/* tunable */
 };
@@ -87,6 +87,11 @@ extern int dir_notify_enable;
  * ʹöưװ?
  */
 #define FS_BINARY_MOUNTDATA 2
+/*
+ * Inodes are freed only after an RCU grace period, so the path walk may
+ * look at them under rcu_read_lock() without holding a reference.
+ */
+#define FS_INODE_RCU	4
 /**
  * Ҫ"."".."NFS
  * ʼĿ¼ٻʹ"."".."·Ч
@@ -247,6 +252,10 @@ extern int dir_notify_enable;
 #define BLKBSZGET  _IOR(0x12,112,size_t)
 #define BLKBSZSET  _IOW(0x12,113,size_t)
 #define BLKGETSIZE64 _IOR(0x12,114,size_t)	/* return device size in bytes (u64 *arg) */
+#define BLKTRACESETUP _IOWR(0x12,115,struct blk_user_trace_setup)
+#define BLKTRACESTART _IO(0x12,116)
+#define BLKTRACESTOP _IO(0x12,117)
+#define BLKTRACETEARDOWN _IO(0x12,118)
 
 #define BMAP_IOCTL 1		/* obsolete - kept for compatibility */
 #define FIBMAP	   _IO(0x00,1)	/* bmap access */
@@ -969,22 +978,11 @@ struct file_ra_state {
 	 * Ԥı־
 	 */
 	unsigned long flags;		/* ra flags RA_FLAG_xxx*/
-	/**
-	 * ٻ(ҳͬʱҳٻ)
-	 */
-	unsigned long cache_hit;	/* cache hit count*/
 	/**
 	 * һҳһζҳһҳʼֵΪ-1
 	 */
 	unsigned long prev_page;	/* Cache last read() position */
-	/**
-	 * Ԥڵĵһҳ
-	 */
-	unsigned long ahead_start;	/* Ahead window */
-	/**
-	 * Ԥҳ(0ʾԤڿ)
-	 */
-	unsigned long ahead_size;
+	unsigned long async_size;	/* Marker this many pages before end */
 	/**
 	 * Ԥڵҳ(0ʾԤýֹ)
 	 * ֶεĳʼֵ(ȱʡֵ)ڸļڿ豸backing_dev_info
@@ -1004,12 +1002,7 @@ struct file_ra_state {
  * ѾԤҳҳٻ(ںΪͷڴԻ)ñ־λ
  * ʱһҪԤڴСС
  */
-#define RA_FLAG_MISS 0x01	/* a cache miss occured against this file */
-/**
- * ںȷ256ҳҳٻʱ(ٻra->cache_hitֶ)ñ־λλ
- * ʱںΪеҳѾҳٻڣرԤ
- */
-#define RA_FLAG_INCACHE 0x02	/* file is already in cache */
+#define RA_FLAG_MISS 0x01	/* readahead pages were evicted before use */
 
 /**
  * һ򿪵ļںopenʱļʵرպ󣬲ͷŸýṹ
@@ -1107,6 +1100,8 @@ struct file {
 	 * ָļַռĶ
 	 */
 	struct address_space	*f_mapping;
+	int			f_sb_list_cpu;	/* s_files list we are on, or -1 */
+	struct rcu_head		f_rcuhead;	/* fget() may still be looking */
 };
 
 /*
@@ -1116,6 +1111,24 @@ extern spinlock_t files_lock;
 #define file_list_lock() spin_lock(&files_lock);
 #define file_list_unlock() spin_unlock(&files_lock);
 
+/*
+ * A superblock's open files are spread over per-cpu lists, each covered
+ * by that cpu's lock, so that open and close on different cpus do not
+ * meet on files_lock.  Walking them takes all of the locks:
+ *
+ *	sb_files_lock_all();
+ *	sb_files_for_each(sb, cpu, file)
+ *		...
+ *	sb_files_unlock_all();
+ *
+ * files_lock is left for the other lists file_move() puts files on.
+ */
+extern void sb_files_lock_all(void);
+extern void sb_files_unlock_all(void);
+#define sb_files_for_each(sb, cpu, file)				\
+	for_each_cpu(cpu)						\
+		list_for_each_entry(file, per_cpu_ptr((sb)->s_files, cpu), f_list)
+
 #define get_file(x)	atomic_inc(&(x)->f_count)
 #define file_count(x)	atomic_read(&(x)->f_count)
 
@@ -1436,10 +1449,24 @@ struct super_block {
 	 * Ŀ¼NFS
 	 */
 	struct hlist_head	s_anon;		/* anonymous dentries for (nfs) exporting */
+	/*
+	 * Unused dentries, most recent first: positive ones on
+	 * s_dentry_lru, negative ones on s_dentry_neg so that they can be
+	 * bounded and reclaimed on their own.  s_lru_sbs and s_neg_sbs link
+	 * the superblock into dcache's lists of those with a non-empty
+	 * s_dentry_lru and s_dentry_neg.  The lists and the count are under
+	 * s_dentry_lru_lock; see fs/dcache.c for the rest of the rules.
+	 */
+	spinlock_t		s_dentry_lru_lock;
+	struct list_head	s_dentry_lru;
+	struct list_head	s_lru_sbs;
+	struct list_head	s_dentry_neg;
+	struct list_head	s_neg_sbs;
+	int			s_nr_dentry_neg;
 	/**
 	 * ļ
 	 */
-	struct list_head	s_files;
+	struct list_head	*s_files;	/* per-cpu, see sb_files_for_each */
 
 	/**
 	 * ָ豸ָ
@@ -1834,6 +1861,12 @@ struct inode_operations {
 	 * ļȨޡ
 	 */
 	int (*permission) (struct inode *, int, struct nameidata *);
+	/*
+	 * ->permission for the RCU path walk: called without a reference
+	 * and must not sleep.  -EAGAIN or any other error sends the walk
+	 * back to ->permission.
+	 */
+	int (*permission_rcu) (struct inode *, int);
 	/**
 	 * ޸ļԡ
 	 */
@@ -2439,7 +2472,9 @@ static inline void insert_inode_hash(struct inode *inode) {
 
 extern struct file * get_empty_filp(void);
 extern void file_move(struct file *f, struct list_head *list);
+extern void file_sb_list_add(struct file *f, struct super_block *sb);
 extern void file_kill(struct file *f);
+extern int get_nr_files(void);
 struct bio;
 extern void submit_bio(int, struct bio *);
 extern int bdev_read_only(struct block_device *);
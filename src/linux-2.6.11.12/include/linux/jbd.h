@@ -47,6 +47,13 @@
  */
 #define JBD_DEFAULT_MAX_COMMIT_AGE 5
 
+/*
+ * Bounds, in microseconds, on how long a synchronous update may hold its
+ * transaction open for others to join it.
+ */
+#define JBD_DEFAULT_MIN_BATCH_TIME 0
+#define JBD_DEFAULT_MAX_BATCH_TIME 15000
+
 #ifdef CONFIG_JBD_DEBUG
 /*
  * Define JBD_EXPENSIVE_CHECKING to enable more expensive internal
@@ -142,6 +149,29 @@ typedef struct journal_header_s
 	__be32		h_sequence;
 } journal_header_t;
 
+/*
+ * Checksum types.
+ */
+#define JFS_CRC32_CHKSUM	1
+
+#define JFS_CRC32_CHKSUM_SIZE	4
+
+#define JBD_CHECKSUM_BYTES	(32 / sizeof(u32))
+
+/*
+ * Commit block header, used when the journal carries commit checksums.
+ * It starts with the standard header, so a kernel which does not know
+ * about checksums still recognises the block as a commit record.
+ */
+struct commit_header {
+	__be32		h_magic;
+	__be32		h_blocktype;
+	__be32		h_sequence;
+	unsigned char	h_chksum_type;
+	unsigned char	h_chksum_size;
+	unsigned char	h_padding[2];
+	__be32		h_chksum[JBD_CHECKSUM_BYTES];
+};
 
 /* 
  * The block tag: used to describe a single buffer in the journal 
@@ -228,12 +258,16 @@ typedef struct journal_superblock_s
 	((j)->j_format_version >= 2 &&					\
 	 ((j)->j_superblock->s_feature_incompat & cpu_to_be32((mask))))
 
-#define JFS_FEATURE_INCOMPAT_REVOKE	0x00000001
+#define JFS_FEATURE_COMPAT_CHECKSUM	0x00000001
+
+#define JFS_FEATURE_INCOMPAT_REVOKE		0x00000001
+#define JFS_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 
 /* Features known to this kernel version: */
-#define JFS_KNOWN_COMPAT_FEATURES	0
+#define JFS_KNOWN_COMPAT_FEATURES	JFS_FEATURE_COMPAT_CHECKSUM
 #define JFS_KNOWN_ROCOMPAT_FEATURES	0
-#define JFS_KNOWN_INCOMPAT_FEATURES	JFS_FEATURE_INCOMPAT_REVOKE
+#define JFS_KNOWN_INCOMPAT_FEATURES	(JFS_FEATURE_INCOMPAT_REVOKE | \
+					 JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -546,6 +580,11 @@ struct transaction_s
 	 */
 	unsigned long		t_expires;
 
+	/*
+	 * When was the transaction started, in jiffies? [no locking]
+	 */
+	unsigned long		t_start_time;
+
 	/*
 	 * How many handles used this transaction? [t_handle_lock]
 	 */
@@ -553,6 +592,15 @@ struct transaction_s
 
 };
 
+/*
+ * Commit latencies are counted in power-of-two millisecond buckets: slot
+ * n holds commits which took less than 2^n ms, the last slot everything
+ * slower.
+ */
+#define JBD_COMMIT_HIST_SLOTS	13
+
+struct proc_dir_entry;
+
 /**
  * struct journal_s - The journal_s type is the concrete type associated with
  *     journal_t.
@@ -597,6 +645,8 @@ struct transaction_s
  *  transaction
  * @j_commit_request: Sequence number of the most recent transaction wanting
  *     commit 
+ * @j_durable_sequence: Sequence number of the most recent transaction whose
+ *     commit record is known to be on disk
  * @j_uuid: Uuid of client object.
  * @j_task: Pointer to the current commit thread for this journal
  * @j_max_transaction_buffers:  Maximum number of metadata buffers to allow in a
@@ -604,8 +654,20 @@ struct transaction_s
  * @j_commit_interval: What is the maximum transaction lifetime before we begin
  *  a commit?
  * @j_commit_timer:  The timer used to wakeup the commit thread
+ * @j_min_batch_time: Minimum time a synchronous update waits for others to
+ *     join its transaction, in usecs
+ * @j_max_batch_time: Maximum time a synchronous update waits for others to
+ *     join its transaction, in usecs
+ * @j_last_sync_writer: pid of the last process to stop a synchronous handle
+ * @j_average_commit_time: Running average of the commit latency, in jiffies
+ * @j_batch_waits: Number of times a synchronous update waited to batch
  * @j_revoke: The revoke table - maintains the list of revoked blocks in the
  *     current transaction.
+ * @j_commit_hist: Commit latency histogram, see JBD_COMMIT_HIST_SLOTS
+ * @j_commit_count: Number of commits accounted in @j_commit_hist
+ * @j_commit_time: Total commit latency, in jiffies
+ * @j_commit_max: Longest commit seen, in jiffies
+ * @j_proc_entry: The journal's entry under /proc/fs/jbd
  */
 
 struct journal_s
@@ -755,6 +817,14 @@ struct journal_s
 	 */
 	tid_t			j_commit_request;
 
+	/*
+	 * Sequence number of the most recent transaction whose commit record
+	 * has reached the disk.  Runs ahead of j_commit_sequence while the
+	 * commit thread is still filing the transaction for checkpoint.
+	 * [j_state_lock]
+	 */
+	tid_t			j_durable_sequence;
+
 	/*
 	 * Journal uuid: identifies the object (filesystem, LVM volume etc)
 	 * backed by this journal.  This will eventually be replaced by an array
@@ -780,6 +850,16 @@ struct journal_s
 	/* The timer used to wakeup the commit thread: */
 	struct timer_list	*j_commit_timer;
 
+	/*
+	 * Bounds on the time a synchronous update holds its transaction
+	 * open for others to join, in usecs.
+	 */
+	unsigned int		j_min_batch_time;
+	unsigned int		j_max_batch_time;
+
+	/* pid of the last process to stop a synchronous handle */
+	pid_t			j_last_sync_writer;
+
 	/*
 	 * The revoke table: maintains the list of revoked blocks in the
 	 * current transaction.  [j_revoke_lock]
@@ -788,6 +868,24 @@ struct journal_s
 	struct jbd_revoke_table_s *j_revoke;
 	struct jbd_revoke_table_s *j_revoke_table[2];
 
+	/*
+	 * Commit latency statistics, updated by the commit thread.
+	 * [j_state_lock]
+	 */
+	unsigned long		j_commit_hist[JBD_COMMIT_HIST_SLOTS];
+	unsigned long		j_commit_count;
+	unsigned long		j_commit_time;
+	unsigned long		j_commit_max;
+
+	/*
+	 * Running average of the commit latency in jiffies, and how often
+	 * a synchronous update waited for others to join. [j_state_lock]
+	 */
+	unsigned long		j_average_commit_time;
+	unsigned long		j_batch_waits;
+
+	struct proc_dir_entry	*j_proc_entry;
+
 	/*
 	 * An opaque pointer to fs-private information.  ext3 puts its
 	 * superblock pointer here
@@ -897,6 +995,8 @@ extern int	   journal_check_available_features
 		   (journal_t *, unsigned long, unsigned long, unsigned long);
 extern int	   journal_set_features 
 		   (journal_t *, unsigned long, unsigned long, unsigned long);
+extern void	   journal_clear_features
+		   (journal_t *, unsigned long, unsigned long, unsigned long);
 extern int	   journal_create     (journal_t *);
 extern int	   journal_load       (journal_t *journal);
 extern void	   journal_destroy    (journal_t *);
@@ -968,6 +1068,7 @@ int __log_start_commit(journal_t *journal, tid_t tid);
 int journal_start_commit(journal_t *journal, tid_t *tid);
 int journal_force_commit_nested(journal_t *journal);
 int log_wait_commit(journal_t *journal, tid_t tid);
+int log_wait_durable(journal_t *journal, tid_t tid);
 int log_do_checkpoint(journal_t *journal);
 
 void __log_wait_for_space(journal_t *journal);
@@ -17,6 +17,8 @@
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/wait.h>
 
 /* Possible states of device */
 enum {
@@ -27,6 +29,17 @@ enum {
 
 struct loop_func_table;
 
+/*
+ * With LO_FLAGS_DIRECT_IO the backing file is mapped once, through bmap,
+ * into runs of contiguous sectors on lo_target, and bios are remapped
+ * onto those instead of going through the file's page cache.
+ */
+struct loop_extent {
+	sector_t	start;		/* first loop sector */
+	sector_t	nr_sects;
+	sector_t	disk_sector;	/* where it starts on lo_target */
+};
+
 struct loop_device {
 	int		lo_number;
 	int		lo_refcnt;
@@ -62,6 +75,20 @@ struct loop_device {
 	struct semaphore	lo_ctl_mutex;
 	struct semaphore	lo_bh_mutex;
 	atomic_t		lo_pending;
+	int			lo_nr_workers;
+
+	/*
+	 * Held shared by the workers while they handle a bio, exclusively
+	 * to switch files, run a transfer function that is not reentrant
+	 * or change the direct I/O mapping.
+	 */
+	struct rw_semaphore	lo_io_sem;
+
+	struct loop_extent	*lo_extents;
+	int			lo_nr_extents;
+	struct block_device	*lo_target;
+	atomic_t		lo_dio_inflight;
+	wait_queue_head_t	lo_dio_wait;
 
 	request_queue_t		*lo_queue;
 };
@@ -72,6 +99,7 @@ struct loop_device {
  * Loop flags
  */
 #define LO_FLAGS_READ_ONLY	1
+#define LO_FLAGS_DIRECT_IO	2
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
 #include <asm/types.h>		/* for __u64 */
@@ -154,5 +182,6 @@ int loop_unregister_transfer(int number);
 #define LOOP_SET_STATUS64	0x4C04
 #define LOOP_GET_STATUS64	0x4C05
 #define LOOP_CHANGE_FD		0x4C06
+#define LOOP_SET_DIRECT_IO	0x4C08
 
 #endif
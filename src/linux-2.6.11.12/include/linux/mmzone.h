@@ -68,6 +68,13 @@ struct per_cpu_pages {
 	struct list_head list;	/* the list of pages */
 };
 
+/*
+ * Blocks of order 1..PCP_MAX_ORDER are cached per CPU as well: network
+ * drivers, the slab and kernel stacks allocate them all the time.  These
+ * lists hold blocks, not pages, and have no cold variant.
+ */
+#define PCP_MAX_ORDER	3
+
 /**
  * ÿCPUҳٻ
  */
@@ -76,6 +83,13 @@ struct per_cpu_pageset {
 	 * ȸٻٻ档
 	 */
 	struct per_cpu_pages pcp[2];	/* 0: hot.  1: cold */
+	struct per_cpu_pages pcp_order[PCP_MAX_ORDER];	/* orders 1.. */
+
+	/* Each refill or drain is one round trip on zone->lock */
+	unsigned long alloc_hit;	/* served from a list, no refill */
+	unsigned long alloc_refill;	/* list refilled from the buddy */
+	unsigned long free_hit;		/* freed to a list, no drain */
+	unsigned long free_drain;	/* list drained to the buddy */
 #ifdef CONFIG_NUMA
 	unsigned long numa_hit;		/* allocated in intended node */
 	unsigned long numa_miss;	/* allocated in non intended node */
@@ -528,6 +542,9 @@ int min_free_kbytes_sysctl_handler(struct ctl_table *, int, struct file *,
 extern int sysctl_lowmem_reserve_ratio[MAX_NR_ZONES-1];
 int lowmem_reserve_ratio_sysctl_handler(struct ctl_table *, int, struct file *,
 					void __user *, size_t *, loff_t *);
+extern int percpu_pagelist_fraction;
+int percpu_pagelist_fraction_sysctl_handler(struct ctl_table *, int,
+			struct file *, void __user *, size_t *, loff_t *);
 
 #include <linux/topology.h>
 /* Returns the number of the current Node. */
@@ -141,6 +141,7 @@
  * ϵͳ𡢻ָʱʹá
  */
 #define PG_nosave_free		19	/* Free, should not be written */
+#define PG_readahead		20	/* Reader reaching it starts async readahead */
 
 
 /*
@@ -197,6 +198,8 @@ struct page_state {
 	unsigned long allocstall;	/* direct reclaim calls */
 
 	unsigned long pgrotated;	/* pages rotated to tail of the LRU */
+	unsigned long pgfault_spec;	/* faults handled without mmap_sem */
+	unsigned long pgfault_spec_retry;/* ... retried under mmap_sem */
 };
 
 extern void get_page_state(struct page_state *ret);
@@ -354,6 +357,11 @@ extern void __mod_page_state(unsigned offset, unsigned long delta);
 #define ClearPageReclaim(page)	clear_bit(PG_reclaim, &(page)->flags)
 #define TestClearPageReclaim(page) test_and_clear_bit(PG_reclaim, &(page)->flags)
 
+#define PageReadahead(page)	test_bit(PG_readahead, &(page)->flags)
+#define SetPageReadahead(page)	set_bit(PG_readahead, &(page)->flags)
+#define ClearPageReadahead(page) clear_bit(PG_readahead, &(page)->flags)
+#define TestClearPageReadahead(page) test_and_clear_bit(PG_readahead, &(page)->flags)
+
 #ifdef CONFIG_HUGETLB_PAGE
 #define PageCompound(page)	test_bit(PG_compound, &(page)->flags)
 #else
@@ -50,6 +50,83 @@ static inline void mapping_set_gfp_mask(struct address_space *m, int mask)
 #define page_cache_release(page)	put_page(page) /*put_pageͷҳ棬page->_countΪ0ͷҳ*/
 void release_pages(struct page **pages, int nr, int cold);
 
+/*
+ * Lockless pagecache lookups.
+ *
+ * With cmpxchg, find_get_page() and friends walk mapping->page_tree under
+ * rcu_read_lock() and pin the page they find with
+ * page_cache_get_speculative().  That only takes a reference if the page
+ * is not free: the page may have been removed from the pagecache, freed
+ * and even reused meanwhile, so the caller must recheck that the radix
+ * tree slot still points at the page, and drop the reference and retry if
+ * it does not.
+ *
+ * Whoever removes a page from the pagecache and wants to be sure nobody
+ * else holds a reference (vmscan, swap cache removal) freezes the count
+ * under ->tree_lock with page_freeze_refs(): that only succeeds if the
+ * count is exactly what is expected, and it leaves the page looking free,
+ * so a speculative get fails until page_unfreeze_refs() (or the removal
+ * has been done, after which the slot recheck fails instead).
+ *
+ * Without cmpxchg the lookups simply keep taking ->tree_lock, which also
+ * excludes the freezers.
+ */
+#ifdef __HAVE_ARCH_CMPXCHG
+
+#define page_cache_read_lock(mapping)	rcu_read_lock()
+#define page_cache_read_unlock(mapping)	rcu_read_unlock()
+
+static inline int page_cache_get_speculative(struct page *page)
+{
+	int c, old;
+
+	/* A free or frozen page has ->_count == -1, see page_count() */
+	c = atomic_read(&page->_count);
+	for (;;) {
+		if (unlikely(c == -1))
+			return 0;
+		old = cmpxchg(&page->_count.counter, c, c + 1);
+		if (likely(old == c))
+			break;
+		c = old;
+	}
+	return 1;
+}
+
+static inline int page_freeze_refs(struct page *page, int count)
+{
+	return likely(cmpxchg(&page->_count.counter, count - 1, -1) == count - 1);
+}
+
+#else
+
+#define page_cache_read_lock(mapping)	spin_lock_irq(&(mapping)->tree_lock)
+#define page_cache_read_unlock(mapping)	spin_unlock_irq(&(mapping)->tree_lock)
+
+static inline int page_cache_get_speculative(struct page *page)
+{
+	get_page(page);
+	return 1;
+}
+
+static inline int page_freeze_refs(struct page *page, int count)
+{
+	if (page_count(page) != count)
+		return 0;
+	set_page_count(page, 0);
+	return 1;
+}
+
+#endif
+
+static inline void page_unfreeze_refs(struct page *page, int count)
+{
+	BUG_ON(page_count(page) != 0);
+	BUG_ON(count == 0);
+	smp_mb();
+	set_page_count(page, count);
+}
+
 static inline struct page *page_cache_alloc(struct address_space *x)
 {
 	return alloc_pages(mapping_gfp_mask(x), 0);
@@ -74,6 +151,9 @@ unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 			unsigned int nr_pages, struct page **pages);
 unsigned find_get_pages_tag(struct address_space *mapping, pgoff_t *index,
 			int tag, unsigned int nr_pages, struct page **pages);
+unsigned find_get_pages_tag_range(struct address_space *mapping,
+			pgoff_t *index, pgoff_t end, int tag,
+			unsigned int nr_pages, struct page **pages);
 
 /*
  * Returns locked page at given index in given cache, creating it if needed.
@@ -21,6 +21,7 @@
 
 #include <linux/preempt.h>
 #include <linux/types.h>
+#include <linux/rcupdate.h>
 
 /**
  * ҳٻĸ
@@ -56,12 +57,27 @@ do {									\
 	(root)->rnode = NULL;						\
 } while (0)
 
+/*
+ * Locking rules: modifications (insert, delete, tag set/clear) must be
+ * serialised by the caller, as before.  radix_tree_lookup(),
+ * radix_tree_lookup_slot(), radix_tree_gang_lookup() and
+ * radix_tree_gang_lookup_slot() may instead be run under rcu_read_lock():
+ * nodes are freed through RCU and every node records its own height, so
+ * a lockless walk never sees freed memory or a torn root.  Such a reader
+ * may of course find an item that is being deleted concurrently, and it
+ * must revalidate whatever it found (see find_get_page()).  The tag
+ * lookups still require the lock.
+ */
 int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
 void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
+void **radix_tree_lookup_slot(struct radix_tree_root *, unsigned long);
 void *radix_tree_delete(struct radix_tree_root *, unsigned long);
 unsigned int
 radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 			unsigned long first_index, unsigned int max_items);
+unsigned int
+radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
+			unsigned long first_index, unsigned int max_items);
 int radix_tree_preload(int gfp_mask);
 void radix_tree_init(void);
 void *radix_tree_tag_set(struct radix_tree_root *root,
@@ -73,8 +89,21 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 unsigned int
 radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
 		unsigned long first_index, unsigned int max_items, int tag);
+unsigned int
+radix_tree_gang_lookup_tag_range(struct radix_tree_root *root, void **results,
+		unsigned long first_index, unsigned long last_index,
+		unsigned int max_items, int tag);
 int radix_tree_tagged(struct radix_tree_root *root, int tag);
 
+/*
+ * Read the item out of a slot returned by one of the _slot lookups.  The
+ * item may have been deleted under us, in which case NULL is returned.
+ */
+static inline void *radix_tree_deref_slot(void **pslot)
+{
+	return rcu_dereference(*pslot);
+}
+
 static inline void radix_tree_preload_end(void)
 {
 	preempt_enable(); /**/
@@ -0,0 +1,117 @@
+/*
+ * bitmap.h: write-intent bitmap for md raid1 and raid4/5
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ */
+#ifndef BITMAP_H
+#define BITMAP_H 1
+
+#define BITMAP_MAJOR	1
+#define BITMAP_MAGIC	0x6d746962	/* "bitm" */
+
+/*
+ * The bitmap lives on every member of an array with a 0.90 superblock,
+ * in the space reserved after the superblock: this 256 byte header,
+ * then one bit per chunk.  All fields are little-endian.
+ */
+typedef struct bitmap_super_s {
+	__u32 magic;		/*  0 BITMAP_MAGIC */
+	__u32 version;		/*  4 BITMAP_MAJOR */
+	__u8  uuid[16];		/*  8 must match the array's uuid */
+	__u64 events;		/* 24 array event count when last written */
+	__u64 sync_size;	/* 32 sectors of each member covered */
+	__u32 chunksize;	/* 40 bytes of each member per bit */
+	__u32 daemon_sleep;	/* 44 seconds between clearing passes */
+	__u8  pad[256 - 48];	/* set to 0 when writing */
+} bitmap_super_t;
+
+/* room for the bitmap after a 0.90 superblock, header included */
+#define BITMAP_MAX_BYTES	(MD_RESERVED_BYTES - MD_SB_BYTES)
+
+/* smallest chunk a new bitmap is given, bigger if the array needs it */
+#define BITMAP_MIN_CHUNK	(4 * 1024 * 1024)
+#define BITMAP_DAEMON_SLEEP	5
+
+#ifdef __KERNEL__
+
+/*
+ * Each chunk has a 16 bit counter in memory:
+ *	0	bit clear
+ *	1	bit set, chunk idle; cleared by the next daemon pass
+ *	2	bit set, chunk just went idle
+ *	n > 2	bit set, n-2 writes in flight
+ * plus NEEDED if the chunk must be resynced and RESYNC while it is.
+ */
+typedef __u16 bitmap_counter_t;
+#define COUNTER_BITS	16
+#define NEEDED_MASK	((bitmap_counter_t) (1 << (COUNTER_BITS - 1)))
+#define RESYNC_MASK	((bitmap_counter_t) (1 << (COUNTER_BITS - 2)))
+#define COUNTER_MAX	((bitmap_counter_t) RESYNC_MASK - 1)
+#define NEEDED(x)	(((bitmap_counter_t) x) & NEEDED_MASK)
+#define RESYNC(x)	(((bitmap_counter_t) x) & RESYNC_MASK)
+#define COUNTER(x)	(((bitmap_counter_t) x) & COUNTER_MAX)
+
+/* bitmap page attributes */
+#define BITMAP_PAGE_DIRTY	0	/* bits set, write before the writes */
+#define BITMAP_PAGE_CLEAN	1	/* has idle chunks for the daemon */
+#define BITMAP_PAGE_NEEDWRITE	2	/* bits cleared, write at leisure */
+
+struct bitmap {
+	mddev_t *mddev;
+
+	unsigned long chunks;		/* bits in the bitmap */
+	int chunkshift;			/* log2 of sectors per chunk */
+	sector_t sync_size;		/* sectors of each member covered */
+	unsigned long dirty_bits;	/* bits set, for /proc/mdstat */
+
+	/* the on-disk image, header first, and an attribute word per page */
+	struct page **pages;
+	unsigned long *page_attr;
+	unsigned long nr_pages;
+	unsigned long bytes;		/* written out of the image */
+
+	bitmap_counter_t *counters;	/* one per chunk */
+	spinlock_t lock;		/* counters, bits and page_attr */
+	wait_queue_head_t overflow_wait;
+
+	/* one writer of the image at a time, waiting for all its bios */
+	struct semaphore write_sem;
+	atomic_t pending_writes;
+	wait_queue_head_t write_wait;
+
+	unsigned long daemon_sleep;	/* seconds */
+	unsigned long daemon_lastrun;	/* jiffies */
+};
+
+int  bitmap_create(mddev_t *mddev);
+void bitmap_destroy(mddev_t *mddev);
+void bitmap_flush(mddev_t *mddev);
+void bitmap_status(struct seq_file *seq, struct bitmap *bitmap);
+
+void bitmap_update_sb(struct bitmap *bitmap);
+void bitmap_write_all(struct bitmap *bitmap);
+void bitmap_unplug(struct bitmap *bitmap);
+void bitmap_daemon_work(struct bitmap *bitmap);
+
+/* has daemon_sleep gone by since bitmap_daemon_work last cleared bits? */
+static inline int bitmap_daemon_due(struct bitmap *bitmap)
+{
+	return bitmap && time_after_eq(jiffies, bitmap->daemon_lastrun +
+				       bitmap->daemon_sleep * HZ);
+}
+
+void bitmap_startwrite(struct bitmap *bitmap, sector_t offset,
+		       unsigned long sectors);
+void bitmap_endwrite(struct bitmap *bitmap, sector_t offset,
+		     unsigned long sectors, int success);
+int  bitmap_start_sync(struct bitmap *bitmap, sector_t offset, int *blocks);
+void bitmap_end_sync(struct bitmap *bitmap, sector_t offset, int *blocks,
+		     int aborted);
+void bitmap_close_sync(struct bitmap *bitmap);
+
+#endif
+
+#endif
@@ -313,6 +313,18 @@ struct mddev_s
 	/*  */
 	request_queue_t			*queue;	/* for plugging ... */
 
+	/* дͼλͼûΪNULL */
+	struct bitmap			*bitmap; /* the bitmap for the device */
+	/* λͼԳƫ0ʾûλͼ */
+	long				bitmap_offset; /* offset from superblock of
+							* start of bitmap. May be
+							* negative, but not '0'
+							*/
+	/* λͼʱʹõƫ */
+	long				default_bitmap_offset; /* this is the offset to use when
+								* hot-adding a bitmap.
+								*/
+
 	/* ֶͨӵSCSI豸 */
 	struct list_head		all_mddevs;
 };
@@ -357,11 +369,18 @@ struct mdk_personality_s
 	/* 豸ӹлָҪʱ */
 	int (*spare_active) (mddev_t *mddev);
 	/* ͬʱã֧࣬ΪNULL */
-	int (*sync_request)(mddev_t *mddev, sector_t sector_nr, int go_faster);
+	int (*sync_request)(mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster);
 	/* 豸ʱ */
 	int (*resize) (mddev_t *mddev, sector_t sectors);
 	int (*reshape) (mddev_t *mddev, int raid_disks);
 	int (*reconfig) (mddev_t *mddev, int layout, int chunk_size);
+	/* quiesce moves between quiescence states
+	 * 0 - fully active
+	 * 1 - no new requests allowed
+	 * others - reserved
+	 */
+	/* ӡɾλͼʱãȴɲֹ */
+	void (*quiesce) (mddev_t *mddev, int state);
 };
 
 
@@ -407,6 +426,8 @@ typedef struct mdk_thread_s {
 	struct completion	*event;
 	/*  */
 	struct task_struct	*tsk;
+	/* ûбʱȴôҲһ */
+	unsigned long		timeout;
 	const char		*name;
 } mdk_thread_t;
 
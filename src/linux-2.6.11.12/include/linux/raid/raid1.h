@@ -36,6 +36,8 @@ struct r1_private_data_s {
 	spinlock_t		device_lock;
 
 	struct list_head	retry_list;
+	/* writes held back until their bitmap bits are on disk */
+	struct bio_list		pending_bio_list;
 	/* for use when syncing mirrors: */
 
 	spinlock_t		resync_lock;
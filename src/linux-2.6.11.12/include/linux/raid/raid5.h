@@ -142,6 +142,8 @@ struct stripe_head {
 	atomic_t		count;			/* nr of active thread/requests */
 	/*  */
 	spinlock_t		lock;
+	/* λͼдţ֮ǰܿʼд */
+	int			bm_seq;			/* sequence number for bitmap flushes */
 	struct r5dev {
 		/* дͨÿ */
 		struct bio	req;
@@ -191,6 +193,7 @@ struct stripe_head {
 #define	STRIPE_INSYNC		4
 #define	STRIPE_PREREAD_ACTIVE	5
 #define	STRIPE_DELAYED		6
+#define	STRIPE_BIT_DELAY	7
 
 /*
  * Plugging:
@@ -213,8 +216,20 @@ struct stripe_head {
  * In stripe_handle, if we find pre-reading is necessary, we do it if
  * PREREAD_ACTIVE is set, else we set DELAYED which will send it to the delayed queue.
  * HANDLE gets cleared if stripe_handle leave nothing locked.
+ *
+ * With a write-intent bitmap, a stripe that gets a new write has the
+ * bits for it set and BIT_DELAY set, and is given bm_seq one past the
+ * current seq_flush.  Unplugging bumps seq_flush; raid5d then writes out
+ * the bitmap and sets seq_write to the seq_flush it wrote for.  Until
+ * seq_write reaches its bm_seq, a BIT_DELAY stripe is not written and
+ * waits on bitmap_list.
  */
  
+/*
+ * Threads that handle stripes alongside raid5d, at most one per extra cpu.
+ */
+#define RAID5_MAX_WORKERS	8
+
 /* RAIDԱ */
 struct disk_info {
 	mdk_rdev_t	*rdev;
@@ -247,6 +262,12 @@ struct raid5_private_data {
 	struct list_head	delayed_list; /* stripes that have plugged requests */
 	/* Ѿȵ */
 	atomic_t		preread_active_stripes; /* stripes with scheduled io */
+	/* ȴλͼд̵ */
+	struct list_head	bitmap_list; /* stripes delaying awaiting bitmap update */
+	/* ĺɵλͼд */
+	int			seq_flush, seq_write;
+	/* 0ʱٽµraid5_quiesce */
+	int			quiesce;
 
 	/* ٻƣڷstrip_head */
 	char			cache_name[20];
@@ -266,6 +287,9 @@ struct raid5_private_data {
 	int			inactive_blocked;	/* release of inactive stripes blocked,
 							 * waiting for 25% to be free
 							 */        
+	/* ػ߳һḶ́߳device_lock */
+	mdk_thread_t		*workers[RAID5_MAX_WORKERS];
+	int			nr_workers, next_worker;
 	/* ڱ͹ϣ */							 
 	spinlock_t		device_lock;
 	/* Ա */
@@ -351,6 +351,8 @@ struct mm_struct {
 	 * ڼ̼乲ͨźԱ⾺
 	 */
 	struct rw_semaphore mmap_sem;
+	seqcount_t vma_seq;			/* see vma_write_begin() */
+	int vma_seq_depth;			/* nesting, under mmap_sem */
 	/**
 	 * ҳ
 	 */
@@ -768,6 +770,7 @@ extern void cpu_attach_domain(struct sched_domain *sd, int cpu);
 
 struct io_context;			/* See blkdev.h */
 void exit_io_context(void);
+struct blk_plug;			/* See blkdev.h */
 
 #define NGROUPS_SMALL		32
 #define NGROUPS_PER_BLOCK	((int)(PAGE_SIZE / sizeof(gid_t)))
@@ -1092,6 +1095,8 @@ struct task_struct {
 	struct backing_dev_info *backing_dev_info;
 
 	struct io_context *io_context;
+	unsigned short ioprio;		/* IOPRIO_PRIO_VALUE, see ioprio.h */
+	struct blk_plug *plug;		/* requests held back, on our stack */
 
 	unsigned long ptrace_message;
 	siginfo_t *last_siginfo; /* For ptrace use.  */
@@ -169,6 +169,7 @@ enum
 	VM_VFS_CACHE_PRESSURE=26, /* dcache/icache reclaim pressure */
 	VM_LEGACY_VA_LAYOUT=27, /* legacy/compatibility virtual address space layout */
 	VM_SWAP_TOKEN_TIMEOUT=28, /* default time for token time out */
+	VM_PERCPU_PAGELIST_FRACTION=29,/* int: fraction of pages in each percpu_pagelist */
 };
 
 
@@ -670,6 +671,9 @@ enum
 	FS_XFS=17,	/* struct: control xfs parameters */
 	FS_AIO_NR=18,	/* current system-wide number of aio requests */
 	FS_AIO_MAX_NR=19,	/* system-wide maximum number of aio requests */
+	FS_DENTRY_NEG_MAX=20,	/* int: unused negative dentries per superblock */
+	FS_DENTRY_NEG_PRESSURE=21, /* int: reclaim weight of negative dentries */
+	FS_DENTRY_NEG_LOOKUPS=22, /* negative dentry hits and misses */
 };
 
 /* /proc/sys/fs/quota/ */
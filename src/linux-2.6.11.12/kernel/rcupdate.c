@@ -473,7 +473,48 @@ void synchronize_kernel(void)
 	wait_for_completion(&rcu.completion);
 }
 
+static DEFINE_PER_CPU(struct rcu_head, rcu_barrier_head);
+static atomic_t rcu_barrier_cpu_count;
+static struct completion rcu_barrier_completion;
+static DECLARE_MUTEX(rcu_barrier_sema);
+
+static void rcu_barrier_callback(struct rcu_head *notused)
+{
+	if (atomic_dec_and_test(&rcu_barrier_cpu_count))
+		complete(&rcu_barrier_completion);
+}
+
+/*
+ * Called with preemption disabled, and from cross-cpu IRQ context.
+ */
+static void rcu_barrier_func(void *notused)
+{
+	atomic_inc(&rcu_barrier_cpu_count);
+	call_rcu(&per_cpu(rcu_barrier_head, smp_processor_id()),
+		 rcu_barrier_callback);
+}
+
+/**
+ * rcu_barrier - wait until all the in-flight RCU callbacks have run.
+ *
+ * Unlike synchronize_kernel(), which only waits for a grace period, this
+ * also waits for the callbacks queued before it to be invoked.  Modules
+ * that free objects through call_rcu() need it before destroying the
+ * slab cache the objects came from.
+ */
+void rcu_barrier(void)
+{
+	BUG_ON(in_interrupt());
+	down(&rcu_barrier_sema);
+	init_completion(&rcu_barrier_completion);
+	atomic_set(&rcu_barrier_cpu_count, 0);
+	on_each_cpu(rcu_barrier_func, NULL, 0, 1);
+	wait_for_completion(&rcu_barrier_completion);
+	up(&rcu_barrier_sema);
+}
+
 module_param(maxbatch, int, 0);
 EXPORT_SYMBOL(call_rcu);
 EXPORT_SYMBOL(call_rcu_bh);
 EXPORT_SYMBOL(synchronize_kernel);
+EXPORT_SYMBOL(rcu_barrier);
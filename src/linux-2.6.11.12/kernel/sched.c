@@ -3230,6 +3230,14 @@ asmlinkage void __sched schedule(void)
 	}
 	profile_hit(SCHED_PROFILING, __builtin_return_address(0));
 
+	/*
+	 * Nobody else can start the requests on our plug: hand them to
+	 * their queues before going to sleep on them.
+	 */
+	if (current->state != TASK_RUNNING &&
+	    !(preempt_count() & PREEMPT_ACTIVE))
+		blk_flush_plug(current);
+
 need_resched:
 	/**
 	 * ȽֹռٳʼһЩ
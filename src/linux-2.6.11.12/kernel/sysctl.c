@@ -65,6 +65,8 @@ extern int min_free_kbytes;
 extern int printk_ratelimit_jiffies;
 extern int printk_ratelimit_burst;
 extern int pid_max_min, pid_max_max;
+extern int proc_nr_files(ctl_table *, int, struct file *,
+			 void __user *, size_t *, loff_t *);
 
 #if defined(CONFIG_X86_LOCAL_APIC) && defined(CONFIG_X86)
 int unknown_nmi_panic;
@@ -762,6 +764,15 @@ static ctl_table vm_table[] = {
 		.strategy	= &sysctl_intvec,
 		.extra1		= &zero,
 	},
+	{
+		.ctl_name	= VM_PERCPU_PAGELIST_FRACTION,
+		.procname	= "percpu_pagelist_fraction",
+		.data		= &percpu_pagelist_fraction,
+		.maxlen		= sizeof(percpu_pagelist_fraction),
+		.mode		= 0644,
+		.proc_handler	= &percpu_pagelist_fraction_sysctl_handler,
+		.extra1		= &zero,
+	},
 #ifdef CONFIG_MMU
 	{
 		.ctl_name	= VM_MAX_MAP_COUNT,
@@ -855,7 +866,7 @@ static ctl_table fs_table[] = {
 		.data		= &files_stat,
 		.maxlen		= 3*sizeof(int),
 		.mode		= 0444,
-		.proc_handler	= &proc_dointvec,
+		.proc_handler	= &proc_nr_files,
 	},
 	{
 		.ctl_name	= FS_MAXFILE,
@@ -871,7 +882,34 @@ static ctl_table fs_table[] = {
 		.data		= &dentry_stat,
 		.maxlen		= 6*sizeof(int),
 		.mode		= 0444,
-		.proc_handler	= &proc_dointvec,
+		.proc_handler	= &proc_dentry_state,
+	},
+	{
+		.ctl_name	= FS_DENTRY_NEG_MAX,
+		.procname	= "dentry-negative-max",
+		.data		= &sysctl_dentry_negative_max,
+		.maxlen		= sizeof(sysctl_dentry_negative_max),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{
+		.ctl_name	= FS_DENTRY_NEG_PRESSURE,
+		.procname	= "dentry-negative-pressure",
+		.data		= &sysctl_dentry_negative_pressure,
+		.maxlen		= sizeof(sysctl_dentry_negative_pressure),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{
+		.ctl_name	= FS_DENTRY_NEG_LOOKUPS,
+		.procname	= "dentry-negative-lookups",
+		.maxlen		= 2*sizeof(unsigned long),
+		.mode		= 0444,
+		.proc_handler	= &proc_dentry_neg_lookups,
 	},
 	{
 		.ctl_name	= FS_OVERFLOWUID,
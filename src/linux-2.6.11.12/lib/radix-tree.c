@@ -29,6 +29,7 @@
 #include <linux/gfp.h>
 #include <linux/string.h>
 #include <linux/bitops.h>
+#include <linux/rcupdate.h>
 
 
 #ifdef __KERNEL__
@@ -65,6 +66,12 @@ struct radix_tree_node {
 	 * õͨoffset趨Ӧλμtag_set()tag_clear()
 	 */
 	unsigned long	tags[RADIX_TREE_TAGS][RADIX_TREE_TAG_LONGS];
+	/*
+	 * Levels from this node down to the items, inclusive.  Lockless
+	 * readers use this instead of root->height.
+	 */
+	unsigned int	height;
+	struct rcu_head	rcu_head;
 };
 
 struct radix_tree_path {
@@ -118,10 +125,22 @@ radix_tree_node_alloc(struct radix_tree_root *root)
 	return ret;
 }
 
+static void radix_tree_node_rcu_free(struct rcu_head *head)
+{
+	struct radix_tree_node *node =
+			container_of(head, struct radix_tree_node, rcu_head);
+	kmem_cache_free(radix_tree_node_cachep, node);
+}
+
+/*
+ * Lockless readers may still be walking the node, so defer the free
+ * until they are done.  The node is already empty, as the slab
+ * constructor expects.
+ */
 static inline void
 radix_tree_node_free(struct radix_tree_node *node)
 {
-	kmem_cache_free(radix_tree_node_cachep, node);
+	call_rcu(&node->rcu_head, radix_tree_node_rcu_free);
 }
 
 /*
@@ -230,7 +249,8 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 		}
 
 		node->count = 1;
-		root->rnode = node;
+		node->height = root->height + 1;
+		rcu_assign_pointer(root->rnode, node);
 		root->height++;
 	} while (height > root->height);
 out:
@@ -285,7 +305,8 @@ int radix_tree_insert(struct radix_tree_root *root,
 			 */
 			if (!(tmp = radix_tree_node_alloc(root))) /**/
 				return -ENOMEM;
-			*slot = tmp;
+			tmp->height = height;
+			rcu_assign_pointer(*slot, tmp);
 			if (node)
 				node->count++;
 		}
@@ -309,42 +330,75 @@ int radix_tree_insert(struct radix_tree_root *root,
 		BUG_ON(tag_get(node, 1, offset));
 	}
 
-	*slot = item;
+	rcu_assign_pointer(*slot, item);
 	return 0;
 }
 EXPORT_SYMBOL(radix_tree_insert);
 
-/**
- *	radix_tree_lookup    -    perform lookup operation on a radix tree
- *	@root:		radix tree root
- *	@index:		index key
- *
- *	Lookup the item at the position @index in the radix tree @root.
+/*
+ * Walk down to the slot for @index.  Safe under rcu_read_lock(): the
+ * height is taken from the node we start at rather than from the root,
+ * so a concurrent radix_tree_extend() cannot make us descend too few
+ * levels, and each child pointer is read exactly once.
  */
-void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+static void **__lookup_slot(struct radix_tree_root *root, unsigned long index)
 {
 	unsigned int height, shift;
-	struct radix_tree_node **slot;
+	struct radix_tree_node *node, **slot;
 
-	height = root->height;
+	node = rcu_dereference(root->rnode);
+	if (node == NULL)
+		return NULL;
+
+	height = node->height;
 	if (index > radix_tree_maxindex(height))
 		return NULL;
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
-	slot = &root->rnode;
-
-	while (height > 0) {
-		if (*slot == NULL)
-			return NULL;
 
+	do {
 		slot = (struct radix_tree_node **)
-			((*slot)->slots +
+			(node->slots +
 				((index >> shift) & RADIX_TREE_MAP_MASK)); /*"& RADIX_TREE_MAP_MASK"6λϵĲ֣õһ0~63ֵ*/
+		node = rcu_dereference(*slot);
+		if (node == NULL)
+			return NULL;
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
-	}
+	} while (height > 0);
+
+	return (void **)slot;
+}
+
+/**
+ *	radix_tree_lookup_slot    -    lookup a slot in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *
+ *	Lookup the slot corresponding to the position @index in the radix tree
+ *	@root.  This is useful for update-if-exists operations, and for
+ *	lockless readers which have to recheck the slot after pinning the
+ *	item they found there.
+ */
+void **radix_tree_lookup_slot(struct radix_tree_root *root, unsigned long index)
+{
+	return __lookup_slot(root, index);
+}
+EXPORT_SYMBOL(radix_tree_lookup_slot);
 
-	return *slot;  /*ע⣬صslots[i]ָָ룬slotsָ롣磬ҳĻһpageָ*/
+/**
+ *	radix_tree_lookup    -    perform lookup operation on a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *
+ *	Lookup the item at the position @index in the radix tree @root.
+ */
+void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+{
+	void **slot;
+
+	slot = __lookup_slot(root, index);
+	return slot != NULL ? rcu_dereference(*slot) : NULL;  /*ע⣬صslots[i]ָָ룬slotsָ롣磬ҳĻһpageָ*/
 }
 EXPORT_SYMBOL(radix_tree_lookup);
 
@@ -542,45 +596,49 @@ EXPORT_SYMBOL(radix_tree_tag_get);
 #endif
 
 static unsigned int
-__lookup(struct radix_tree_root *root, void **results, unsigned long index,
+__lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
 	unsigned int max_items, unsigned long *next_index)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift;
-	unsigned int height = root->height;
-	struct radix_tree_node *slot;
+	unsigned int height = slot->height;
+	unsigned long i;
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
-	slot = root->rnode;
 
-	while (height > 0) {
-		unsigned long i = (index >> shift) & RADIX_TREE_MAP_MASK;
-
-		for ( ; i < RADIX_TREE_MAP_SIZE; i++) {
+	for ( ; height > 1; height--) {
+		i = (index >> shift) & RADIX_TREE_MAP_MASK;
+		for (;;) {
 			if (slot->slots[i] != NULL)
 				break;
 			index &= ~((1UL << shift) - 1);
 			index += 1UL << shift;
 			if (index == 0)
 				goto out;	/* 32-bit wraparound */
+			i++;
+			if (i == RADIX_TREE_MAP_SIZE)
+				goto out;
 		}
-		if (i == RADIX_TREE_MAP_SIZE)
+
+		shift -= RADIX_TREE_MAP_SHIFT;
+		/*
+		 * Read the child once: a lockless walk may race with a delete
+		 * emptying the slot we just looked at.  The caller restarts
+		 * from *next_index and will skip it next time round.
+		 */
+		slot = rcu_dereference(slot->slots[i]);
+		if (slot == NULL)
 			goto out;
-		height--;
-		if (height == 0) {	/* Bottom level: grab some items */
-			unsigned long j = index & RADIX_TREE_MAP_MASK;
+	}
 
-			for ( ; j < RADIX_TREE_MAP_SIZE; j++) {
-				index++;
-				if (slot->slots[j]) {
-					results[nr_found++] = slot->slots[j];
-					if (nr_found == max_items)
-						goto out;
-				}
-			}
+	/* Bottom level: grab some items */
+	for (i = index & RADIX_TREE_MAP_MASK; i < RADIX_TREE_MAP_SIZE; i++) {
+		index++;
+		if (slot->slots[i]) {
+			results[nr_found++] = &(slot->slots[i]);
+			if (nr_found == max_items)
+				goto out;
 		}
-		shift -= RADIX_TREE_MAP_SHIFT;
-		slot = slot->slots[i];
 	}
 out:
 	*next_index = index;
@@ -604,18 +662,38 @@ unsigned int
 radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 			unsigned long first_index, unsigned int max_items)
 {
-	const unsigned long max_index = radix_tree_maxindex(root->height);
+	unsigned long max_index;
+	struct radix_tree_node *node;
 	unsigned long cur_index = first_index;
 	unsigned int ret = 0;
 
+	node = rcu_dereference(root->rnode);
+	if (!node)
+		return 0;
+
+	max_index = radix_tree_maxindex(node->height);
 	while (ret < max_items) {
-		unsigned int nr_found;
+		unsigned int nr_found, slots_found, i;
 		unsigned long next_index;	/* Index of next search */
 
 		if (cur_index > max_index)
 			break;
-		nr_found = __lookup(root, results + ret, cur_index,
+		slots_found = __lookup(node, (void ***)results + ret, cur_index,
 					max_items - ret, &next_index);
+		/*
+		 * __lookup() hands back slots; turn them into items, dropping
+		 * any that were deleted since it looked.
+		 */
+		nr_found = 0;
+		for (i = 0; i < slots_found; i++) {
+			void *item;
+
+			item = rcu_dereference(*(((void ***)results)[ret + i]));
+			if (!item)
+				continue;
+			results[ret + nr_found] = item;
+			nr_found++;
+		}
 		ret += nr_found;
 		if (next_index == 0)
 			break;
@@ -625,13 +703,69 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 }
 EXPORT_SYMBOL(radix_tree_gang_lookup);
 
+/**
+ *	radix_tree_gang_lookup_slot - perform multiple slot lookup on radix tree
+ *	@root:		radix tree root
+ *	@results:	where the results of the lookup are placed
+ *	@first_index:	start the lookup from this key
+ *	@max_items:	place up to this many items at *results
+ *
+ *	Like radix_tree_gang_lookup(), but returns the slots holding the
+ *	items.  Under rcu_read_lock() a returned slot may already be empty;
+ *	use radix_tree_deref_slot() to read it.
+ */
+unsigned int
+radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
+			unsigned long first_index, unsigned int max_items)
+{
+	unsigned long max_index;
+	struct radix_tree_node *node;
+	unsigned long cur_index = first_index;
+	unsigned int ret = 0;
+
+	node = rcu_dereference(root->rnode);
+	if (!node)
+		return 0;
+
+	max_index = radix_tree_maxindex(node->height);
+	while (ret < max_items) {
+		unsigned int slots_found;
+		unsigned long next_index;	/* Index of next search */
+
+		if (cur_index > max_index)
+			break;
+		slots_found = __lookup(node, results + ret, cur_index,
+					max_items - ret, &next_index);
+		ret += slots_found;
+		if (next_index == 0)
+			break;
+		cur_index = next_index;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(radix_tree_gang_lookup_slot);
+
 /*
- * FIXME: the two tag_get()s here should use find_next_bit() instead of
- * open-coding the search.
+ * Find the first slot at or after @offset in @node which has @tag set,
+ * or RADIX_TREE_MAP_SIZE if there is none.  A clear tag bit means the
+ * whole subtree below that slot is untagged, so this is what lets a scan
+ * of a huge, sparsely tagged tree skip clean subtrees a word at a time.
  */
+static inline unsigned long
+next_tagged_slot(struct radix_tree_node *node, int tag, unsigned long offset)
+{
+	unsigned long ret;
+
+	if (offset >= RADIX_TREE_MAP_SIZE)
+		return RADIX_TREE_MAP_SIZE;
+	ret = find_next_bit(node->tags[tag], RADIX_TREE_MAP_SIZE, offset);
+	return min(ret, RADIX_TREE_MAP_SIZE);
+}
+
 static unsigned int
 __lookup_tag(struct radix_tree_root *root, void **results, unsigned long index,
-	unsigned int max_items, unsigned long *next_index, int tag)
+	unsigned long last_index, unsigned int max_items,
+	unsigned long *next_index, int tag)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift;
@@ -643,33 +777,40 @@ __lookup_tag(struct radix_tree_root *root, void **results, unsigned long index,
 
 	while (height > 0) {
 		unsigned long i = (index >> shift) & RADIX_TREE_MAP_MASK;
+		unsigned long j;
 
-		for ( ; i < RADIX_TREE_MAP_SIZE; i++) {
-			if (tag_get(slot, tag, i)) {
-				BUG_ON(slot->slots[i] == NULL);
-				break;
-			}
+		/* Skip the untagged subtrees in front of us in one go */
+		j = next_tagged_slot(slot, tag, i);
+		if (j != i) {
 			index &= ~((1UL << shift) - 1);
-			index += 1UL << shift;
+			index += (j - i) << shift;
 			if (index == 0)
 				goto out;	/* 32-bit wraparound */
+			if (j == RADIX_TREE_MAP_SIZE)
+				goto out;
+			i = j;
 		}
-		if (i == RADIX_TREE_MAP_SIZE)
+		if (index > last_index)
 			goto out;
-		height--;
-		if (height == 0) {	/* Bottom level: grab some items */
-			unsigned long j = index & RADIX_TREE_MAP_MASK;
+		BUG_ON(slot->slots[i] == NULL);
 
-			for ( ; j < RADIX_TREE_MAP_SIZE; j++) {
+		if (height == 1) {	/* Bottom level: grab some items */
+			for (;;) {
+				results[nr_found++] = slot->slots[i];
 				index++;
-				if (tag_get(slot, tag, j)) {
-					BUG_ON(slot->slots[j] == NULL);
-					results[nr_found++] = slot->slots[j];
-					if (nr_found == max_items)
-						goto out;
-				}
+				if (nr_found == max_items)
+					goto out;
+				j = next_tagged_slot(slot, tag, i + 1);
+				index += j - (i + 1);
+				if (index == 0)
+					goto out;	/* 32-bit wraparound */
+				if (j == RADIX_TREE_MAP_SIZE || index > last_index)
+					goto out;
+				BUG_ON(slot->slots[j] == NULL);
+				i = j;
 			}
 		}
+		height--;
 		shift -= RADIX_TREE_MAP_SHIFT;
 		slot = slot->slots[i];
 	}
@@ -679,21 +820,25 @@ out:
 }
 
 /**
- *	radix_tree_gang_lookup_tag - perform multiple lookup on a radix tree
- *	                             based on a tag
+ *	radix_tree_gang_lookup_tag_range - perform multiple lookup on a radix
+ *	                                   tree based on a tag, within a range
  *	@root:		radix tree root
  *	@results:	where the results of the lookup are placed
  *	@first_index:	start the lookup from this key
+ *	@last_index:	don't return items beyond this key
  *	@max_items:	place up to this many items at *results
  *	@tag:		the tag index
  *
- *	Performs an index-ascending scan of the tree for present items which
- *	have the tag indexed by @tag set.  Places the items at *@results and
- *	returns the number of items which were placed at *@results.
+ *	Performs an index-ascending scan of the tree for present items in
+ *	[@first_index, @last_index] which have the tag indexed by @tag set.
+ *	Places the items at *@results and returns the number of items which
+ *	were placed at *@results.  The scan stops as soon as it passes
+ *	@last_index, so asking for a small range of a huge tree is cheap.
  */
 unsigned int
-radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
-		unsigned long first_index, unsigned int max_items, int tag)
+radix_tree_gang_lookup_tag_range(struct radix_tree_root *root, void **results,
+		unsigned long first_index, unsigned long last_index,
+		unsigned int max_items, int tag)
 {
 	const unsigned long max_index = radix_tree_maxindex(root->height);
 	unsigned long cur_index = first_index;
@@ -703,10 +848,11 @@ radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
 		unsigned int nr_found;
 		unsigned long next_index;	/* Index of next search */
 
-		if (cur_index > max_index)
+		if (cur_index > max_index || cur_index > last_index)
 			break;
 		nr_found = __lookup_tag(root, results + ret, cur_index,
-					max_items - ret, &next_index, tag);
+					last_index, max_items - ret,
+					&next_index, tag);
 		ret += nr_found;
 		if (next_index == 0)
 			break;
@@ -714,6 +860,28 @@ radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
 	}
 	return ret;
 }
+EXPORT_SYMBOL(radix_tree_gang_lookup_tag_range);
+
+/**
+ *	radix_tree_gang_lookup_tag - perform multiple lookup on a radix tree
+ *	                             based on a tag
+ *	@root:		radix tree root
+ *	@results:	where the results of the lookup are placed
+ *	@first_index:	start the lookup from this key
+ *	@max_items:	place up to this many items at *results
+ *	@tag:		the tag index
+ *
+ *	Performs an index-ascending scan of the tree for present items which
+ *	have the tag indexed by @tag set.  Places the items at *@results and
+ *	returns the number of items which were placed at *@results.
+ */
+unsigned int
+radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
+		unsigned long first_index, unsigned int max_items, int tag)
+{
+	return radix_tree_gang_lookup_tag_range(root, results, first_index,
+						~0UL, max_items, tag);
+}
 EXPORT_SYMBOL(radix_tree_gang_lookup_tag);
 
 /**
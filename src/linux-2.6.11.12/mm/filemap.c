@@ -252,18 +252,14 @@ static int wait_on_page_writeback_range(struct address_space *mapping,
 	pagevec_init(&pvec, 0);
 	index = start;
 	while ((index <= end) &&
-			(nr_pages = pagevec_lookup_tag(&pvec, mapping, &index, /*pvec */
-			PAGECACHE_TAG_WRITEBACK,
+			(nr_pages = pagevec_lookup_tag_range(&pvec, mapping, /*pvec */
+			&index, end, PAGECACHE_TAG_WRITEBACK,
 			min(end - index, (pgoff_t)PAGEVEC_SIZE-1) + 1)) != 0) {
 		unsigned i;
 
 		for (i = 0; i < nr_pages; i++) {
 			struct page *page = pvec.pages[i];
 
-			/* until radix tree lookup accepts end_index */
-			if (page->index > end)
-				continue;
-
 			wait_on_page_writeback(page); /**/
 			if (PageError(page))
 				ret = -EIO;
@@ -397,11 +393,29 @@ int add_to_page_cache(struct page *page, struct address_space *mapping,
 	 * radix_tree_node_cachepԤ䲻ɹadd_to_page_cacheֹش-ENOMEM
 	 */
 	int error = radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM);
+	int locked;
 
 	/*
 	 * radix_tree_preload ɹڵ
 	 */
 	if (error == 0) {
+		/**
+		 * ҳµģʹЧҳPG_locked־ֹں·ʸҳ
+		 * Lockless lookups may find the page as soon as it is in the
+		 * tree, so it is locked, referenced and pointed at its mapping
+		 * before the insert.  A caller that already holds the page
+		 * locked keeps its lock if the insert fails.
+		 */
+		locked = !TestSetPageLocked(page);
+		/**
+		 * ҳʹü
+		 */
+		page_cache_get(page);
+		/**
+		 * ʹmapping offset ʼpage
+		 */
+		page->mapping = mapping; /**/
+		page->index = offset; /**/
 		/**
 		 * ȡtree_lock
 		 * radix_tree_preloadѾֹںռ
@@ -412,19 +426,6 @@ int add_to_page_cache(struct page *page, struct address_space *mapping,
 		 */
 		error = radix_tree_insert(&mapping->page_tree, offset, page); /**/
 		if (!error) {
-			/**
-			 * ҳʹü
-			 */
-			page_cache_get(page);
-			/**
-			 * ҳµģʹЧҳPG_locked־ֹں·ʸҳ
-			 */
-			SetPageLocked(page);
-			/**
-			 * ʹmapping offset ʼpage
-			 */
-			page->mapping = mapping; /**/
-			page->index = offset; /**/
 			mapping->nrpages++;
 			/**
 			 * ӵַռĻҳļ
@@ -436,6 +437,12 @@ int add_to_page_cache(struct page *page, struct address_space *mapping,
 		 */
 		spin_unlock_irq(&mapping->tree_lock);
 		radix_tree_preload_end(); /**/
+		if (error) {
+			page->mapping = NULL;
+			if (locked)
+				ClearPageLocked(page);
+			page_cache_release(page);
+		}
 	}
 	return error;
 }
@@ -569,26 +576,30 @@ EXPORT_SYMBOL(__lock_page);
  */
 struct page * find_get_page(struct address_space *mapping, unsigned long offset)
 {
+	void **pagep;
 	struct page *page;
 
-	/**
-	 * Ȼȡ
-	 */
-	spin_lock_irq(&mapping->tree_lock);
-	/**
-	 * radix_tree_lookupӵָƫĻҶӽڵ㡣
-	 * ƫֵеλδʼָ룬򷵻NULL򣬷Ҷӽڵĵַ
-	 */
-	page = radix_tree_lookup(&mapping->page_tree, offset);
-	/**
-	 * ҵҪҳӸҳʹü
-	 */
-	if (page)
-		page_cache_get(page);
-	/**
-	 * ͷŻҳַ
-	 */
-	spin_unlock_irq(&mapping->tree_lock);
+	page_cache_read_lock(mapping);
+repeat:
+	page = NULL;
+	pagep = radix_tree_lookup_slot(&mapping->page_tree, offset);
+	if (pagep) {
+		page = radix_tree_deref_slot(pagep);
+		if (unlikely(!page))
+			goto out;
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+		/*
+		 * Has the page moved?  It may have been truncated or
+		 * reclaimed, and even reused, before we got the reference.
+		 */
+		if (unlikely(page != *pagep)) {
+			page_cache_release(page);
+			goto repeat;
+		}
+	}
+out:
+	page_cache_read_unlock(mapping);
 	return page;
 }
 
@@ -633,25 +644,17 @@ struct page *find_lock_page(struct address_space *mapping,
 {
 	struct page *page;
 
-	spin_lock_irq(&mapping->tree_lock);
 repeat:
-	page = radix_tree_lookup(&mapping->page_tree, offset); /**/
+	page = find_get_page(mapping, offset);
 	if (page) {
-		page_cache_get(page);
-		if (TestSetPageLocked(page)) {/* Ѿס */
-			spin_unlock_irq(&mapping->tree_lock);/* ͷΪlock_pageܻᱻȳ */
-			lock_page(page); /* סҳ */
-			spin_lock_irq(&mapping->tree_lock);
-
-			/* Has the page been truncated while we slept? */
-			if (page->mapping != mapping || page->index != offset) {/* ȷ˯߹Уҳûз仯 */
-				unlock_page(page);
-				page_cache_release(page);
-				goto repeat;
-			}
+		lock_page(page);
+		/* Has the page been truncated before we got the lock? */
+		if (unlikely(page->mapping != mapping || page->index != offset)) {
+			unlock_page(page);
+			page_cache_release(page);
+			goto repeat;
 		}
 	}
-	spin_unlock_irq(&mapping->tree_lock);
 	return page;
 }
 
@@ -734,17 +737,34 @@ unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 {
 	unsigned int i;
 	unsigned int ret;
+	unsigned int nr_found;
 
-	spin_lock_irq(&mapping->tree_lock);
-	/**
-	 * radix_tree_gang_lookupʵĲҲΪָ鸳ֵҵҳ
-	 * һЩҳܲҳٻУԽлֿȱҳǷصҳֵǵġ
-	 */
-	ret = radix_tree_gang_lookup(&mapping->page_tree,
-				(void **)pages, start, nr_pages);
-	for (i = 0; i < ret; i++)
-		page_cache_get(pages[i]);
-	spin_unlock_irq(&mapping->tree_lock);
+	page_cache_read_lock(mapping);
+	/*
+	 * The slots are looked up into @pages and then replaced in place by
+	 * the pages we managed to pin, so ret never overtakes i.
+	 */
+	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				(void ***)pages, start, nr_pages);
+	ret = 0;
+	for (i = 0; i < nr_found; i++) {
+		void **pagep = (void **)pages[i];
+		struct page *page;
+repeat:
+		page = radix_tree_deref_slot(pagep);
+		if (unlikely(!page))
+			continue;
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+		/* Has the page moved? */
+		if (unlikely(page != *pagep)) {
+			page_cache_release(page);
+			goto repeat;
+		}
+		pages[ret] = page;
+		ret++;
+	}
+	page_cache_read_unlock(mapping);
 	return ret;
 }
 
@@ -758,13 +778,26 @@ unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
  */
 unsigned find_get_pages_tag(struct address_space *mapping, pgoff_t *index,
 			int tag, unsigned int nr_pages, struct page **pages)
+{
+	return find_get_pages_tag_range(mapping, index, (pgoff_t)-1, tag,
+					nr_pages, pages);
+}
+
+/*
+ * As find_get_pages_tag, but never returns pages beyond index @end.  The
+ * radix tree walk itself stops at @end, so writeback of a small range of
+ * a huge file does not scan the tags of the rest of it.
+ */
+unsigned find_get_pages_tag_range(struct address_space *mapping,
+			pgoff_t *index, pgoff_t end, int tag,
+			unsigned int nr_pages, struct page **pages)
 {
 	unsigned int i;
 	unsigned int ret;
 
 	spin_lock_irq(&mapping->tree_lock);
-	ret = radix_tree_gang_lookup_tag(&mapping->page_tree,
-				(void **)pages, *index, nr_pages, tag);
+	ret = radix_tree_gang_lookup_tag_range(&mapping->page_tree,
+				(void **)pages, *index, end, nr_pages, tag);
 	for (i = 0; i < ret; i++)
 		page_cache_get(pages[i]);
 	if (ret)
@@ -834,8 +867,7 @@ void do_generic_mapping_read(struct address_space *mapping,
 	unsigned long index;
 	unsigned long end_index;
 	unsigned long offset;
-	unsigned long req_size;
-	unsigned long next_index;
+	unsigned long last_index;
 	unsigned long prev_index;
 	loff_t isize;
 	struct page *cached_page;
@@ -850,9 +882,8 @@ void do_generic_mapping_read(struct address_space *mapping,
 	 * ļָ*pposһֽҳ߼,ַռеҳ,index
 	 */
 	index = *ppos >> PAGE_CACHE_SHIFT; 
-	next_index = index;
 	prev_index = ra.prev_page;
-	req_size = (desc->count + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	last_index = (*ppos + desc->count + PAGE_CACHE_SIZE-1) >> PAGE_CACHE_SHIFT;
 	/**
 	 * Ҳѵһֽҳڵƫoffsetֲ.
 	 */
@@ -868,7 +899,7 @@ void do_generic_mapping_read(struct address_space *mapping,
 	 */
 	for (;;) {
 		struct page *page;
-		unsigned long ret_size, nr, ret;
+		unsigned long nr, ret;
 
 		/* nr is the maximum number of bytes to copy from this page */
 		/**
@@ -907,15 +938,6 @@ void do_generic_mapping_read(struct address_space *mapping,
 		 * ǰ̵TIF_NEED_RESCHED,λ,ͽһε.
 		 */
 		cond_resched();
-		/**
-		 * Ԥҳ,͵page_cache_readaheadЩҳ
-		 */
-		if (index == next_index && req_size) {
-			ret_size = page_cache_readahead(mapping, &ra,
-					filp, index, req_size); /**/
-			next_index += ret_size;
-			req_size -= ret_size;
-		}
 
 find_page:
 		/**
@@ -926,14 +948,21 @@ find_page:
 		 * page==NULLʾҳڸٻ
 		 */
 		if (unlikely(page == NULL)) {
-			/**
-			 * handle_ra_missԤ.
-			 */
-			handle_ra_miss(mapping, &ra, index); /**/
+			page_cache_sync_readahead(mapping, &ra, filp,
+					index, last_index - index);
+			page = find_get_page(mapping, index);
 			/*
-			 * תno_cached_pageǴ
+			 * Ԥûܰҳҳʧܣתno_cached_pageǴ
 			 */
-			goto no_cached_page;
+			if (unlikely(page == NULL))
+				goto no_cached_page;
+		}
+		/*
+		 * ߵԤҳ˵ǰڱģǰ첽ύһ
+		 */
+		if (PageReadahead(page)) {
+			page_cache_async_readahead(mapping, &ra, filp, page,
+					index, last_index - index);
 		}
 
 		/**
@@ -1159,6 +1188,7 @@ out:
 	 * Ļ˵ԶѾ,͸Ԥݽṹfilp->f_raѾ˳ļ(μļԤ).
 	 */	
 	*_ra = ra;
+	_ra->prev_page = prev_index;
 
 	/**
 	 * index*4096+offsetֵ*ppos,ӶԺread()write()˳ʵλ
@@ -1562,18 +1592,6 @@ retry_all:
 	if (size > endoff)
 		size = endoff;
 
-	/*
-	 * The readahead code wants to be told about each and every page
-	 * so it can build and shrink its windows appropriately
-	 *
-	 * For sequential accesses, we use the generic readahead logic.
-	 */
-	/**
-	 * ļVM_SEQ_READôҪԤ
-	 */
-	if (VM_SequentialReadHint(area))
-		page_cache_readahead(mapping, ra, file, pgoff, 1);
-
 	/*
 	 * Do we have something in the page cache already?
 	 */
@@ -1593,11 +1611,13 @@ retry_find:
 		 */
 		if (VM_SequentialReadHint(area)) {
 			/**
-			 * ñ־λҳûڻУ˵Ԥ㷨ʧܣں˻ǿԤеҳ
-			 * handle_ra_missԤ
+			 * ñ־λ˵˳ӳ䣬Ԥ
 			 */
-			handle_ra_miss(mapping, ra, pgoff);
-			goto no_cached_page;
+			page_cache_sync_readahead(mapping, ra, file, pgoff, 1);
+			page = find_get_page(mapping, pgoff);
+			if (!page)
+				goto no_cached_page;
+			goto found;
 		}
 
 		/**
@@ -1634,9 +1654,13 @@ retry_find:
 			if (pgoff > ra_pages / 2)
 				start = pgoff - ra_pages / 2;
 			/**
-			 * do_page_cache_readaheadΧҳǰһҳ
+			 * ΧҳǰһҳĩβһֱΪԤ
+			 * ̽˳ȥת밴Ԥ
 			 */
-			do_page_cache_readahead(mapping, file, start, ra_pages);
+			ra->start = start;
+			ra->size = ra_pages;
+			ra->async_size = ra_pages / 4;
+			ra_submit(ra, mapping, file);
 		}
 		/**
 		 * ٴεfind_get_pageҳٻвҳ
@@ -1652,6 +1676,13 @@ retry_find:
 	if (!did_readaround)
 		ra->mmap_hit++;
 
+found:
+	/**
+	 * ҳԤǣ˵Ԥڱģǰύһڡ
+	 */
+	if (PageReadahead(page))
+		page_cache_async_readahead(mapping, ra, file, page, pgoff, 1);
+
 	/*
 	 * Ok, found a page in the page cache, now we need to check
 	 * that it's up-to-date.
@@ -46,6 +46,7 @@
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
+#include <linux/mempolicy.h>
 #include <linux/acct.h>
 #include <linux/module.h>
 #include <linux/init.h>
@@ -2469,6 +2470,147 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
 	return VM_FAULT_OOM;
 }
 
+/*
+ * Bound on the VMA tree walk done without mmap_sem: a concurrent
+ * rebalance may send the walk astray, and although the sequence
+ * check catches that afterwards the walk itself must terminate.
+ */
+#define SPECULATIVE_WALK_MAX	64
+
+/*
+ * Handle a not-present fault on private anonymous memory without
+ * taking mmap_sem.
+ *
+ * The VMA is found under rcu_read_lock() and is only trusted once
+ * mm->vma_seq has been rechecked with page_table_lock held.  Every VMA
+ * change bumps that count before the page tables of the range are
+ * touched under page_table_lock, so a fault that still sees the same
+ * count there is ordered before the change, exactly as if it had held
+ * mmap_sem for read.
+ *
+ * Only first-touch faults on VMAs that already have an anon_vma and
+ * whose page tables are populated are handled here, and nothing in this
+ * path sleeps.  Returns 1 if the fault was handled, 0 if the caller must
+ * take mmap_sem and go through handle_mm_fault().
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+		int write_access)
+{
+	struct vm_area_struct *vma;
+	struct rb_node *rb_node;
+	struct page *page = NULL;
+	unsigned int seq;
+	int depth = 0;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+	pte_t entry;
+
+	rcu_read_lock();
+	seq = read_seqcount_begin(&mm->vma_seq);
+	if (seq & 1)
+		goto out;
+
+	vma = mm->mmap_cache;
+	if (!vma || vma->vm_end <= address || vma->vm_start > address) {
+		vma = NULL;
+		rb_node = mm->mm_rb.rb_node;
+		while (rb_node) {
+			struct vm_area_struct *vma_tmp;
+
+			if (++depth > SPECULATIVE_WALK_MAX)
+				goto out;
+			vma_tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+			if (vma_tmp->vm_end > address) {
+				if (vma_tmp->vm_start <= address) {
+					vma = vma_tmp;
+					break;
+				}
+				rb_node = rb_node->rb_left;
+			} else
+				rb_node = rb_node->rb_right;
+		}
+		if (!vma)
+			goto out;
+	}
+
+	/* File pages, anon_vma setup and NUMA policies need mmap_sem */
+	if (vma->vm_ops || vma->vm_file || !vma->anon_vma || vma_policy(vma))
+		goto out;
+	if (write_access) {
+		if (!(vma->vm_flags & VM_WRITE))
+			goto out;
+		page = alloc_page_vma((GFP_HIGHUSER & ~__GFP_WAIT) | __GFP_NOWARN,
+				vma, address);
+		if (!page)
+			goto out;
+		clear_user_highpage(page, address);
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC)))
+		goto out;
+
+	spin_lock(&mm->page_table_lock);
+	if (read_seqcount_retry(&mm->vma_seq, seq))
+		goto out_unlock;
+
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_unlock;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out_unlock;
+	pmd = pmd_offset(pud, address);
+	if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd)))
+		goto out_unlock;
+
+	pte = pte_offset_map(pmd, address);
+	entry = *pte;
+	if (!pte_none(entry)) {
+		pte_unmap(pte);
+		/* Another thread populated it first: just retry the access */
+		if (pte_present(entry))
+			goto out_done;
+		goto out_unlock;
+	}
+
+	if (write_access) {
+		mm->rss++;
+		acct_update_integrals();
+		update_mem_hiwater();
+		entry = maybe_mkwrite(pte_mkdirty(mk_pte(page,
+							 vma->vm_page_prot)),
+				      vma);
+		lru_cache_add_active(page);
+		SetPageReferenced(page);
+		page_add_anon_rmap(page, vma, address);
+		page = NULL;
+	} else
+		entry = pte_wrprotect(mk_pte(ZERO_PAGE(address),
+					     vma->vm_page_prot));
+	set_pte(pte, entry);
+	pte_unmap(pte);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, entry);
+out_done:
+	spin_unlock(&mm->page_table_lock);
+	rcu_read_unlock();
+	if (page)
+		page_cache_release(page);
+	inc_page_state(pgfault);
+	inc_page_state(pgfault_spec);
+	return 1;
+
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+out:
+	rcu_read_unlock();
+	if (page)
+		page_cache_release(page);
+	inc_page_state(pgfault_spec_retry);
+	return 0;
+}
+
 #ifndef __ARCH_HAS_4LEVEL_HACK
 /*
  * Allocate page upper directory.
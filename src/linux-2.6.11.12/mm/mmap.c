@@ -179,6 +179,24 @@ static void __remove_shared_vm_struct(struct vm_area_struct *vma,
 	flush_dcache_mmap_unlock(mapping);
 }
 
+static void free_vma_rcu(struct rcu_head *head)
+{
+	struct vm_area_struct *vma =
+		container_of(head, struct vm_area_struct, vm_rcu);
+
+	kmem_cache_free(vm_area_cachep, vma);
+}
+
+/*
+ * Free a VMA that has been visible in an mm's VMA tree.  The
+ * speculative fault path walks the tree under rcu_read_lock() only,
+ * so the structure must stay around until a grace period has passed.
+ */
+void free_vma(struct vm_area_struct *vma)
+{
+	call_rcu(&vma->vm_rcu, free_vma_rcu);
+}
+
 /*
  * Remove one vm structure and free it.
  */
@@ -202,7 +220,7 @@ static void remove_vm_struct(struct vm_area_struct *vma)
 	anon_vma_unlink(vma);
 	mpol_free(vma_policy(vma));
     /*kmem_cache_free()ͷ*/
-	kmem_cache_free(vm_area_cachep, vma);
+	free_vma(vma);
 }
 
 /*
@@ -412,10 +430,12 @@ __vma_link_list(struct mm_struct *mm, struct vm_area_struct *vma,
 void __vma_link_rb(struct mm_struct *mm, struct vm_area_struct *vma,
 		struct rb_node **rb_link, struct rb_node *rb_parent)
 {
+	vma_write_begin(mm);
     /*ʼvmarbnode*/
 	rb_link_node(&vma->vm_rb, rb_parent, rb_link);
     /*½ڵ*/
 	rb_insert_color(&vma->vm_rb, &mm->mm_rb);
+	vma_write_end(mm);
 }
 
 static inline void __vma_link_file(struct vm_area_struct *vma)
@@ -539,10 +559,12 @@ __vma_unlink(struct mm_struct *mm, struct vm_area_struct *vma,
 	 * ڴɾvma
 	 */
 	prev->vm_next = vma->vm_next;
+	vma_write_begin(mm);
 	/**
 	 * Ӻɾvma
 	 */
 	rb_erase(&vma->vm_rb, &mm->mm_rb);
+	vma_write_end(mm);
 	/**
 	 * mmap_cacheָҪɾͶ¡
 	 */
@@ -578,6 +600,7 @@ void vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	long adjust_next = 0;
 	int remove_next = 0;
 
+	vma_write_begin(mm);
 	if (next && !insert) {
 		if (end >= next->vm_end) {
 			/*
@@ -703,7 +726,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 			fput(file);
 		mm->map_count--;
 		mpol_free(vma_policy(next));
-		kmem_cache_free(vm_area_cachep, next);
+		free_vma(next);
 		/*
 		 * In mprotect's case 6 (see comments on vma_merge),
 		 * we must remove another next too. It would clutter
@@ -714,6 +737,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 			goto again;
 		}
 	}
+	vma_write_end(mm);
 
 	validate_mm(mm);
 }
@@ -2092,6 +2116,7 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
     /*¼ǰһprev vmanextĵַԱи*/
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
 
+	vma_write_begin(mm);
     /*λumapڵvmaһumapvmavm_startһend,ΪǰѾsplit_vmaѺ*/
 	do {
         /*Ӻɾ*/
@@ -2101,6 +2126,7 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 		tail_vma = vma;
 		vma = vma->vm_next;
 	} while (vma && vma->vm_start < end);
+	vma_write_end(mm);
 
     /*prevnextָumapvmavmaϣ൱ڽumapvma*/
 	*insertion_point = vma;
@@ -207,8 +207,10 @@ success:
 	 * vm_flags and vm_page_prot are protected by the mmap_sem
 	 * held in write mode.
 	 */
+	vma_write_begin(mm);
 	vma->vm_flags = newflags;
 	vma->vm_page_prot = newprot;
+	vma_write_end(mm);
 	change_protection(vma, start, end, newprot);
 	__vm_stat_account(mm, oldflags, vma->vm_file, -nrpages);
 	__vm_stat_account(mm, newflags, vma->vm_file, nrpages);
@@ -624,14 +624,21 @@ void __init page_writeback_init(void)
 
 int do_writepages(struct address_space *mapping, struct writeback_control *wbc)
 {
+	struct blk_plug plug;
+	int ret;
+
 	if (wbc->nr_to_write <= 0)
 		return 0;
+	blk_start_plug(&plug);
 	if (mapping->a_ops->writepages)
         /*
          * ext2_writepages
          */
-		return mapping->a_ops->writepages(mapping, wbc); /**/
-	return generic_writepages(mapping, wbc); /**/
+		ret = mapping->a_ops->writepages(mapping, wbc); /**/
+	else
+		ret = generic_writepages(mapping, wbc); /**/
+	blk_finish_plug(&plug);
+	return ret;
 }
 
 /**
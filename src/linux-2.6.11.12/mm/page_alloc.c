@@ -402,6 +402,8 @@ free_pages_bulk(struct zone *zone, int count,
 	return ret;
 }
 
+static void free_pcp_block(struct page *page, unsigned int order);
+
 void __free_pages_ok(struct page *page, unsigned int order)
 {
 	LIST_HEAD(list);
@@ -419,8 +421,14 @@ void __free_pages_ok(struct page *page, unsigned int order)
 
 	for (i = 0 ; i < (1 << order) ; ++i)
 		free_pages_check(__FUNCTION__, page + i);
-	list_add(&page->lru, &list);
 	kernel_map_pages(page, 1<<order, 0);
+	if (order && order <= PCP_MAX_ORDER) {
+		/* The per-CPU lists hold plain blocks, as the buddy does */
+		destroy_compound_page(page, order);
+		free_pcp_block(page, order);
+		return;
+	}
+	list_add(&page->lru, &list);
 	free_pages_bulk(page_zone(page), 1, &list, order);
 }
 
@@ -497,7 +505,8 @@ static void prep_new_page(struct page *page, int order)
 
 	page->flags &= ~(1 << PG_uptodate | 1 << PG_error |
 			1 << PG_referenced | 1 << PG_arch_1 |
-			1 << PG_checked | 1 << PG_mappedtodisk);
+			1 << PG_checked | 1 << PG_mappedtodisk |
+			1 << PG_readahead);
 	page->private = 0;
 	set_page_refs(page, order);
 	kernel_map_pages(page, 1 << order, 1);
@@ -582,6 +591,44 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 	return allocated;
 }
 
+/*
+ * Give the high-order blocks cached in a pageset back to the buddy
+ * allocator, so that they can merge into larger blocks again.  Must be
+ * called on the pageset's own CPU with interrupts disabled, or for a
+ * CPU that is gone.
+ */
+static void drain_highorder_pages(struct zone *zone,
+				struct per_cpu_pageset *pset)
+{
+	int i;
+
+	for (i = 0; i < PCP_MAX_ORDER; i++) {
+		struct per_cpu_pages *pcp = &pset->pcp_order[i];
+
+		if (pcp->count)
+			pcp->count -= free_pages_bulk(zone, pcp->count,
+						&pcp->list, i + 1);
+	}
+}
+
+/*
+ * Called when a high-order allocation is about to reclaim: the blocks
+ * this CPU is sitting on might be exactly what it needs.
+ */
+static void drain_local_highorder_pages(void)
+{
+	unsigned long flags;
+	struct zone *zone;
+	int cpu;
+
+	cpu = get_cpu();
+	local_irq_save(flags);
+	for_each_zone(zone)
+		drain_highorder_pages(zone, &zone->pageset[cpu]);
+	local_irq_restore(flags);
+	put_cpu();
+}
+
 #if defined(CONFIG_PM) || defined(CONFIG_HOTPLUG_CPU)
 static void __drain_pages(unsigned int cpu)
 {
@@ -599,6 +646,7 @@ static void __drain_pages(unsigned int cpu)
 			pcp->count -= free_pages_bulk(zone, pcp->count,
 						&pcp->list, 0);
 		}
+		drain_highorder_pages(zone, pset);
 	}
 }
 #endif /* CONFIG_PM || CONFIG_HOTPLUG_CPU */
@@ -684,6 +732,7 @@ static void fastcall free_hot_cold_page(struct page *page, int cold)
 	 * page_zonepage->flagУpageڵڴ
 	 */
 	struct zone *zone = page_zone(page);
+	struct per_cpu_pageset *pset;
 	struct per_cpu_pages *pcp;
 	unsigned long flags;
 
@@ -697,15 +746,19 @@ static void fastcall free_hot_cold_page(struct page *page, int cold)
 	/**
 	 * ٻ滹ȸٻ??
 	 */
-	pcp = &zone->pageset[get_cpu()].pcp[cold];
+	pset = &zone->pageset[get_cpu()];
+	pcp = &pset->pcp[cold];
 	local_irq_save(flags);
 	/**
 	 * ҳ̫࣬һЩ
 	 * free_pages_bulkЩҳͷŸϵͳ
 	 * ȻҪһcount
 	 */
-	if (pcp->count >= pcp->high)
+	if (pcp->count >= pcp->high) {
 		pcp->count -= free_pages_bulk(zone, pcp->batch, &pcp->list, 0);
+		pset->free_drain++;
+	} else
+		pset->free_hit++;
 	/**
 	 * ͷŵҳӵٻϡcountֶΡ
 	 */
@@ -725,6 +778,32 @@ void fastcall free_cold_page(struct page *page)
 	free_hot_cold_page(page, 1);
 }
 
+/*
+ * Free a block of order 1..PCP_MAX_ORDER to this CPU's list for its
+ * order.  The caller has done the checks __free_pages_ok() does.
+ */
+static void free_pcp_block(struct page *page, unsigned int order)
+{
+	struct zone *zone = page_zone(page);
+	struct per_cpu_pageset *pset;
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+
+	pset = &zone->pageset[get_cpu()];
+	pcp = &pset->pcp_order[order - 1];
+	local_irq_save(flags);
+	if (pcp->count >= pcp->high) {
+		pcp->count -= free_pages_bulk(zone, pcp->batch, &pcp->list,
+						order);
+		pset->free_drain++;
+	} else
+		pset->free_hit++;
+	list_add(&page->lru, &pcp->list);
+	pcp->count++;
+	local_irq_restore(flags);
+	put_cpu();
+}
+
 static inline void prep_zero_page(struct page *page, int order, int gfp_flags)
 {
 	int i;
@@ -756,23 +835,28 @@ buffered_rmqueue(struct zone *zone, int order, int gfp_flags)
 	/**
 	 * order!=0ÿCPUҳٻͲܱʹá
 	 */
-	if (order == 0) {
+	if (order <= PCP_MAX_ORDER) {
+		struct per_cpu_pageset *pset;
 		struct per_cpu_pages *pcp;
 
 		/**
 		 * __GFP_COLD־ʶڴCPUٻǷҪ䡣
 		 * countֶСڻߵlow
 		 */
-		pcp = &zone->pageset[get_cpu()].pcp[cold];
+		pset = &zone->pageset[get_cpu()];
+		pcp = order ? &pset->pcp_order[order - 1] : &pset->pcp[cold];
 		local_irq_save(flags);
 		/**
 		 * ǰеҳlowҪӻϵͳвҳ
 		 * rmqueue_bulkӻϵͳзbatchһҳ
 		 * rmqueue_bulk__rmqueueֱҳﵽlow
 		 */
-		if (pcp->count <= pcp->low)
-			pcp->count += rmqueue_bulk(zone, 0,
+		if (pcp->count <= pcp->low) {
+			pcp->count += rmqueue_bulk(zone, order,
 						pcp->batch, &pcp->list);
+			pset->alloc_refill++;
+		} else
+			pset->alloc_hit++;
 		/**
 		 * countΪӸٻлһҳ
 		 * count1
@@ -1017,6 +1101,9 @@ rebalance:
 	 */
 	cond_resched();
 
+	if (order)
+		drain_local_highorder_pages();
+
 	/* We now go into synchronous reclaim */
 	/**
 	 * PF_MEMALLOC־ʾѾ׼ִڴա
@@ -1872,6 +1959,71 @@ void zone_init_free_lists(struct pglist_data *pgdat, struct zone *zone,
  *   - mark all memory queues empty
  *   - clear the memory bitmaps
  */
+/*
+ * The per-cpu-pages pools are set to around 1000th of the
+ * size of the zone.  But no more than 1/4 of a meg - there's
+ * no point in going beyond the size of L2 cache.
+ *
+ * OK, so we don't know how big the cache is.  So guess.
+ */
+static unsigned long zone_batchsize(struct zone *zone)
+{
+	unsigned long batch;
+
+	batch = zone->present_pages / 1024;
+	if (batch * PAGE_SIZE > 256 * 1024)
+		batch = (256 * 1024) / PAGE_SIZE;
+	batch /= 4;		/* We effectively *= 4 below */
+	if (batch < 1)
+		batch = 1;
+	return batch;
+}
+
+/*
+ * Size all the lists of a pageset from the order-0 batch.  A high-order
+ * list moves blocks of 2^order pages, so its batch shrinks accordingly
+ * and it only refills once empty.  Can be called at runtime: the lists
+ * themselves are left alone and only drain down to the new high mark
+ * as pages are freed.
+ */
+static void pageset_set_batch(struct per_cpu_pageset *p, unsigned long batch)
+{
+	struct per_cpu_pages *pcp;
+	int order;
+
+	pcp = &p->pcp[0];		/* hot */
+	pcp->low = 2 * batch;
+	pcp->high = 6 * batch;
+	pcp->batch = 1 * batch;
+
+	pcp = &p->pcp[1];		/* cold */
+	pcp->low = 0;
+	pcp->high = 2 * batch;
+	pcp->batch = 1 * batch;
+
+	for (order = 1; order <= PCP_MAX_ORDER; order++) {
+		unsigned long b = max(batch >> order, 1UL);
+
+		pcp = &p->pcp_order[order - 1];
+		pcp->low = 0;
+		pcp->high = 2 * b;
+		pcp->batch = b;
+	}
+}
+
+static void __init setup_pageset(struct per_cpu_pageset *p,
+				unsigned long batch)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	for (i = 0; i < ARRAY_SIZE(p->pcp); i++)
+		INIT_LIST_HEAD(&p->pcp[i].list);
+	for (i = 0; i < PCP_MAX_ORDER; i++)
+		INIT_LIST_HEAD(&p->pcp_order[i].list);
+	pageset_set_batch(p, batch);
+}
+
 static void __init free_area_init_core(struct pglist_data *pgdat,
 		unsigned long *zones_size, unsigned long *zholes_size)
 {
@@ -1908,37 +2060,10 @@ static void __init free_area_init_core(struct pglist_data *pgdat,
 
 		zone->temp_priority = zone->prev_priority = DEF_PRIORITY;
 
-		/*
-		 * The per-cpu-pages pools are set to around 1000th of the
-		 * size of the zone.  But no more than 1/4 of a meg - there's
-		 * no point in going beyond the size of L2 cache.
-		 *
-		 * OK, so we don't know how big the cache is.  So guess.
-		 */
-		batch = zone->present_pages / 1024;
-		if (batch * PAGE_SIZE > 256 * 1024)
-			batch = (256 * 1024) / PAGE_SIZE;
-		batch /= 4;		/* We effectively *= 4 below */
-		if (batch < 1)
-			batch = 1;
-
-		for (cpu = 0; cpu < NR_CPUS; cpu++) {
-			struct per_cpu_pages *pcp;
+		batch = zone_batchsize(zone);
 
-			pcp = &zone->pageset[cpu].pcp[0];	/* hot */
-			pcp->count = 0;
-			pcp->low = 2 * batch;
-			pcp->high = 6 * batch;
-			pcp->batch = 1 * batch;
-			INIT_LIST_HEAD(&pcp->list);
-
-			pcp = &zone->pageset[cpu].pcp[1];	/* cold */
-			pcp->count = 0;
-			pcp->low = 0;
-			pcp->high = 2 * batch;
-			pcp->batch = 1 * batch;
-			INIT_LIST_HEAD(&pcp->list);
-		}
+		for (cpu = 0; cpu < NR_CPUS; cpu++)
+			setup_pageset(zone->pageset + cpu, batch);
 		printk(KERN_DEBUG "  %s zone: %lu pages, LIFO batch:%lu\n",
 				zone_names[j], realsize, batch);
 		INIT_LIST_HEAD(&zone->active_list);
@@ -2083,6 +2208,71 @@ struct seq_operations fragmentation_op = {
 	.show	= frag_show,
 };
 
+static void zoneinfo_show_pcp(struct seq_file *m, const char *name,
+				struct per_cpu_pages *pcp)
+{
+	seq_printf(m, "\n    %-6s count: %4d low: %4d high: %4d batch: %4d",
+		   name, pcp->count, pcp->low, pcp->high, pcp->batch);
+}
+
+/*
+ * Per-zone watermarks and, for each CPU, the state of its page lists
+ * and how often they had to go to zone->lock.
+ */
+static int zoneinfo_show(struct seq_file *m, void *arg)
+{
+	static const char *order_names[PCP_MAX_ORDER] = {
+		"order1", "order2", "order3",
+	};
+	pg_data_t *pgdat = (pg_data_t *)arg;
+	struct zone *zone;
+	struct zone *node_zones = pgdat->node_zones;
+	int cpu, i;
+
+	for (zone = node_zones; zone - node_zones < MAX_NR_ZONES; ++zone) {
+		if (!zone->present_pages)
+			continue;
+
+		seq_printf(m, "Node %d, zone %8s", pgdat->node_id, zone->name);
+		seq_printf(m, "\n  pages free %lu min %lu low %lu high %lu"
+			   " present %lu",
+			   zone->free_pages, zone->pages_min, zone->pages_low,
+			   zone->pages_high, zone->present_pages);
+		seq_printf(m, "\n  pagesets");
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			struct per_cpu_pageset *pset;
+			unsigned long allocs;
+
+			if (!cpu_possible(cpu))
+				continue;
+			pset = &zone->pageset[cpu];
+			seq_printf(m, "\n  cpu: %d", cpu);
+			zoneinfo_show_pcp(m, "hot", &pset->pcp[0]);
+			zoneinfo_show_pcp(m, "cold", &pset->pcp[1]);
+			for (i = 0; i < PCP_MAX_ORDER; i++)
+				zoneinfo_show_pcp(m, order_names[i],
+						&pset->pcp_order[i]);
+			allocs = pset->alloc_hit + pset->alloc_refill;
+			seq_printf(m, "\n    alloc  hit: %lu refill: %lu"
+				   " (hit rate %lu%%)",
+				   pset->alloc_hit, pset->alloc_refill,
+				   allocs ? pset->alloc_hit * 100 / allocs : 0);
+			seq_printf(m, "\n    free   hit: %lu drain: %lu",
+				   pset->free_hit, pset->free_drain);
+		}
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+
+struct seq_operations zoneinfo_op = {
+	.start	= frag_start,	/* iterate over all zones. The same as in
+				 * fragmentation. */
+	.next	= frag_next,
+	.stop	= frag_stop,
+	.show	= zoneinfo_show,
+};
+
 static char *vmstat_text[] = {
 	"nr_dirty",
 	"nr_writeback",
@@ -2128,6 +2318,8 @@ static char *vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"pgfault_spec",
+	"pgfault_spec_retry",
 };
 
 static void *vmstat_start(struct seq_file *m, loff_t *pos)
@@ -2370,6 +2562,48 @@ int lowmem_reserve_ratio_sysctl_handler(ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * percpu_pagelist_fraction - changes the size of the per-CPU page lists
+ *	of every zone to 1/fraction of the zone's pages (hot list high
+ *	mark), with batch and the high-order lists scaled from it.  Zero
+ *	restores the boot-time sizes; anything from 1 to 7 would let the
+ *	lists swallow most of a zone and is refused.
+ */
+int percpu_pagelist_fraction;
+
+int percpu_pagelist_fraction_sysctl_handler(ctl_table *table, int write,
+		struct file *file, void __user *buffer, size_t *length,
+		loff_t *ppos)
+{
+	int old = percpu_pagelist_fraction;
+	struct zone *zone;
+	int cpu, ret;
+
+	ret = proc_dointvec_minmax(table, write, file, buffer, length, ppos);
+	if (!write || ret)
+		return ret;
+	if (percpu_pagelist_fraction && percpu_pagelist_fraction < 8) {
+		percpu_pagelist_fraction = old;
+		return -EINVAL;
+	}
+
+	for_each_zone(zone) {
+		unsigned long batch;
+
+		if (percpu_pagelist_fraction) {
+			batch = zone->present_pages / percpu_pagelist_fraction;
+			batch = max(batch / 6, 1UL);
+			/* rmqueue_bulk() moves a batch with irqs off */
+			batch = min(batch, (unsigned long)(PAGE_SHIFT * 8));
+		} else
+			batch = zone_batchsize(zone);
+
+		for (cpu = 0; cpu < NR_CPUS; cpu++)
+			pageset_set_batch(zone->pageset + cpu, batch);
+	}
+	return 0;
+}
+
 __initdata int hashdist = HASHDIST_DEFAULT;
 
 #ifdef CONFIG_NUMA
@@ -14,6 +14,7 @@
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
 #include <linux/pagevec.h>
+#include <linux/pagemap.h>
 
 void default_unplug_io_fn(struct backing_dev_info *bdi, struct page *page)
 {
@@ -55,14 +56,9 @@ static inline unsigned long get_min_readahead(struct file_ra_state *ra)
 	return (VM_MIN_READAHEAD * 1024) / PAGE_CACHE_SIZE;
 }
 
-static inline void ra_off(struct file_ra_state *ra)
+static inline void ra_stat_inc(struct address_space *mapping, int item)
 {
-	ra->start = 0;
-	ra->flags = 0;
-	ra->size = -1;
-	ra->ahead_start = 0;
-	ra->ahead_size = 0;
-	return;
+	mapping->backing_dev_info->ra_stat[item]++;
 }
 
 /*
@@ -88,25 +84,21 @@ static unsigned long get_init_ra_size(unsigned long size, unsigned long max)
 }
 
 /*
- * Set the new window size, this is called only when I/O is to be submitted,
- * not for each call to readahead.  If a cache miss occured, reduce next I/O
- * size, else increase depending on how close to max we are.
+ * Set the size of the window following the current one.  Windows ramp up
+ * while the reader keeps consuming them, fast while they are small.  If
+ * readahead pages were evicted before the reader got to them
+ * (RA_FLAG_MISS), we are thrashing and a bigger window would only make it
+ * worse, so shrink instead.
  */
-/*
- * Ԥĳȣĳ뵱ǰĳ(cur)
- */
-static unsigned long get_next_ra_size(unsigned long cur, unsigned long max,
-				unsigned long min, unsigned long * flags)
+static unsigned long get_next_ra_size(struct file_ra_state *ra,
+				      unsigned long max)
 {
+	unsigned long cur = ra->size;
 	unsigned long newsize;
 
-    /*
-     * RA_FLAG_MISSλԤĳǵǰȼ2С4ʱΪ4     
-     * Ԥĳǵǰȵ42
-     */
-	if (*flags & RA_FLAG_MISS) {
-		newsize = max((cur - 2), min);
-		*flags &= ~RA_FLAG_MISS;
+	if (ra->flags & RA_FLAG_MISS) {
+		ra->flags &= ~RA_FLAG_MISS;
+		newsize = max(cur / 2, get_min_readahead(ra));
 	} else if (cur < max / 16) {
 		newsize = 4 * cur;
 	} else {
@@ -169,8 +161,11 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 {
 	unsigned page_idx;
 	struct pagevec lru_pvec;
+	struct blk_plug plug;
 	int ret = 0;
 
+	blk_start_plug(&plug);
+
     /*
      * ܣͨʹöbioͨÿ㷢ͨaddress_spaceרõreadpagesʵ֡
      * ҳҳٻУext3_readpagesadd_to_page_cache
@@ -199,70 +194,57 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 	}
 	pagevec_lru_add(&lru_pvec);
 out:
+	blk_finish_plug(&plug);
 	return ret;
 }
 
 /*
  * Readahead design.
  *
- * The fields in struct file_ra_state represent the most-recently-executed
- * readahead attempt:
+ * Readahead is done on demand, from two places:
  *
- * start:	Page index at which we started the readahead
- * size:	Number of pages in that read
- *              Together, these form the "current window".
- *              Together, start and size represent the `readahead window'.
- * next_size:   The number of pages to read on the next readahead miss.
- *              Has the magical value -1UL if readahead has been disabled.
- * prev_page:   The page which the readahead algorithm most-recently inspected.
- *              prev_page is mainly an optimisation: if page_cache_readahead
- *		sees that it is again being called for a page which it just
- *		looked at, it can return immediately without making any state
- *		changes.
- * ahead_start,
- * ahead_size:  Together, these form the "ahead window".
- * ra_pages:	The externally controlled max readahead for this fd.
+ * - page_cache_sync_readahead() is called when a reader finds a page
+ *   missing from the pagecache.  The reader has to wait for I/O anyway,
+ *   so this is where streams are detected and (re)started.
  *
- * When readahead is in the off state (size == -1UL), readahead is disabled.
- * In this state, prev_page is used to detect the resumption of sequential I/O.
+ * - page_cache_async_readahead() is called when a reader finds a page
+ *   carrying PG_readahead.  One page of each readahead window is marked,
+ *   async_size pages before its end, so the next window is submitted
+ *   while the reader is still walking the current one.  A stream that is
+ *   up to speed never waits for I/O.
  *
- * The readahead code manages two windows - the "current" and the "ahead"
- * windows.  The intent is that while the application is walking the pages
- * in the current window, I/O is underway on the ahead window.  When the
- * current window is fully traversed, it is replaced by the ahead window
- * and the ahead window is invalidated.  When this copying happens, the
- * new current window's pages are probably still locked.  So
- * we submit a new batch of I/O immediately, creating a new ahead window.
+ * The fields in struct file_ra_state describe the most recent window:
  *
- * So:
+ * start:	Page index at which the window starts
+ * size:	Number of pages in it
+ * async_size:	The marker sits on page start + size - async_size
+ * prev_page:	The page which the reader most recently looked at
+ * ra_pages:	The externally controlled max readahead for this fd
  *
- *   ----|----------------|----------------|-----
- *       ^start           ^start+size
- *                        ^ahead_start     ^ahead_start+ahead_size
+ * A reader arriving at the marker, or just past the window, is following
+ * it: the window moves forward and grows.  A miss inside the window means
+ * its pages were reclaimed before they were used, and the next window is
+ * made smaller instead (see get_next_ra_size()).
  *
- *         ^ When this page is read, we submit I/O for the
- *           ahead window.
+ * Several sequential streams on one fd, such as a server interleaving
+ * pread()s from different parts of a file, keep knocking that single
+ * window around.  They are recognised without keeping more state, from
+ * what is in the pagecache:
  *
- * A `readahead hit' occurs when a read request is made against a page which is
- * the next sequential page. Ahead windowe calculations are done only when it
- * is time to submit a new IO.  The code ramps up the size agressively at first,
- * but slow down as it approaches max_readhead.
+ * - a marked page outside our window was left by the window of another
+ *   stream.  The cached run after it says how large that window was, and
+ *   the stream carries on from the end of the run.
  *
- * Any seek/ramdom IO will result in readahead being turned off.  It will resume
- * at the first sequential access.
+ * - on a miss that does not follow prev_page, a run of cached pages just
+ *   before the missing one is the trace a sequential stream leaves
+ *   behind ("context readahead"), and its length sizes the new window.
+ *   Without one the read is taken to be random: it is read as is, and
+ *   the window is left alone.
  *
- * There is a special-case: if the first page which the application tries to
- * read happens to be the first page of the file, it is assumed that a linear
- * read is about to happen and the window is immediately set to the initial size
- * based on I/O request size and the max_readahead.
- * 
- * A page request at (start + size) is not a miss at all - it's just a part of
- * sequential file reading.
+ * There is a special case: a read at the start of the file is assumed to
+ * be the beginning of a linear read, and gets a window straight away.
  *
- * This function is to be called for every read request, rather than when
- * it is time to perform readahead.  It is called only oce for the entire I/O
- * regardless of size unless readahead is unable to start enough I/O to satisfy
- * the request (I/O request > max_readahead).
+ * What readahead decided is counted per device, see enum ra_stat_item.
  */
 
 /*
@@ -275,10 +257,14 @@ out:
  *
  * do_page_cache_readahead() returns -1 if it encountered request queue
  * congestion.
+ *
+ * The page @lookahead_size pages before the end of the chunk is marked
+ * PG_readahead, so that the reader reaching it triggers the next readahead.
  */
 static int
 __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
-			unsigned long offset, unsigned long nr_to_read)
+			unsigned long offset, unsigned long nr_to_read,
+			unsigned long lookahead_size)
 {
 	struct inode *inode = mapping->host;
 	struct page *page;
@@ -319,6 +305,8 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			break;
 		page->index = page_offset;
 		list_add(&page->lru, &page_pool);
+		if (page_idx == nr_to_read - lookahead_size)
+			SetPageReadahead(page);
 		ret++;
 	}
 	spin_unlock_irq(&mapping->tree_lock);
@@ -331,6 +319,7 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	if (ret)
 		read_pages(mapping, filp, &page_pool, ret); /**/
 	BUG_ON(!list_empty(&page_pool));
+	mapping->backing_dev_info->ra_stat[RA_STAT_PAGES] += ret;
 out:
 	return ret;
 }
@@ -355,7 +344,7 @@ int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		if (this_chunk > nr_to_read)
 			this_chunk = nr_to_read;
 		err = __do_page_cache_readahead(mapping, filp,
-						offset, this_chunk); /**/
+						offset, this_chunk, 0); /**/
 		if (err < 0) {
 			ret = err;
 			break;
@@ -367,32 +356,6 @@ int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	return ret;
 }
 
-/*
- * Check how effective readahead is being.  If the amount of started IO is
- * less than expected then the file is partly or fully in pagecache and
- * readahead isn't helping.
- *
- */
-int check_ra_success(struct file_ra_state *ra, unsigned long nr_to_read,
-				 unsigned long actual)
-{
-	if (actual == 0) {
-		ra->cache_hit += nr_to_read;
-        /*
-         * ȫ256(VM_MAX_CACHE_HIT)ҳڸٻ
-         * λǰԤļΪڸٻ(RA_FLAG_INCACHE)
-         */        
-		if (ra->cache_hit >= VM_MAX_CACHE_HIT) {
-			ra_off(ra); //λǰԤ /**/
-			ra->flags |= RA_FLAG_INCACHE;
-			return 0;
-		}
-	} else {
-		ra->cache_hit=0;
-	}
-	return 1;
-}
-
 /*
  * This version skips the IO if the queue is read-congested, and will tell the
  * block layer to abandon the readahead if request allocation would block.
@@ -406,264 +369,223 @@ int do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	if (bdi_read_congested(mapping->backing_dev_info))
 		return -1;
 
-	return __do_page_cache_readahead(mapping, filp, offset, nr_to_read); /**/
+	return __do_page_cache_readahead(mapping, filp, offset, nr_to_read, 0); /**/
 }
 
 /*
- * Read 'nr_to_read' pages starting at page 'offset'. If the flag 'block'
- * is set wait till the read completes.  Otherwise attempt to read without
- * blocking.
- * Returns 1 meaning 'success' if read is succesfull without switching off
- * readhaead mode. Otherwise return failure.
+ * Submit the readahead window described by @ra, marking the page async_size
+ * pages before its end.  Returns the number of pages actually read in.
  */
-/**
- * ÿpage_cache_readaheadһ´ͿʼҳĶΪ˶һҳ
- * page_cache_readaheadblockable_page_cache_readahead
- * Ԥ
+unsigned long ra_submit(struct file_ra_state *ra,
+			struct address_space *mapping, struct file *filp)
+{
+	return __do_page_cache_readahead(mapping, filp,
+					ra->start, ra->size, ra->async_size);
+}
+
+/*
+ * Count the pages cached right before @offset, looking back no further than
+ * @max pages.  This is the trail of a sequential stream.
  */
-static int
-blockable_page_cache_readahead(struct address_space *mapping, struct file *filp,
-			unsigned long offset, unsigned long nr_to_read,
-			struct file_ra_state *ra, int block)
+static unsigned long count_history_pages(struct address_space *mapping,
+					 pgoff_t offset, unsigned long max)
 {
-	int actual;
+	unsigned long count = 0;
 
-	if (block) { /*ڿ豸ǶģͲж*/
-		actual = __do_page_cache_readahead(mapping, filp,
-						offset, nr_to_read); /**/
-	} else {
-		actual = do_page_cache_readahead(mapping, filp,
-						offset, nr_to_read); /**/
-		if (actual == -1)
-			return 0;
-	}
+	if (max > offset)
+		max = offset;
 
-    /*
-     * ȫ256(VM_MAX_CACHE_HIT)ҳڸٻ
-     * λǰԤļΪڸٻ(RA_FLAG_INCACHE)
-     */       
-	return check_ra_success(ra, nr_to_read, actual); /**/
+	page_cache_read_lock(mapping);
+	while (count < max &&
+	       radix_tree_lookup(&mapping->page_tree, offset - 1 - count))
+		count++;
+	page_cache_read_unlock(mapping);
+	return count;
 }
 
 /*
- * page_cache_readahead is the main function.  If performs the adaptive
- * readahead window size management and submits the readahead I/O.
+ * Count the pages cached from @offset onwards, up to @max.
  */
-/**
- * ļԤ
- * дǰںԤڣԤµǰںԤڵĴС
- * mapping:		ҳߵaddress_spaceָ롣
- * ra:			ҳļfile_ra_stateָ롣
- * filp:		ļַ
- * offset:		ļҳƫ
- * req_size:	ҪɵǰҪҳ
+static unsigned long count_cached_pages(struct address_space *mapping,
+					pgoff_t offset, unsigned long max)
+{
+	unsigned long count = 0;
+
+	page_cache_read_lock(mapping);
+	while (count < max &&
+	       radix_tree_lookup(&mapping->page_tree, offset + count))
+		count++;
+	page_cache_read_unlock(mapping);
+	return count;
+}
+
+/*
+ * The readahead state machine, see "Readahead design" above.
  */
-unsigned long
-page_cache_readahead(struct address_space *mapping, struct file_ra_state *ra,
-		     struct file *filp, unsigned long offset,
-		     unsigned long req_size)
+static unsigned long
+ondemand_readahead(struct address_space *mapping, struct file_ra_state *ra,
+		   struct file *filp, int hit_marker, pgoff_t offset,
+		   unsigned long req_size)
 {
-	unsigned long max, min;
-	unsigned long newsize = req_size;
-	unsigned long block;
+	unsigned long max = get_max_readahead(ra);
+	unsigned long size;
 
 	/*
-	 * Here we detect the case where the application is performing
-	 * sub-page sized reads.  We avoid doing extra work and bogusly
-	 * perturbing the readahead window expansion logic.
-	 * If size is zero, there is no read ahead window so we need one
+	 * Start of file: assume a whole-file read.
 	 */
-	/*
-	 * ûнֹԤϴεʵͬһļֻһҳ˳
-     */ 
-	if (offset == ra->prev_page && req_size == 1 && ra->size != 0)
-		goto out;
-
-	max = get_max_readahead(ra);
-	min = get_min_readahead(ra);
-    /*
-     * max = 0ônewsize = 0ʾýֹԤ
-     */
-	newsize = min(req_size, max); 
+	if (!offset)
+		goto initial_readahead;
 
-    /*
-     * ҪԤ(ýֹԤ)
-     * 
-     * ļѾڸٻ
-     */
-	if (newsize == 0 || (ra->flags & RA_FLAG_INCACHE)) {
-		newsize = 1;
-		ra->prev_page = offset;
-		goto out;	/* No readahead or file already in cache */
+	/*
+	 * At the marker of our window, or right after it: a sequential
+	 * stream following the window.  Move it forward and ramp it up.
+	 */
+	if (offset == ra->start + ra->size - ra->async_size ||
+	    offset == ra->start + ra->size) {
+		ra->start += ra->size;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size;
+		goto readit;
 	}
+
 	/*
-	 * Special case - first read.  We'll assume it's a whole-file read if
-	 * at start of file, and grow the window fast.  Or detect first
-	 * sequential access
+	 * A marked page outside our window, left by the window of another
+	 * stream on this file.  The cached run after it is what remains of
+	 * that window; continue from its end.
 	 */
+	if (hit_marker) {
+		size = count_cached_pages(mapping, offset + 1, max);
+		if (size >= max)
+			return 0;
+		ra->start = offset + 1 + size;
+		ra->size = size + 1 + req_size;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size;
+		goto readit;
+	}
+
 	/*
-	 * һηļ״ҳƫΪ0 
-	 * 
-	 * Ԥʱֹ˳ȡ
-     */
-	if ((ra->size == 0 && offset == 0)	/* first io and start of file */
-	    || (ra->size == -1 && ra->prev_page == offset - 1)) {
-		/* First sequential */
-        /*
-         * 趨ǰҳȷʼҳȡԵǰж
-         */
-		ra->prev_page  = offset + newsize - 1;
-		ra->size = get_init_ra_size(newsize, max);
+	 * A miss inside our window: the pages we read ahead were reclaimed
+	 * before the reader got to them.  Restart from here, smaller.
+	 */
+	if (offset > ra->start && offset < ra->start + ra->size) {
+		ra_stat_inc(mapping, RA_STAT_THRASH);
+		ra->flags |= RA_FLAG_MISS;
 		ra->start = offset;
-		if (!blockable_page_cache_readahead(mapping, filp, offset,
-							 ra->size, ra, 1)) /**/
-			goto out;
-
-		/*
-		 * If the request size is larger than our max readahead, we
-		 * at least want to be sure that we get 2 IOs in flight and
-		 * we know that we will definitly need the new I/O.
-		 * once we do this, subsequent calls should be able to overlap
-		 * IOs,* thus preventing stalls. so issue the ahead window
-		 * immediately.
-		 */
-		/*
-		 * ҳڵǰֵڵǰ潨һµԤԤIO
-         */
-		if (req_size >= max) {
-			ra->ahead_size = get_next_ra_size(ra->size, max, min,
-							  &ra->flags);
-			ra->ahead_start = ra->start + ra->size;
-			blockable_page_cache_readahead(mapping, filp,
-				 ra->ahead_start, ra->ahead_size, ra, 1); /**/
-		}
-		goto out;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size / 2;
+		goto readit;
 	}
 
 	/*
-	 * Now handle the random case:
-	 * partial page reads and first access were handled above,
-	 * so this must be the next page otherwise it is random
+	 * Oversize read, or a miss right after the previous read.
 	 */
-	/*
-	 * 
-	 * 
-	 * ǰΪ
-     */ 
-	if ((offset != (ra->prev_page+1) || (ra->size == 0))) {
-        /*
-         * λǰԤ
-         */
-		ra_off(ra);
-		ra->prev_page  = offset + newsize - 1;
-        /*
-         * ʼҳIO
-         */
-		blockable_page_cache_readahead(mapping, filp, offset,
-				 newsize, ra, 1); /**/
-		goto out;
-	}
+	if (req_size > max || offset - ra->prev_page <= 1UL)
+		goto initial_readahead;
 
 	/*
-	 * If we get here we are doing sequential IO and this was not the first
-	 * occurence (ie we have an existing window)
+	 * Look for the trail of a sequential stream in the pagecache.  A
+	 * trail reaching back to the start of the file is a strong hint of
+	 * a long stream (or a whole-file read).
 	 */
-    /*
-     * ԤΪ
-     */
-	if (ra->ahead_start == 0) {	 /* no ahead window yet */
-        /*
-         * ڵǰ潨һµԤʼԤIO
-         */
-		ra->ahead_size = get_next_ra_size(ra->size, max, min,
-						  &ra->flags);
-		ra->ahead_start = ra->start + ra->size;
-		block = ((offset + newsize -1) >= ra->ahead_start);
-		if (!blockable_page_cache_readahead(mapping, filp,
-		    ra->ahead_start, ra->ahead_size, ra, block) /**/) {
-			/* A read failure in blocking mode, implies pages are
-			 * all cached. So we can safely assume we have taken
-			 * care of all the pages requested in this call. A read
-			 * failure in non-blocking mode, implies we are reading
-			 * more pages than requested in this call.  So we safely
-			 * assume we have taken care of all the pages requested
-			 * in this call.
-			 *
-			 * Just reset the ahead window in case we failed due to
-			 * congestion.  The ahead window will any way be closed
-			 * in case we failed due to exessive page cache hits.
-			 */
-			ra->ahead_start = 0;
-			ra->ahead_size = 0;
-			goto out;
-		}
+	size = count_history_pages(mapping, offset, max);
+	if (size) {
+		ra_stat_inc(mapping, RA_STAT_CONTEXT);
+		if (size >= offset)
+			size *= 2;
+		ra->start = offset;
+		ra->size = get_init_ra_size(size + req_size, max);
+		ra->async_size = ra->size;
+		goto readit;
 	}
+
 	/*
-	 * Already have an ahead window, check if we crossed into it.
-	 * If so, shift windows and issue a new ahead window.
-	 * Only return the #pages that are in the current window, so that
-	 * we get called back on the first page of the ahead window which
-	 * will allow us to submit more IO.
+	 * A standalone random read.  Read it as is, and don't disturb the
+	 * window of whatever stream may be going on.
 	 */
+	ra_stat_inc(mapping, RA_STAT_RANDOM);
+	return __do_page_cache_readahead(mapping, filp, offset,
+					 min(req_size, max), 0);
+
+initial_readahead:
+	ra->start = offset;
+	ra->size = get_init_ra_size(min(req_size, max), max);
+	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
+
+readit:
 	/*
-	 * вҳڵǰҲ˵һԤ
-     */
-	if ((offset + newsize - 1) >= ra->ahead_start) {
-        /*
-         * ԤȡǰڣٴһµԤ
-         * ԤIO
-         */
-		ra->start = ra->ahead_start;
-		ra->size = ra->ahead_size;
-		ra->ahead_start = ra->ahead_start + ra->ahead_size;
-		ra->ahead_size = get_next_ra_size(ra->ahead_size,
-						  max, min, &ra->flags);
-		block = ((offset + newsize - 1) >= ra->ahead_start);
-		if (!blockable_page_cache_readahead(mapping, filp,
-			ra->ahead_start, ra->ahead_size, ra, block) /**/) {
-			/* A read failure in blocking mode, implies pages are
-			 * all cached. So we can safely assume we have taken
-			 * care of all the pages requested in this call.
-			 * A read failure in non-blocking mode, implies we are
-			 * reading more pages than requested in this call.  So
-			 * we safely assume we have taken care of all the pages
-			 * requested in this call.
-			 *
-			 * Just reset the ahead window in case we failed due to
-			 * congestion.  The ahead window will any way be closed
-			 * in case we failed due to excessive page cache hits.
-			 */
-			ra->ahead_start = 0;
-			ra->ahead_size = 0;
-		}
+	 * Would this very read hit the marker of the window we are about to
+	 * submit?  Then submit the next window along with it, as one I/O.
+	 */
+	if (offset == ra->start && ra->size == ra->async_size) {
+		ra->async_size = get_next_ra_size(ra, max);
+		ra->size += ra->async_size;
 	}
 
-out:
-	ra->prev_page = offset + newsize - 1;
-	return(newsize);
+	return ra_submit(ra, mapping, filp);
 }
 
-/*
- * handle_ra_miss() is called when it is known that a page which should have
- * been present in the pagecache (we just did some readahead there) was in fact
- * not found.  This will happen if it was evicted by the VM (readahead
- * thrashing)
+/**
+ * page_cache_sync_readahead - generic file readahead on a cache miss
+ * @mapping: address_space which holds the pagecache and I/O vectors
+ * @ra: file_ra_state which holds the readahead state
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @offset: start offset into @mapping, in pagecache page-sized units
+ * @req_size: hint: total size of the read which the caller is performing in
+ *            pagecache pages
  *
- * Turn on the cache miss flag in the RA struct, this will cause the RA code
- * to reduce the RA size on the next read.
+ * Called when the page at @offset is not in the pagecache.  Starts or
+ * restarts readahead for the stream this read belongs to, or just reads
+ * the request in if it looks random.
  */
-/*
- * 
- * ͨRA_FLAG_MISSλRA_FLAG_INCACHE־Ԥ㷨
- * do_generic_file_read()еpage_cache_readahead()Ԥ󣬻ͨfind_get_page()Ҳҳ
- * ˵ҳ㷨Ԥҳ˻գʱҪͨhandle_ra_miss()㷨ĵ
+void page_cache_sync_readahead(struct address_space *mapping,
+			       struct file_ra_state *ra, struct file *filp,
+			       pgoff_t offset, unsigned long req_size)
+{
+	/* no read-ahead */
+	if (!ra->ra_pages)
+		return;
+
+	ra_stat_inc(mapping, RA_STAT_SYNC);
+	ondemand_readahead(mapping, ra, filp, 0, offset, req_size);
+}
+EXPORT_SYMBOL_GPL(page_cache_sync_readahead);
+
+/**
+ * page_cache_async_readahead - file readahead for marked pages
+ * @mapping: address_space which holds the pagecache and I/O vectors
+ * @ra: file_ra_state which holds the readahead state
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @page: the page at @offset, which has PG_readahead set
+ * @offset: start offset into @mapping, in pagecache page-sized units
+ * @req_size: hint: total size of the read which the caller is performing in
+ *            pagecache pages
+ *
+ * Called when the reader finds a page marked PG_readahead: the window it
+ * is in is being used up, so submit the next one before the reader gets
+ * there.  Skipped if the queue is congested; the reader will then miss at
+ * the end of the window and catch up synchronously.
  */
-void handle_ra_miss(struct address_space *mapping,
-		struct file_ra_state *ra, pgoff_t offset)
+void page_cache_async_readahead(struct address_space *mapping,
+				struct file_ra_state *ra, struct file *filp,
+				struct page *page, pgoff_t offset,
+				unsigned long req_size)
 {
-	ra->flags |= RA_FLAG_MISS;
-	ra->flags &= ~RA_FLAG_INCACHE;
+	/* no read-ahead */
+	if (!ra->ra_pages)
+		return;
+
+	/* Someone else got here first */
+	if (!TestClearPageReadahead(page))
+		return;
+
+	if (bdi_read_congested(mapping->backing_dev_info))
+		return;
+
+	ra_stat_inc(mapping, RA_STAT_ASYNC);
+	ondemand_readahead(mapping, ra, filp, 1, offset, req_size);
 }
+EXPORT_SYMBOL_GPL(page_cache_async_readahead);
 
 /*
  * Given a desired number of PAGE_CACHE_SIZE readahead pages, return a
@@ -77,28 +77,37 @@ void show_swap_cache_info(void)
 static int __add_to_swap_cache(struct page *page,
 		swp_entry_t entry, int gfp_mask)
 {
-	int error;
+	int error, locked;
 
 	BUG_ON(PageSwapCache(page));
 	BUG_ON(PagePrivate(page));
 	error = radix_tree_preload(gfp_mask);
 	if (!error) {
+		/*
+		 * ҳüPG_swapcachePG_locked־
+		 * As in add_to_page_cache(), before the insert: lockless
+		 * lookups may find the page as soon as it is in the tree.
+		 */
+		page_cache_get(page);
+		locked = !TestSetPageLocked(page);
+		SetPageSwapCache(page);
+		page->private = entry.val; /**/ /*趨pageprivateΪindex(entry.val)ֵ֪δSWAPҵҳݲ*/
 		spin_lock_irq(&swapper_space.tree_lock);
 		error = radix_tree_insert(&swapper_space.page_tree,
 						entry.val, page);
 		if (!error) {
-            /*
-             * ҳüPG_swapcachePG_locked־
-             */
-			page_cache_get(page);
-			SetPageLocked(page);
-			SetPageSwapCache(page);
-			page->private = entry.val; /**/ /*趨pageprivateΪindex(entry.val)ֵ֪δSWAPҵҳݲ*/
 			total_swapcache_pages++;
 			pagecache_acct(1);
 		}
 		spin_unlock_irq(&swapper_space.tree_lock);
 		radix_tree_preload_end();
+		if (error) {
+			page->private = 0;
+			ClearPageSwapCache(page);
+			if (locked)
+				ClearPageLocked(page);
+			page_cache_release(page);
+		}
 	}
 	return error;
 }
@@ -366,16 +375,9 @@ struct page * lookup_swap_cache(swp_entry_t entry)
 {
 	struct page *page;
 
-	spin_lock_irq(&swapper_space.tree_lock);
-	/**
-	 * swapper_space.page_treeǽٻĻ
-	 */
-	page = radix_tree_lookup(&swapper_space.page_tree, entry.val);
-	if (page) {
-		page_cache_get(page);
+	page = find_get_page(&swapper_space, entry.val);
+	if (page)
 		INC_CACHE_INFO(find_success);
-	}
-	spin_unlock_irq(&swapper_space.tree_lock);
 	INC_CACHE_INFO(find_total);
 	return page;
 }
@@ -404,18 +406,7 @@ struct page *read_swap_cache_async(swp_entry_t entry,
 		 * called after lookup_swap_cache() failed, re-calling
 		 * that would confuse statistics.
 		 */
-		spin_lock_irq(&swapper_space.tree_lock);
-		/**
-		 * radix_tree_lookupswapper_spaceѰɻҳʶentryλõҳ
-		 */
-		found_page = radix_tree_lookup(&swapper_space.page_tree,
-						entry.val);
-		/**
-		 * ڽٻУظҳ
-		 */
-		if (found_page)
-			page_cache_get(found_page);
-		spin_unlock_irq(&swapper_space.tree_lock);
+		found_page = find_get_page(&swapper_space, entry.val);
 		if (found_page)
 			break;
 
@@ -474,10 +474,13 @@ int remove_exclusive_swap_page(struct page *page)
 	if (p->swap_map[swp_offset(entry)] == 1) {
 		/* Recheck the page count with the swapcache lock held.. */
 		spin_lock_irq(&swapper_space.tree_lock);
-		if ((page_count(page) == 2) && !PageWriteback(page)) {
-			__delete_from_swap_cache(page);
-			SetPageDirty(page);
-			retval = 1;
+		if (page_freeze_refs(page, 2)) {
+			if (!PageWriteback(page)) {
+				__delete_from_swap_cache(page);
+				SetPageDirty(page);
+				retval = 1;
+			}
+			page_unfreeze_refs(page, 2);
 		}
 		spin_unlock_irq(&swapper_space.tree_lock);
 	}
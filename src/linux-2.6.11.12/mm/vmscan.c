@@ -429,6 +429,7 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 {
 	LIST_HEAD(ret_pages);
 	struct pagevec freed_pvec;
+	struct blk_plug plug;
 	int pgactivate = 0;
 	int reclaimed = 0;
 
@@ -438,6 +439,8 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 	cond_resched();
 
 	pagevec_init(&freed_pvec, 1);
+	/* let the writes pageout() starts for neighbouring pages merge */
+	blk_start_plug(&plug);
 	/**
 	 * ѭpage_listеÿһҳÿԪأɾҳԻոҳ򡣶ÿҳִ:
 	 *		1:free_cold_pageҳͷŵϵͳ
@@ -601,7 +604,17 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 		 * ԼPFRA£ҳΪ࣬ôҳͿԻա
 		 * ֻҪüΪ2ҳȻΪ࣬ôͲҳ
 		 */
-		if (page_count(page) != 2 || PageDirty(page)) {
+		/*
+		 * find_get_page() no longer takes ->tree_lock, so checking
+		 * the count is not enough: freeze it, which makes speculative
+		 * lookups back off until the page is gone from the tree.
+		 */
+		if (!page_freeze_refs(page, 2)) {
+			spin_unlock_irq(&mapping->tree_lock);
+			goto keep_locked;
+		}
+		if (PageDirty(page)) {
+			page_unfreeze_refs(page, 2);
 			spin_unlock_irq(&mapping->tree_lock);
 			goto keep_locked;
 		}
@@ -627,7 +640,7 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 			__delete_from_swap_cache(page);
 			spin_unlock_irq(&mapping->tree_lock);
 			swap_free(swap);
-			__put_page(page);	/* The pagecache ref */
+			page_unfreeze_refs(page, 1);	/* drop the pagecache ref */
 			goto free_it;
 		}
 #endif /* CONFIG_SWAP */
@@ -638,7 +651,7 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 		 */
 		__remove_from_page_cache(page);
 		spin_unlock_irq(&mapping->tree_lock);
-		__put_page(page);
+		page_unfreeze_refs(page, 1);	/* drop the pagecache ref */
 
 free_it:
 		unlock_page(page);
@@ -662,6 +675,7 @@ keep:
 		list_add(&page->lru, &ret_pages);
 		BUG_ON(PageLRU(page));
 	}
+	blk_finish_plug(&plug);
 
 	/**
 	 * Ѿpage_listûͷҳŻpage_list
@@ -841,8 +841,10 @@ static struct file_operations sel_commit_bools_ops = {
  * fs/proc/generic.c proc_kill_inodes */
 static void sel_remove_bools(struct dentry *de)
 {
-	struct list_head *p, *node;
+	struct list_head *node;
 	struct super_block *sb = de->d_sb;
+	struct file *filp;
+	int cpu;
 
 	spin_lock(&dcache_lock);
 	node = de->d_subdirs.next;
@@ -863,9 +865,8 @@ static void sel_remove_bools(struct dentry *de)
 
 	spin_unlock(&dcache_lock);
 
-	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file * filp = list_entry(p, struct file, f_list);
+	sb_files_lock_all();
+	sb_files_for_each(sb, cpu, filp) {
 		struct dentry * dentry = filp->f_dentry;
 
 		if (dentry->d_parent != de) {
@@ -873,7 +874,7 @@ static void sel_remove_bools(struct dentry *de)
 		}
 		filp->f_op = NULL;
 	}
-	file_list_unlock();
+	sb_files_unlock_all();
 }
 
 #define BOOL_DIR_NAME "booleans"